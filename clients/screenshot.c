@@ -41,6 +41,7 @@
 
 static struct wl_shm *shm;
 static struct screenshooter *screenshooter;
+static uint32_t screenshooter_version;
 static struct wl_list output_list;
 int min_x, min_y, max_x, max_y;
 int buffer_copy_done;
@@ -49,6 +50,10 @@ struct screenshooter_output {
 	struct wl_output *output;
 	struct wl_buffer *buffer;
 	int width, height, offset_x, offset_y;
+	/* Where the output is in the compositor's global space. */
+	int x, y;
+	/* What the compositor actually wrote to the buffer. */
+	int captured_width, captured_height;
 	void *data;
 	struct wl_list link;
 };
@@ -72,6 +77,8 @@ display_handle_geometry(void *data,
 	if (wl_output == output->output) {
 		output->offset_x = x;
 		output->offset_y = y;
+		output->x = x;
+		output->y = y;
 	}
 }
 
@@ -104,8 +111,21 @@ screenshot_done(void *data, struct screenshooter *screenshooter)
 	buffer_copy_done = 1;
 }
 
+/* Sent before done when shooting a region, data is the output being
+ * captured. */
+static void
+screenshot_captured(void *data, struct screenshooter *screenshooter,
+		    int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	struct screenshooter_output *output = data;
+
+	output->captured_width = MIN(width, output->width);
+	output->captured_height = MIN(height, output->height);
+}
+
 static const struct screenshooter_listener screenshooter_listener = {
-	screenshot_done
+	screenshot_done,
+	screenshot_captured
 };
 
 static void
@@ -123,8 +143,10 @@ handle_global(void *data, struct wl_registry *registry,
 	} else if (strcmp(interface, "wl_shm") == 0) {
 		shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
 	} else if (strcmp(interface, "screenshooter") == 0) {
+		screenshooter_version = MIN(version, 3);
 		screenshooter = wl_registry_bind(registry, name,
-						 &screenshooter_interface, 1);
+						 &screenshooter_interface,
+						 screenshooter_version);
 	}
 }
 
@@ -182,14 +204,16 @@ write_png(int width, int height)
 	if (!data)
 		return;
 
+	memset(data, 0, buffer_stride * height);
+
 	wl_list_for_each_safe(output, next, &output_list, link) {
 		output_stride = output->width * 4;
 		s = output->data;
 		d = data + (output->offset_y - min_y) * buffer_stride +
 			   (output->offset_x - min_x) * 4;
 
-		for (i = 0; i < output->height; i++) {
-			memcpy(d, s, output_stride);
+		for (i = 0; i < output->captured_height; i++) {
+			memcpy(d, s, output->captured_width * 4);
 			d += buffer_stride;
 			s += output_stride;
 		}
@@ -257,7 +281,7 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	screenshooter_add_listener(screenshooter, &screenshooter_listener, screenshooter);
+	screenshooter_add_listener(screenshooter, &screenshooter_listener, NULL);
 
 	if (set_buffer_size(&width, &height))
 		return -1;
@@ -265,7 +289,24 @@ int main(int argc, char *argv[])
 
 	wl_list_for_each(output, &output_list, link) {
 		output->buffer = create_shm_buffer(output->width, output->height, &output->data);
-		screenshooter_shoot(screenshooter, output->output, output->buffer);
+		screenshooter_set_user_data(screenshooter, output);
+		/* A version 3 compositor tells what it captured and
+		 * nothing at all if the output is gone. */
+		if (screenshooter_version >= 3) {
+			output->captured_width = 0;
+			output->captured_height = 0;
+			screenshooter_shoot_region(screenshooter,
+						   output->output,
+						   output->buffer,
+						   output->x, output->y,
+						   output->width,
+						   output->height);
+		} else {
+			output->captured_width = output->width;
+			output->captured_height = output->height;
+			screenshooter_shoot(screenshooter, output->output,
+					    output->buffer);
+		}
 		buffer_copy_done = 0;
 		while (!buffer_copy_done)
 			wl_display_roundtrip(display);
@@ -84,7 +84,7 @@ android_finish_frame(void *data)
 	struct android_output *output = data;
 
 	weston_output_finish_frame(&output->base,
-				   weston_compositor_get_time());
+				   weston_compositor_get_time_usec());
 }
 
 static void
@@ -200,7 +200,7 @@ android_seat_open_device(struct android_seat *seat, const char *devnode)
 		return;
 	}
 
-	device = evdev_device_create(&seat->base, devnode, fd);
+	device = evdev_device_create(&seat->base, devnode, fd, NULL);
 	if (!device) {
 		close(fd);
 		return;
@@ -42,9 +42,17 @@
 #include "compositor.h"
 #include "gl-renderer.h"
 #include "evdev.h"
+#include "evdev-trace.h"
 #include "launcher-util.h"
+#include "drm-plane-assign.h"
+
+#ifndef DRM_CAP_TIMESTAMP_MONOTONIC
+#define DRM_CAP_TIMESTAMP_MONOTONIC 0x6
+#endif
 
 static int option_current_mode = 0;
+static int option_input_thread = 0;
+static char *option_record_input = NULL;
 static char *output_name;
 static char *output_mode;
 static char *output_transform;
@@ -78,10 +86,18 @@ struct drm_compositor {
 	struct udev_monitor *udev_monitor;
 	struct wl_event_source *udev_drm_source;
 
+	/* Reads the input devices if --input-thread was given. */
+	struct evdev_input_thread *input_thread;
+	/* Records the input devices if --record-input was given. */
+	struct evdev_trace_writer *input_trace;
+
 	struct {
 		int id;
 		int fd;
 	} drm;
+	/* Whether the kernel stamps page flips and vblanks with
+	 * CLOCK_MONOTONIC rather than CLOCK_REALTIME. */
+	int clock_monotonic;
 	struct gbm_device *gbm;
 	uint32_t *crtcs;
 	int num_crtcs;
@@ -141,6 +157,9 @@ struct drm_output {
 	int current_cursor;
 	struct drm_fb *current, *next;
 	struct backlight *backlight;
+
+	struct drm_plane_candidate *candidates;
+	int candidates_size;
 };
 
 /*
@@ -330,15 +349,6 @@ drm_output_prepare_scanout_surface(struct weston_output *_output,
 	struct gbm_bo *bo;
 	uint32_t format;
 
-	if (es->geometry.x != output->base.x ||
-	    es->geometry.y != output->base.y ||
-	    buffer == NULL ||
-	    buffer->width != output->base.current->width ||
-	    buffer->height != output->base.current->height ||
-	    output->base.transform != es->buffer_transform ||
-	    es->transform.enabled)
-		return NULL;
-
 	bo = gbm_bo_import(c->gbm, GBM_BO_IMPORT_WL_BUFFER,
 			   buffer, GBM_BO_USE_SCANOUT);
 
@@ -476,13 +486,30 @@ drm_output_repaint(struct weston_output *output_base,
 	return;
 }
 
+/* The presentation time of a flip or vblank event, on the clock of
+ * weston_compositor_get_time_usec().  Realtime kernel stamps can't be
+ * compared with it, those are replaced with the time the event is
+ * handled. */
+static uint64_t
+drm_event_usecs(struct drm_output *output,
+		unsigned int sec, unsigned int usec)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+
+	if (!c->clock_monotonic)
+		return weston_compositor_get_time_usec();
+
+	return (uint64_t) sec * 1000000 + usec;
+}
+
 static void
 vblank_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec,
 	       void *data)
 {
 	struct drm_sprite *s = (struct drm_sprite *)data;
 	struct drm_output *output = s->output;
-	uint32_t msecs;
+	uint64_t usecs;
 
 	output->vblank_pending = 0;
 
@@ -493,8 +520,8 @@ vblank_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec,
 	s->next = NULL;
 
 	if (!output->page_flip_pending) {
-		msecs = sec * 1000 + usec / 1000;
-		weston_output_finish_frame(&output->base, msecs);
+		usecs = drm_event_usecs(output, sec, usec);
+		weston_output_finish_frame(&output->base, usecs);
 	}
 }
 
@@ -503,7 +530,7 @@ page_flip_handler(int fd, unsigned int frame,
 		  unsigned int sec, unsigned int usec, void *data)
 {
 	struct drm_output *output = (struct drm_output *) data;
-	uint32_t msecs;
+	uint64_t usecs;
 
 	output->page_flip_pending = 0;
 
@@ -519,8 +546,8 @@ page_flip_handler(int fd, unsigned int frame,
 	output->next = NULL;
 
 	if (!output->vblank_pending) {
-		msecs = sec * 1000 + usec / 1000;
-		weston_output_finish_frame(&output->base, msecs);
+		usecs = drm_event_usecs(output, sec, usec);
+		weston_output_finish_frame(&output->base, usecs);
 	}
 }
 
@@ -597,27 +624,6 @@ drm_output_prepare_overlay_surface(struct weston_output *output_base,
 	uint32_t format;
 	wl_fixed_t sx1, sy1, sx2, sy2;
 
-	if (es->buffer_transform != output_base->transform)
-		return NULL;
-
-	if (c->sprites_are_broken)
-		return NULL;
-
-	if (es->output_mask != (1u << output_base->id))
-		return NULL;
-
-	if (es->buffer_ref.buffer == NULL)
-		return NULL;
-
-	if (es->alpha != 1.0f)
-		return NULL;
-
-	if (wl_buffer_is_shm(es->buffer_ref.buffer))
-		return NULL;
-
-	if (!drm_surface_transform_supported(es))
-		return NULL;
-
 	wl_list_for_each(s, &c->sprite_list, link) {
 		if (!drm_sprite_crtc_supported(output_base, s->possible_crtcs))
 			continue;
@@ -719,22 +725,10 @@ static struct weston_plane *
 drm_output_prepare_cursor_surface(struct weston_output *output_base,
 				  struct weston_surface *es)
 {
-	struct drm_compositor *c =
-		(struct drm_compositor *) output_base->compositor;
 	struct drm_output *output = (struct drm_output *) output_base;
 
-	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL)
-		return NULL;
 	if (output->cursor_surface)
 		return NULL;
-	if (es->output_mask != (1u << output_base->id))
-		return NULL;
-	if (c->cursors_are_broken)
-		return NULL;
-	if (es->buffer_ref.buffer == NULL ||
-	    !wl_buffer_is_shm(es->buffer_ref.buffer) ||
-	    es->geometry.width > 64 || es->geometry.height > 64)
-		return NULL;
 
 	output->cursor_surface = es;
 
@@ -796,16 +790,160 @@ drm_output_set_cursor(struct drm_output *output)
 	}
 }
 
+/* The planes a surface could go on, without looking at the buffer
+ * format or what else is on the output. */
+static uint32_t
+drm_surface_plane_kinds(struct drm_output *output, struct weston_surface *es)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct wl_buffer *buffer = es->buffer_ref.buffer;
+	uint32_t kinds = 0;
+
+	if (buffer == NULL)
+		return 0;
+
+	if (es->geometry.x == output->base.x &&
+	    es->geometry.y == output->base.y &&
+	    buffer->width == output->base.current->width &&
+	    buffer->height == output->base.current->height &&
+	    output->base.transform == es->buffer_transform &&
+	    !es->transform.enabled)
+		kinds |= DRM_PLANE_KIND_BIT(DRM_PLANE_SCANOUT);
+
+	if (es->output_mask != (1u << output->base.id))
+		return kinds;
+
+	if (output->base.transform == WL_OUTPUT_TRANSFORM_NORMAL &&
+	    !c->cursors_are_broken &&
+	    wl_buffer_is_shm(buffer) &&
+	    es->geometry.width <= 64 && es->geometry.height <= 64)
+		kinds |= DRM_PLANE_KIND_BIT(DRM_PLANE_CURSOR);
+
+	if (es->buffer_transform == output->base.transform &&
+	    !c->sprites_are_broken &&
+	    es->alpha == 1.0f &&
+	    !wl_buffer_is_shm(buffer) &&
+	    drm_surface_transform_supported(es))
+		kinds |= DRM_PLANE_KIND_BIT(DRM_PLANE_OVERLAY);
+
+	return kinds;
+}
+
+static int
+drm_output_update_candidates(struct drm_output *output)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	struct drm_plane_candidate *candidate;
+	struct weston_surface *es;
+	pixman_box32_t *box;
+	pixman_region32_t r;
+	uint32_t msecs;
+	int n, size;
+
+	n = wl_list_length(&ec->surface_list);
+	if (n > output->candidates_size) {
+		size = output->candidates_size ? output->candidates_size : 16;
+		while (size < n)
+			size *= 2;
+		candidate = realloc(output->candidates,
+				    size * sizeof *candidate);
+		if (candidate == NULL)
+			return -1;
+		output->candidates = candidate;
+		output->candidates_size = size;
+	}
+
+	msecs = weston_compositor_get_time();
+	candidate = output->candidates;
+	wl_list_for_each(es, &ec->surface_list, link) {
+		/* test whether this buffer can ever go into a plane:
+		 * non-shm, or small enough to be a cursor
+		 */
+		if ((es->buffer_ref.buffer &&
+		     !wl_buffer_is_shm(es->buffer_ref.buffer)) ||
+		    (es->geometry.width <= 64 && es->geometry.height <= 64))
+			es->keep_buffer = 1;
+		else
+			es->keep_buffer = 0;
+
+		box = pixman_region32_extents(&es->transform.boundingbox);
+		candidate->box.x1 = box->x1;
+		candidate->box.y1 = box->y1;
+		candidate->box.x2 = box->x2;
+		candidate->box.y2 = box->y2;
+		candidate->kinds = drm_surface_plane_kinds(output, es);
+
+		pixman_region32_init(&r);
+		pixman_region32_subtract(&r, &es->transform.boundingbox,
+					 &es->transform.opaque);
+		candidate->opaque =
+			es->alpha == 1.0f && !pixman_region32_not_empty(&r);
+		pixman_region32_fini(&r);
+
+		candidate->commit_rate =
+			weston_surface_get_commit_rate(es, msecs);
+		candidate->fixed = 0;
+		candidate->assigned = DRM_PLANE_PRIMARY;
+		candidate->data = es;
+		candidate++;
+	}
+
+	return n;
+}
+
+static void
+drm_output_fill_plane_layout(struct drm_output *output,
+			     struct drm_plane_layout *layout)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_sprite *s;
+
+	memset(layout, 0, sizeof *layout);
+	layout->output.x1 = output->base.x;
+	layout->output.y1 = output->base.y;
+	layout->output.x2 = output->base.x + output->base.width;
+	layout->output.y2 = output->base.y + output->base.height;
+
+	layout->count[DRM_PLANE_SCANOUT] = 1;
+	layout->count[DRM_PLANE_CURSOR] = output->cursor_surface == NULL;
+	wl_list_for_each(s, &c->sprite_list, link)
+		if (drm_sprite_crtc_supported(&output->base,
+					      s->possible_crtcs) && !s->next)
+			layout->count[DRM_PLANE_OVERLAY]++;
+}
+
+static struct weston_plane *
+drm_output_prepare_plane(struct drm_output *output,
+			 struct drm_plane_candidate *candidate)
+{
+	struct weston_surface *es = candidate->data;
+
+	switch (candidate->assigned) {
+	case DRM_PLANE_SCANOUT:
+		return drm_output_prepare_scanout_surface(&output->base, es);
+	case DRM_PLANE_OVERLAY:
+		return drm_output_prepare_overlay_surface(&output->base, es);
+	case DRM_PLANE_CURSOR:
+		return drm_output_prepare_cursor_surface(&output->base, es);
+	default:
+		return &output->base.compositor->primary_plane;
+	}
+}
+
 static void
 drm_assign_planes(struct weston_output *output)
 {
 	struct drm_compositor *c =
 		(struct drm_compositor *) output->compositor;
 	struct drm_output *drm_output = (struct drm_output *) output;
+	struct drm_plane_candidate *candidate;
+	struct drm_plane_layout layout;
 	struct drm_sprite *s;
-	struct weston_surface *es, *next;
-	pixman_region32_t overlap, surface_overlap;
-	struct weston_plane *primary, *next_plane;
+	struct weston_surface *es;
+	struct weston_plane *next_plane;
+	int i, n, first;
 
 	/* Reset the opaque region of the planes */
 	pixman_region32_fini(&drm_output->cursor_plane.opaque);
@@ -821,55 +959,43 @@ drm_assign_planes(struct weston_output *output)
 		pixman_region32_init(&s->plane.opaque);
 	}
 
+	n = drm_output_update_candidates(drm_output);
+	if (n < 0) {
+		wl_list_for_each(es, &c->base.surface_list, link)
+			weston_surface_move_to_plane(es,
+						     &c->base.primary_plane);
+		return;
+	}
+
+	drm_output_fill_plane_layout(drm_output, &layout);
+
 	/*
-	 * Find a surface for each sprite in the output using some heuristics:
-	 * 1) size
-	 * 2) frequency of update
-	 * 3) opacity (though some hw might support alpha blending)
-	 * 4) clipping (this can be fixed with color keys)
-	 *
-	 * The idea is to save on blitting since this should save power.
-	 * If we can get a large video surface on the sprite for example,
-	 * the main display surface may not need to update at all, and
-	 * the client buffer can be used directly for the sprite surface
-	 * as we do for flipping full screen surfaces.
+	 * Let the assigner pick the planes that save the most composition,
+	 * see drm_plane_score().  If the buffer then turns out not to work
+	 * on the plane, drop that kind for the surface and decide again
+	 * for everything below it.
 	 */
-	pixman_region32_init(&overlap);
-	primary = &c->base.primary_plane;
-	wl_list_for_each_safe(es, next, &c->base.surface_list, link) {
-		/* test whether this buffer can ever go into a plane:
-		 * non-shm, or small enough to be a cursor
-		 */
-		if ((es->buffer_ref.buffer &&
-		     !wl_buffer_is_shm(es->buffer_ref.buffer)) ||
-		    (es->geometry.width <= 64 && es->geometry.height <= 64))
-			es->keep_buffer = 1;
-		else
-			es->keep_buffer = 0;
-
-		pixman_region32_init(&surface_overlap);
-		pixman_region32_intersect(&surface_overlap, &overlap,
-					  &es->transform.boundingbox);
+	first = 0;
+	while (first < n) {
+		drm_plane_assign(&layout, drm_output->candidates, n);
+
+		for (i = first; i < n; i++) {
+			candidate = &drm_output->candidates[i];
+			next_plane = drm_output_prepare_plane(drm_output,
+							      candidate);
+			if (next_plane == NULL) {
+				candidate->kinds &=
+					~DRM_PLANE_KIND_BIT(candidate->assigned);
+				break;
+			}
 
-		next_plane = NULL;
-		if (pixman_region32_not_empty(&surface_overlap))
-			next_plane = primary;
-		if (next_plane == NULL)
-			next_plane = drm_output_prepare_cursor_surface(output, es);
-		if (next_plane == NULL)
-			next_plane = drm_output_prepare_scanout_surface(output, es);
-		if (next_plane == NULL)
-			next_plane = drm_output_prepare_overlay_surface(output, es);
-		if (next_plane == NULL)
-			next_plane = primary;
-		weston_surface_move_to_plane(es, next_plane);
-		if (next_plane == primary)
-			pixman_region32_union(&overlap, &overlap,
-					      &es->transform.boundingbox);
+			candidate->fixed = 1;
+			weston_surface_move_to_plane(candidate->data,
+						     next_plane);
+		}
 
-		pixman_region32_fini(&surface_overlap);
+		first = i;
 	}
-	pixman_region32_fini(&overlap);
 }
 
 static void
@@ -905,6 +1031,7 @@ drm_output_destroy(struct weston_output *output_base)
 	weston_output_destroy(&output->base);
 	wl_list_remove(&output->base.link);
 
+	free(output->candidates);
 	free(output->name);
 	free(output);
 }
@@ -1020,7 +1147,8 @@ static int
 init_egl(struct drm_compositor *ec, struct udev_device *device)
 {
 	const char *filename, *sysnum;
-	int fd;
+	uint64_t cap;
+	int fd, ret;
 
 	sysnum = udev_device_get_sysnum(device);
 	if (sysnum)
@@ -1042,6 +1170,13 @@ init_egl(struct drm_compositor *ec, struct udev_device *device)
 	weston_log("using %s\n", filename);
 
 	ec->drm.fd = fd;
+
+	ret = drmGetCap(fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap);
+	ec->clock_monotonic = ret == 0 && cap == 1;
+	if (!ec->clock_monotonic)
+		weston_log("kernel page flip timestamps aren't monotonic, "
+			   "using the time flips are handled\n");
+
 	ec->gbm = gbm_create_device(ec->drm.fd);
 
 	if (gl_renderer_create(&ec->base, ec->gbm, gl_renderer_opaque_attribs,
@@ -1733,6 +1868,7 @@ static void
 device_added(struct udev_device *udev_device, struct drm_seat *master)
 {
 	struct weston_compositor *c;
+	struct drm_compositor *ec;
 	struct evdev_device *device;
 	const char *devnode;
 	const char *device_seat;
@@ -1747,6 +1883,7 @@ device_added(struct udev_device *udev_device, struct drm_seat *master)
 		return;
 
 	c = master->base.compositor;
+	ec = (struct drm_compositor *) c;
 	devnode = udev_device_get_devnode(udev_device);
 
 	/* Use non-blocking mode so that we can loop on read on
@@ -1758,7 +1895,8 @@ device_added(struct udev_device *udev_device, struct drm_seat *master)
 		return;
 	}
 
-	device = evdev_device_create(&master->base, devnode, fd);
+	device = evdev_device_create(&master->base, devnode, fd,
+				     ec->input_thread);
 	if (!device) {
 		close(fd);
 		weston_log("not using input device '%s'.\n", devnode);
@@ -1769,6 +1907,11 @@ device_added(struct udev_device *udev_device, struct drm_seat *master)
 		udev_device_get_property_value(udev_device,
 					       "WL_CALIBRATION");
 
+	/* The input thread may be reading the device already, keep it
+	 * from doing so while the device is being set up. */
+	if (ec->input_thread)
+		evdev_input_thread_lock(ec->input_thread);
+
 	if (calibration_values && sscanf(calibration_values,
 					 "%f %f %f %f %f %f",
 					 &device->abs.calibration[0],
@@ -1787,6 +1930,12 @@ device_added(struct udev_device *udev_device, struct drm_seat *master)
 			    device->abs.calibration[5]);
 	}
 
+	if (ec->input_trace)
+		evdev_device_start_recording(device, ec->input_trace);
+
+	if (ec->input_thread)
+		evdev_input_thread_unlock(ec->input_thread);
+
 	wl_list_insert(master->devices_list.prev, &device->link);
 }
 
@@ -1999,6 +2148,10 @@ drm_destroy(struct weston_compositor *ec)
 
 	wl_list_for_each_safe(seat, next, &ec->seat_list, link)
 		evdev_input_destroy(seat);
+	if (d->input_thread)
+		evdev_input_thread_destroy(d->input_thread);
+	if (d->input_trace)
+		evdev_trace_writer_destroy(d->input_trace);
 	wl_list_for_each_safe(o, n, &configured_output_list, link)
 		drm_free_configured_output(o);
 
@@ -2264,6 +2417,24 @@ drm_compositor_create(struct wl_display *display,
 
 	path = NULL;
 
+	if (option_input_thread) {
+		ec->input_thread = evdev_input_thread_create(&ec->base);
+		if (ec->input_thread == NULL)
+			weston_log("failed to start input thread, "
+				   "reading input on the main thread\n");
+	}
+
+	if (option_record_input) {
+		ec->input_trace =
+			evdev_trace_writer_create(option_record_input);
+		if (ec->input_trace)
+			weston_log("recording input to %s\n",
+				   option_record_input);
+		else
+			weston_log("failed to record input to %s: %m\n",
+				   option_record_input);
+	}
+
 	evdev_input_create(&ec->base, ec->udev, seat);
 
 	loop = wl_display_get_event_loop(ec->base.wl_display);
@@ -2306,6 +2477,10 @@ err_drm_source:
 	wl_event_source_remove(ec->drm_source);
 	wl_list_for_each_safe(weston_seat, next, &ec->base.seat_list, link)
 		evdev_input_destroy(weston_seat);
+	if (ec->input_thread)
+		evdev_input_thread_destroy(ec->input_thread);
+	if (ec->input_trace)
+		evdev_trace_writer_destroy(ec->input_trace);
 err_sprite:
 	gl_renderer_destroy(&ec->base);
 	gbm_device_destroy(ec->gbm);
@@ -2479,6 +2654,8 @@ backend_init(struct wl_display *display, int argc, char *argv[],
 		{ WESTON_OPTION_STRING, "seat", 0, &seat },
 		{ WESTON_OPTION_INTEGER, "tty", 0, &tty },
 		{ WESTON_OPTION_BOOLEAN, "current-mode", 0, &option_current_mode },
+		{ WESTON_OPTION_BOOLEAN, "input-thread", 0, &option_input_thread },
+		{ WESTON_OPTION_STRING, "record-input", 0, &option_record_input },
 	};
 
 	parse_options(drm_options, ARRAY_LENGTH(drm_options), argc, argv);
@@ -27,49 +27,103 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/time.h>
 
 #include "compositor.h"
+#include "pixman-renderer.h"
+#ifdef BUILD_HEADLESS_REPLAY
+#include "evdev.h"
+#endif
+
+enum headless_frame_pacing {
+	HEADLESS_PACING_FIXED,		/* complete frames after 16 ms */
+	HEADLESS_PACING_UNTHROTTLED,	/* complete frames from an idle */
+	HEADLESS_PACING_EXTERNAL	/* complete frames on frame fd input */
+};
 
 struct headless_compositor {
 	struct weston_compositor base;
 	struct weston_seat fake_seat;
+
+	int use_pixman;
+	enum headless_frame_pacing pacing;
+	int frame_fd;
+	struct wl_event_source *frame_fd_source;
+
+#ifdef BUILD_HEADLESS_REPLAY
+	struct evdev_replay *replay;
+#endif
 };
 
 struct headless_output {
 	struct weston_output base;
 	struct weston_mode mode;
 	struct wl_event_source *finish_frame_timer;
+	struct wl_event_source *finish_frame_idle;
+	int frame_pending;
+
+	uint32_t *image_buf;
+	pixman_image_t *image;
 };
 
 
+static void
+headless_output_finish_frame(struct headless_output *output)
+{
+	output->frame_pending = 0;
+	weston_output_finish_frame(&output->base,
+				   weston_compositor_get_time_usec());
+}
+
 static int
 finish_frame_handler(void *data)
 {
-	struct weston_output *output = data;
-	uint32_t msec;
-	struct timeval tv;
+	struct headless_output *output = data;
 
-	gettimeofday(&tv, NULL);
-	msec = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-	weston_output_finish_frame(output, msec);
+	headless_output_finish_frame(output);
 
 	return 1;
 }
 
+static void
+finish_frame_idle(void *data)
+{
+	struct headless_output *output = data;
+
+	output->finish_frame_idle = NULL;
+	headless_output_finish_frame(output);
+}
+
 static void
 headless_output_repaint(struct weston_output *output_base,
 		       pixman_region32_t *damage)
 {
 	struct headless_output *output = (struct headless_output *) output_base;
 	struct weston_compositor *ec = output->base.compositor;
+	struct headless_compositor *c = (struct headless_compositor *) ec;
+	struct wl_event_loop *loop;
 
 	ec->renderer->repaint_output(&output->base, damage);
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 16);
+	output->frame_pending = 1;
+
+	switch (c->pacing) {
+	case HEADLESS_PACING_FIXED:
+		wl_event_source_timer_update(output->finish_frame_timer, 16);
+		break;
+	case HEADLESS_PACING_UNTHROTTLED:
+		loop = wl_display_get_event_loop(ec->wl_display);
+		output->finish_frame_idle =
+			wl_event_loop_add_idle(loop, finish_frame_idle, output);
+		break;
+	case HEADLESS_PACING_EXTERNAL:
+		/* Completed by frame_fd_handler() */
+		break;
+	}
 
 	return;
 }
@@ -78,8 +132,21 @@ static void
 headless_output_destroy(struct weston_output *output_base)
 {
 	struct headless_output *output = (struct headless_output *) output_base;
+	struct headless_compositor *c =
+		(struct headless_compositor *) output->base.compositor;
 
 	wl_event_source_remove(output->finish_frame_timer);
+	if (output->finish_frame_idle)
+		wl_event_source_remove(output->finish_frame_idle);
+
+	if (c->use_pixman) {
+		pixman_renderer_output_destroy(&output->base);
+		pixman_image_unref(output->image);
+		free(output->image_buf);
+	}
+
+	wl_list_remove(&output->base.link);
+	weston_output_destroy(&output->base);
 	free(output);
 
 	return;
@@ -114,6 +181,25 @@ headless_compositor_create_output(struct headless_compositor *c,
 
 	weston_output_move(&output->base, 0, 0);
 
+	if (c->use_pixman) {
+		output->image_buf = malloc(width * height * 4);
+		if (output->image_buf == NULL)
+			goto err_output;
+
+		output->image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+							 width, height,
+							 output->image_buf,
+							 width * 4);
+		if (output->image == NULL)
+			goto err_buf;
+
+		if (pixman_renderer_output_create(&output->base) < 0)
+			goto err_image;
+
+		pixman_renderer_output_set_buffer(&output->base,
+						  output->image);
+	}
+
 	loop = wl_display_get_event_loop(c->base.wl_display);
 	output->finish_frame_timer =
 		wl_event_loop_add_timer(loop, finish_frame_handler, output);
@@ -129,6 +215,81 @@ headless_compositor_create_output(struct headless_compositor *c,
 	wl_list_insert(c->base.output_list.prev, &output->base.link);
 
 	return 0;
+
+err_image:
+	pixman_image_unref(output->image);
+err_buf:
+	free(output->image_buf);
+err_output:
+	weston_output_destroy(&output->base);
+	free(output);
+	return -1;
+}
+
+static int
+frame_fd_handler(int fd, uint32_t mask, void *data)
+{
+	struct headless_compositor *c = data;
+	struct headless_output *output, *next;
+	char buf[64];
+	int len;
+
+	len = read(fd, buf, sizeof buf);
+	if (len <= 0 || mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+		weston_log("headless: frame fd closed, "
+			   "falling back to fixed frame pacing\n");
+		wl_event_source_remove(c->frame_fd_source);
+		c->frame_fd_source = NULL;
+		close(c->frame_fd);
+		c->frame_fd = -1;
+		c->pacing = HEADLESS_PACING_FIXED;
+	}
+
+	/* One read completes the pending frame on every output, no
+	 * matter how many bytes the driver wrote. */
+	wl_list_for_each_safe(output, next, &c->base.output_list, base.link)
+		if (output->frame_pending)
+			headless_output_finish_frame(output);
+
+	return 1;
+}
+
+static int
+headless_compositor_init_pacing(struct headless_compositor *c,
+				const char *pacing)
+{
+	struct wl_event_loop *loop;
+
+	c->frame_fd = -1;
+
+	if (pacing == NULL || strcmp(pacing, "fixed") == 0) {
+		c->pacing = HEADLESS_PACING_FIXED;
+	} else if (strcmp(pacing, "unthrottled") == 0) {
+		c->pacing = HEADLESS_PACING_UNTHROTTLED;
+	} else if (strcmp(pacing, "external") == 0) {
+		c->pacing = HEADLESS_PACING_EXTERNAL;
+		c->frame_fd =
+			weston_environment_get_fd("WESTON_HEADLESS_FRAME_FD");
+		if (c->frame_fd < 0) {
+			weston_log("headless: external frame pacing requires "
+				   "WESTON_HEADLESS_FRAME_FD\n");
+			return -1;
+		}
+
+		loop = wl_display_get_event_loop(c->base.wl_display);
+		c->frame_fd_source =
+			wl_event_loop_add_fd(loop, c->frame_fd,
+					     WL_EVENT_READABLE,
+					     frame_fd_handler, c);
+	} else {
+		weston_log("headless: invalid frame pacing \"%s\"\n", pacing);
+		return -1;
+	}
+
+	weston_log("headless: %s frame pacing\n",
+		   pacing ? pacing : "fixed");
+
+	return 0;
 }
 
 static void
@@ -141,20 +302,36 @@ headless_destroy(struct weston_compositor *ec)
 {
 	struct headless_compositor *c = (struct headless_compositor *) ec;
 
-	noop_renderer_destroy(ec);
+	if (c->frame_fd_source)
+		wl_event_source_remove(c->frame_fd_source);
+	if (c->frame_fd >= 0)
+		close(c->frame_fd);
 
+#ifdef BUILD_HEADLESS_REPLAY
+	if (c->replay)
+		evdev_replay_destroy(c->replay);
+#endif
 	weston_seat_release(&c->fake_seat);
 	weston_compositor_shutdown(ec);
 
+	if (c->use_pixman)
+		pixman_renderer_destroy(ec);
+	else
+		noop_renderer_destroy(ec);
+
 	free(ec);
 }
 
 static struct weston_compositor *
 headless_compositor_create(struct wl_display *display,
 			  int width, int height, const char *display_name,
+			  int use_pixman, const char *pacing, int render_threads,
+			  const char *replay, int replay_speed,
+			  const char *replay_trajectory,
 			  int argc, char *argv[], const char *config_file)
 {
 	struct headless_compositor *c;
+	struct headless_output *output, *next;
 
 	c = calloc(1, sizeof *c);
 	if (c == NULL)
@@ -171,14 +348,55 @@ headless_compositor_create(struct wl_display *display,
 	c->base.destroy = headless_destroy;
 	c->base.restore = headless_restore;
 
-	if (headless_compositor_create_output(c, width, height) < 0)
+	if (headless_compositor_init_pacing(c, pacing) < 0)
 		goto err_compositor;
 
-	if (noop_renderer_init(&c->base) < 0)
-		goto err_compositor;
+	c->use_pixman = use_pixman;
+	if (c->use_pixman) {
+		if (pixman_renderer_init(&c->base) < 0)
+			goto err_pacing;
+		if (render_threads > 1 &&
+		    pixman_renderer_set_threads(&c->base, render_threads) < 0)
+			weston_log("continuing with fewer render threads\n");
+	} else {
+		if (noop_renderer_init(&c->base) < 0)
+			goto err_pacing;
+	}
+	weston_log("Using %s renderer\n", use_pixman ? "pixman" : "noop");
+
+	if (headless_compositor_create_output(c, width, height) < 0)
+		goto err_renderer;
+
+	/* Replay devices are mapped to the output, so it must exist. */
+	if (replay) {
+#ifdef BUILD_HEADLESS_REPLAY
+		c->replay = evdev_replay_create(&c->fake_seat, replay,
+						replay_speed,
+						replay_trajectory);
+		if (c->replay == NULL)
+			goto err_output;
+#else
+		weston_log("headless: built without input replay, "
+			   "it needs mtdev\n");
+		goto err_output;
+#endif
+	}
 
 	return &c->base;
 
+err_output:
+	wl_list_for_each_safe(output, next, &c->base.output_list, base.link)
+		headless_output_destroy(&output->base);
+err_renderer:
+	if (c->use_pixman)
+		pixman_renderer_destroy(&c->base);
+	else
+		noop_renderer_destroy(&c->base);
+err_pacing:
+	if (c->frame_fd_source)
+		wl_event_source_remove(c->frame_fd_source);
+	if (c->frame_fd >= 0)
+		close(c->frame_fd);
 err_compositor:
 	weston_compositor_shutdown(&c->base);
 err_free:
@@ -192,15 +410,30 @@ backend_init(struct wl_display *display, int argc, char *argv[],
 {
 	int width = 1024, height = 640;
 	char *display_name = NULL;
+	int use_pixman = 0;
+	char *pacing = NULL;
+	int render_threads = 1;
+	char *replay = NULL;
+	int replay_speed = 1;
+	char *replay_trajectory = NULL;
 
 	const struct weston_option headless_options[] = {
 		{ WESTON_OPTION_INTEGER, "width", 0, &width },
 		{ WESTON_OPTION_INTEGER, "height", 0, &height },
+		{ WESTON_OPTION_BOOLEAN, "use-pixman", 0, &use_pixman },
+		{ WESTON_OPTION_STRING, "frame-pacing", 0, &pacing },
+		{ WESTON_OPTION_INTEGER, "render-threads", 0, &render_threads },
+		{ WESTON_OPTION_STRING, "replay-input", 0, &replay },
+		{ WESTON_OPTION_INTEGER, "replay-speed", 0, &replay_speed },
+		{ WESTON_OPTION_STRING, "replay-trajectory", 0,
+		  &replay_trajectory },
 	};
 
 	parse_options(headless_options,
 		      ARRAY_LENGTH(headless_options), argc, argv);
 
 	return headless_compositor_create(display, width, height, display_name,
+					 use_pixman, pacing, render_threads,
+					 replay, replay_speed, replay_trajectory,
 					 argc, argv, config_file);
 }
@@ -617,14 +617,11 @@ rpi_flippipe_update_complete(DISPMANX_UPDATE_HANDLE_T update, void *data)
 {
 	/* This function runs in a different thread. */
 	struct rpi_flippipe *flippipe = data;
-	struct timeval tv;
 	uint64_t time;
 	ssize_t ret;
 
 	/* manufacture flip completion timestamp */
-	/* XXX: use CLOCK_MONOTONIC instead? */
-	gettimeofday(&tv, NULL);
-	time = (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	time = weston_compositor_get_time_usec();
 
 	ret = write(flippipe->writefd, &time, sizeof time);
 	if (ret != sizeof time)
@@ -1143,7 +1140,7 @@ device_added(struct udev_device *udev_device, struct rpi_seat *master)
 		return;
 	}
 
-	device = evdev_device_create(&master->base, devnode, fd);
+	device = evdev_device_create(&master->base, devnode, fd, NULL);
 	if (!device) {
 		close(fd);
 		weston_log("not using input device '%s'.\n", devnode);
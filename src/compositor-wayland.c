@@ -119,7 +119,8 @@ frame_done(void *data, struct wl_callback *callback, uint32_t time)
 	struct weston_output *output = data;
 
 	wl_callback_destroy(callback);
-	weston_output_finish_frame(output, time);
+	/* The parent's timestamps are on its own clock. */
+	weston_output_finish_frame(output, weston_compositor_get_time_usec());
 }
 
 static const struct wl_callback_listener frame_listener = {
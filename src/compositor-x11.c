@@ -32,7 +32,6 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
-#include <sys/time.h>
 #include <sys/shm.h>
 #include <linux/input.h>
 
@@ -62,6 +61,7 @@ static char *output_transform;
 static int option_width;
 static int option_height;
 static int option_count;
+static int option_render_threads;
 static struct wl_list configured_output_list;
 
 struct x11_configured_output {
@@ -116,10 +116,8 @@ struct x11_output {
 	xcb_gc_t		gc;
 	xcb_shm_seg_t		segment;
 	pixman_image_t	       *hw_surface;
-	pixman_image_t         *shadow_surface;
 	int			shm_id;
 	void		       *buf;
-	void		       *shadow_buf;
 	uint8_t			depth;
 };
 
@@ -342,59 +340,12 @@ x11_output_repaint_shm(struct weston_output *output_base,
 	struct x11_output *output = (struct x11_output *)output_base;
 	struct weston_compositor *ec = output->base.compositor;
 	struct x11_compositor *c = (struct x11_compositor *)ec;
-	pixman_box32_t *rects;
-	int nrects, i, src_x, src_y, x1, y1, x2, y2, width, height;
 	xcb_void_cookie_t cookie;
 	xcb_generic_error_t *err;
 
-	pixman_renderer_output_set_buffer(output_base, output->shadow_surface);
+	pixman_renderer_output_set_buffer(output_base, output->hw_surface);
 	ec->renderer->repaint_output(output_base, damage);
 
-	width = pixman_image_get_width(output->shadow_surface);
-	height = pixman_image_get_height(output->shadow_surface);
-	rects = pixman_region32_rectangles(damage, &nrects);
-	for (i = 0; i < nrects; i++) {
-		switch (output_base->transform) {
-		default:
-		case WL_OUTPUT_TRANSFORM_NORMAL:
-			x1 = rects[i].x1;
-			x2 = rects[i].x2;
-			y1 = rects[i].y1;
-			y2 = rects[i].y2;
-			break;
-		case WL_OUTPUT_TRANSFORM_180:
-			x1 = width - rects[i].x2;
-			x2 = width - rects[i].x1;
-			y1 = height - rects[i].y2;
-			y2 = height - rects[i].y1;
-			break;
-		case WL_OUTPUT_TRANSFORM_90:
-			x1 = height - rects[i].y2;
-			x2 = height - rects[i].y1;
-			y1 = rects[i].x1;
-			y2 = rects[i].x2;
-			break;
-		case WL_OUTPUT_TRANSFORM_270:
-			x1 = rects[i].y1;
-			x2 = rects[i].y2;
-			y1 = width - rects[i].x2;
-			y2 = width - rects[i].x1;
-			break;
-		}
-		src_x = x1;
-		src_y = y1;
-
-		pixman_image_composite32(PIXMAN_OP_SRC,
-			output->shadow_surface, /* src */
-			NULL /* mask */,
-			output->hw_surface, /* dest */
-			src_x, src_y, /* src_x, src_y */
-			0, 0, /* mask_x, mask_y */
-			x1, y1, /* dest_x, dest_y */
-			x2 - x1, /* width */
-			y2 - y1 /* height */);
-	}
-
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 	cookie = xcb_shm_put_image_checked(c->conn, output->window, output->gc,
@@ -418,12 +369,9 @@ static int
 finish_frame_handler(void *data)
 {
 	struct x11_output *output = data;
-	uint32_t msec;
-	struct timeval tv;
-	
-	gettimeofday(&tv, NULL);
-	msec = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-	weston_output_finish_frame(&output->base, msec);
+
+	weston_output_finish_frame(&output->base,
+				   weston_compositor_get_time_usec());
 
 	return 1;
 }
@@ -444,10 +392,6 @@ x11_output_deinit_shm(struct x11_compositor *c, struct x11_output *output)
 		free(err);
 	}
 	shmdt(output->buf);
-
-	pixman_image_unref(output->shadow_surface);
-	output->shadow_surface = NULL;
-	free(output->shadow_buf);
 }
 
 static void
@@ -586,8 +530,6 @@ x11_output_init_shm(struct x11_compositor *c, struct x11_output *output,
 	xcb_format_iterator_t fmt;
 	xcb_void_cookie_t cookie;
 	xcb_generic_error_t *err;
-	int shadow_width, shadow_height;
-	pixman_transform_t transform;
 	xcb_shm_query_version_reply_t *version;
 	int bitsperpixel = 0;
 	pixman_format_code_t pixman_format;
@@ -662,53 +604,6 @@ x11_output_init_shm(struct x11_compositor *c, struct x11_output *output,
 	/* Now create pixman image */
 	output->hw_surface = pixman_image_create_bits(pixman_format, width, height, output->buf,
 		width * (bitsperpixel / 8));
-	pixman_transform_init_identity(&transform);
-	switch (output->base.transform) {
-	default:
-	case WL_OUTPUT_TRANSFORM_NORMAL:
-		shadow_width = width;
-		shadow_height = height;
-		pixman_transform_rotate(&transform,
-			NULL, 0, 0);
-		pixman_transform_translate(&transform, NULL,
-			0, 0);
-		break;
-	case WL_OUTPUT_TRANSFORM_180:
-		shadow_width = width;
-		shadow_height = height;
-		pixman_transform_rotate(&transform,
-			NULL, -pixman_fixed_1, 0);
-		pixman_transform_translate(NULL, &transform,
-			pixman_int_to_fixed(shadow_width),
-			pixman_int_to_fixed(shadow_height));
-		break;
-	case WL_OUTPUT_TRANSFORM_270:
-		shadow_width = height;
-		shadow_height = width;
-		pixman_transform_rotate(&transform,
-			NULL, 0, pixman_fixed_1);
-		pixman_transform_translate(&transform,
-			NULL,
-			pixman_int_to_fixed(shadow_width),
-			0);
-		break;
-	case WL_OUTPUT_TRANSFORM_90:
-		shadow_width = height;
-		shadow_height = width;
-		pixman_transform_rotate(&transform,
-			NULL, 0, -pixman_fixed_1);
-		pixman_transform_translate(&transform,
-			NULL,
-			0,
-			pixman_int_to_fixed(shadow_height));
-		break;
-	}
-	output->shadow_buf = malloc(width * height *  (bitsperpixel / 8));
-	output->shadow_surface = pixman_image_create_bits(pixman_format, shadow_width, shadow_height,
-		output->shadow_buf, shadow_width * (bitsperpixel / 8));
-	/* No need in transform for normal output */
-	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL)
-		pixman_image_set_transform(output->shadow_surface, &transform);
 
 	output->gc = xcb_generate_id(c->conn);
 	xcb_create_gc(c->conn, output->gc, output->window, 0, NULL);
@@ -1436,6 +1331,10 @@ x11_compositor_create(struct wl_display *display,
 	if (c->use_shm) {
 		if (pixman_renderer_init(&c->base) < 0)
 			goto err_xdisplay;
+		if (option_render_threads > 1 &&
+		    pixman_renderer_set_threads(&c->base,
+						option_render_threads) < 0)
+			weston_log("continuing with fewer render threads\n");
 	}
 	else {
 		if (gl_renderer_create(&c->base, c->dpy, gl_renderer_opaque_attribs,
@@ -1591,6 +1490,7 @@ backend_init(struct wl_display *display, int argc, char *argv[],
 		{ WESTON_OPTION_INTEGER, "output-count", 0, &option_count },
 		{ WESTON_OPTION_BOOLEAN, "no-input", 0, &no_input },
 		{ WESTON_OPTION_BOOLEAN, "use-shm", 0, &use_shm },
+		{ WESTON_OPTION_INTEGER, "render-threads", 0, &option_render_threads },
 	};
 
 	parse_options(x11_options, ARRAY_LENGTH(x11_options), argc, argv);
@@ -588,6 +588,8 @@ weston_surface_update_transform(struct weston_surface *surface)
 	weston_surface_damage_below(surface);
 
 	weston_surface_assign_output(surface);
+
+	surface->compositor->pick_index.dirty = 1;
 }
 
 WL_EXPORT void
@@ -706,6 +708,142 @@ weston_surface_is_mapped(struct weston_surface *surface)
 		return 0;
 }
 
+#define STATS_WINDOW_MSECS 1000.0f
+
+/* The surface statistics decayed to msecs. */
+WL_EXPORT void
+weston_surface_get_stats(struct weston_surface *surface, uint32_t msecs,
+			 struct weston_surface_stats *stats)
+{
+	float decay;
+
+	*stats = surface->stats;
+	decay = expf(-(float) (msecs - stats->last_commit) /
+		     STATS_WINDOW_MSECS);
+	stats->commit_rate *= decay;
+	stats->damage_rate *= decay;
+}
+
+WL_EXPORT float
+weston_surface_get_commit_rate(struct weston_surface *surface,
+			       uint32_t msecs)
+{
+	struct weston_surface_stats stats;
+
+	weston_surface_get_stats(surface, msecs, &stats);
+
+	return stats.commit_rate;
+}
+
+static void
+weston_surface_count_commit(struct weston_surface *surface,
+			    pixman_region32_t *damage)
+{
+	struct weston_surface_stats *stats = &surface->stats;
+	uint32_t msecs = weston_compositor_get_time();
+	pixman_box32_t *rects;
+	int32_t x1, y1, x2, y2;
+	uint64_t area = 0;
+	int i, n;
+
+	/* The rectangles don't overlap, so clipping each to the surface
+	 * gives the damaged area. */
+	rects = pixman_region32_rectangles(damage, &n);
+	for (i = 0; i < n; i++) {
+		x1 = rects[i].x1 > 0 ? rects[i].x1 : 0;
+		y1 = rects[i].y1 > 0 ? rects[i].y1 : 0;
+		x2 = rects[i].x2 < surface->geometry.width ?
+			rects[i].x2 : surface->geometry.width;
+		y2 = rects[i].y2 < surface->geometry.height ?
+			rects[i].y2 : surface->geometry.height;
+		if (x1 < x2 && y1 < y2)
+			area += (uint64_t) (x2 - x1) * (y2 - y1);
+	}
+
+	weston_surface_get_stats(surface, msecs, stats);
+	stats->commit_rate += 1000.0f / STATS_WINDOW_MSECS;
+	stats->damage_rate += area * 1000.0f / STATS_WINDOW_MSECS;
+	stats->last_commit = msecs;
+	stats->commits++;
+}
+
+struct surface_stats_entry {
+	struct weston_surface *surface;
+	struct weston_surface_stats stats;
+};
+
+static int
+compare_damage_rate(const void *a, const void *b)
+{
+	const struct weston_surface_stats *sa =
+		&((const struct surface_stats_entry *) a)->stats;
+	const struct weston_surface_stats *sb =
+		&((const struct surface_stats_entry *) b)->stats;
+
+	if (sa->damage_rate != sb->damage_rate)
+		return sa->damage_rate < sb->damage_rate ? 1 : -1;
+	if (sa->commit_rate != sb->commit_rate)
+		return sa->commit_rate < sb->commit_rate ? 1 : -1;
+
+	return 0;
+}
+
+/* Logs the statistics of all surfaces in the scene, the ones damaging
+ * the most first. */
+WL_EXPORT void
+weston_compositor_log_surface_stats(struct weston_compositor *compositor)
+{
+	struct surface_stats_entry *entries, *e;
+	struct weston_surface *surface;
+	uint32_t msecs = weston_compositor_get_time();
+	pid_t pid;
+	int i, n;
+
+	n = wl_list_length(&compositor->surface_list);
+	weston_log("statistics of %d surfaces\n", n);
+	if (n == 0)
+		return;
+
+	entries = malloc(n * sizeof *entries);
+	if (entries == NULL)
+		return;
+
+	e = entries;
+	wl_list_for_each(surface, &compositor->surface_list, link) {
+		e->surface = surface;
+		weston_surface_get_stats(surface, msecs, &e->stats);
+		e++;
+	}
+	qsort(entries, n, sizeof *entries, compare_damage_rate);
+
+	weston_log_continue(STAMP_SPACE "%6s %-21s %8s %10s %8s %8s\n",
+			    "pid", "geometry", "commit/s", "Mpixel/s",
+			    "idle ms", "commits");
+	for (i = 0; i < n; i++) {
+		e = &entries[i];
+		surface = e->surface;
+		pid = 0;
+		if (surface->surface.resource.client)
+			wl_client_get_credentials(
+				surface->surface.resource.client,
+				&pid, NULL, NULL);
+		weston_log_continue(STAMP_SPACE
+				    "%6d %4dx%-4d @ %5d,%-5d %8.1f %10.2f "
+				    "%8u %8u\n",
+				    (int) pid,
+				    surface->geometry.width,
+				    surface->geometry.height,
+				    (int) surface->geometry.x,
+				    (int) surface->geometry.y,
+				    e->stats.commit_rate,
+				    e->stats.damage_rate / 1e6f,
+				    msecs - e->stats.last_commit,
+				    e->stats.commits);
+	}
+
+	free(entries);
+}
+
 WL_EXPORT int32_t
 weston_surface_buffer_width(struct weston_surface *surface)
 {
@@ -734,14 +872,122 @@ weston_surface_buffer_height(struct weston_surface *surface)
 	}
 }
 
+/* All compositor timestamps are CLOCK_MONOTONIC, so they don't jump
+ * with the wall clock.  Milliseconds are only for the protocol and for
+ * animations; measure anything finer in microseconds. */
+WL_EXPORT uint64_t
+weston_compositor_get_time_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 WL_EXPORT uint32_t
 weston_compositor_get_time(void)
 {
-       struct timeval tv;
+	return weston_compositor_get_time_usec() / 1000;
+}
+
+static void
+pick_index_init(struct weston_pick_index *index)
+{
+	int i;
+
+	for (i = 0; i < (int) ARRAY_LENGTH(index->cells); i++)
+		wl_array_init(&index->cells[i]);
+	index->dirty = 1;
+}
+
+static void
+pick_index_release(struct weston_pick_index *index)
+{
+	int i;
+
+	for (i = 0; i < (int) ARRAY_LENGTH(index->cells); i++)
+		wl_array_release(&index->cells[i]);
+}
+
+static int
+pick_index_cell(int32_t v, int32_t origin, int32_t size)
+{
+	int32_t cell = (v - origin) / size;
+
+	if (v < origin)
+		return 0;
+	if (cell >= WESTON_PICK_GRID_SIZE)
+		return WESTON_PICK_GRID_SIZE - 1;
+
+	return cell;
+}
+
+static void
+pick_index_rebuild(struct weston_compositor *compositor)
+{
+	struct weston_pick_index *index = &compositor->pick_index;
+	struct weston_surface *surface, **p;
+	pixman_box32_t *e, extents;
+	int i, x, y, x1, y1, x2, y2, empty = 1;
+
+	for (i = 0; i < (int) ARRAY_LENGTH(index->cells); i++)
+		index->cells[i].size = 0;
+
+	wl_list_for_each(surface, &compositor->surface_list, link) {
+		if (!pixman_region32_not_empty(&surface->transform.boundingbox))
+			continue;
+		e = pixman_region32_extents(&surface->transform.boundingbox);
+		if (empty) {
+			extents = *e;
+			empty = 0;
+			continue;
+		}
+		if (e->x1 < extents.x1)
+			extents.x1 = e->x1;
+		if (e->y1 < extents.y1)
+			extents.y1 = e->y1;
+		if (e->x2 > extents.x2)
+			extents.x2 = e->x2;
+		if (e->y2 > extents.y2)
+			extents.y2 = e->y2;
+	}
+
+	index->dirty = 0;
+	if (empty) {
+		index->cell_width = 0;
+		return;
+	}
 
-       gettimeofday(&tv, NULL);
+	index->x = extents.x1;
+	index->y = extents.y1;
+	index->cell_width = (extents.x2 - extents.x1 +
+			     WESTON_PICK_GRID_SIZE - 1) / WESTON_PICK_GRID_SIZE;
+	index->cell_height = (extents.y2 - extents.y1 +
+			      WESTON_PICK_GRID_SIZE - 1) / WESTON_PICK_GRID_SIZE;
 
-       return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	wl_list_for_each(surface, &compositor->surface_list, link) {
+		if (!pixman_region32_not_empty(&surface->transform.boundingbox))
+			continue;
+		e = pixman_region32_extents(&surface->transform.boundingbox);
+		x1 = pick_index_cell(e->x1, index->x, index->cell_width);
+		y1 = pick_index_cell(e->y1, index->y, index->cell_height);
+		x2 = pick_index_cell(e->x2 - 1, index->x, index->cell_width);
+		y2 = pick_index_cell(e->y2 - 1, index->y, index->cell_height);
+
+		for (y = y1; y <= y2; y++) {
+			for (x = x1; x <= x2; x++) {
+				i = y * WESTON_PICK_GRID_SIZE + x;
+				p = wl_array_add(&index->cells[i], sizeof *p);
+				if (p == NULL) {
+					/* Fall back to the surface list. */
+					index->dirty = 1;
+					return;
+				}
+				*p = surface;
+			}
+		}
+	}
 }
 
 static struct weston_surface *
@@ -749,9 +995,49 @@ weston_compositor_pick_surface(struct weston_compositor *compositor,
 			       wl_fixed_t x, wl_fixed_t y,
 			       wl_fixed_t *sx, wl_fixed_t *sy)
 {
-	struct weston_surface *surface;
+	struct weston_pick_index *index = &compositor->pick_index;
+	struct weston_surface *surface, **p;
+	struct wl_array *cell;
+	int32_t ix, iy;
 
-	wl_list_for_each(surface, &compositor->surface_list, link) {
+	if (index->dirty)
+		pick_index_rebuild(compositor);
+
+	if (index->dirty) {
+		wl_list_for_each(surface, &compositor->surface_list, link) {
+			weston_surface_from_global_fixed(surface, x, y, sx, sy);
+			if (pixman_region32_contains_point(&surface->input,
+							   wl_fixed_to_int(*sx),
+							   wl_fixed_to_int(*sy),
+							   NULL))
+				return surface;
+		}
+
+		return NULL;
+	}
+
+	/* Only surfaces whose bounding box overlaps the cell under the
+	 * pointer can contain it.  The bounding box is conservative for
+	 * transformed surfaces, so each candidate still gets the exact
+	 * input region test, in stacking order. */
+	ix = wl_fixed_to_int(x);
+	iy = wl_fixed_to_int(y);
+	if (index->cell_width == 0 ||
+	    ix < index->x ||
+	    iy < index->y ||
+	    ix >= index->x + index->cell_width * WESTON_PICK_GRID_SIZE ||
+	    iy >= index->y + index->cell_height * WESTON_PICK_GRID_SIZE)
+		return NULL;
+
+	cell = &index->cells[((iy - index->y) / index->cell_height) *
+			     WESTON_PICK_GRID_SIZE +
+			     (ix - index->x) / index->cell_width];
+
+	wl_array_for_each(p, cell) {
+		surface = *p;
+		if (!pixman_region32_contains_point(&surface->transform.boundingbox,
+						    ix, iy, NULL))
+			continue;
 		weston_surface_from_global_fixed(surface, x, y, sx, sy);
 		if (pixman_region32_contains_point(&surface->input,
 						   wl_fixed_to_int(*sx),
@@ -816,6 +1102,9 @@ weston_surface_unmap(struct weston_surface *surface)
 	weston_surface_damage_below(surface);
 	surface->output = NULL;
 	wl_list_remove(&surface->layer_link);
+	wl_list_remove(&surface->link);
+	wl_list_init(&surface->link);
+	weston_compositor_mark_layers_dirty(surface->compositor);
 
 	wl_list_for_each(seat, &surface->compositor->seat_list, link) {
 		if (seat->seat.keyboard &&
@@ -936,6 +1225,7 @@ weston_surface_restack(struct weston_surface *surface, struct wl_list *below)
 {
 	wl_list_remove(&surface->layer_link);
 	wl_list_insert(below, &surface->layer_link);
+	weston_compositor_mark_layers_dirty(surface->compositor);
 	weston_surface_damage_below(surface);
 	weston_surface_damage(surface);
 }
@@ -1004,10 +1294,46 @@ fade_frame(struct weston_animation *animation,
 	}
 }
 
+/* A surface is occluded on output when the opaque region of everything
+ * above it covers all of it that's on the output.  Transformed and
+ * translucent surfaces have no opaque region, so they can be occluded
+ * but never occlude anything. */
+static int
+surface_is_occluded(struct weston_surface *surface,
+		    struct weston_output *output,
+		    pixman_region32_t *opaque, int covered)
+{
+	pixman_region32_t visible;
+	int occluded;
+
+	if (covered)
+		return 1;
+
+	pixman_region32_init(&visible);
+	pixman_region32_intersect(&visible, &surface->transform.boundingbox,
+				  &output->region);
+	pixman_region32_subtract(&visible, &visible, opaque);
+	occluded = !pixman_region32_not_empty(&visible);
+	pixman_region32_fini(&visible);
+
+	return occluded;
+}
+
 static void
 surface_accumulate_damage(struct weston_surface *surface,
-			  pixman_region32_t *opaque)
-{
+			  struct weston_output *output,
+			  pixman_region32_t *opaque, int covered)
+{
+	/* Renderers skip drawing surfaces occluded on the output, and hold
+	 * on to their damage instead of uploading it for as long as they
+	 * are occluded on every output. */
+	if (surface_is_occluded(surface, output, opaque, covered))
+		surface->occluded_mask |= 1 << output->id;
+	else
+		surface->occluded_mask &= ~(1 << output->id);
+	surface->occluded =
+		(surface->output_mask & ~surface->occluded_mask) == 0;
+
 	if (surface->buffer_ref.buffer &&
 	    wl_buffer_is_shm(surface->buffer_ref.buffer))
 		surface->compositor->renderer->flush_damage(surface);
@@ -1035,53 +1361,187 @@ surface_accumulate_damage(struct weston_surface *surface,
 			      &surface->plane->damage, &surface->damage);
 	empty_region(&surface->damage);
 	pixman_region32_copy(&surface->clip, opaque);
+
+	/* transform.opaque is only updated with the geometry, the alpha
+	 * may have changed since. */
+	if (surface->alpha < 1.0)
+		return;
+
 	pixman_region32_union(&surface->plane->opaque,
 			      &surface->plane->opaque,
 			      &surface->transform.opaque);
 	pixman_region32_union(opaque, opaque, &surface->transform.opaque);
 }
 
+/* Records input events by their kernel timestamps, for the input
+ * latency of the frame that first shows their effect. */
+WL_EXPORT void
+weston_compositor_note_input_stamps(struct weston_compositor *compositor,
+				    const struct weston_input_stamps *stamps)
+{
+	struct weston_output *output;
+	struct weston_input_stamps *input;
+
+	if (stamps->count == 0)
+		return;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		input = &output->timing.input;
+		if (input->count == 0 || stamps->oldest < input->oldest)
+			input->oldest = stamps->oldest;
+		if (input->count == 0 || stamps->newest > input->newest)
+			input->newest = stamps->newest;
+		input->sum += stamps->sum;
+		input->count += stamps->count;
+	}
+}
+
+WL_EXPORT void
+weston_compositor_note_input(struct weston_compositor *compositor,
+			     uint64_t usecs)
+{
+	struct weston_input_stamps stamps;
+
+	stamps.count = 1;
+	stamps.oldest = usecs;
+	stamps.newest = usecs;
+	stamps.sum = usecs;
+	weston_compositor_note_input_stamps(compositor, &stamps);
+}
+
+static void
+weston_output_timing_start(struct weston_output *output, uint32_t msecs)
+{
+	struct weston_output_timing *timing = &output->timing;
+
+	clock_gettime(CLOCK_MONOTONIC, &timing->last);
+	memset(&timing->current, 0, sizeof timing->current);
+	timing->current.msecs = msecs;
+	timing->pending = 1;
+
+	timing->frame_input = timing->input;
+	memset(&timing->input, 0, sizeof timing->input);
+}
+
+static void
+weston_output_timing_present(struct weston_output *output, uint64_t usecs)
+{
+	struct weston_output_timing *timing = &output->timing;
+	struct weston_input_stamps *input = &timing->frame_input;
+
+	if (!timing->pending || input->count == 0 || usecs < input->newest)
+		return;
+
+	timing->current.input_events = input->count;
+	timing->current.input_latency_min = usecs - input->newest;
+	timing->current.input_latency_avg =
+		usecs - input->sum / input->count;
+	timing->current.input_latency_max = usecs - input->oldest;
+}
+
+/* Charge the time since the previous mark to the given phase.  Marking
+ * FLIP completes the frame and stores it in the ring buffer. */
+WL_EXPORT void
+weston_output_timing_mark(struct weston_output *output,
+			  enum weston_repaint_phase phase)
+{
+	struct weston_output_timing *timing = &output->timing;
+	struct timespec now;
+	int64_t usecs;
+
+	if (!timing->pending)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	usecs = (int64_t) (now.tv_sec - timing->last.tv_sec) * 1000000 +
+		(now.tv_nsec - timing->last.tv_nsec) / 1000;
+	timing->current.phase_usecs[phase] += usecs;
+	timing->last = now;
+
+	if (phase == WESTON_REPAINT_PHASE_FLIP) {
+		timing->frames[timing->count % WESTON_FRAME_TIMING_HISTORY] =
+			timing->current;
+		timing->count++;
+		timing->pending = 0;
+	}
+}
+
 static void
 weston_output_repaint(struct weston_output *output, uint32_t msecs)
 {
 	struct weston_compositor *ec = output->compositor;
-	struct weston_surface *es;
+	struct weston_surface *es, *next_es;
 	struct weston_layer *layer;
 	struct weston_animation *animation, *next;
 	struct weston_frame_callback *cb, *cnext;
 	struct wl_list frame_callback_list;
 	pixman_region32_t opaque, output_damage;
+	int covered;
+
+	/* Pick up what the input thread read since the last frame, so
+	 * the pointer is where it is now rather than where it was a frame
+	 * ago.  Input read on the main thread can't have moved on. */
+	if (ec->threaded_input)
+		wl_event_loop_dispatch(ec->input_loop, 0);
+
+	weston_output_timing_start(output, msecs);
 
 	weston_compositor_update_drag_surfaces(ec);
 
-	/* Rebuild the surface list and update surface transforms up front. */
-	wl_list_init(&ec->surface_list);
+	/* Rebuild the surface list only if the stacking order changed.
+	 * Surface transforms are updated up front either way;
+	 * weston_surface_update_transform() is a no-op for surfaces whose
+	 * geometry is clean. */
+	if (ec->layers_dirty) {
+		wl_list_for_each_safe(es, next_es, &ec->surface_list, link)
+			wl_list_init(&es->link);
+		wl_list_init(&ec->surface_list);
+		wl_list_for_each(layer, &ec->layer_list, link)
+			wl_list_for_each(es, &layer->surface_list, layer_link)
+				wl_list_insert(ec->surface_list.prev,
+					       &es->link);
+		ec->layers_dirty = 0;
+		ec->pick_index.dirty = 1;
+		ec->surface_list_rebuilds++;
+	} else {
+		ec->surface_list_reuses++;
+	}
+
 	wl_list_init(&frame_callback_list);
-	wl_list_for_each(layer, &ec->layer_list, link) {
-		wl_list_for_each(es, &layer->surface_list, layer_link) {
-			weston_surface_update_transform(es);
-			wl_list_insert(ec->surface_list.prev, &es->link);
-			if (es->output == output) {
-				wl_list_insert_list(&frame_callback_list,
-						    &es->frame_callback_list);
-				wl_list_init(&es->frame_callback_list);
-			}
+	wl_list_for_each(es, &ec->surface_list, link) {
+		weston_surface_update_transform(es);
+		if (es->output == output) {
+			wl_list_insert_list(&frame_callback_list,
+					    &es->frame_callback_list);
+			wl_list_init(&es->frame_callback_list);
 		}
 	}
 
+	weston_output_timing_mark(output, WESTON_REPAINT_PHASE_UPDATE);
+
 	if (output->assign_planes && !output->disable_planes)
 		output->assign_planes(output);
 	else
 		wl_list_for_each(es, &ec->surface_list, link)
 			weston_surface_move_to_plane(es, &ec->primary_plane);
 
+	weston_output_timing_mark(output, WESTON_REPAINT_PHASE_ASSIGN_PLANES);
+
 	pixman_region32_init(&opaque);
 
 	pixman_region32_fini(&ec->primary_plane.opaque);
 	pixman_region32_init(&ec->primary_plane.opaque);
 
+	covered = 0;
 	wl_list_for_each(es, &ec->surface_list, link) {
-		surface_accumulate_damage(es, &opaque);
+		surface_accumulate_damage(es, output, &opaque, covered);
+
+		/* Typically a fullscreen opaque surface; everything below
+		 * it is occluded without looking any further. */
+		if (!covered)
+			covered = pixman_region32_contains_rectangle(&opaque,
+				pixman_region32_extents(&output->region)) ==
+				PIXMAN_REGION_IN;
 
 		/* Both the renderer and the backend have seen the buffer
 		 * by now. If renderer needs the buffer, it has its own
@@ -1089,14 +1549,18 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 		 * around for migrating the surface into a non-primary plane
 		 * later, keep_buffer is true. Otherwise, drop the core
 		 * reference now, and allow early buffer release. This enables
-		 * clients to use single-buffering.
+		 * clients to use single-buffering. An occluded surface keeps
+		 * it too, so the renderer can upload its pending damage once
+		 * the surface shows up again.
 		 */
-		if (!es->keep_buffer)
+		if (!es->keep_buffer && !es->occluded)
 			weston_buffer_reference(&es->buffer_ref, NULL);
 	}
 
 	pixman_region32_fini(&opaque);
 
+	weston_output_timing_mark(output, WESTON_REPAINT_PHASE_DAMAGE);
+
 	pixman_region32_init(&output_damage);
 	pixman_region32_intersect(&output_damage,
 				  &ec->primary_plane.damage, &output->region);
@@ -1106,6 +1570,8 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 
 	output->repaint(output, &output_damage);
 
+	weston_output_timing_mark(output, WESTON_REPAINT_PHASE_SUBMIT);
+
 	pixman_region32_fini(&output_damage);
 
 	output->repaint_needed = 0;
@@ -1134,17 +1600,23 @@ weston_compositor_read_input(int fd, uint32_t mask, void *data)
 	return 1;
 }
 
+/* usecs is when the frame was shown, on the CLOCK_MONOTONIC time base
+ * of weston_compositor_get_time_usec(). */
 WL_EXPORT void
-weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
+weston_output_finish_frame(struct weston_output *output, uint64_t usecs)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct wl_event_loop *loop =
 		wl_display_get_event_loop(compositor->wl_display);
 	int fd;
 
-	output->frame_time = msecs;
+	weston_output_timing_present(output, usecs);
+	weston_output_timing_mark(output, WESTON_REPAINT_PHASE_FLIP);
+
+	output->frame_usecs = usecs;
+	output->frame_time = usecs / 1000;
 	if (output->repaint_needed) {
-		weston_output_repaint(output, msecs);
+		weston_output_repaint(output, output->frame_time);
 		return;
 	}
 
@@ -1158,12 +1630,123 @@ weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
 				     weston_compositor_read_input, compositor);
 }
 
+static void
+weston_output_timing_log(struct weston_output *output)
+{
+	static const char *phase_names[WESTON_REPAINT_PHASE_COUNT] = {
+		"update", "assign planes", "damage",
+		"render", "submit", "flip"
+	};
+	static const uint32_t bucket_usecs[] = {
+		1000, 2000, 4000, 8000, 16000, 33000
+	};
+	struct weston_output_timing *timing = &output->timing;
+	struct weston_frame_timing *frame;
+	uint32_t min[WESTON_REPAINT_PHASE_COUNT];
+	uint32_t max[WESTON_REPAINT_PHASE_COUNT];
+	uint64_t sum[WESTON_REPAINT_PHASE_COUNT];
+	uint32_t buckets[ARRAY_LENGTH(bucket_usecs) + 1];
+	uint32_t n, repaint, usecs;
+	uint32_t input_events = 0, input_min = UINT32_MAX, input_max = 0;
+	uint64_t input_sum = 0;
+	unsigned int i, j;
+
+	n = timing->count;
+	if (n > WESTON_FRAME_TIMING_HISTORY)
+		n = WESTON_FRAME_TIMING_HISTORY;
+
+	weston_log("output %u: repaint timing of the last %u frames\n",
+		   output->id, n);
+	if (n == 0)
+		return;
+
+	memset(max, 0, sizeof max);
+	memset(sum, 0, sizeof sum);
+	memset(buckets, 0, sizeof buckets);
+	for (j = 0; j < WESTON_REPAINT_PHASE_COUNT; j++)
+		min[j] = UINT32_MAX;
+
+	for (i = 0; i < n; i++) {
+		frame = &timing->frames[i];
+		repaint = 0;
+		for (j = 0; j < WESTON_REPAINT_PHASE_COUNT; j++) {
+			usecs = frame->phase_usecs[j];
+			if (usecs < min[j])
+				min[j] = usecs;
+			if (usecs > max[j])
+				max[j] = usecs;
+			sum[j] += usecs;
+			if (j != WESTON_REPAINT_PHASE_FLIP)
+				repaint += usecs;
+		}
+
+		for (j = 0; j < ARRAY_LENGTH(bucket_usecs); j++)
+			if (repaint < bucket_usecs[j])
+				break;
+		buckets[j]++;
+
+		if (frame->input_events == 0)
+			continue;
+		input_events += frame->input_events;
+		input_sum += (uint64_t) frame->input_latency_avg *
+			frame->input_events;
+		if (frame->input_latency_min < input_min)
+			input_min = frame->input_latency_min;
+		if (frame->input_latency_max > input_max)
+			input_max = frame->input_latency_max;
+	}
+
+	for (j = 0; j < WESTON_REPAINT_PHASE_COUNT; j++)
+		weston_log_continue(STAMP_SPACE
+				    "%-14s min %6u avg %6u max %6u us\n",
+				    phase_names[j], min[j],
+				    (uint32_t) (sum[j] / n), max[j]);
+
+	weston_log_continue(STAMP_SPACE "repaint time histogram:\n");
+	for (j = 0; j < ARRAY_LENGTH(bucket_usecs); j++)
+		weston_log_continue(STAMP_SPACE "  < %2u ms: %u\n",
+				    bucket_usecs[j] / 1000, buckets[j]);
+	weston_log_continue(STAMP_SPACE " >= %2u ms: %u\n",
+			    bucket_usecs[j - 1] / 1000, buckets[j]);
+
+	if (input_events > 0)
+		weston_log_continue(STAMP_SPACE
+				    "input to present: %u events, "
+				    "min %u avg %u max %u us\n",
+				    input_events, input_min,
+				    (uint32_t) (input_sum / input_events),
+				    input_max);
+}
+
+static void
+timing_debug_binding(struct wl_seat *seat, uint32_t time, uint32_t key,
+		     void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_output *output;
+
+	wl_list_for_each(output, &ec->output_list, link)
+		weston_output_timing_log(output);
+
+	weston_log("surface list: %u rebuilds, %u reuses\n",
+		   ec->surface_list_rebuilds, ec->surface_list_reuses);
+}
+
+static void
+surface_stats_debug_binding(struct wl_seat *seat, uint32_t time,
+			    uint32_t key, void *data)
+{
+	struct weston_compositor *ec = data;
+
+	weston_compositor_log_surface_stats(ec);
+}
+
 static void
 idle_repaint(void *data)
 {
 	struct weston_output *output = data;
 
-	weston_output_finish_frame(output, weston_compositor_get_time());
+	weston_output_finish_frame(output, weston_compositor_get_time_usec());
 }
 
 WL_EXPORT void
@@ -1174,6 +1757,16 @@ weston_layer_init(struct weston_layer *layer, struct wl_list *below)
 		wl_list_insert(below, &layer->link);
 }
 
+/* Must be called after changing layer_list, a layer's surface_list or a
+ * surface's layer_link directly, so the next repaint picks up the new
+ * stacking order.  weston_surface_restack() and weston_surface_unmap()
+ * do this themselves. */
+WL_EXPORT void
+weston_compositor_mark_layers_dirty(struct weston_compositor *compositor)
+{
+	compositor->layers_dirty = 1;
+}
+
 WL_EXPORT void
 weston_output_schedule_repaint(struct weston_output *output)
 {
@@ -1228,6 +1821,7 @@ weston_compositor_fade(struct weston_compositor *compositor, float tint)
 		weston_surface_set_color(surface, 0.0, 0.0, 0.0, 0.0);
 		wl_list_insert(&compositor->fade_layer.surface_list,
 			       &surface->layer_link);
+		weston_compositor_mark_layers_dirty(compositor);
 		weston_surface_update_transform(surface);
 		compositor->fade.surface = surface;
 		pixman_region32_init(&surface->input);
@@ -1403,6 +1997,8 @@ surface_commit(struct wl_client *client, struct wl_resource *resource)
 	surface->pending.sx = 0;
 	surface->pending.sy = 0;
 
+	weston_surface_count_commit(surface, &surface->pending.damage);
+
 	/* wl_surface.damage */
 	pixman_region32_union(&surface->damage, &surface->damage,
 			      &surface->pending.damage);
@@ -2158,6 +2754,7 @@ pointer_cursor_surface_configure(struct weston_surface *es,
 	if (!weston_surface_is_mapped(es)) {
 		wl_list_insert(&es->compositor->cursor_layer.surface_list,
 			       &es->layer_link);
+		weston_compositor_mark_layers_dirty(es->compositor);
 		weston_surface_update_transform(es);
 	}
 }
@@ -2650,6 +3247,7 @@ device_map_drag_surface(struct weston_seat *seat)
 		list = &seat->compositor->cursor_layer.surface_list;
 
 	wl_list_insert(list, &seat->drag_surface->layer_link);
+	weston_compositor_mark_layers_dirty(seat->compositor);
 	weston_surface_update_transform(seat->drag_surface);
 	empty_region(&seat->drag_surface->input);
 }
@@ -2740,6 +3338,8 @@ weston_output_destroy(struct weston_output *output)
 {
 	struct weston_compositor *c = output->compositor;
 
+	wl_signal_emit(&output->destroy_signal, output);
+
 	pixman_region32_fini(&output->region);
 	pixman_region32_fini(&output->previous_damage);
 	output->compositor->output_id_pool &= ~(1 << output->id);
@@ -2888,6 +3488,7 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 	output->mm_width = width;
 	output->mm_height = height;
 	output->dirty = 1;
+	memset(&output->timing, 0, sizeof output->timing);
 
 	weston_output_transform_init(output, transform);
 	weston_output_init_zoom(output);
@@ -2896,6 +3497,7 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 	weston_output_damage(output);
 
 	wl_signal_init(&output->frame_signal);
+	wl_signal_init(&output->destroy_signal);
 	wl_list_init(&output->animation_list);
 	wl_list_init(&output->resource_list);
 
@@ -2980,12 +3582,14 @@ weston_compositor_init(struct weston_compositor *ec,
 	wl_list_init(&ec->fade.animation.link);
 
 	weston_plane_init(&ec->primary_plane, 0, 0);
+	pick_index_init(&ec->pick_index);
+	ec->layers_dirty = 1;
 
 	weston_compositor_xkb_init(ec, &xkb_names);
 
 	ec->ping_handler = NULL;
 
-	screenshooter_create(ec);
+	screenshooter_create(ec, config_file);
 	text_cursor_position_notifier_create(ec);
 	text_backend_init(ec);
 
@@ -3005,6 +3609,11 @@ weston_compositor_init(struct weston_compositor *ec,
 	weston_layer_init(&ec->fade_layer, &ec->layer_list);
 	weston_layer_init(&ec->cursor_layer, &ec->fade_layer.link);
 
+	weston_compositor_add_debug_binding(ec, KEY_T,
+					    timing_debug_binding, ec);
+	weston_compositor_add_debug_binding(ec, KEY_U,
+					    surface_stats_debug_binding, ec);
+
 	weston_compositor_schedule_repaint(ec);
 
 	return 0;
@@ -3029,10 +3638,7 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	weston_binding_list_destroy_all(&ec->debug_binding_list);
 
 	weston_plane_release(&ec->primary_plane);
-
-	wl_array_release(&ec->vertices);
-	wl_array_release(&ec->indices);
-	wl_array_release(&ec->vtxcnt);
+	pick_index_release(&ec->pick_index);
 
 	wl_event_loop_destroy(ec->input_loop);
 }
@@ -3207,7 +3813,9 @@ usage(int error_code)
 		"  --connector=ID\tBring up only this connector\n"
 		"  --seat=SEAT\t\tThe seat that weston should run on\n"
 		"  --tty=TTY\t\tThe tty to use\n"
-		"  --current-mode\tPrefer current KMS mode over EDID preferred mode\n\n");
+		"  --current-mode\tPrefer current KMS mode over EDID preferred mode\n"
+		"  --input-thread\tRead input devices on a separate thread\n"
+		"  --record-input=FILE\tRecord the input devices to FILE\n\n");
 
 	fprintf(stderr,
 		"Options for x11-backend.so:\n\n"
@@ -3215,7 +3823,9 @@ usage(int error_code)
 		"  --height=HEIGHT\tHeight of X window\n"
 		"  --fullscreen\t\tRun in fullscreen mode\n"
 		"  --output-count=COUNT\tCreate multiple outputs\n"
-		"  --no-input\t\tDont create input devices\n\n");
+		"  --no-input\t\tDont create input devices\n"
+		"  --use-shm\t\tRender with pixman and MIT-SHM\n"
+		"  --render-threads=N\tSplit pixman composition across N threads\n\n");
 
 	fprintf(stderr,
 		"Options for wayland-backend.so:\n\n"
@@ -3223,6 +3833,22 @@ usage(int error_code)
 		"  --height=HEIGHT\tHeight of Wayland surface\n"
 		"  --display=DISPLAY\tWayland display to connect to\n\n");
 
+	fprintf(stderr,
+		"Options for headless-backend.so:\n\n"
+		"  --width=WIDTH\t\tWidth of memory surface\n"
+		"  --height=HEIGHT\tHeight of memory surface\n"
+		"  --use-pixman\t\tRender with pixman into memory\n"
+		"  --render-threads=N\tSplit pixman composition across N threads\n"
+		"  --frame-pacing=MODE\tfixed (16 ms), unthrottled or external.\n"
+		"\t\t\t\tExternal pacing completes a frame for each\n"
+		"\t\t\t\tread from WESTON_HEADLESS_FRAME_FD\n"
+		"  --replay-input=FILE\tReplay input recorded with --record-input\n"
+		"\t\t\t\tand exit when done\n"
+		"  --replay-speed=N\tReplay N times as fast, 0 for as fast\n"
+		"\t\t\t\tas possible (default 1)\n"
+		"  --replay-trajectory=FILE\n"
+		"\t\t\tWrite the replayed pointer positions to FILE\n\n");
+
 	exit(error_code);
 }
 
@@ -24,6 +24,7 @@
 #ifndef _WAYLAND_SYSTEM_COMPOSITOR_H_
 #define _WAYLAND_SYSTEM_COMPOSITOR_H_
 
+#include <time.h>
 #include <pixman.h>
 #include <xkbcommon/xkbcommon.h>
 #include <wayland-server.h>
@@ -137,6 +138,50 @@ struct weston_output_zoom {
 	struct weston_fixed_point text_cursor;
 };
 
+/* Phases of an output repaint, in the order they run.  RENDER is marked
+ * by the renderer when it is done drawing, SUBMIT when the backend's
+ * repaint hook returns and FLIP when the frame completes. */
+enum weston_repaint_phase {
+	WESTON_REPAINT_PHASE_UPDATE,
+	WESTON_REPAINT_PHASE_ASSIGN_PLANES,
+	WESTON_REPAINT_PHASE_DAMAGE,
+	WESTON_REPAINT_PHASE_RENDER,
+	WESTON_REPAINT_PHASE_SUBMIT,
+	WESTON_REPAINT_PHASE_FLIP,
+	WESTON_REPAINT_PHASE_COUNT
+};
+
+#define WESTON_FRAME_TIMING_HISTORY 128
+
+struct weston_frame_timing {
+	uint32_t msecs;
+	uint32_t phase_usecs[WESTON_REPAINT_PHASE_COUNT];
+	/* Input events first shown by this frame and how long they took
+	 * from the kernel to the screen. */
+	uint32_t input_events;
+	uint32_t input_latency_min, input_latency_avg, input_latency_max;
+};
+
+/* CLOCK_MONOTONIC timestamps of input events, in microseconds. */
+struct weston_input_stamps {
+	uint32_t count;
+	uint64_t oldest, newest, sum;
+};
+
+/* Ring buffer of the last WESTON_FRAME_TIMING_HISTORY frames; frame
+ * n lives in frames[n % WESTON_FRAME_TIMING_HISTORY]. */
+struct weston_output_timing {
+	int pending;
+	struct timespec last;
+	struct weston_frame_timing current;
+	uint32_t count;
+	struct weston_frame_timing frames[WESTON_FRAME_TIMING_HISTORY];
+
+	/* Input since the last repaint started, and the input the
+	 * frame being repainted shows. */
+	struct weston_input_stamps input, frame_input;
+};
+
 /* bit compatible with drm definitions. */
 enum dpms_enum {
 	WESTON_DPMS_ON,
@@ -166,8 +211,11 @@ struct weston_output {
 	struct weston_output_zoom zoom;
 	int dirty;
 	struct wl_signal frame_signal;
+	struct wl_signal destroy_signal;
 	uint32_t frame_time;
+	uint64_t frame_usecs;
 	int disable_planes;
+	struct weston_output_timing timing;
 
 	char *make, *model;
 	uint32_t subpixel;
@@ -259,11 +307,46 @@ struct weston_plane {
 	int32_t x, y;
 };
 
+/* Uniform grid over the bounding boxes of compositor->surface_list,
+ * used to find pick candidates without testing every surface.  Each cell
+ * lists the surfaces whose bounding box overlaps it, in stacking order.
+ * Rebuilt lazily whenever dirty is set.
+ */
+#define WESTON_PICK_GRID_SIZE 16
+
+struct weston_pick_index {
+	int dirty;
+	int32_t x, y;
+	int32_t cell_width, cell_height;
+	struct wl_array cells[WESTON_PICK_GRID_SIZE * WESTON_PICK_GRID_SIZE];
+};
+
+/* Called when the pixels asked for with read_pixels_async() are
+ * available.  pixels holds the rectangle bottom-up with a stride of
+ * width * 4, like read_pixels() would have returned it, and is only
+ * valid during the call.  pixels is NULL if the read failed or the
+ * output went away first. */
+typedef void (*weston_read_pixels_func_t)(void *pixels, void *data);
+
 struct weston_renderer {
 	int (*read_pixels)(struct weston_output *output,
 			       pixman_format_code_t format, void *pixels,
 			       uint32_t x, uint32_t y,
 			       uint32_t width, uint32_t height);
+	/* Optional.  Like read_pixels(), but only starts the read and
+	 * calls func from a later repaint of the output once the pixels
+	 * are in, instead of waiting for rendering to finish.  Returns
+	 * -1 if the read can't be done asynchronously, func is not
+	 * called then. */
+	int (*read_pixels_async)(struct weston_output *output,
+				 pixman_format_code_t format,
+				 uint32_t x, uint32_t y,
+				 uint32_t width, uint32_t height,
+				 weston_read_pixels_func_t func, void *data);
+	/* Optional.  Returns the output's framebuffer if the renderer
+	 * keeps it in system memory, in the same orientation that
+	 * read_pixels() reads from, but top-down.  NULL otherwise. */
+	pixman_image_t *(*output_image)(struct weston_output *output);
 	void (*repaint_output)(struct weston_output *output,
 			       pixman_region32_t *output_damage);
 	void (*flush_damage)(struct weston_surface *surface);
@@ -293,6 +376,8 @@ struct weston_compositor {
 
 	struct wl_event_loop *input_loop;
 	struct wl_event_source *input_loop_source;
+	/* Set while an evdev input thread delivers to input_loop. */
+	int threaded_input;
 
 	struct weston_layer fade_layer;
 	struct weston_layer cursor_layer;
@@ -301,6 +386,15 @@ struct weston_compositor {
 	struct wl_list seat_list;
 	struct wl_list layer_list;
 	struct wl_list surface_list;
+	struct weston_pick_index pick_index;
+
+	/* Set whenever a layer or a surface's layer_link changes, so the
+	 * next repaint rebuilds surface_list from layer_list.  Otherwise
+	 * the previous list is reused as is. */
+	int layers_dirty;
+	uint32_t surface_list_rebuilds;
+	uint32_t surface_list_reuses;
+
 	struct wl_list key_binding_list;
 	struct wl_list button_binding_list;
 	struct wl_list axis_binding_list;
@@ -318,9 +412,6 @@ struct weston_compositor {
 	int idle_time;			/* effective timeout, s */
 
 	/* Repaint state. */
-	struct wl_array vertices;
-	struct wl_array indices; /* only used in compositor-wayland */
-	struct wl_array vtxcnt;
 	struct weston_plane primary_plane;
 	int fan_debug;
 
@@ -380,6 +471,15 @@ struct weston_region {
  * transformation in global coordinates, add it to the tail of the list.
  */
 
+/* Rates are decayed exponentially, so they follow changes in what a
+ * client does within about a second. */
+struct weston_surface_stats {
+	float commit_rate;	/* commits per second */
+	float damage_rate;	/* damaged pixels per second */
+	uint32_t last_commit;	/* msecs */
+	uint32_t commits;	/* since the surface was created */
+};
+
 struct weston_surface {
 	struct wl_surface surface;
 	struct weston_compositor *compositor;
@@ -391,6 +491,14 @@ struct weston_surface {
 	struct wl_list layer_link;
 	float alpha;
 	struct weston_plane *plane;
+	/* Bit output->id is set during the repaint of output if nothing
+	 * of the surface shows on it.  occluded is set if the surface is
+	 * hidden on every output it is on. */
+	uint32_t occluded_mask;
+	int occluded;
+
+	/* As of the last commit, see weston_surface_get_stats(). */
+	struct weston_surface_stats stats;
 
 	void *renderer_state;
 
@@ -559,6 +667,8 @@ notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
 
 void
 weston_layer_init(struct weston_layer *layer, struct wl_list *below);
+void
+weston_compositor_mark_layers_dirty(struct weston_compositor *compositor);
 
 void
 weston_plane_init(struct weston_plane *plane, int32_t x, int32_t y);
@@ -566,7 +676,10 @@ void
 weston_plane_release(struct weston_plane *plane);
 
 void
-weston_output_finish_frame(struct weston_output *output, uint32_t msecs);
+weston_output_finish_frame(struct weston_output *output, uint64_t usecs);
+void
+weston_output_timing_mark(struct weston_output *output,
+			  enum weston_repaint_phase phase);
 void
 weston_output_schedule_repaint(struct weston_output *output);
 void
@@ -671,6 +784,15 @@ weston_surface_set_position(struct weston_surface *surface,
 int
 weston_surface_is_mapped(struct weston_surface *surface);
 
+void
+weston_surface_get_stats(struct weston_surface *surface, uint32_t msecs,
+			 struct weston_surface_stats *stats);
+float
+weston_surface_get_commit_rate(struct weston_surface *surface,
+			       uint32_t msecs);
+void
+weston_compositor_log_surface_stats(struct weston_compositor *compositor);
+
 void
 weston_surface_schedule_repaint(struct weston_surface *surface);
 
@@ -695,6 +817,14 @@ weston_buffer_reference(struct weston_buffer_reference *ref,
 
 uint32_t
 weston_compositor_get_time(void);
+uint64_t
+weston_compositor_get_time_usec(void);
+void
+weston_compositor_note_input(struct weston_compositor *compositor,
+			     uint64_t usecs);
+void
+weston_compositor_note_input_stamps(struct weston_compositor *compositor,
+				    const struct weston_input_stamps *stamps);
 
 int
 weston_compositor_init(struct weston_compositor *ec, struct wl_display *display,
@@ -765,7 +895,7 @@ int
 tty_activate_vt(struct tty *tty, int vt);
 
 void
-screenshooter_create(struct weston_compositor *ec);
+screenshooter_create(struct weston_compositor *ec, const char *config_file);
 
 struct clipboard *
 clipboard_create(struct weston_seat *seat);
@@ -0,0 +1,324 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "drm-plane-assign.h"
+
+/* A surface that is not committing still gets recomposited whenever
+ * something around it changes; count that as one repaint a second. */
+#define IDLE_RATE		1.0f
+
+/* Give up looking for a better assignment after this many steps and
+ * keep the best one found so far. */
+#define SEARCH_LIMIT		4096
+
+/* Stacking order of the planes.  Scanout replaces the primary plane, the
+ * cursor is always on top.  Overlays have no defined order among each
+ * other, so they must not overlap. */
+static const int plane_z[DRM_PLANE_KIND_COUNT] = {
+	[DRM_PLANE_PRIMARY] = 0,
+	[DRM_PLANE_SCANOUT] = 0,
+	[DRM_PLANE_OVERLAY] = 1,
+	[DRM_PLANE_CURSOR] = 2,
+};
+
+static uint64_t
+box_area(const struct drm_plane_box *a, const struct drm_plane_box *b)
+{
+	int32_t x1, y1, x2, y2;
+
+	x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+	y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+	x2 = a->x2 < b->x2 ? a->x2 : b->x2;
+	y2 = a->y2 < b->y2 ? a->y2 : b->y2;
+
+	if (x1 >= x2 || y1 >= y2)
+		return 0;
+
+	return (uint64_t) (x2 - x1) * (y2 - y1);
+}
+
+/* Bytes per second of composition the plane saves.  On the primary
+ * plane, every repaint of the surface reads it and writes the
+ * framebuffer, and blending also reads what is underneath.  Scanout
+ * saves composing the whole output. */
+uint64_t
+drm_plane_score(const struct drm_plane_layout *layout,
+		const struct drm_plane_candidate *candidate,
+		enum drm_plane_kind kind)
+{
+	uint64_t area, bytes, millihz;
+
+	switch (kind) {
+	case DRM_PLANE_SCANOUT:
+		area = box_area(&layout->output, &layout->output);
+		bytes = area * 4 * 2;
+		break;
+	case DRM_PLANE_OVERLAY:
+	case DRM_PLANE_CURSOR:
+		area = box_area(&candidate->box, &layout->output);
+		bytes = area * 4 * (candidate->opaque ? 2 : 3);
+		break;
+	default:
+		return 0;
+	}
+
+	millihz = (candidate->commit_rate + IDLE_RATE) * 1000.0f;
+
+	return bytes * millihz / 1000;
+}
+
+/* With more free planes of a kind than this, the estimate of what the
+ * rest of the stack can still save just adds up all of it. */
+#define TOP_MAX			8
+
+struct assign_state {
+	const struct drm_plane_layout *layout;
+	struct drm_plane_candidate *candidates;
+	int count;
+
+	enum drm_plane_kind *current;
+	uint64_t *scores;
+	int used[DRM_PLANE_KIND_COUNT];
+
+	int found;
+	uint64_t best;
+	int steps;
+};
+
+static int
+boxes_overlap(const struct drm_plane_box *a, const struct drm_plane_box *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+		a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static int
+placement_allowed(struct assign_state *state, int i, enum drm_plane_kind kind)
+{
+	const struct drm_plane_candidate *c = &state->candidates[i];
+	int j;
+
+	if (kind == DRM_PLANE_PRIMARY)
+		return 1;
+
+	/* Nothing below a scanout surface is visible, and the primary
+	 * plane is not composited at all. */
+	if (state->used[DRM_PLANE_SCANOUT] > 0)
+		return 0;
+
+	if (state->used[kind] >= state->layout->count[kind])
+		return 0;
+
+	/* Everything above that overlaps must be on a higher plane. */
+	for (j = 0; j < i; j++)
+		if (plane_z[state->current[j]] <= plane_z[kind] &&
+		    boxes_overlap(&state->candidates[j].box, &c->box))
+			return 0;
+
+	return 1;
+}
+
+/* The most candidates i and below could still add, counting only the
+ * best scores that fit in the free planes of each kind but ignoring
+ * stacking.  threshold[kind] is the lowest of those scores, a candidate
+ * scoring less would be better off leaving the plane to another. */
+static uint64_t
+suffix_bound(struct assign_state *state, int i,
+	     uint64_t threshold[DRM_PLANE_KIND_COUNT])
+{
+	struct drm_plane_candidate *c;
+	uint64_t top[TOP_MAX], bound = 0, s;
+	int j, k, l, n, avail;
+
+	for (j = i; j < state->count; j++)
+		if (state->candidates[j].fixed)
+			bound += state->scores[j * DRM_PLANE_KIND_COUNT +
+					       state->candidates[j].assigned];
+
+	for (k = DRM_PLANE_PRIMARY + 1; k < DRM_PLANE_KIND_COUNT; k++) {
+		threshold[k] = 0;
+		avail = state->layout->count[k] - state->used[k];
+		if (state->used[DRM_PLANE_SCANOUT] > 0 || avail <= 0)
+			continue;
+
+		n = 0;
+		for (j = i; j < state->count; j++) {
+			c = &state->candidates[j];
+			if (c->fixed || !(c->kinds & DRM_PLANE_KIND_BIT(k)))
+				continue;
+
+			s = state->scores[j * DRM_PLANE_KIND_COUNT + k];
+			if (avail > TOP_MAX) {
+				bound += s;
+				continue;
+			}
+			if (n == avail && s <= top[n - 1])
+				continue;
+			if (n < avail)
+				n++;
+			for (l = n - 1; l > 0 && top[l - 1] < s; l--)
+				top[l] = top[l - 1];
+			top[l] = s;
+		}
+
+		if (avail <= TOP_MAX) {
+			for (l = 0; l < n; l++)
+				bound += top[l];
+			if (n == avail)
+				threshold[k] = top[n - 1];
+		}
+	}
+
+	return bound;
+}
+
+static void
+insert_kind(enum drm_plane_kind *kinds, int n, const uint64_t *scores,
+	    enum drm_plane_kind kind)
+{
+	for (; n > 0 && scores[kinds[n - 1]] < scores[kind]; n--)
+		kinds[n] = kinds[n - 1];
+	kinds[n] = kind;
+}
+
+static void
+search(struct assign_state *state, int i, uint64_t score);
+
+static void
+search_place(struct assign_state *state, int i, uint64_t score,
+	     enum drm_plane_kind kind)
+{
+	if (!placement_allowed(state, i, kind))
+		return;
+
+	state->current[i] = kind;
+	state->used[kind]++;
+	search(state, i + 1,
+	       score + state->scores[i * DRM_PLANE_KIND_COUNT + kind]);
+	state->used[kind]--;
+}
+
+/* Depth first over the candidates from the top of the stack down.
+ * Planes a candidate is among the best for are tried first, then the
+ * primary plane, then the rest, so without conflicts in the stacking
+ * the first complete assignment is already the best one. */
+static void
+search(struct assign_state *state, int i, uint64_t score)
+{
+	struct drm_plane_candidate *c;
+	uint64_t *scores, bound, threshold[DRM_PLANE_KIND_COUNT];
+	enum drm_plane_kind order[DRM_PLANE_KIND_COUNT];
+	enum drm_plane_kind later[DRM_PLANE_KIND_COUNT];
+	int j, k, good, rest;
+
+	if (i == state->count) {
+		if (state->found && score <= state->best)
+			return;
+		for (j = 0; j < state->count; j++)
+			state->candidates[j].assigned = state->current[j];
+		state->best = score;
+		state->found = 1;
+		return;
+	}
+
+	/* Most surfaces cannot go on any plane, no choice to make. */
+	c = &state->candidates[i];
+	if (!c->fixed && c->kinds == 0) {
+		search_place(state, i, score, DRM_PLANE_PRIMARY);
+		return;
+	}
+
+	bound = suffix_bound(state, i, threshold);
+	if (state->found &&
+	    (state->steps >= SEARCH_LIMIT || score + bound <= state->best))
+		return;
+	state->steps++;
+
+	if (c->fixed) {
+		search_place(state, i, score, c->assigned);
+		return;
+	}
+
+	scores = &state->scores[i * DRM_PLANE_KIND_COUNT];
+	good = 0;
+	rest = 0;
+	for (k = DRM_PLANE_PRIMARY + 1; k < DRM_PLANE_KIND_COUNT; k++) {
+		if (!(c->kinds & DRM_PLANE_KIND_BIT(k)))
+			continue;
+		if (scores[k] >= threshold[k])
+			insert_kind(order, good++, scores, k);
+		else
+			insert_kind(later, rest++, scores, k);
+	}
+
+	for (j = 0; j < good; j++)
+		search_place(state, i, score, order[j]);
+	search_place(state, i, score, DRM_PLANE_PRIMARY);
+	for (j = 0; j < rest; j++)
+		search_place(state, i, score, later[j]);
+}
+
+/* Picks a plane for every candidate that is not fixed, maximizing the
+ * sum of drm_plane_score().  The candidates are in stacking order, top
+ * first.  Returns the score of the assignment. */
+uint64_t
+drm_plane_assign(const struct drm_plane_layout *layout,
+		 struct drm_plane_candidate *candidates, int count)
+{
+	struct assign_state state;
+	int i, k;
+
+	memset(&state, 0, sizeof state);
+	state.layout = layout;
+	state.candidates = candidates;
+	state.count = count;
+
+	if (count > 0) {
+		state.current = malloc(count * sizeof *state.current);
+		state.scores = malloc(count * DRM_PLANE_KIND_COUNT *
+				      sizeof *state.scores);
+		if (!state.current || !state.scores)
+			goto out;
+
+		for (i = 0; i < count; i++)
+			for (k = 0; k < DRM_PLANE_KIND_COUNT; k++)
+				state.scores[i * DRM_PLANE_KIND_COUNT + k] =
+					drm_plane_score(layout,
+							&candidates[i], k);
+	}
+
+	search(&state, 0, 0);
+
+out:
+	if (!state.found)
+		for (i = 0; i < count; i++)
+			if (!candidates[i].fixed)
+				candidates[i].assigned = DRM_PLANE_PRIMARY;
+
+	free(state.current);
+	free(state.scores);
+
+	return state.best;
+}
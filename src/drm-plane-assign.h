@@ -0,0 +1,76 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _DRM_PLANE_ASSIGN_H_
+#define _DRM_PLANE_ASSIGN_H_
+
+#include <stdint.h>
+
+/* Decides which surfaces of an output go on hardware planes.  This only
+ * sees a description of the planes and surfaces, not KMS objects, so it
+ * can be tested and benchmarked without a DRM device. */
+
+enum drm_plane_kind {
+	DRM_PLANE_PRIMARY,	/* composited by the renderer */
+	DRM_PLANE_SCANOUT,	/* the surface buffer is the framebuffer */
+	DRM_PLANE_OVERLAY,
+	DRM_PLANE_CURSOR,
+	DRM_PLANE_KIND_COUNT
+};
+
+#define DRM_PLANE_KIND_BIT(kind) (1u << (kind))
+
+struct drm_plane_box {
+	int32_t x1, y1, x2, y2;
+};
+
+struct drm_plane_layout {
+	struct drm_plane_box output;
+	/* Free planes of each kind, the primary plane is never counted. */
+	int count[DRM_PLANE_KIND_COUNT];
+};
+
+struct drm_plane_candidate {
+	/* Bounding box in the same space as the output box. */
+	struct drm_plane_box box;
+	/* DRM_PLANE_KIND_BIT()s the surface could be put on, apart from
+	 * the primary plane, which is always possible. */
+	uint32_t kinds;
+	int opaque;
+	/* Commits per second, see weston_surface_get_stats(). */
+	float commit_rate;
+	/* If set, the candidate keeps the plane in assigned. */
+	int fixed;
+	enum drm_plane_kind assigned;
+	void *data;
+};
+
+uint64_t
+drm_plane_score(const struct drm_plane_layout *layout,
+		const struct drm_plane_candidate *candidate,
+		enum drm_plane_kind kind);
+
+uint64_t
+drm_plane_assign(const struct drm_plane_layout *layout,
+		 struct drm_plane_candidate *candidates, int count);
+
+#endif
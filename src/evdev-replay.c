@@ -0,0 +1,372 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Plays a recording made with --record-input back through the evdev
+ * code, as a repeatable input workload.  Event timestamps keep their
+ * recorded spacing at any speed, so the pointer acceleration sees the
+ * same input and the pointer takes the same path every time. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "compositor.h"
+#include "evdev.h"
+#include "evdev-trace.h"
+
+/* When replaying as fast as possible, give the compositor a chance to
+ * repaint after this long. */
+#define SLICE_USECS		4000
+
+struct evdev_replay {
+	struct weston_seat *seat;
+	struct evdev_trace_reader *reader;
+	struct wl_event_source *timer;
+	struct wl_event_source *idle;
+	int speed;
+	FILE *trajectory;
+
+	struct wl_list devices;
+	struct wl_array by_id;
+
+	struct evdev_trace_chunk chunk;
+	int have_chunk;
+
+	int started;
+	uint64_t first_usecs;	/* recorded time of the first event */
+	uint64_t start_usecs;	/* when we replayed it */
+	wl_fixed_t x, y;
+
+	uint32_t nevents, nchunks, ndevices;
+	uint64_t busy_nsecs;
+	uint64_t worst_nsecs;	/* per event, in the slowest chunk */
+};
+
+static uint64_t
+get_nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t
+event_usecs(const struct input_event *e)
+{
+	return (uint64_t) e->time.tv_sec * 1000000 + e->time.tv_usec;
+}
+
+/* The recorder numbers devices from 0 in the order it writes them, so
+ * a device chunk names at most the next id.  Anything else is a broken
+ * recording, and must not make us allocate a table for it. */
+static void
+replay_add_device(struct evdev_replay *replay,
+		  const struct evdev_trace_chunk *chunk)
+{
+	struct evdev_device *device, **slot;
+	size_t count = replay->by_id.size / sizeof *slot;
+
+	if (chunk->device > count ||
+	    (chunk->device < count &&
+	     ((struct evdev_device **) replay->by_id.data)[chunk->device])) {
+		weston_log("replay: unexpected device %u\n", chunk->device);
+		return;
+	}
+
+	if (chunk->device == count) {
+		slot = wl_array_add(&replay->by_id, sizeof *slot);
+		if (slot == NULL)
+			return;
+		*slot = NULL;
+	}
+
+	device = evdev_device_create_replay(replay->seat, &chunk->desc);
+	if (device == NULL) {
+		weston_log("replay: failed to create device %u (%s)\n",
+			   chunk->device, chunk->desc.name);
+		return;
+	}
+	wl_list_insert(replay->devices.prev, &device->link);
+	replay->ndevices++;
+
+	slot = replay->by_id.data;
+	slot[chunk->device] = device;
+}
+
+static struct evdev_device *
+replay_get_device(struct evdev_replay *replay, uint32_t id)
+{
+	struct evdev_device **slot = replay->by_id.data;
+
+	if (id >= replay->by_id.size / sizeof *slot)
+		return NULL;
+
+	return slot[id];
+}
+
+static void
+replay_chunk(struct evdev_replay *replay, struct evdev_trace_chunk *chunk)
+{
+	struct evdev_device *device;
+	struct wl_pointer *pointer;
+	uint64_t usecs, start, elapsed;
+	int i;
+
+	device = replay_get_device(replay, chunk->device);
+	if (device == NULL)
+		return;
+
+	/* Move the recording to the compositor's clock. */
+	for (i = 0; i < chunk->count; i++) {
+		usecs = event_usecs(&chunk->events[i]) -
+			replay->first_usecs + replay->start_usecs;
+		chunk->events[i].time.tv_sec = usecs / 1000000;
+		chunk->events[i].time.tv_usec = usecs % 1000000;
+	}
+
+	start = get_nsecs();
+	evdev_device_replay(device, chunk->events, chunk->count);
+	elapsed = get_nsecs() - start;
+
+	replay->nevents += chunk->count;
+	replay->nchunks++;
+	replay->busy_nsecs += elapsed;
+	if (elapsed / chunk->count > replay->worst_nsecs)
+		replay->worst_nsecs = elapsed / chunk->count;
+
+	pointer = replay->seat->seat.pointer;
+	if (!replay->trajectory || !pointer ||
+	    (pointer->x == replay->x && pointer->y == replay->y))
+		return;
+
+	replay->x = pointer->x;
+	replay->y = pointer->y;
+	fprintf(replay->trajectory, "%llu %.2f %.2f\n",
+		(unsigned long long)
+		(event_usecs(&chunk->events[chunk->count - 1]) -
+		 replay->start_usecs),
+		wl_fixed_to_double(pointer->x),
+		wl_fixed_to_double(pointer->y));
+}
+
+static void
+replay_finish(struct evdev_replay *replay)
+{
+	struct wl_pointer *pointer = replay->seat->seat.pointer;
+
+	weston_log("replay: %u events in %u chunks from %u devices\n",
+		   replay->nevents, replay->nchunks, replay->ndevices);
+	if (replay->nevents > 0)
+		weston_log_continue(STAMP_SPACE "%.3f us per event, "
+				    "%.3f us per event in the slowest chunk\n",
+				    replay->busy_nsecs / 1000.0 /
+				    replay->nevents,
+				    replay->worst_nsecs / 1000.0);
+	if (pointer)
+		weston_log_continue(STAMP_SPACE "pointer ended at %.2f, %.2f\n",
+				    wl_fixed_to_double(pointer->x),
+				    wl_fixed_to_double(pointer->y));
+
+	if (replay->trajectory)
+		fflush(replay->trajectory);
+
+	wl_display_terminate(replay->seat->compositor->wl_display);
+}
+
+static void
+replay_idle(void *data);
+
+static void
+replay_schedule(struct evdev_replay *replay, uint32_t msecs)
+{
+	struct wl_event_loop *loop;
+
+	if (msecs > 0) {
+		wl_event_source_timer_update(replay->timer, msecs);
+		return;
+	}
+
+	loop = wl_display_get_event_loop(replay->seat->compositor->wl_display);
+	replay->idle = wl_event_loop_add_idle(loop, replay_idle, replay);
+}
+
+/* Replays everything that is due, then waits for the next chunk. */
+static void
+replay_run(struct evdev_replay *replay)
+{
+	struct evdev_trace_chunk *chunk = &replay->chunk;
+	uint64_t now, due, slice, usecs;
+	int ret;
+
+	slice = weston_compositor_get_time_usec();
+
+	while (1) {
+		if (!replay->have_chunk) {
+			ret = evdev_trace_read(replay->reader, chunk);
+			if (ret < 0)
+				weston_log("replay: broken recording\n");
+			if (ret <= 0) {
+				replay_finish(replay);
+				return;
+			}
+			if (chunk->type == EVDEV_TRACE_DEVICE) {
+				replay_add_device(replay, chunk);
+				continue;
+			}
+			if (chunk->count == 0)
+				continue;
+			replay->have_chunk = 1;
+		}
+
+		now = weston_compositor_get_time_usec();
+		if (!replay->started) {
+			replay->first_usecs = event_usecs(&chunk->events[0]);
+			replay->start_usecs = now;
+			replay->started = 1;
+		}
+
+		/* Chunks are written as devices are read, so one may start
+		 * a little before the first one. */
+		usecs = event_usecs(&chunk->events[0]);
+		if (usecs < replay->first_usecs)
+			usecs = replay->first_usecs;
+
+		if (replay->speed > 0) {
+			due = replay->start_usecs +
+				(usecs - replay->first_usecs) / replay->speed;
+			if (due > now) {
+				replay_schedule(replay,
+						(due - now + 999) / 1000);
+				return;
+			}
+		} else if (now - slice > SLICE_USECS) {
+			replay_schedule(replay, 0);
+			return;
+		}
+
+		replay_chunk(replay, chunk);
+		replay->have_chunk = 0;
+	}
+}
+
+static int
+replay_timer(void *data)
+{
+	struct evdev_replay *replay = data;
+
+	replay_run(replay);
+
+	return 1;
+}
+
+static void
+replay_idle(void *data)
+{
+	struct evdev_replay *replay = data;
+
+	replay->idle = NULL;
+	replay_run(replay);
+}
+
+/* speed is a multiple of the recorded speed, 0 replays as fast as
+ * possible.  If trajectory is set, the pointer position is written to
+ * it after every chunk of events that moved it. */
+struct evdev_replay *
+evdev_replay_create(struct weston_seat *seat, const char *filename,
+		    int speed, const char *trajectory)
+{
+	struct evdev_replay *replay;
+	struct wl_event_loop *loop;
+
+	replay = malloc(sizeof *replay);
+	if (replay == NULL)
+		return NULL;
+	memset(replay, 0, sizeof *replay);
+
+	replay->seat = seat;
+	replay->speed = speed;
+	wl_list_init(&replay->devices);
+	wl_array_init(&replay->by_id);
+
+	replay->reader = evdev_trace_reader_open(filename);
+	if (replay->reader == NULL) {
+		weston_log("replay: failed to open recording %s\n", filename);
+		goto err_free;
+	}
+
+	if (trajectory) {
+		replay->trajectory = fopen(trajectory, "we");
+		if (replay->trajectory == NULL) {
+			weston_log("replay: failed to open %s: %m\n",
+				   trajectory);
+			goto err_reader;
+		}
+	}
+
+	loop = wl_display_get_event_loop(seat->compositor->wl_display);
+	replay->timer = wl_event_loop_add_timer(loop, replay_timer, replay);
+	if (replay->timer == NULL)
+		goto err_trajectory;
+
+	if (speed > 0)
+		weston_log("replaying input from %s at %dx recorded speed\n",
+			   filename, speed);
+	else
+		weston_log("replaying input from %s as fast as possible\n",
+			   filename);
+
+	replay_schedule(replay, 0);
+
+	return replay;
+
+err_trajectory:
+	if (replay->trajectory)
+		fclose(replay->trajectory);
+err_reader:
+	evdev_trace_reader_close(replay->reader);
+err_free:
+	wl_array_release(&replay->by_id);
+	free(replay);
+	return NULL;
+}
+
+void
+evdev_replay_destroy(struct evdev_replay *replay)
+{
+	struct evdev_device *device, *next;
+
+	if (replay->idle)
+		wl_event_source_remove(replay->idle);
+	wl_event_source_remove(replay->timer);
+
+	wl_list_for_each_safe(device, next, &replay->devices, link)
+		evdev_device_destroy(device);
+
+	if (replay->trajectory)
+		fclose(replay->trajectory);
+	evdev_trace_reader_close(replay->reader);
+	wl_array_release(&replay->by_id);
+	free(replay);
+}
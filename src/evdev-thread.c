@@ -0,0 +1,437 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Reads evdev devices on a thread of its own, so input is picked up and
+ * filtered while the compositor is busy repainting.  The thread runs the
+ * evdev and touchpad code on its own event loop and queues what would
+ * have been notify_*() calls in a ring, which the compositor drains from
+ * its input loop.  The ring has a single producer and a single consumer
+ * and needs no lock; the mutex only keeps the thread from dispatching
+ * while the compositor adds or removes devices. */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "compositor.h"
+#include "evdev.h"
+
+/* Must be a power of two. */
+#define RING_SIZE	1024
+
+struct evdev_input_thread {
+	struct weston_compositor *compositor;
+	struct wl_event_loop *loop;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+
+	/* Written by the compositor to stop the thread. */
+	int quit_fd[2];
+	/* Written by the thread when the ring was empty, read from the
+	 * compositor's input loop. */
+	int wake_fd[2];
+	struct wl_event_source *wake_source;
+	volatile int wake_pending;
+
+	struct evdev_record ring[RING_SIZE];
+	volatile uint32_t head;		/* next slot the thread writes */
+	volatile uint32_t tail;		/* next slot the compositor reads */
+
+	/* Input timestamps for the latency statistics don't go through
+	 * the ring.  The thread sums them up in input and hands them over
+	 * in input_shared, one batch at a time, after the records they
+	 * belong to. */
+	struct weston_input_stamps input;
+	struct weston_input_stamps input_shared;
+	volatile int input_ready;
+
+	/* Only touched by the thread.  Relative motion is summed up in
+	 * motion until something else comes along, and what does not fit
+	 * in the ring waits in backlog. */
+	struct evdev_record motion;
+	int motion_pending;
+	struct wl_array backlog;
+	int published;
+};
+
+static int
+ring_put(struct evdev_input_thread *thread, const struct evdev_record *record)
+{
+	uint32_t head = thread->head;
+
+	if (head - thread->tail == RING_SIZE)
+		return -1;
+
+	/* Don't write the slot before the compositor is done reading it. */
+	__sync_synchronize();
+	thread->ring[head & (RING_SIZE - 1)] = *record;
+	__sync_synchronize();
+	thread->head = head + 1;
+	thread->published = 1;
+
+	return 0;
+}
+
+static int
+ring_get(struct evdev_input_thread *thread, struct evdev_record *record)
+{
+	uint32_t tail = thread->tail;
+
+	if (tail == thread->head)
+		return -1;
+
+	__sync_synchronize();
+	*record = thread->ring[tail & (RING_SIZE - 1)];
+	__sync_synchronize();
+	thread->tail = tail + 1;
+
+	return 0;
+}
+
+static void
+queue_record(struct evdev_input_thread *thread,
+	     const struct evdev_record *record)
+{
+	struct evdev_record *r;
+
+	if (thread->backlog.size == 0 && ring_put(thread, record) == 0)
+		return;
+
+	r = wl_array_add(&thread->backlog, sizeof *r);
+	if (r)
+		*r = *record;
+}
+
+static void
+flush_motion(struct evdev_input_thread *thread)
+{
+	if (!thread->motion_pending)
+		return;
+
+	queue_record(thread, &thread->motion);
+	thread->motion_pending = 0;
+}
+
+/* Called from the evdev code on the input thread. */
+void
+evdev_input_thread_push(struct evdev_input_thread *thread,
+			const struct evdev_record *record)
+{
+	switch (record->type) {
+	case EVDEV_RECORD_MOTION:
+		if (thread->motion_pending &&
+		    thread->motion.seat == record->seat) {
+			thread->motion.time = record->time;
+			thread->motion.x += record->x;
+			thread->motion.y += record->y;
+			return;
+		}
+		flush_motion(thread);
+		thread->motion = *record;
+		thread->motion_pending = 1;
+		return;
+	case EVDEV_RECORD_INPUT:
+		if (thread->input.count == 0 ||
+		    record->usecs < thread->input.oldest)
+			thread->input.oldest = record->usecs;
+		if (thread->input.count == 0 ||
+		    record->usecs > thread->input.newest)
+			thread->input.newest = record->usecs;
+		thread->input.sum += record->usecs;
+		thread->input.count++;
+		return;
+	default:
+		flush_motion(thread);
+		break;
+	}
+
+	queue_record(thread, record);
+}
+
+/* Moves what waits in the backlog to the ring, hands over the input
+ * timestamps once the compositor took the last batch and everything
+ * they belong to is in the ring, and wakes the compositor if it was
+ * given anything new. */
+static void
+publish(struct evdev_input_thread *thread)
+{
+	struct evdev_record *r, *end;
+	char byte = 0;
+	size_t n;
+
+	flush_motion(thread);
+
+	r = thread->backlog.data;
+	end = (struct evdev_record *)
+		((char *) thread->backlog.data + thread->backlog.size);
+	for (; r < end; r++)
+		if (ring_put(thread, r) < 0)
+			break;
+
+	n = (char *) end - (char *) r;
+	memmove(thread->backlog.data, r, n);
+	thread->backlog.size = n;
+
+	if (thread->input.count > 0 && thread->backlog.size == 0 &&
+	    !thread->input_ready) {
+		__sync_synchronize();
+		thread->input_shared = thread->input;
+		__sync_synchronize();
+		thread->input_ready = 1;
+		memset(&thread->input, 0, sizeof thread->input);
+		thread->published = 1;
+	}
+
+	if (!thread->published)
+		return;
+	thread->published = 0;
+
+	__sync_synchronize();
+	if (__sync_lock_test_and_set(&thread->wake_pending, 1) == 0)
+		if (write(thread->wake_fd[1], &byte, 1) < 0)
+			thread->wake_pending = 0;
+}
+
+static void *
+input_thread_main(void *data)
+{
+	struct evdev_input_thread *thread = data;
+	struct pollfd fds[2];
+	int timeout;
+
+	fds[0].fd = wl_event_loop_get_fd(thread->loop);
+	fds[0].events = POLLIN;
+	fds[1].fd = thread->quit_fd[0];
+	fds[1].events = POLLIN;
+
+	while (1) {
+		/* With a full ring or timestamps the compositor can't take
+		 * yet, check back soon whether it caught up. */
+		timeout = thread->backlog.size > 0 ||
+			thread->input.count > 0 ? 1 : -1;
+		if (poll(fds, ARRAY_LENGTH(fds), timeout) < 0 &&
+		    errno != EINTR)
+			break;
+		if (fds[1].revents)
+			break;
+
+		pthread_mutex_lock(&thread->mutex);
+		wl_event_loop_dispatch(thread->loop, 0);
+		pthread_mutex_unlock(&thread->mutex);
+
+		publish(thread);
+	}
+
+	return NULL;
+}
+
+/* Absolute devices are mapped to the first output, like
+ * evdev_device_create() does. */
+static struct weston_output *
+record_output(struct evdev_record *r)
+{
+	struct wl_list *outputs = &r->seat->compositor->output_list;
+
+	if (wl_list_empty(outputs))
+		return NULL;
+
+	return container_of(outputs->next, struct weston_output, link);
+}
+
+static void
+deliver_record(struct evdev_record *r)
+{
+	struct weston_seat *seat = r->seat;
+	struct weston_output *output;
+	wl_fixed_t x = 0, y = 0;
+
+	switch (r->type) {
+	case EVDEV_RECORD_MOTION:
+		notify_motion(seat, r->time,
+			      seat->seat.pointer->x + r->x,
+			      seat->seat.pointer->y + r->y);
+		break;
+	case EVDEV_RECORD_MOTION_ABSOLUTE:
+		output = record_output(r);
+		if (!output)
+			break;
+		evdev_absolute_to_output(&r->abs, output, &x, &y);
+		notify_motion(seat, r->time, x, y);
+		break;
+	case EVDEV_RECORD_BUTTON:
+		notify_button(seat, r->time, r->code, r->state);
+		break;
+	case EVDEV_RECORD_KEY:
+		notify_key(seat, r->time, r->code, r->state,
+			   STATE_UPDATE_AUTOMATIC);
+		break;
+	case EVDEV_RECORD_AXIS:
+		notify_axis(seat, r->time, r->code, r->x);
+		break;
+	case EVDEV_RECORD_TOUCH:
+		if (r->state != WL_TOUCH_UP) {
+			output = record_output(r);
+			if (!output)
+				break;
+			evdev_absolute_to_output(&r->abs, output, &x, &y);
+		}
+		notify_touch(seat, r->time, r->slot, x, y, r->state);
+		break;
+	case EVDEV_RECORD_INPUT:
+		/* Never queued, see publish(). */
+		break;
+	}
+}
+
+static int
+input_thread_wake(int fd, uint32_t mask, void *data)
+{
+	struct evdev_input_thread *thread = data;
+	struct evdev_record record;
+	struct weston_input_stamps input;
+	char buf[16];
+
+	while (read(fd, buf, sizeof buf) > 0)
+		;
+
+	/* Clear the flag before looking at the ring, so a record published
+	 * after we looked always writes the pipe again. */
+	thread->wake_pending = 0;
+	__sync_synchronize();
+
+	while (ring_get(thread, &record) == 0)
+		deliver_record(&record);
+
+	if (thread->input_ready) {
+		__sync_synchronize();
+		input = thread->input_shared;
+		__sync_synchronize();
+		thread->input_ready = 0;
+		weston_compositor_note_input_stamps(thread->compositor,
+						    &input);
+	}
+
+	return 1;
+}
+
+struct wl_event_loop *
+evdev_input_thread_get_loop(struct evdev_input_thread *thread)
+{
+	return thread->loop;
+}
+
+void
+evdev_input_thread_lock(struct evdev_input_thread *thread)
+{
+	pthread_mutex_lock(&thread->mutex);
+}
+
+void
+evdev_input_thread_unlock(struct evdev_input_thread *thread)
+{
+	pthread_mutex_unlock(&thread->mutex);
+}
+
+struct evdev_input_thread *
+evdev_input_thread_create(struct weston_compositor *compositor)
+{
+	struct evdev_input_thread *thread;
+
+	thread = malloc(sizeof *thread);
+	if (thread == NULL)
+		return NULL;
+	memset(thread, 0, sizeof *thread);
+
+	thread->compositor = compositor;
+	wl_array_init(&thread->backlog);
+	pthread_mutex_init(&thread->mutex, NULL);
+
+	thread->loop = wl_event_loop_create();
+	if (thread->loop == NULL)
+		goto err_free;
+
+	if (pipe2(thread->quit_fd, O_CLOEXEC) < 0)
+		goto err_loop;
+	if (pipe2(thread->wake_fd, O_CLOEXEC | O_NONBLOCK) < 0)
+		goto err_quit;
+
+	thread->wake_source =
+		wl_event_loop_add_fd(compositor->input_loop,
+				     thread->wake_fd[0], WL_EVENT_READABLE,
+				     input_thread_wake, thread);
+	if (thread->wake_source == NULL)
+		goto err_wake;
+
+	if (pthread_create(&thread->thread, NULL,
+			   input_thread_main, thread) != 0)
+		goto err_source;
+
+	compositor->threaded_input = 1;
+	weston_log("reading input on a separate thread\n");
+
+	return thread;
+
+err_source:
+	wl_event_source_remove(thread->wake_source);
+err_wake:
+	close(thread->wake_fd[0]);
+	close(thread->wake_fd[1]);
+err_quit:
+	close(thread->quit_fd[0]);
+	close(thread->quit_fd[1]);
+err_loop:
+	wl_event_loop_destroy(thread->loop);
+err_free:
+	pthread_mutex_destroy(&thread->mutex);
+	free(thread);
+	return NULL;
+}
+
+/* All devices must have been destroyed.  Records still queued are
+ * dropped, their seats may be gone already. */
+void
+evdev_input_thread_destroy(struct evdev_input_thread *thread)
+{
+	char byte = 0;
+
+	if (write(thread->quit_fd[1], &byte, 1) < 0)
+		weston_log("failed to stop input thread: %m\n");
+	else
+		pthread_join(thread->thread, NULL);
+
+	thread->compositor->threaded_input = 0;
+	wl_event_source_remove(thread->wake_source);
+	close(thread->wake_fd[0]);
+	close(thread->wake_fd[1]);
+	close(thread->quit_fd[0]);
+	close(thread->quit_fd[1]);
+	wl_event_loop_destroy(thread->loop);
+	wl_array_release(&thread->backlog);
+	pthread_mutex_destroy(&thread->mutex);
+	free(thread);
+}
@@ -154,16 +154,12 @@ struct touchpad_dispatch {
 static enum touchpad_model
 get_touchpad_model(struct evdev_device *device)
 {
-	struct input_id id;
 	unsigned int i;
 
-	if (ioctl(device->fd, EVIOCGID, &id) < 0)
-		return TOUCHPAD_MODEL_UNKNOWN;
-
 	for (i = 0; i < ARRAY_LENGTH(touchpad_spec_table); i++)
-		if (touchpad_spec_table[i].vendor == id.vendor &&
+		if (touchpad_spec_table[i].vendor == device->id.vendor &&
 		    (!touchpad_spec_table[i].product ||
-		     touchpad_spec_table[i].product == id.product))
+		     touchpad_spec_table[i].product == device->id.product))
 			return touchpad_spec_table[i].model;
 
 	return TOUCHPAD_MODEL_UNKNOWN;
@@ -273,17 +269,17 @@ filter_motion(struct touchpad_dispatch *touchpad,
 static void
 notify_button_pressed(struct touchpad_dispatch *touchpad, uint32_t time)
 {
-	notify_button(touchpad->device->seat, time,
-		      DEFAULT_TOUCHPAD_SINGLE_TAP_BUTTON,
-		      WL_POINTER_BUTTON_STATE_PRESSED);
+	evdev_notify_button(touchpad->device, time,
+			    DEFAULT_TOUCHPAD_SINGLE_TAP_BUTTON,
+			    WL_POINTER_BUTTON_STATE_PRESSED);
 }
 
 static void
 notify_button_released(struct touchpad_dispatch *touchpad, uint32_t time)
 {
-	notify_button(touchpad->device->seat, time,
-		      DEFAULT_TOUCHPAD_SINGLE_TAP_BUTTON,
-		      WL_POINTER_BUTTON_STATE_RELEASED);
+	evdev_notify_button(touchpad->device, time,
+			    DEFAULT_TOUCHPAD_SINGLE_TAP_BUTTON,
+			    WL_POINTER_BUTTON_STATE_RELEASED);
 }
 
 static void
@@ -484,15 +480,15 @@ touchpad_update_state(struct touchpad_dispatch *touchpad, uint32_t time)
 				EVDEV_RELATIVE_MOTION;
 		} else if (touchpad->finger_state == TOUCHPAD_FINGERS_TWO) {
 			if (dx != 0.0)
-				notify_axis(touchpad->device->seat,
-					    time,
-					    WL_POINTER_AXIS_HORIZONTAL_SCROLL,
-					    wl_fixed_from_double(dx));
+				evdev_notify_axis(touchpad->device,
+						  time,
+						  WL_POINTER_AXIS_HORIZONTAL_SCROLL,
+						  wl_fixed_from_double(dx));
 			if (dy != 0.0)
-				notify_axis(touchpad->device->seat,
-					    time,
-					    WL_POINTER_AXIS_VERTICAL_SCROLL,
-					    wl_fixed_from_double(dy));
+				evdev_notify_axis(touchpad->device,
+						  time,
+						  WL_POINTER_AXIS_VERTICAL_SCROLL,
+						  wl_fixed_from_double(dy));
 		}
 	}
 
@@ -578,10 +574,10 @@ process_key(struct touchpad_dispatch *touchpad,
 	case BTN_FORWARD:
 	case BTN_BACK:
 	case BTN_TASK:
-		notify_button(device->seat,
-			      time, e->code,
-			      e->value ? WL_POINTER_BUTTON_STATE_PRESSED :
-			                 WL_POINTER_BUTTON_STATE_RELEASED);
+		evdev_notify_button(device,
+				    time, e->code,
+				    e->value ? WL_POINTER_BUTTON_STATE_PRESSED :
+					       WL_POINTER_BUTTON_STATE_RELEASED);
 		break;
 	case BTN_TOOL_PEN:
 	case BTN_TOOL_RUBBER:
@@ -661,9 +657,6 @@ touchpad_init(struct touchpad_dispatch *touchpad,
 	struct weston_motion_filter *accel;
 	struct wl_event_loop *loop;
 
-	struct input_absinfo absinfo;
-	unsigned long abs_bits[NBITS(ABS_MAX)];
-
 	double width;
 	double height;
 	double diagonal;
@@ -675,13 +668,11 @@ touchpad_init(struct touchpad_dispatch *touchpad,
 	touchpad->model = get_touchpad_model(device);
 
 	/* Configure pressure */
-	ioctl(device->fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits);
-	if (TEST_BIT(abs_bits, ABS_PRESSURE)) {
-		ioctl(device->fd, EVIOCGABS(ABS_PRESSURE), &absinfo);
+	touchpad->has_pressure = 0;
+	if (device->abs.has_pressure)
 		configure_touchpad_pressure(touchpad,
-					    absinfo.minimum,
-					    absinfo.maximum);
-	}
+					    device->abs.min_pressure,
+					    device->abs.max_pressure);
 
 	/* Configure acceleration factor */
 	width = abs(device->abs.max_x - device->abs.min_x);
@@ -721,7 +712,11 @@ touchpad_init(struct touchpad_dispatch *touchpad,
 	wl_array_init(&touchpad->fsm.events);
 	touchpad->fsm.state = FSM_IDLE;
 
-	loop = wl_display_get_event_loop(device->seat->compositor->wl_display);
+	if (device->thread)
+		loop = evdev_input_thread_get_loop(device->thread);
+	else
+		loop = wl_display_get_event_loop(
+			device->seat->compositor->wl_display);
 	touchpad->fsm.timer_source =
 		wl_event_loop_add_timer(loop, fsm_timout_handler, touchpad);
 	if (touchpad->fsm.timer_source == NULL) {
@@ -0,0 +1,273 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "evdev-trace.h"
+
+/* Events are written in chunks of at most this many.  Each chunk goes
+ * out in one fwrite(), so chunks written from different threads don't
+ * interleave. */
+#define CHUNK_EVENTS		64
+
+/* A reader refuses chunks bigger than this. */
+#define MAX_EVENTS		65536
+
+struct evdev_trace_writer {
+	FILE *fp;
+	uint32_t next_device;
+};
+
+struct evdev_trace_reader {
+	FILE *fp;
+	struct input_event *events;
+	int events_size;
+};
+
+static uint64_t
+event_usecs(const struct input_event *e)
+{
+	return (uint64_t) e->time.tv_sec * 1000000 + e->time.tv_usec;
+}
+
+struct evdev_trace_writer *
+evdev_trace_writer_create(const char *filename)
+{
+	struct evdev_trace_writer *writer;
+	struct evdev_trace_header header;
+
+	writer = malloc(sizeof *writer);
+	if (writer == NULL)
+		return NULL;
+
+	writer->fp = fopen(filename, "we");
+	if (writer->fp == NULL) {
+		free(writer);
+		return NULL;
+	}
+
+	writer->next_device = 0;
+
+	header.magic = EVDEV_TRACE_MAGIC;
+	header.version = EVDEV_TRACE_VERSION;
+	if (fwrite(&header, sizeof header, 1, writer->fp) != 1) {
+		fclose(writer->fp);
+		free(writer);
+		return NULL;
+	}
+
+	return writer;
+}
+
+void
+evdev_trace_writer_destroy(struct evdev_trace_writer *writer)
+{
+	fclose(writer->fp);
+	free(writer);
+}
+
+/* Returns the id to write the events of the device with. */
+uint32_t
+evdev_trace_write_device(struct evdev_trace_writer *writer,
+			 const struct evdev_trace_device *device)
+{
+	struct evdev_trace_chunk_header header;
+	char buffer[sizeof header + sizeof *device];
+
+	header.type = EVDEV_TRACE_DEVICE;
+	header.device = writer->next_device++;
+	header.size = sizeof *device;
+
+	memcpy(buffer, &header, sizeof header);
+	memcpy(buffer + sizeof header, device, sizeof *device);
+	fwrite(buffer, sizeof buffer, 1, writer->fp);
+
+	return header.device;
+}
+
+int
+evdev_trace_write_events(struct evdev_trace_writer *writer, uint32_t device,
+			 const struct input_event *events, int count)
+{
+	struct evdev_trace_chunk_header header;
+	struct evdev_trace_events chunk;
+	struct evdev_trace_event event[CHUNK_EVENTS];
+	char buffer[sizeof header + sizeof chunk + sizeof event];
+	uint64_t last, usecs;
+	int i, n;
+
+	while (count > 0) {
+		n = count < CHUNK_EVENTS ? count : CHUNK_EVENTS;
+
+		last = event_usecs(&events[0]);
+		chunk.usecs = last;
+		chunk.count = n;
+		chunk.reserved = 0;
+
+		for (i = 0; i < n; i++) {
+			usecs = event_usecs(&events[i]);
+			if (usecs < last)
+				usecs = last;
+			event[i].delta = usecs - last > UINT32_MAX ?
+				UINT32_MAX : usecs - last;
+			event[i].type = events[i].type;
+			event[i].code = events[i].code;
+			event[i].value = events[i].value;
+			last = usecs;
+		}
+
+		header.type = EVDEV_TRACE_EVENTS;
+		header.device = device;
+		header.size = sizeof chunk + n * sizeof event[0];
+
+		memcpy(buffer, &header, sizeof header);
+		memcpy(buffer + sizeof header, &chunk, sizeof chunk);
+		memcpy(buffer + sizeof header + sizeof chunk,
+		       event, n * sizeof event[0]);
+		if (fwrite(buffer, sizeof header + header.size, 1,
+			   writer->fp) != 1)
+			return -1;
+
+		events += n;
+		count -= n;
+	}
+
+	return 0;
+}
+
+struct evdev_trace_reader *
+evdev_trace_reader_open(const char *filename)
+{
+	struct evdev_trace_reader *reader;
+	struct evdev_trace_header header;
+
+	reader = malloc(sizeof *reader);
+	if (reader == NULL)
+		return NULL;
+	memset(reader, 0, sizeof *reader);
+
+	reader->fp = fopen(filename, "re");
+	if (reader->fp == NULL) {
+		free(reader);
+		return NULL;
+	}
+
+	if (fread(&header, sizeof header, 1, reader->fp) != 1 ||
+	    header.magic != EVDEV_TRACE_MAGIC ||
+	    header.version != EVDEV_TRACE_VERSION) {
+		evdev_trace_reader_close(reader);
+		return NULL;
+	}
+
+	return reader;
+}
+
+void
+evdev_trace_reader_close(struct evdev_trace_reader *reader)
+{
+	fclose(reader->fp);
+	free(reader->events);
+	free(reader);
+}
+
+static int
+read_events(struct evdev_trace_reader *reader, uint32_t size,
+	    struct evdev_trace_chunk *chunk)
+{
+	struct evdev_trace_events header;
+	struct evdev_trace_event event;
+	struct input_event *e;
+	uint64_t usecs;
+	uint32_t i;
+
+	if (size < sizeof header ||
+	    fread(&header, sizeof header, 1, reader->fp) != 1)
+		return -1;
+	if (header.count > MAX_EVENTS ||
+	    size != sizeof header + header.count * sizeof event)
+		return -1;
+
+	if ((int) header.count > reader->events_size) {
+		e = realloc(reader->events, header.count * sizeof *e);
+		if (e == NULL)
+			return -1;
+		reader->events = e;
+		reader->events_size = header.count;
+	}
+
+	usecs = header.usecs;
+	for (i = 0; i < header.count; i++) {
+		if (fread(&event, sizeof event, 1, reader->fp) != 1)
+			return -1;
+
+		usecs += event.delta;
+		e = &reader->events[i];
+		e->time.tv_sec = usecs / 1000000;
+		e->time.tv_usec = usecs % 1000000;
+		e->type = event.type;
+		e->code = event.code;
+		e->value = event.value;
+	}
+
+	chunk->events = reader->events;
+	chunk->count = header.count;
+
+	return 0;
+}
+
+/* Returns 1 and fills in chunk, 0 at the end of the file, or -1 if the
+ * file is broken.  Chunks of unknown type are skipped. */
+int
+evdev_trace_read(struct evdev_trace_reader *reader,
+		 struct evdev_trace_chunk *chunk)
+{
+	struct evdev_trace_chunk_header header;
+
+	while (1) {
+		if (fread(&header, sizeof header, 1, reader->fp) != 1)
+			return feof(reader->fp) ? 0 : -1;
+
+		memset(chunk, 0, sizeof *chunk);
+		chunk->type = header.type;
+		chunk->device = header.device;
+
+		switch (header.type) {
+		case EVDEV_TRACE_DEVICE:
+			if (header.size != sizeof chunk->desc ||
+			    fread(&chunk->desc, sizeof chunk->desc, 1,
+				  reader->fp) != 1)
+				return -1;
+			chunk->desc.name[sizeof chunk->desc.name - 1] = '\0';
+			return 1;
+		case EVDEV_TRACE_EVENTS:
+			if (read_events(reader, header.size, chunk) < 0)
+				return -1;
+			return 1;
+		default:
+			if (fseek(reader->fp, header.size, SEEK_CUR) < 0)
+				return -1;
+			break;
+		}
+	}
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _EVDEV_TRACE_H_
+#define _EVDEV_TRACE_H_
+
+#include <stdint.h>
+#include <linux/input.h>
+
+/* A recording of evdev input: the devices as evdev_configure_device()
+ * saw them, and the events read from them, after mtdev.  The file is a
+ * header followed by chunks, all in host byte order.  A device chunk
+ * comes before the first events chunk of its device. */
+
+#define EVDEV_TRACE_MAGIC	0x52564557	/* "WEVR" */
+#define EVDEV_TRACE_VERSION	1
+
+struct evdev_trace_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+enum evdev_trace_chunk_type {
+	EVDEV_TRACE_DEVICE = 1,
+	EVDEV_TRACE_EVENTS = 2,
+};
+
+/* Followed by size bytes of payload. */
+struct evdev_trace_chunk_header {
+	uint32_t type;
+	uint32_t device;
+	uint32_t size;
+};
+
+#define EVDEV_TRACE_DEVICE_MT		0x01
+#define EVDEV_TRACE_DEVICE_TOUCHPAD	0x02
+#define EVDEV_TRACE_DEVICE_PRESSURE	0x04
+
+/* Payload of a device chunk. */
+struct evdev_trace_device {
+	uint32_t caps;			/* enum evdev_device_capability */
+	uint32_t flags;
+	int32_t min_x, max_x, min_y, max_y;
+	int32_t min_pressure, max_pressure;
+	uint16_t bustype, vendor, product, version;
+	char name[64];
+};
+
+/* Payload of an events chunk: the time of the first event, then count
+ * struct evdev_trace_event, each timed relative to the one before. */
+struct evdev_trace_events {
+	uint64_t usecs;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct evdev_trace_event {
+	uint32_t delta;			/* microseconds */
+	uint16_t type;
+	uint16_t code;
+	int32_t value;
+};
+
+struct evdev_trace_writer;
+
+struct evdev_trace_writer *
+evdev_trace_writer_create(const char *filename);
+
+void
+evdev_trace_writer_destroy(struct evdev_trace_writer *writer);
+
+uint32_t
+evdev_trace_write_device(struct evdev_trace_writer *writer,
+			 const struct evdev_trace_device *device);
+
+int
+evdev_trace_write_events(struct evdev_trace_writer *writer, uint32_t device,
+			 const struct input_event *events, int count);
+
+/* A chunk as returned by evdev_trace_read(), the events are only valid
+ * until the next call. */
+struct evdev_trace_chunk {
+	enum evdev_trace_chunk_type type;
+	uint32_t device;
+	struct evdev_trace_device desc;
+	struct input_event *events;
+	int count;
+};
+
+struct evdev_trace_reader;
+
+struct evdev_trace_reader *
+evdev_trace_reader_open(const char *filename);
+
+void
+evdev_trace_reader_close(struct evdev_trace_reader *reader);
+
+int
+evdev_trace_read(struct evdev_trace_reader *reader,
+		 struct evdev_trace_chunk *chunk);
+
+#endif
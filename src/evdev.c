@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <linux/input.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -29,9 +30,192 @@
 
 #include "compositor.h"
 #include "evdev.h"
+#include "evdev-trace.h"
 
 #define DEFAULT_AXIS_STEP_DISTANCE wl_fixed_from_int(10)
 
+/* Devices read on the input thread must not call into the compositor,
+ * their notifications are queued and delivered by
+ * the compositor thread instead. */
+static void
+evdev_record_init(struct evdev_record *record, struct evdev_device *device,
+		  enum evdev_record_type type, uint32_t time)
+{
+	memset(record, 0, sizeof *record);
+	record->type = type;
+	record->seat = device->seat;
+	record->time = time;
+}
+
+static void
+evdev_notify_motion(struct evdev_device *device, uint32_t time,
+		    wl_fixed_t dx, wl_fixed_t dy)
+{
+	struct weston_seat *seat = device->seat;
+	struct evdev_record record;
+
+	if (!device->thread) {
+		notify_motion(seat, time,
+			      seat->seat.pointer->x + dx,
+			      seat->seat.pointer->y + dy);
+		return;
+	}
+
+	evdev_record_init(&record, device, EVDEV_RECORD_MOTION, time);
+	record.x = dx;
+	record.y = dy;
+	evdev_input_thread_push(device->thread, &record);
+}
+
+void
+evdev_absolute_to_output(const struct evdev_absolute *abs,
+			 struct weston_output *output,
+			 wl_fixed_t *x, wl_fixed_t *y)
+{
+	int32_t sx, sy, cx, cy;
+
+	sx = (abs->x - abs->min_x) * output->current->width /
+		(abs->max_x - abs->min_x) + output->x;
+	sy = (abs->y - abs->min_y) * output->current->height /
+		(abs->max_y - abs->min_y) + output->y;
+
+	if (abs->apply_calibration) {
+		cx = sx * abs->calibration[0] + sy * abs->calibration[1] +
+			abs->calibration[2];
+		cy = sx * abs->calibration[3] + sy * abs->calibration[4] +
+			abs->calibration[5];
+		sx = cx;
+		sy = cy;
+	}
+
+	*x = wl_fixed_from_int(sx);
+	*y = wl_fixed_from_int(sy);
+}
+
+static void
+evdev_get_absolute(struct evdev_device *device, int32_t x, int32_t y,
+		   int apply_calibration, struct evdev_absolute *abs)
+{
+	abs->x = x;
+	abs->y = y;
+	abs->min_x = device->abs.min_x;
+	abs->max_x = device->abs.max_x;
+	abs->min_y = device->abs.min_y;
+	abs->max_y = device->abs.max_y;
+	abs->apply_calibration =
+		apply_calibration && device->abs.apply_calibration;
+	memcpy(abs->calibration, device->abs.calibration,
+	       sizeof abs->calibration);
+}
+
+static void
+evdev_notify_motion_absolute(struct evdev_device *device, uint32_t time,
+			     const struct evdev_absolute *abs)
+{
+	struct evdev_record record;
+	wl_fixed_t x, y;
+
+	if (!device->thread) {
+		evdev_absolute_to_output(abs, device->output, &x, &y);
+		notify_motion(device->seat, time, x, y);
+		return;
+	}
+
+	evdev_record_init(&record, device, EVDEV_RECORD_MOTION_ABSOLUTE, time);
+	record.abs = *abs;
+	evdev_input_thread_push(device->thread, &record);
+}
+
+void
+evdev_notify_button(struct evdev_device *device, uint32_t time,
+		    int32_t button, enum wl_pointer_button_state state)
+{
+	struct evdev_record record;
+
+	if (!device->thread) {
+		notify_button(device->seat, time, button, state);
+		return;
+	}
+
+	evdev_record_init(&record, device, EVDEV_RECORD_BUTTON, time);
+	record.code = button;
+	record.state = state;
+	evdev_input_thread_push(device->thread, &record);
+}
+
+static void
+evdev_notify_key(struct evdev_device *device, uint32_t time,
+		 uint32_t key, enum wl_keyboard_key_state state)
+{
+	struct evdev_record record;
+
+	if (!device->thread) {
+		notify_key(device->seat, time, key, state,
+			   STATE_UPDATE_AUTOMATIC);
+		return;
+	}
+
+	evdev_record_init(&record, device, EVDEV_RECORD_KEY, time);
+	record.code = key;
+	record.state = state;
+	evdev_input_thread_push(device->thread, &record);
+}
+
+void
+evdev_notify_axis(struct evdev_device *device, uint32_t time,
+		  uint32_t axis, wl_fixed_t value)
+{
+	struct evdev_record record;
+
+	if (!device->thread) {
+		notify_axis(device->seat, time, axis, value);
+		return;
+	}
+
+	evdev_record_init(&record, device, EVDEV_RECORD_AXIS, time);
+	record.code = axis;
+	record.x = value;
+	evdev_input_thread_push(device->thread, &record);
+}
+
+/* abs is NULL for WL_TOUCH_UP, which has no position. */
+static void
+evdev_notify_touch(struct evdev_device *device, uint32_t time, int slot,
+		   const struct evdev_absolute *abs, int touch_type)
+{
+	struct evdev_record record;
+	wl_fixed_t x = 0, y = 0;
+
+	if (!device->thread) {
+		if (abs)
+			evdev_absolute_to_output(abs, device->output, &x, &y);
+		notify_touch(device->seat, time, slot, x, y, touch_type);
+		return;
+	}
+
+	evdev_record_init(&record, device, EVDEV_RECORD_TOUCH, time);
+	record.slot = slot;
+	if (abs)
+		record.abs = *abs;
+	record.state = touch_type;
+	evdev_input_thread_push(device->thread, &record);
+}
+
+static void
+evdev_note_input(struct evdev_device *device, uint64_t usecs)
+{
+	struct evdev_record record;
+
+	if (!device->thread) {
+		weston_compositor_note_input(device->seat->compositor, usecs);
+		return;
+	}
+
+	evdev_record_init(&record, device, EVDEV_RECORD_INPUT, usecs / 1000);
+	record.usecs = usecs;
+	evdev_input_thread_push(device->thread, &record);
+}
+
 void
 evdev_led_update(struct evdev_device *device, enum weston_led leds)
 {
@@ -75,18 +259,17 @@ evdev_process_key(struct evdev_device *device, struct input_event *e, int time)
 	case BTN_FORWARD:
 	case BTN_BACK:
 	case BTN_TASK:
-		notify_button(device->seat,
-			      time, e->code,
-			      e->value ? WL_POINTER_BUTTON_STATE_PRESSED :
-					 WL_POINTER_BUTTON_STATE_RELEASED);
+		evdev_notify_button(device,
+				    time, e->code,
+				    e->value ? WL_POINTER_BUTTON_STATE_PRESSED :
+					       WL_POINTER_BUTTON_STATE_RELEASED);
 		break;
 
 	default:
-		notify_key(device->seat,
-			   time, e->code,
-			   e->value ? WL_KEYBOARD_KEY_STATE_PRESSED :
-				      WL_KEYBOARD_KEY_STATE_RELEASED,
-			   STATE_UPDATE_AUTOMATIC);
+		evdev_notify_key(device,
+				 time, e->code,
+				 e->value ? WL_KEYBOARD_KEY_STATE_PRESSED :
+					    WL_KEYBOARD_KEY_STATE_RELEASED);
 		break;
 	}
 }
@@ -94,9 +277,6 @@ evdev_process_key(struct evdev_device *device, struct input_event *e, int time)
 static void
 evdev_process_touch(struct evdev_device *device, struct input_event *e)
 {
-	const int screen_width = device->output->current->width;
-	const int screen_height = device->output->current->height;
-
 	switch (e->code) {
 	case ABS_MT_SLOT:
 		device->mt.slot = e->value;
@@ -108,17 +288,11 @@ evdev_process_touch(struct evdev_device *device, struct input_event *e)
 			device->pending_events |= EVDEV_ABSOLUTE_MT_UP;
 		break;
 	case ABS_MT_POSITION_X:
-		device->mt.x[device->mt.slot] =
-			(e->value - device->abs.min_x) * screen_width /
-			(device->abs.max_x - device->abs.min_x) +
-			device->output->x;
+		device->mt.x[device->mt.slot] = e->value;
 		device->pending_events |= EVDEV_ABSOLUTE_MT_MOTION;
 		break;
 	case ABS_MT_POSITION_Y:
-		device->mt.y[device->mt.slot] =
-			(e->value - device->abs.min_y) * screen_height /
-			(device->abs.max_y - device->abs.min_y) +
-			device->output->y;
+		device->mt.y[device->mt.slot] = e->value;
 		device->pending_events |= EVDEV_ABSOLUTE_MT_MOTION;
 		break;
 	}
@@ -128,22 +302,13 @@ static inline void
 evdev_process_absolute_motion(struct evdev_device *device,
 			      struct input_event *e)
 {
-	const int screen_width = device->output->current->width;
-	const int screen_height = device->output->current->height;
-
 	switch (e->code) {
 	case ABS_X:
-		device->abs.x =
-			(e->value - device->abs.min_x) * screen_width /
-			(device->abs.max_x - device->abs.min_x) +
-			device->output->x;
+		device->abs.x = e->value;
 		device->pending_events |= EVDEV_ABSOLUTE_MOTION;
 		break;
 	case ABS_Y:
-		device->abs.y =
-			(e->value - device->abs.min_y) * screen_height /
-			(device->abs.max_y - device->abs.min_y) +
-			device->output->y;
+		device->abs.y = e->value;
 		device->pending_events |= EVDEV_ABSOLUTE_MOTION;
 		break;
 	}
@@ -168,10 +333,10 @@ evdev_process_relative(struct evdev_device *device,
 			/* Scroll down */
 		case 1:
 			/* Scroll up */
-			notify_axis(device->seat,
-				    time,
-				    WL_POINTER_AXIS_VERTICAL_SCROLL,
-				    -1 * e->value * DEFAULT_AXIS_STEP_DISTANCE);
+			evdev_notify_axis(device,
+					  time,
+					  WL_POINTER_AXIS_VERTICAL_SCROLL,
+					  -1 * e->value * DEFAULT_AXIS_STEP_DISTANCE);
 			break;
 		default:
 			break;
@@ -183,10 +348,10 @@ evdev_process_relative(struct evdev_device *device,
 			/* Scroll left */
 		case 1:
 			/* Scroll right */
-			notify_axis(device->seat,
-				    time,
-				    WL_POINTER_AXIS_HORIZONTAL_SCROLL,
-				    e->value * DEFAULT_AXIS_STEP_DISTANCE);
+			evdev_notify_axis(device,
+					  time,
+					  WL_POINTER_AXIS_HORIZONTAL_SCROLL,
+					  e->value * DEFAULT_AXIS_STEP_DISTANCE);
 			break;
 		default:
 			break;
@@ -229,65 +394,44 @@ is_motion_event(struct input_event *e)
 	return 0;
 }
 
-static void
-transform_absolute(struct evdev_device *device)
-{
-	if (!device->abs.apply_calibration)
-		return;
-
-	device->abs.x = device->abs.x * device->abs.calibration[0] +
-			device->abs.y * device->abs.calibration[1] +
-			device->abs.calibration[2];
-
-	device->abs.y = device->abs.x * device->abs.calibration[3] +
-			device->abs.y * device->abs.calibration[4] +
-			device->abs.calibration[5];
-}
-
 static void
 evdev_flush_motion(struct evdev_device *device, uint32_t time)
 {
-	struct weston_seat *master = device->seat;
+	struct evdev_absolute abs;
+	int slot = device->mt.slot;
 
 	if (!device->pending_events)
 		return;
 
 	if (device->pending_events & EVDEV_RELATIVE_MOTION) {
-		notify_motion(master, time,
-			      master->seat.pointer->x + device->rel.dx,
-			      master->seat.pointer->y + device->rel.dy);
+		evdev_notify_motion(device, time,
+				    device->rel.dx, device->rel.dy);
 		device->pending_events &= ~EVDEV_RELATIVE_MOTION;
 		device->rel.dx = 0;
 		device->rel.dy = 0;
 	}
 	if (device->pending_events & EVDEV_ABSOLUTE_MT_DOWN) {
-		notify_touch(master, time,
-			     device->mt.slot,
-			     wl_fixed_from_int(device->mt.x[device->mt.slot]),
-			     wl_fixed_from_int(device->mt.y[device->mt.slot]),
-			     WL_TOUCH_DOWN);
+		evdev_get_absolute(device, device->mt.x[slot],
+				   device->mt.y[slot], 0, &abs);
+		evdev_notify_touch(device, time, slot, &abs, WL_TOUCH_DOWN);
 		device->pending_events &= ~EVDEV_ABSOLUTE_MT_DOWN;
 		device->pending_events &= ~EVDEV_ABSOLUTE_MT_MOTION;
 	}
 	if (device->pending_events & EVDEV_ABSOLUTE_MT_MOTION) {
-		notify_touch(master, time,
-			     device->mt.slot,
-			     wl_fixed_from_int(device->mt.x[device->mt.slot]),
-			     wl_fixed_from_int(device->mt.y[device->mt.slot]),
-			     WL_TOUCH_MOTION);
+		evdev_get_absolute(device, device->mt.x[slot],
+				   device->mt.y[slot], 0, &abs);
+		evdev_notify_touch(device, time, slot, &abs, WL_TOUCH_MOTION);
 		device->pending_events &= ~EVDEV_ABSOLUTE_MT_DOWN;
 		device->pending_events &= ~EVDEV_ABSOLUTE_MT_MOTION;
 	}
 	if (device->pending_events & EVDEV_ABSOLUTE_MT_UP) {
-		notify_touch(master, time, device->mt.slot, 0, 0,
-			     WL_TOUCH_UP);
+		evdev_notify_touch(device, time, slot, NULL, WL_TOUCH_UP);
 		device->pending_events &= ~EVDEV_ABSOLUTE_MT_UP;
 	}
 	if (device->pending_events & EVDEV_ABSOLUTE_MOTION) {
-		transform_absolute(device);
-		notify_motion(master, time,
-			      wl_fixed_from_int(device->abs.x),
-			      wl_fixed_from_int(device->abs.y));
+		evdev_get_absolute(device, device->abs.x, device->abs.y,
+				   1, &abs);
+		evdev_notify_motion_absolute(device, time, &abs);
 		device->pending_events &= ~EVDEV_ABSOLUTE_MOTION;
 	}
 }
@@ -340,14 +484,30 @@ evdev_process_events(struct evdev_device *device,
 {
 	struct evdev_dispatch *dispatch = device->dispatch;
 	struct input_event *e, *end;
+	uint64_t usecs = 0;
 	uint32_t time = 0;
 
 	device->pending_events = 0;
 
+	if (device->trace)
+		evdev_trace_write_events(device->trace, device->trace_id,
+					 ev, count);
+
+	/* Without kernel timestamps on our clock, the best we have is
+	 * when we read the events. */
+	if (!device->monotonic_time)
+		usecs = weston_compositor_get_time_usec();
+
 	e = ev;
 	end = e + count;
 	for (e = ev; e < end; e++) {
-		time = e->time.tv_sec * 1000 + e->time.tv_usec / 1000;
+		if (device->monotonic_time)
+			usecs = (uint64_t) e->time.tv_sec * 1000000 +
+				e->time.tv_usec;
+		time = usecs / 1000;
+
+		if (e->type == EV_SYN)
+			evdev_note_input(device, usecs);
 
 		/* we try to minimize the amount of notifications to be
 		 * forwarded to the compositor, so we accumulate motion
@@ -396,6 +556,30 @@ evdev_device_data(int fd, uint32_t mask, void *data)
 	return 1;
 }
 
+static void
+evdev_device_init_seat(struct evdev_device *device)
+{
+	if ((device->caps &
+	     (EVDEV_MOTION_ABS | EVDEV_MOTION_REL | EVDEV_BUTTON))) {
+		weston_seat_init_pointer(device->seat);
+		weston_log("input device %s, %s is a pointer caps =%s%s%s\n",
+			   device->devname, device->devnode,
+			   device->caps & EVDEV_MOTION_ABS ? " absolute-motion" : "",
+			   device->caps & EVDEV_MOTION_REL ? " relative-motion": "",
+			   device->caps & EVDEV_BUTTON ? " button" : "");
+	}
+	if ((device->caps & EVDEV_KEYBOARD)) {
+		weston_seat_init_keyboard(device->seat, NULL);
+		weston_log("input device %s, %s is a keyboard\n",
+			   device->devname, device->devnode);
+	}
+	if ((device->caps & EVDEV_TOUCH)) {
+		weston_seat_init_touch(device->seat);
+		weston_log("input device %s, %s is a touch device\n",
+			   device->devname, device->devnode);
+	}
+}
+
 static int
 evdev_configure_device(struct evdev_device *device)
 {
@@ -411,6 +595,7 @@ evdev_configure_device(struct evdev_device *device)
 	has_abs = 0;
 	device->caps = 0;
 
+	ioctl(device->fd, EVIOCGID, &device->id);
 	ioctl(device->fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits);
 	if (TEST_BIT(ev_bits, EV_ABS)) {
 		has_abs = 1;
@@ -429,6 +614,12 @@ evdev_configure_device(struct evdev_device *device)
 			device->abs.max_y = absinfo.maximum;
 			device->caps |= EVDEV_MOTION_ABS;
 		}
+		if (TEST_BIT(abs_bits, ABS_PRESSURE)) {
+			ioctl(device->fd, EVIOCGABS(ABS_PRESSURE), &absinfo);
+			device->abs.min_pressure = absinfo.minimum;
+			device->abs.max_pressure = absinfo.maximum;
+			device->abs.has_pressure = 1;
+		}
 		if (TEST_BIT(abs_bits, ABS_MT_SLOT)) {
 			ioctl(device->fd, EVIOCGABS(ABS_MT_POSITION_X),
 			      &absinfo);
@@ -486,35 +677,20 @@ evdev_configure_device(struct evdev_device *device)
 		return -1;
 	}
 
-	if ((device->caps &
-	     (EVDEV_MOTION_ABS | EVDEV_MOTION_REL | EVDEV_BUTTON))) {
-		weston_seat_init_pointer(device->seat);
-		weston_log("input device %s, %s is a pointer caps =%s%s%s\n",
-			   device->devname, device->devnode,
-			   device->caps & EVDEV_MOTION_ABS ? " absolute-motion" : "",
-			   device->caps & EVDEV_MOTION_REL ? " relative-motion": "",
-			   device->caps & EVDEV_BUTTON ? " button" : "");
-	}
-	if ((device->caps & EVDEV_KEYBOARD)) {
-		weston_seat_init_keyboard(device->seat, NULL);
-		weston_log("input device %s, %s is a keyboard\n",
-			   device->devname, device->devnode);
-	}
-	if ((device->caps & EVDEV_TOUCH)) {
-		weston_seat_init_touch(device->seat);
-		weston_log("input device %s, %s is a touch device\n",
-			   device->devname, device->devnode);
-	}
+	evdev_device_init_seat(device);
 
 	return 0;
 }
 
 struct evdev_device *
-evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
+evdev_device_create(struct weston_seat *seat, const char *path, int device_fd,
+		    struct evdev_input_thread *thread)
 {
 	struct evdev_device *device;
 	struct weston_compositor *ec;
+	struct wl_event_loop *loop;
 	char devname[256] = "unknown";
+	int clockid;
 
 	device = malloc(sizeof *device);
 	if (device == NULL)
@@ -534,10 +710,26 @@ evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
 	device->rel.dy = 0;
 	device->dispatch = NULL;
 	device->fd = device_fd;
+	device->thread = thread;
 
 	ioctl(device->fd, EVIOCGNAME(sizeof(devname)), devname);
 	device->devname = strdup(devname);
 
+#ifdef EVIOCSCLOCKID
+	clockid = CLOCK_MONOTONIC;
+	device->monotonic_time =
+		ioctl(device->fd, EVIOCSCLOCKID, &clockid) == 0;
+#endif
+
+	/* The touchpad timer and the fd go on the input thread's loop, keep
+	 * it from dispatching until the device is complete. */
+	if (thread) {
+		evdev_input_thread_lock(thread);
+		loop = evdev_input_thread_get_loop(thread);
+	} else {
+		loop = ec->input_loop;
+	}
+
 	if (evdev_configure_device(device) == -1)
 		goto err1;
 
@@ -554,17 +746,22 @@ evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
 			weston_log("mtdev failed to open for %s\n", path);
 	}
 
-	device->source = wl_event_loop_add_fd(ec->input_loop, device->fd,
+	device->source = wl_event_loop_add_fd(loop, device->fd,
 					      WL_EVENT_READABLE,
 					      evdev_device_data, device);
 	if (device->source == NULL)
 		goto err2;
 
+	if (thread)
+		evdev_input_thread_unlock(thread);
+
 	return device;
 
 err2:
 	device->dispatch->interface->destroy(device->dispatch);
 err1:
+	if (thread)
+		evdev_input_thread_unlock(thread);
 	free(device->devname);
 	free(device->devnode);
 	free(device);
@@ -576,20 +773,121 @@ evdev_device_destroy(struct evdev_device *device)
 {
 	struct evdev_dispatch *dispatch;
 
+	if (device->thread)
+		evdev_input_thread_lock(device->thread);
+
 	dispatch = device->dispatch;
 	if (dispatch)
 		dispatch->interface->destroy(dispatch);
 
-	wl_event_source_remove(device->source);
-	wl_list_remove(&device->link);
+	if (device->source)
+		wl_event_source_remove(device->source);
 	if (device->mtdev)
 		mtdev_close_delete(device->mtdev);
-	close(device->fd);
+
+	if (device->thread)
+		evdev_input_thread_unlock(device->thread);
+
+	wl_list_remove(&device->link);
+	if (device->fd >= 0)
+		close(device->fd);
 	free(device->devname);
 	free(device->devnode);
 	free(device);
 }
 
+/* Writes the device to the recording, then everything that is read
+ * from it. */
+void
+evdev_device_start_recording(struct evdev_device *device,
+			     struct evdev_trace_writer *writer)
+{
+	struct evdev_trace_device desc;
+
+	memset(&desc, 0, sizeof desc);
+	desc.caps = device->caps;
+	if (device->is_mt)
+		desc.flags |= EVDEV_TRACE_DEVICE_MT;
+	if (device->dispatch->interface != &fallback_interface)
+		desc.flags |= EVDEV_TRACE_DEVICE_TOUCHPAD;
+	if (device->abs.has_pressure)
+		desc.flags |= EVDEV_TRACE_DEVICE_PRESSURE;
+	desc.min_x = device->abs.min_x;
+	desc.max_x = device->abs.max_x;
+	desc.min_y = device->abs.min_y;
+	desc.max_y = device->abs.max_y;
+	desc.min_pressure = device->abs.min_pressure;
+	desc.max_pressure = device->abs.max_pressure;
+	desc.bustype = device->id.bustype;
+	desc.vendor = device->id.vendor;
+	desc.product = device->id.product;
+	desc.version = device->id.version;
+	strncpy(desc.name, device->devname, sizeof desc.name - 1);
+
+	device->trace_id = evdev_trace_write_device(writer, &desc);
+	device->trace = writer;
+}
+
+/* A device without an fd, configured as recorded in desc.  Its events
+ * come from evdev_device_replay(). */
+struct evdev_device *
+evdev_device_create_replay(struct weston_seat *seat,
+			   const struct evdev_trace_device *desc)
+{
+	struct evdev_device *device;
+	struct weston_compositor *ec = seat->compositor;
+
+	device = malloc(sizeof *device);
+	if (device == NULL)
+		return NULL;
+	memset(device, 0, sizeof *device);
+
+	device->output =
+		container_of(ec->output_list.next, struct weston_output, link);
+	device->seat = seat;
+	device->devnode = strdup("replay");
+	device->devname = strdup(desc->name);
+	device->fd = -1;
+	device->mt.slot = desc->flags & EVDEV_TRACE_DEVICE_MT ? 0 : -1;
+	device->is_mt = !!(desc->flags & EVDEV_TRACE_DEVICE_MT);
+	device->caps = desc->caps;
+	device->monotonic_time = 1;
+	device->abs.min_x = desc->min_x;
+	device->abs.max_x = desc->max_x;
+	device->abs.min_y = desc->min_y;
+	device->abs.max_y = desc->max_y;
+	device->abs.has_pressure =
+		!!(desc->flags & EVDEV_TRACE_DEVICE_PRESSURE);
+	device->abs.min_pressure = desc->min_pressure;
+	device->abs.max_pressure = desc->max_pressure;
+	device->id.bustype = desc->bustype;
+	device->id.vendor = desc->vendor;
+	device->id.product = desc->product;
+	device->id.version = desc->version;
+
+	if (desc->flags & EVDEV_TRACE_DEVICE_TOUCHPAD)
+		device->dispatch = evdev_touchpad_create(device);
+	else
+		device->dispatch = fallback_dispatch_create();
+	if (device->dispatch == NULL) {
+		free(device->devname);
+		free(device->devnode);
+		free(device);
+		return NULL;
+	}
+
+	evdev_device_init_seat(device);
+
+	return device;
+}
+
+void
+evdev_device_replay(struct evdev_device *device,
+		    struct input_event *events, int count)
+{
+	evdev_process_events(device, events, count);
+}
+
 void
 evdev_notify_keyboard_focus(struct weston_seat *seat,
 			    struct wl_list *evdev_devices)
@@ -44,10 +44,17 @@ enum evdev_device_capability {
 	EVDEV_TOUCH = (1 << 4),
 };
 
+struct evdev_input_thread;
+struct evdev_trace_writer;
+struct evdev_trace_device;
+
 struct evdev_device {
 	struct weston_seat *seat;
 	struct wl_list link;
 	struct wl_event_source *source;
+	/* If set, events are read and processed on the input thread and
+	 * the notify_*() calls are forwarded to the compositor. */
+	struct evdev_input_thread *thread;
 	struct weston_output *output;
 	struct evdev_dispatch *dispatch;
 	char *devnode;
@@ -57,6 +64,9 @@ struct evdev_device {
 		int min_x, max_x, min_y, max_y;
 		int32_t x, y;
 
+		int has_pressure;
+		int32_t min_pressure, max_pressure;
+
 		int apply_calibration;
 		float calibration[6];
 	} abs;
@@ -76,6 +86,13 @@ struct evdev_device {
 	enum evdev_device_capability caps;
 
 	int is_mt;
+	/* Event timestamps are CLOCK_MONOTONIC, like the compositor's. */
+	int monotonic_time;
+	struct input_id id;
+
+	/* If set, everything read from the device is recorded. */
+	struct evdev_trace_writer *trace;
+	uint32_t trace_id;
 };
 
 /* copied from udev/extras/input_id/input_id.c */
@@ -112,13 +129,106 @@ void
 evdev_led_update(struct evdev_device *device, enum weston_led leds);
 
 struct evdev_device *
-evdev_device_create(struct weston_seat *seat, const char *path, int device_fd);
+evdev_device_create(struct weston_seat *seat, const char *path, int device_fd,
+		    struct evdev_input_thread *thread);
 
 void
 evdev_device_destroy(struct evdev_device *device);
 
+void
+evdev_device_start_recording(struct evdev_device *device,
+			     struct evdev_trace_writer *writer);
+
+struct evdev_device *
+evdev_device_create_replay(struct weston_seat *seat,
+			   const struct evdev_trace_device *desc);
+
+void
+evdev_device_replay(struct evdev_device *device,
+		    struct input_event *events, int count);
+
 void
 evdev_notify_keyboard_focus(struct weston_seat *seat,
 			    struct wl_list *evdev_devices);
 
+void
+evdev_notify_button(struct evdev_device *device, uint32_t time,
+		    int32_t button, enum wl_pointer_button_state state);
+
+void
+evdev_notify_axis(struct evdev_device *device, uint32_t time,
+		  uint32_t axis, wl_fixed_t value);
+
+/* A position read from an absolute device, with the range and
+ * calibration needed to map it onto an output. */
+struct evdev_absolute {
+	int32_t x, y;
+	int min_x, max_x, min_y, max_y;
+	int apply_calibration;
+	float calibration[6];
+};
+
+void
+evdev_absolute_to_output(const struct evdev_absolute *abs,
+			 struct weston_output *output,
+			 wl_fixed_t *x, wl_fixed_t *y);
+
+/* Input thread, see evdev-thread.c. */
+
+enum evdev_record_type {
+	EVDEV_RECORD_MOTION,
+	EVDEV_RECORD_MOTION_ABSOLUTE,
+	EVDEV_RECORD_BUTTON,
+	EVDEV_RECORD_KEY,
+	EVDEV_RECORD_AXIS,
+	EVDEV_RECORD_TOUCH,
+	EVDEV_RECORD_INPUT,
+};
+
+/* One notify_*() call.  Relative motion is applied to the pointer
+ * position, and absolute motion and touch positions are mapped to the
+ * output, when the record is handed to the compositor: the output
+ * geometry belongs to the compositor thread. */
+struct evdev_record {
+	enum evdev_record_type type;
+	struct weston_seat *seat;
+	uint32_t time;
+	uint32_t code;
+	uint32_t state;
+	int32_t slot;
+	wl_fixed_t x, y;
+	struct evdev_absolute abs;
+	uint64_t usecs;
+};
+
+struct evdev_input_thread *
+evdev_input_thread_create(struct weston_compositor *compositor);
+
+void
+evdev_input_thread_destroy(struct evdev_input_thread *thread);
+
+struct wl_event_loop *
+evdev_input_thread_get_loop(struct evdev_input_thread *thread);
+
+void
+evdev_input_thread_lock(struct evdev_input_thread *thread);
+
+void
+evdev_input_thread_unlock(struct evdev_input_thread *thread);
+
+void
+evdev_input_thread_push(struct evdev_input_thread *thread,
+			const struct evdev_record *record);
+
+/* Input replay, see evdev-replay.c. */
+
+struct evdev_replay;
+
+struct evdev_replay *
+evdev_replay_create(struct weston_seat *seat, const char *filename,
+		    int speed, const char *trajectory);
+
+void
+evdev_replay_destroy(struct evdev_replay *replay);
+
 #endif /* EVDEV_H */
@@ -50,6 +50,19 @@ struct gl_output_state {
 	EGLSurface egl_surface;
 	int current_buffer;
 	pixman_region32_t buffer_damage[2];
+
+	/* Reads into pixel buffer objects started during a repaint and
+	 * finished on the next one. */
+	struct wl_list readback_list;
+	struct wl_event_source *readback_idle;
+};
+
+struct gl_readback {
+	struct wl_list link;
+	GLuint pbo;
+	GLsizeiptr size;
+	weston_read_pixels_func_t func;
+	void *data;
 };
 
 struct gl_surface_state {
@@ -66,12 +79,36 @@ struct gl_surface_state {
 
 	struct weston_buffer_reference buffer_ref;
 	int pitch; /* in pixels */
+	int height; /* of the shm texture storage, 0 if none */
+	int needs_full_upload;
+};
+
+struct gl_batch {
+	struct weston_surface *surface;
+	struct gl_shader *shader;
+	int blend;
+	GLint filter;
+	int first, count;	/* in gl_renderer::indices */
+
+	/* for fan_debug and drawing without 32-bit indices: */
+	int first_vertex;
+	int first_fan, nfans;	/* in gl_renderer::vtxcnt */
 };
 
 struct gl_renderer {
 	struct weston_renderer base;
 	int fragment_shader_debug;
 
+	/* Frame geometry is built in these arrays and streamed into
+	 * vbo and ibo before drawing. */
+	struct wl_array vertices;
+	struct wl_array indices;
+	struct wl_array vtxcnt;
+	struct wl_array batches;
+	struct wl_array staging;
+	GLuint vbo, ibo;
+	GLsizeiptr vbo_size, ibo_size;
+
 	EGLDisplay egl_display;
 	EGLContext egl_context;
 	EGLConfig egl_config;
@@ -87,6 +124,7 @@ struct gl_renderer {
 	PFNEGLDESTROYIMAGEKHRPROC destroy_image;
 
 	int has_unpack_subimage;
+	int has_element_index_uint;
 
 	PFNEGLBINDWAYLANDDISPLAYWL bind_display;
 	PFNEGLUNBINDWAYLANDDISPLAYWL unbind_display;
@@ -95,6 +133,10 @@ struct gl_renderer {
 
 	int has_egl_image_external;
 
+	PFNGLMAPBUFFERRANGEEXTPROC map_buffer_range;
+	PFNGLUNMAPBUFFEROESPROC unmap_buffer;
+	int has_pbo;
+
 	struct gl_shader texture_shader_rgba;
 	struct gl_shader texture_shader_rgbx;
 	struct gl_shader texture_shader_egl_external;
@@ -526,7 +568,7 @@ texture_region(struct weston_surface *es, pixman_region32_t *region,
 		pixman_region32_t *surf_region)
 {
 	struct gl_surface_state *gs = get_surface_state(es);
-	struct weston_compositor *ec = es->compositor;
+	struct gl_renderer *gr = get_renderer(es->compositor);
 	GLfloat *v, inv_width, inv_height;
 	unsigned int *vtxcnt, nvtx = 0;
 	pixman_box32_t *rects, *surf_rects;
@@ -538,8 +580,8 @@ texture_region(struct weston_surface *es, pixman_region32_t *region,
 	/* worst case we can have 8 vertices per rect (ie. clipped into
 	 * an octagon):
 	 */
-	v = wl_array_add(&ec->vertices, nrects * nsurf * 8 * 4 * sizeof *v);
-	vtxcnt = wl_array_add(&ec->vtxcnt, nrects * nsurf * sizeof *vtxcnt);
+	v = wl_array_add(&gr->vertices, nrects * nsurf * 8 * 4 * sizeof *v);
+	vtxcnt = wl_array_add(&gr->vtxcnt, nrects * nsurf * sizeof *vtxcnt);
 
 	inv_width = 1.0 / gs->pitch;
 
@@ -597,6 +639,11 @@ texture_region(struct weston_surface *es, pixman_region32_t *region,
 		}
 	}
 
+	/* Drop the unused part of the worst case allocation, so the next
+	 * call appends right after these fans. */
+	gr->vertices.size = (char *) v - (char *) gr->vertices.data;
+	gr->vtxcnt.size = (char *) (vtxcnt + nvtx) - (char *) gr->vtxcnt.data;
+
 	return nvtx;
 }
 
@@ -622,32 +669,78 @@ triangle_fan_debug(struct weston_surface *surface, int first, int count)
 	buffer = malloc(sizeof(GLushort) * nelems);
 	index = buffer;
 
+	/* The indices are relative to the fan, the position pointer is
+	 * moved to its first vertex instead: the frame can have more
+	 * vertices than 16-bit indices address. */
 	for (i = 1; i < count; i++) {
-		*index++ = first;
-		*index++ = first + i;
+		*index++ = 0;
+		*index++ = i;
 	}
 
 	for (i = 2; i < count; i++) {
-		*index++ = first + i - 1;
-		*index++ = first + i;
+		*index++ = i - 1;
+		*index++ = i;
 	}
 
 	glUseProgram(gr->solid_shader.program);
 	glUniform4fv(gr->solid_shader.color_uniform, 1,
 			color[color_idx++ % ARRAY_LENGTH(color)]);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      (void *) (first * 4 * sizeof(GLfloat)));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glDrawElements(GL_LINES, nelems, GL_UNSIGNED_SHORT, buffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gr->ibo);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      (void *) 0);
 	glUseProgram(gr->current_shader->program);
 	free(buffer);
 }
 
+static int
+same_surface_state(struct weston_surface *a, struct weston_surface *b)
+{
+	struct gl_surface_state *ga = get_surface_state(a);
+	struct gl_surface_state *gb = get_surface_state(b);
+	int i;
+
+	if (a == b)
+		return 1;
+
+	if (a->alpha != b->alpha ||
+	    ga->target != gb->target ||
+	    ga->num_textures != gb->num_textures ||
+	    memcmp(ga->color, gb->color, sizeof ga->color) != 0)
+		return 0;
+
+	for (i = 0; i < ga->num_textures; i++)
+		if (ga->textures[i] != gb->textures[i])
+			return 0;
+
+	return 1;
+}
+
+/* Turn the fans texture_region() just appended into indexed triangles
+ * and add them to the frame's batches.  A batch is a run of triangles
+ * that can be drawn with one glDrawElements() call: same surface state,
+ * shader and blending.  Consecutive batches for different surfaces are
+ * merged when their GL state is identical, e.g. solid color surfaces.
+ * Without GL_OES_element_index_uint a frame can easily have more
+ * vertices than 16-bit indices address, so no indices are built and
+ * the batch is drawn fan by fan instead. */
 static void
-repaint_region(struct weston_surface *es, pixman_region32_t *region,
-		pixman_region32_t *surf_region)
+repaint_region(struct weston_surface *es, struct weston_output *output,
+	       pixman_region32_t *region, pixman_region32_t *surf_region,
+	       struct gl_shader *shader, int blend)
 {
 	struct weston_compositor *ec = es->compositor;
-	GLfloat *v;
-	unsigned int *vtxcnt;
-	int i, first, nfans;
+	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_batch *batch;
+	unsigned int *vtxcnt, *index;
+	int i, j, first, first_vertex, first_fan, nfans, ntriangles;
+	GLint filter;
+
+	first_vertex = gr->vertices.size / (4 * sizeof(GLfloat));
+	first_fan = gr->vtxcnt.size / sizeof *vtxcnt;
 
 	/* The final region to be painted is the intersection of
 	 * 'region' and 'surf_region'. However, 'region' is in the global
@@ -658,30 +751,64 @@ repaint_region(struct weston_surface *es, pixman_region32_t *region,
 	 * it has a non-zero area (at least 3 vertices, actually).
 	 */
 	nfans = texture_region(es, region, surf_region);
+	if (nfans == 0)
+		return;
 
-	v = ec->vertices.data;
-	vtxcnt = ec->vtxcnt.data;
+	vtxcnt = (unsigned int *) gr->vtxcnt.data + first_fan;
+	ntriangles = 0;
+	for (i = 0; i < nfans; i++)
+		ntriangles += vtxcnt[i] - 2;
+
+	batch = gr->batches.size ?
+		(struct gl_batch *) ((char *) gr->batches.data +
+				     gr->batches.size) - 1 : NULL;
+
+	if (gr->has_element_index_uint) {
+		index = wl_array_add(&gr->indices,
+				     ntriangles * 3 * sizeof *index);
+		if (!index) {
+			gr->vtxcnt.size = first_fan * sizeof *vtxcnt;
+			gr->vertices.size = first_vertex * 4 * sizeof(GLfloat);
+			return;
+		}
 
-	/* position: */
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
-	glEnableVertexAttribArray(0);
+		first = first_vertex;
+		for (i = 0; i < nfans; i++) {
+			for (j = 2; j < (int) vtxcnt[i]; j++) {
+				*index++ = first;
+				*index++ = first + j - 1;
+				*index++ = first + j;
+			}
+			first += vtxcnt[i];
+		}
+	}
 
-	/* texcoord: */
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
-	glEnableVertexAttribArray(1);
+	if (es->transform.enabled || output->zoom.active)
+		filter = GL_LINEAR;
+	else
+		filter = GL_NEAREST;
 
-	for (i = 0, first = 0; i < nfans; i++) {
-		glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
-		if (ec->fan_debug)
-			triangle_fan_debug(es, first, vtxcnt[i]);
-		first += vtxcnt[i];
+	if (batch && batch->shader == shader && batch->blend == blend &&
+	    batch->filter == filter &&
+	    same_surface_state(batch->surface, es)) {
+		batch->count += ntriangles * 3;
+		batch->nfans += nfans;
+		return;
 	}
 
-	glDisableVertexAttribArray(1);
-	glDisableVertexAttribArray(0);
+	batch = wl_array_add(&gr->batches, sizeof *batch);
+	if (!batch)
+		return;
 
-	ec->vertices.size = 0;
-	ec->vtxcnt.size = 0;
+	batch->surface = es;
+	batch->shader = shader;
+	batch->blend = blend;
+	batch->filter = filter;
+	batch->first = gr->indices.size / sizeof(GLuint) - ntriangles * 3;
+	batch->count = ntriangles * 3;
+	batch->first_vertex = first_vertex;
+	batch->first_fan = first_fan;
+	batch->nfans = nfans;
 }
 
 static int
@@ -748,8 +875,7 @@ draw_surface(struct weston_surface *es, struct weston_output *output,
 	/* non-opaque region in surface coordinates: */
 	pixman_region32_t surface_blend;
 	pixman_region32_t *buffer_damage;
-	GLint filter;
-	int i;
+	struct gl_shader *shader;
 
 	pixman_region32_init(&repaint);
 	pixman_region32_intersect(&repaint,
@@ -762,57 +888,29 @@ draw_surface(struct weston_surface *es, struct weston_output *output,
 	buffer_damage = &go->buffer_damage[go->current_buffer];
 	pixman_region32_subtract(buffer_damage, buffer_damage, &repaint);
 
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-
-	if (ec->fan_debug) {
-		use_shader(gr, &gr->solid_shader);
-		shader_uniforms(&gr->solid_shader, es, output);
-	}
-
-	use_shader(gr, gs->shader);
-	shader_uniforms(gs->shader, es, output);
-
-	if (es->transform.enabled || output->zoom.active)
-		filter = GL_LINEAR;
-	else
-		filter = GL_NEAREST;
-
-	for (i = 0; i < gs->num_textures; i++) {
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(gs->target, gs->textures[i]);
-		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, filter);
-		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
-	}
-
 	/* blended region is whole surface minus opaque region: */
 	pixman_region32_init_rect(&surface_blend, 0, 0,
 				  es->geometry.width, es->geometry.height);
 	pixman_region32_subtract(&surface_blend, &surface_blend, &es->opaque);
 
 	if (pixman_region32_not_empty(&es->opaque)) {
+		shader = gs->shader;
 		if (gs->shader == &gr->texture_shader_rgba) {
 			/* Special case for RGBA textures with possibly
 			 * bad data in alpha channel: use the shader
 			 * that forces texture alpha = 1.0.
 			 * Xwayland surfaces need this.
 			 */
-			use_shader(gr, &gr->texture_shader_rgbx);
-			shader_uniforms(&gr->texture_shader_rgbx, es, output);
+			shader = &gr->texture_shader_rgbx;
 		}
 
-		if (es->alpha < 1.0)
-			glEnable(GL_BLEND);
-		else
-			glDisable(GL_BLEND);
-
-		repaint_region(es, &repaint, &es->opaque);
+		repaint_region(es, output, &repaint, &es->opaque,
+			       shader, es->alpha < 1.0);
 	}
 
-	if (pixman_region32_not_empty(&surface_blend)) {
-		use_shader(gr, gs->shader);
-		glEnable(GL_BLEND);
-		repaint_region(es, &repaint, &surface_blend);
-	}
+	if (pixman_region32_not_empty(&surface_blend))
+		repaint_region(es, output, &repaint, &surface_blend,
+			       gs->shader, 1);
 
 	pixman_region32_fini(&surface_blend);
 
@@ -820,15 +918,154 @@ out:
 	pixman_region32_fini(&repaint);
 }
 
+static void
+stream_buffer(GLenum target, GLuint buffer, GLsizeiptr *capacity,
+	      struct wl_array *data)
+{
+	GLsizeiptr size = data->size;
+
+	glBindBuffer(target, buffer);
+
+	/* Grow geometrically, so the storage settles after a few frames.
+	 * Respecifying it orphans the previous contents instead of
+	 * waiting for draws that still read them. */
+	if (size > *capacity) {
+		if (*capacity == 0)
+			*capacity = 4096;
+		while (*capacity < size)
+			*capacity *= 2;
+	}
+
+	glBufferData(target, *capacity, NULL, GL_STREAM_DRAW);
+	glBufferSubData(target, 0, size, data->data);
+}
+
+static void
+upload_geometry(struct gl_renderer *gr)
+{
+	stream_buffer(GL_ARRAY_BUFFER, gr->vbo, &gr->vbo_size,
+		      &gr->vertices);
+	if (gr->indices.size > 0)
+		stream_buffer(GL_ELEMENT_ARRAY_BUFFER, gr->ibo, &gr->ibo_size,
+			      &gr->indices);
+
+	/* position: */
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE,
+			      4 * sizeof(GLfloat), (void *) 0);
+	glEnableVertexAttribArray(0);
+
+	/* texcoord: */
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE,
+			      4 * sizeof(GLfloat),
+			      (void *) (2 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(1);
+}
+
+/* Issue the draws collected by draw_surface(), back to front, only
+ * touching GL state that changes between batches. */
+static void
+draw_batches(struct weston_output *output)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_surface_state *gs;
+	struct gl_batch *batch;
+	struct weston_surface *surface = NULL;
+	struct gl_shader *shader = NULL;
+	unsigned int *vtxcnt;
+	int blend = -1;
+	int i, first;
+
+	if (gr->batches.size == 0)
+		return;
+
+	vtxcnt = gr->vtxcnt.data;
+	upload_geometry(gr);
+
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	if (ec->fan_debug) {
+		use_shader(gr, &gr->solid_shader);
+		glUniformMatrix4fv(gr->solid_shader.proj_uniform,
+				   1, GL_FALSE, output->matrix.d);
+	}
+
+	wl_array_for_each(batch, &gr->batches) {
+		gs = get_surface_state(batch->surface);
+
+		if (batch->shader != shader || batch->surface != surface) {
+			use_shader(gr, batch->shader);
+			shader_uniforms(batch->shader, batch->surface, output);
+			shader = batch->shader;
+		}
+
+		if (batch->surface != surface) {
+			for (i = 0; i < gs->num_textures; i++) {
+				glActiveTexture(GL_TEXTURE0 + i);
+				glBindTexture(gs->target, gs->textures[i]);
+				glTexParameteri(gs->target,
+						GL_TEXTURE_MIN_FILTER,
+						batch->filter);
+				glTexParameteri(gs->target,
+						GL_TEXTURE_MAG_FILTER,
+						batch->filter);
+			}
+			surface = batch->surface;
+		}
+
+		if (batch->blend != blend) {
+			if (batch->blend)
+				glEnable(GL_BLEND);
+			else
+				glDisable(GL_BLEND);
+			blend = batch->blend;
+		}
+
+		if (gr->has_element_index_uint) {
+			glDrawElements(GL_TRIANGLES, batch->count,
+				       GL_UNSIGNED_INT,
+				       (void *) (batch->first * sizeof(GLuint)));
+		} else {
+			first = batch->first_vertex;
+			for (i = 0; i < batch->nfans; i++) {
+				glDrawArrays(GL_TRIANGLE_FAN, first,
+					     vtxcnt[batch->first_fan + i]);
+				first += vtxcnt[batch->first_fan + i];
+			}
+		}
+
+		if (ec->fan_debug) {
+			first = batch->first_vertex;
+			for (i = 0; i < batch->nfans; i++) {
+				triangle_fan_debug(batch->surface, first,
+						   vtxcnt[batch->first_fan + i]);
+				first += vtxcnt[batch->first_fan + i];
+			}
+		}
+	}
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+}
+
 static void
 repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
+	struct gl_renderer *gr = get_renderer(compositor);
 	struct weston_surface *surface;
 
 	wl_list_for_each_reverse(surface, &compositor->surface_list, link)
-		if (surface->plane == &compositor->primary_plane)
+		if (surface->plane == &compositor->primary_plane &&
+		    !(surface->occluded_mask & (1 << output->id)))
 			draw_surface(surface, output, damage);
+
+	draw_batches(output);
+
+	gr->vertices.size = 0;
+	gr->vtxcnt.size = 0;
+	gr->indices.size = 0;
+	gr->batches.size = 0;
 }
 
 
@@ -838,7 +1075,7 @@ texture_border(struct weston_output *output)
 	struct weston_compositor *ec = output->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
 	GLfloat *d;
-	unsigned int *p;
+	GLushort *p;
 	int i, j, k, n;
 	GLfloat x[4], y[4], u[4], v[4];
 
@@ -863,8 +1100,8 @@ texture_border(struct weston_output *output)
 	v[3] = 1.0;
 
 	n = 8;
-	d = wl_array_add(&ec->vertices, n * 16 * sizeof *d);
-	p = wl_array_add(&ec->indices, n * 6 * sizeof *p);
+	d = wl_array_add(&gr->vertices, n * 16 * sizeof *d);
+	p = wl_array_add(&gr->indices, n * 6 * sizeof *p);
 
 	k = 0;
 	for (i = 0; i < 3; i++)
@@ -914,7 +1151,6 @@ draw_border(struct weston_output *output)
 	struct weston_compositor *ec = output->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
 	struct gl_shader *shader = &gr->texture_shader_rgba;
-	GLfloat *v;
 	int n;
 
 	glDisable(GL_BLEND);
@@ -931,20 +1167,46 @@ draw_border(struct weston_output *output)
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, gr->border.texture);
 
-	v = ec->vertices.data;
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
+	upload_geometry(gr);
 
-	glDrawElements(GL_TRIANGLES, n * 6,
-		       GL_UNSIGNED_INT, ec->indices.data);
+	/* The border is a handful of quads, 16-bit indices are always
+	 * supported and enough. */
+	glDrawElements(GL_TRIANGLES, n * 6, GL_UNSIGNED_SHORT, (void *) 0);
 
 	glDisableVertexAttribArray(1);
 	glDisableVertexAttribArray(0);
 
-	ec->vertices.size = 0;
-	ec->indices.size = 0;
+	gr->vertices.size = 0;
+	gr->indices.size = 0;
+}
+
+/* Hand the pixels of every pending read to its callback, or NULL if
+ * failed is set.  By the next repaint the GPU has normally long
+ * finished the reads, so mapping the buffers doesn't stall. */
+static void
+finish_readbacks(struct weston_output *output, int failed)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_readback *readback, *next;
+	void *pixels;
+
+	wl_list_for_each_safe(readback, next, &go->readback_list, link) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, readback->pbo);
+		pixels = NULL;
+		if (!failed)
+			pixels = gr->map_buffer_range(GL_PIXEL_PACK_BUFFER_NV,
+						      0, readback->size,
+						      GL_MAP_READ_BIT_EXT);
+		readback->func(pixels, readback->data);
+		if (pixels)
+			gr->unmap_buffer(GL_PIXEL_PACK_BUFFER_NV);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+
+		glDeleteBuffers(1, &readback->pbo);
+		wl_list_remove(&readback->link);
+		free(readback);
+	}
 }
 
 static void
@@ -968,6 +1230,8 @@ gl_renderer_repaint_output(struct weston_output *output,
 	if (use_output(output) < 0)
 		return;
 
+	finish_readbacks(output, 0);
+
 	/* if debugging, redraw everything outside the damage to clean up
 	 * debug lines from the previous draw on this buffer:
 	 */
@@ -995,6 +1259,8 @@ gl_renderer_repaint_output(struct weston_output *output,
 	if (gr->border.texture)
 		draw_border(output);
 
+	weston_output_timing_mark(output, WESTON_REPAINT_PHASE_RENDER);
+
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
 
@@ -1038,18 +1304,178 @@ gl_renderer_read_pixels(struct weston_output *output,
 	return 0;
 }
 
+static void
+readback_idle(void *data)
+{
+	struct weston_output *output = data;
+	struct gl_output_state *go = get_output_state(output);
+
+	go->readback_idle = NULL;
+	weston_output_schedule_repaint(output);
+}
+
+static int
+gl_renderer_read_pixels_async(struct weston_output *output,
+			      pixman_format_code_t format,
+			      uint32_t x, uint32_t y,
+			      uint32_t width, uint32_t height,
+			      weston_read_pixels_func_t func, void *data)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_readback *readback;
+	struct wl_event_loop *loop;
+	GLenum gl_format;
+
+	if (!gr->has_pbo)
+		return -1;
+
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+		gl_format = GL_BGRA_EXT;
+		break;
+	case PIXMAN_a8b8g8r8:
+		gl_format = GL_RGBA;
+		break;
+	default:
+		return -1;
+	}
+
+	if (use_output(output) < 0)
+		return -1;
+
+	readback = malloc(sizeof *readback);
+	if (readback == NULL)
+		return -1;
+
+	readback->size = width * height * 4;
+	readback->func = func;
+	readback->data = data;
+
+	/* With a pack buffer bound, glReadPixels() only queues a copy
+	 * into it and returns without waiting for the GPU. */
+	glGenBuffers(1, &readback->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, readback->pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER_NV, readback->size,
+		     NULL, GL_STREAM_DRAW);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(x, y, width, height, gl_format, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+
+	wl_list_insert(go->readback_list.prev, &readback->link);
+
+	/* Make sure there is a next repaint to pick up the pixels.  This
+	 * is normally called from the frame signal, where scheduling a
+	 * repaint directly would be reset once the repaint returns. */
+	if (!go->readback_idle) {
+		loop = wl_display_get_event_loop(output->compositor->wl_display);
+		go->readback_idle =
+			wl_event_loop_add_idle(loop, readback_idle, output);
+	}
+
+	return 0;
+}
+
+/* Rough cost of one texture upload call, expressed in pixels that
+ * could have been transferred instead.  Damage rectangles are merged as
+ * long as the extra pixels cost less than the call they save. */
+#define UPLOAD_CALL_COST 4096
+#define UPLOAD_MAX_TILES 64
+
+static int
+box_area(pixman_box32_t *b)
+{
+	return (b->x2 - b->x1) * (b->y2 - b->y1);
+}
+
+static int
+coalesce_upload_tiles(pixman_box32_t *tiles, int n)
+{
+	pixman_box32_t bbox;
+	int i, j, merged;
+
+	do {
+		merged = 0;
+		for (i = 0; i < n; i++) {
+			for (j = i + 1; j < n; j++) {
+				bbox = tiles[i];
+				if (tiles[j].x1 < bbox.x1)
+					bbox.x1 = tiles[j].x1;
+				if (tiles[j].y1 < bbox.y1)
+					bbox.y1 = tiles[j].y1;
+				if (tiles[j].x2 > bbox.x2)
+					bbox.x2 = tiles[j].x2;
+				if (tiles[j].y2 > bbox.y2)
+					bbox.y2 = tiles[j].y2;
+
+				if (box_area(&bbox) > box_area(&tiles[i]) +
+				    box_area(&tiles[j]) + UPLOAD_CALL_COST)
+					continue;
+
+				tiles[i] = bbox;
+				tiles[j--] = tiles[--n];
+				merged = 1;
+			}
+		}
+	} while (merged);
+
+	return n;
+}
+
+static void
+upload_tile(struct gl_renderer *gr, struct gl_surface_state *gs,
+	    uint32_t *data, pixman_box32_t *r)
+{
+	int width = r->x2 - r->x1;
+	int height = r->y2 - r->y1;
+	uint32_t *src, *dst;
+	int i;
+
+#ifdef GL_UNPACK_ROW_LENGTH
+	if (gr->has_unpack_subimage) {
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, r->x1);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, r->y1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r->x1, r->y1, width, height,
+				GL_BGRA_EXT, GL_UNSIGNED_BYTE, data);
+		return;
+	}
+#endif
+
+	/* Without unpack_subimage only whole rows are contiguous.  Send
+	 * full rows when the tile spans most of them, otherwise pack the
+	 * tile into the staging buffer first. */
+	if (width * 2 >= gs->pitch) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, r->y1, gs->pitch, height,
+				GL_BGRA_EXT, GL_UNSIGNED_BYTE,
+				data + r->y1 * gs->pitch);
+		return;
+	}
+
+	gr->staging.size = 0;
+	dst = wl_array_add(&gr->staging, width * height * sizeof *dst);
+	if (!dst)
+		return;
+
+	src = data + r->y1 * gs->pitch + r->x1;
+	for (i = 0; i < height; i++) {
+		memcpy(dst + i * width, src, width * sizeof *src);
+		src += gs->pitch;
+	}
+
+	glTexSubImage2D(GL_TEXTURE_2D, 0, r->x1, r->y1, width, height,
+			GL_BGRA_EXT, GL_UNSIGNED_BYTE, gr->staging.data);
+}
+
 static void
 gl_renderer_flush_damage(struct weston_surface *surface)
 {
 	struct gl_renderer *gr = get_renderer(surface->compositor);
 	struct gl_surface_state *gs = get_surface_state(surface);
 	struct wl_buffer *buffer = gs->buffer_ref.buffer;
-
-#ifdef GL_UNPACK_ROW_LENGTH
-	pixman_box32_t *rectangles;
-	void *data;
+	pixman_box32_t *rectangles, extents;
+	pixman_box32_t tiles[UPLOAD_MAX_TILES];
+	uint32_t *data;
 	int i, n;
-#endif
 
 	pixman_region32_union(&gs->texture_damage,
 			      &gs->texture_damage, &surface->damage);
@@ -1065,35 +1491,53 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	if (surface->plane != &surface->compositor->primary_plane)
 		return;
 
-	if (!pixman_region32_not_empty(&gs->texture_damage))
+	/* Likewise while it's hidden behind opaque surfaces on all of its
+	 * outputs; the compositor keeps the buffer referenced, so the
+	 * damage is uploaded once it becomes visible again. */
+	if (surface->occluded)
+		return;
+
+	if (!pixman_region32_not_empty(&gs->texture_damage) &&
+	    !gs->needs_full_upload)
 		goto done;
 
 	glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
+	data = wl_shm_buffer_get_data(buffer);
 
-	if (!gr->has_unpack_subimage) {
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT,
-			     gs->pitch, buffer->height, 0,
-			     GL_BGRA_EXT, GL_UNSIGNED_BYTE,
-			     wl_shm_buffer_get_data(buffer));
-
+	if (gs->needs_full_upload) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+				gs->pitch, buffer->height,
+				GL_BGRA_EXT, GL_UNSIGNED_BYTE, data);
+		gs->needs_full_upload = 0;
 		goto done;
 	}
 
+	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
+	if (n > UPLOAD_MAX_TILES) {
+		extents = *pixman_region32_extents(&gs->texture_damage);
+		tiles[0] = weston_surface_to_buffer_rect(surface, extents);
+		n = 1;
+	} else {
+		for (i = 0; i < n; i++)
+			tiles[i] = weston_surface_to_buffer_rect(surface,
+								 rectangles[i]);
+		n = coalesce_upload_tiles(tiles, n);
+	}
+
 #ifdef GL_UNPACK_ROW_LENGTH
 	/* Mesa does not define GL_EXT_unpack_subimage */
-	glPixelStorei(GL_UNPACK_ROW_LENGTH, gs->pitch);
-	data = wl_shm_buffer_get_data(buffer);
-	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
-	for (i = 0; i < n; i++) {
-		pixman_box32_t r;
+	if (gr->has_unpack_subimage)
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, gs->pitch);
+#endif
 
-		r = weston_surface_to_buffer_rect(surface, rectangles[i]);
+	for (i = 0; i < n; i++)
+		upload_tile(gr, gs, data, &tiles[i]);
 
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS, r.x1);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS, r.y1);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x1, r.y1,
-				r.x2 - r.x1, r.y2 - r.y1,
-				GL_BGRA_EXT, GL_UNSIGNED_BYTE, data);
+#ifdef GL_UNPACK_ROW_LENGTH
+	if (gr->has_unpack_subimage) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
 	}
 #endif
 
@@ -1131,7 +1575,7 @@ gl_renderer_attach(struct weston_surface *es, struct wl_buffer *buffer)
 	struct gl_renderer *gr = get_renderer(ec);
 	struct gl_surface_state *gs = get_surface_state(es);
 	EGLint attribs[3], format;
-	int i, num_planes;
+	int i, num_planes, pitch;
 
 	weston_buffer_reference(&gs->buffer_ref, buffer);
 
@@ -1143,18 +1587,27 @@ gl_renderer_attach(struct weston_surface *es, struct wl_buffer *buffer)
 		gs->num_images = 0;
 		glDeleteTextures(gs->num_textures, gs->textures);
 		gs->num_textures = 0;
+		gs->height = 0;
 		return;
 	}
 
 	if (wl_buffer_is_shm(buffer)) {
-		gs->pitch = wl_shm_buffer_get_stride(buffer) / 4;
+		pitch = wl_shm_buffer_get_stride(buffer) / 4;
 		gs->target = GL_TEXTURE_2D;
 
 		ensure_textures(gs, 1);
-		glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT,
-			     gs->pitch, buffer->height, 0,
-			     GL_BGRA_EXT, GL_UNSIGNED_BYTE, NULL);
+
+		/* Keep the texture storage while the size does not change,
+		 * so flush_damage only needs to upload what changed. */
+		if (pitch != gs->pitch || buffer->height != gs->height) {
+			gs->pitch = pitch;
+			gs->height = buffer->height;
+			glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT,
+				     gs->pitch, buffer->height, 0,
+				     GL_BGRA_EXT, GL_UNSIGNED_BYTE, NULL);
+			gs->needs_full_upload = 1;
+		}
 		if (wl_shm_buffer_get_format(buffer) == WL_SHM_FORMAT_XRGB8888)
 			gs->shader = &gr->texture_shader_rgbx;
 		else
@@ -1213,6 +1666,7 @@ gl_renderer_attach(struct weston_surface *es, struct wl_buffer *buffer)
 		}
 
 		gs->pitch = buffer->width;
+		gs->height = 0;
 	} else {
 		weston_log("unhandled buffer type!\n");
 		weston_buffer_reference(&gs->buffer_ref, NULL);
@@ -1619,6 +2073,7 @@ gl_renderer_output_create(struct weston_output *output,
 	go->current_buffer = 0;
 	for (i = 0; i < 2; i++)
 		pixman_region32_init(&go->buffer_damage[i]);
+	wl_list_init(&go->readback_list);
 
 	output->renderer_state = go;
 
@@ -1632,8 +2087,24 @@ gl_renderer_output_destroy(struct weston_output *output)
 {
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	struct gl_output_state *go = get_output_state(output);
+	struct gl_readback *readback, *next;
 	int i;
 
+	/* Pending reads fail either way.  Without the context their
+	 * buffers can't be deleted here, they go with the context. */
+	if (use_output(output) == 0) {
+		finish_readbacks(output, 1);
+	} else {
+		wl_list_for_each_safe(readback, next,
+				      &go->readback_list, link) {
+			readback->func(NULL, readback->data);
+			wl_list_remove(&readback->link);
+			free(readback);
+		}
+	}
+	if (go->readback_idle)
+		wl_event_source_remove(go->readback_idle);
+
 	for (i = 0; i < 2; i++)
 		pixman_region32_fini(&go->buffer_damage[i]);
 
@@ -1656,6 +2127,9 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	if (gr->has_bind_display)
 		gr->unbind_display(gr->egl_display, ec->wl_display);
 
+	glDeleteBuffers(1, &gr->vbo);
+	glDeleteBuffers(1, &gr->ibo);
+
 	/* Work around crash in egl_dri2.c's dri2_make_current() - when does this apply? */
 	eglMakeCurrent(gr->egl_display,
 		       EGL_NO_SURFACE, EGL_NO_SURFACE,
@@ -1663,6 +2137,12 @@ gl_renderer_destroy(struct weston_compositor *ec)
 
 	eglTerminate(gr->egl_display);
 	eglReleaseThread();
+
+	wl_array_release(&gr->vertices);
+	wl_array_release(&gr->indices);
+	wl_array_release(&gr->vtxcnt);
+	wl_array_release(&gr->batches);
+	wl_array_release(&gr->staging);
 }
 
 static int
@@ -1741,7 +2221,14 @@ gl_renderer_create(struct weston_compositor *ec, EGLNativeDisplayType display,
 	if (gr == NULL)
 		return -1;
 
+	wl_array_init(&gr->vertices);
+	wl_array_init(&gr->indices);
+	wl_array_init(&gr->vtxcnt);
+	wl_array_init(&gr->batches);
+	wl_array_init(&gr->staging);
+
 	gr->base.read_pixels = gl_renderer_read_pixels;
+	gr->base.read_pixels_async = gl_renderer_read_pixels_async;
 	gr->base.repaint_output = gl_renderer_repaint_output;
 	gr->base.flush_damage = gl_renderer_flush_damage;
 	gr->base.attach = gl_renderer_attach;
@@ -1911,6 +2398,17 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 	if (strstr(extensions, "GL_OES_EGL_image_external"))
 		gr->has_egl_image_external = 1;
 
+	if (strstr(extensions, "GL_OES_element_index_uint"))
+		gr->has_element_index_uint = 1;
+
+	gr->map_buffer_range =
+		(void *) eglGetProcAddress("glMapBufferRangeEXT");
+	gr->unmap_buffer = (void *) eglGetProcAddress("glUnmapBufferOES");
+	if (strstr(extensions, "GL_NV_pixel_buffer_object") &&
+	    strstr(extensions, "GL_EXT_map_buffer_range") &&
+	    gr->map_buffer_range && gr->unmap_buffer)
+		gr->has_pbo = 1;
+
 	extensions =
 		(const char *) eglQueryString(gr->egl_display, EGL_EXTENSIONS);
 	if (!extensions) {
@@ -1931,6 +2429,9 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 	if (compile_shaders(ec))
 		return -1;
 
+	glGenBuffers(1, &gr->vbo);
+	glGenBuffers(1, &gr->ibo);
+
 	weston_compositor_add_debug_binding(ec, KEY_S,
 					    fragment_debug_binding, ec);
 
@@ -1941,6 +2442,10 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 			    gr->has_unpack_subimage ? "yes" : "no");
 	weston_log_continue(STAMP_SPACE "EGL Wayland extension: %s\n",
 			    gr->has_bind_display ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "asynchronous read-back: %s\n",
+			    gr->has_pbo ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "32-bit vertex indices: %s\n",
+			    gr->has_element_index_uint ? "yes" : "no");
 
 
 	return 0;
@@ -25,6 +25,9 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include "pixman-renderer.h"
 
@@ -34,11 +37,64 @@ struct pixman_output_state {
 
 struct pixman_surface_state {
 	pixman_image_t *image;
+	pixman_color_t color;
 	struct weston_buffer_reference buffer_ref;
 };
 
+/* Damage shorter than this is not worth splitting across threads. */
+#define PIXMAN_MIN_BAND_HEIGHT 32
+
+enum pixman_xform_kind {
+	PIXMAN_XFORM_TRANSLATE,
+	PIXMAN_XFORM_EXACT,
+	PIXMAN_XFORM_GENERAL
+};
+
+struct pixman_draw_op {
+	struct weston_surface *surface;
+	pixman_region32_t region; /* in framebuffer coordinates */
+	pixman_op_t op;
+
+	/* framebuffer to buffer coordinates: an offset for translations,
+	 * a pixman transform otherwise */
+	enum pixman_xform_kind kind;
+	int32_t dx, dy;
+	pixman_transform_t transform;
+};
+
+/* One output repaint: the draw ops in back to front order and the rows
+ * they cover, split into nbands horizontal bands. */
+struct pixman_job {
+	pixman_image_t *dest;
+	struct wl_array ops;
+	int32_t y, height;
+	int nbands;
+};
+
+struct pixman_renderer;
+
+struct pixman_worker {
+	struct pixman_renderer *renderer;
+	pthread_t thread;
+	int band;
+};
+
 struct pixman_renderer {
 	struct weston_renderer base;
+
+	struct pixman_job job;
+
+	/* Band 0 is always drawn by the main thread, the workers take
+	 * the others.  The main thread waits for all of them before
+	 * returning from repaint_output. */
+	int nworkers;
+	struct pixman_worker *workers;
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond;
+	pthread_cond_t done_cond;
+	uint32_t job_serial;
+	int jobs_pending;
+	int quit;
 };
 
 static inline struct pixman_output_state *
@@ -65,76 +121,415 @@ pixman_renderer_read_pixels(struct weston_output *output,
 			       uint32_t x, uint32_t y,
 			       uint32_t width, uint32_t height)
 {
-	/* FIXME: not implemented for now */
+	struct pixman_output_state *po = get_output_state(output);
+	pixman_transform_t transform;
+	pixman_image_t *out_buf;
+	int hw_height;
+
+	if (!po->hw_buffer) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	out_buf = pixman_image_create_bits(format,
+		width,
+		height,
+		pixels,
+		(PIXMAN_FORMAT_BPP(format) / 8) * width);
+	if (!out_buf) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* Callers expect glReadPixels() semantics: y counts from the
+	 * bottom of the framebuffer and rows come out bottom-up.  Flip
+	 * the source while compositing, so only the requested rectangle
+	 * is touched and no intermediate copy is needed. */
+	hw_height = pixman_image_get_height(po->hw_buffer);
+	pixman_transform_init_identity(&transform);
+	transform.matrix[0][2] = pixman_int_to_fixed(x);
+	transform.matrix[1][1] = pixman_fixed_minus_1;
+	transform.matrix[1][2] = pixman_int_to_fixed(hw_height - y);
+	pixman_image_set_transform(po->hw_buffer, &transform);
+
+	pixman_image_composite32(PIXMAN_OP_SRC,
+				 po->hw_buffer, /* src */
+				 NULL /* mask */,
+				 out_buf, /* dest */
+				 0, 0, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 0, 0, /* dest_x, dest_y */
+				 width, /* width */
+				 height /* height */);
+	pixman_image_set_transform(po->hw_buffer, NULL);
+
+	pixman_image_unref(out_buf);
+
 	return 0;
 }
 
-static void
-repaint_region(struct weston_surface *es, struct weston_output *output,
-		pixman_region32_t *region, pixman_region32_t *surf_region,
-		pixman_op_t pixman_op)
+static pixman_image_t *
+pixman_renderer_output_image(struct weston_output *output)
 {
-	struct pixman_surface_state *ps = get_surface_state(es);
 	struct pixman_output_state *po = get_output_state(output);
-	pixman_region32_t final_region;
-	pixman_box32_t *rects;
-	int nrects, i, src_x, src_y;
-	float surface_x, surface_y;
+
+	return po->hw_buffer;
+}
+
+static pixman_image_t *
+clone_image(pixman_image_t *image, pixman_color_t *color)
+{
+	uint32_t *data = pixman_image_get_data(image);
+
+	if (data == NULL)
+		return pixman_image_create_solid_fill(color);
+
+	return pixman_image_create_bits(pixman_image_get_format(image),
+					pixman_image_get_width(image),
+					pixman_image_get_height(image),
+					data,
+					pixman_image_get_stride(image));
+}
+
+/* m <- fb * output->matrix * m, so m maps to top-down framebuffer
+ * coordinates of the output, with output transform and zoom applied. */
+static void
+output_fb_matrix(struct weston_output *output, struct weston_matrix *m)
+{
+	float width = output->current->width;
+	float height = output->current->height;
+
+	weston_matrix_multiply(m, &output->matrix);
+	weston_matrix_scale(m, width / 2, -height / 2, 1);
+	weston_matrix_translate(m, width / 2, height / 2, 0);
+}
+
+/* Affine map from surface to buffer coordinates for the surface's
+ * buffer_transform. */
+static void
+surface_to_buffer_matrix(struct weston_surface *es, struct weston_matrix *m)
+{
+	float x0, y0, x1, y1, x2, y2;
+
+	weston_surface_to_buffer_float(es, 0, 0, &x0, &y0);
+	weston_surface_to_buffer_float(es, 1, 0, &x1, &y1);
+	weston_surface_to_buffer_float(es, 0, 1, &x2, &y2);
+
+	weston_matrix_init(m);
+	m->d[0] = x1 - x0;
+	m->d[1] = y1 - y0;
+	m->d[4] = x2 - x0;
+	m->d[5] = y2 - y0;
+	m->d[12] = x0;
+	m->d[13] = y0;
+}
+
+static int
+near_integer(float v, int32_t *i)
+{
+	float r = floorf(v + 0.5f);
+
+	if (fabsf(v - r) > 1.0f / 1024)
+		return 0;
+
+	*i = r;
+	return 1;
+}
+
+/* Sort a 2D affine matrix into what pixman can do fastest: a plain
+ * offset, an exact 90 degree rotation or flip (pixman has nearest
+ * neighbour fast paths for those), or anything else. */
+static enum pixman_xform_kind
+classify_matrix(const struct weston_matrix *m, int32_t snapped[6])
+{
+	static const int idx[6] = { 0, 4, 12, 1, 5, 13 };
+	int i;
+
+	for (i = 0; i < 6; i++) {
+		if (!near_integer(m->d[idx[i]], &snapped[i]))
+			return PIXMAN_XFORM_GENERAL;
+		if (i % 3 != 2 && (snapped[i] < -1 || snapped[i] > 1))
+			return PIXMAN_XFORM_GENERAL;
+	}
+
+	if (snapped[0] == 1 && snapped[1] == 0 &&
+	    snapped[3] == 0 && snapped[4] == 1)
+		return PIXMAN_XFORM_TRANSLATE;
+
+	if ((snapped[0] == 0 && snapped[4] == 0 &&
+	     snapped[1] != 0 && snapped[3] != 0) ||
+	    (snapped[1] == 0 && snapped[3] == 0 &&
+	     snapped[0] != 0 && snapped[4] != 0))
+		return PIXMAN_XFORM_EXACT;
+
+	return PIXMAN_XFORM_GENERAL;
+}
+
+/* Transform every rectangle of src by m and store the bounding boxes in
+ * dst.  Exact for translations and 90 degree rotations, conservative
+ * otherwise. */
+static void
+transform_region(pixman_region32_t *dst, pixman_region32_t *src,
+		 struct weston_matrix *m)
+{
+	pixman_box32_t *rects, *boxes;
+	struct weston_vector v;
+	float x1, y1, x2, y2;
+	int nrects, i, j;
+
+	rects = pixman_region32_rectangles(src, &nrects);
+	boxes = malloc(nrects * sizeof *boxes);
+	if (nrects == 0 || !boxes) {
+		free(boxes);
+		pixman_region32_init(dst);
+		return;
+	}
+
+	for (i = 0; i < nrects; i++) {
+		for (j = 0; j < 4; j++) {
+			v.f[0] = j & 1 ? rects[i].x2 : rects[i].x1;
+			v.f[1] = j & 2 ? rects[i].y2 : rects[i].y1;
+			v.f[2] = 0;
+			v.f[3] = 1;
+			weston_matrix_transform(m, &v);
+			if (j == 0 || v.f[0] < x1)
+				x1 = v.f[0];
+			if (j == 0 || v.f[0] > x2)
+				x2 = v.f[0];
+			if (j == 0 || v.f[1] < y1)
+				y1 = v.f[1];
+			if (j == 0 || v.f[1] > y2)
+				y2 = v.f[1];
+		}
+		boxes[i].x1 = floorf(x1 + 1.0f / 1024);
+		boxes[i].y1 = floorf(y1 + 1.0f / 1024);
+		boxes[i].x2 = ceilf(x2 - 1.0f / 1024);
+		boxes[i].y2 = ceilf(y2 - 1.0f / 1024);
+	}
+
+	pixman_region32_init_rects(dst, boxes, nrects);
+	free(boxes);
+}
+
+static void
+add_op(struct pixman_job *job, struct weston_surface *es,
+       pixman_region32_t *region, pixman_region32_t *surf_region,
+       pixman_op_t pixman_op, const struct weston_matrix *inverse,
+       enum pixman_xform_kind kind, int32_t snapped[6])
+{
+	struct pixman_draw_op *op;
+	int i;
 
 #if 0
-	weston_log("%s %p %p %p %p %s\n", __func__, es, output, region, surf_region,
+	weston_log("%s %p %p %p %s\n", __func__, es, region, surf_region,
 		pixman_op == PIXMAN_OP_OVER ? "over" : "src");
 #endif
 
+	op = wl_array_add(&job->ops, sizeof *op);
+	if (!op)
+		return;
+
 	/* The final region to be painted is the intersection of
-	 * 'region' and 'surf_region'. However, 'region' is in the global
-	 * coordinates, and 'surf_region' is in the surface-local
-	 * coordinates
-	 */
-	pixman_region32_init(&final_region);
-	pixman_region32_copy(&final_region, surf_region);
+	 * 'region' and 'surf_region', both in framebuffer coordinates
+	 * by now. */
+	pixman_region32_init(&op->region);
+	if (surf_region)
+		pixman_region32_intersect(&op->region, region, surf_region);
+	else
+		pixman_region32_copy(&op->region, region);
+
+	if (!pixman_region32_not_empty(&op->region)) {
+		pixman_region32_fini(&op->region);
+		job->ops.size -= sizeof *op;
+		return;
+	}
 
-	if (es->transform.enabled) {
-		weston_surface_to_global_float(es, 0, 0, &surface_x, &surface_y);
-		pixman_region32_translate(&final_region, (int)surface_x, (int)surface_y);
-	} else
-		pixman_region32_translate(&final_region, es->geometry.x, es->geometry.y);
+	op->surface = es;
+	op->op = pixman_op;
+	op->kind = kind;
 
-	/* That's what we need to paint */
-	pixman_region32_intersect(&final_region, &final_region, region);
+	switch (kind) {
+	case PIXMAN_XFORM_TRANSLATE:
+		op->dx = snapped[2];
+		op->dy = snapped[5];
+		break;
+	case PIXMAN_XFORM_EXACT:
+		pixman_transform_init_identity(&op->transform);
+		for (i = 0; i < 6; i++)
+			op->transform.matrix[i / 3][i % 3] =
+				pixman_int_to_fixed(snapped[i]);
+		break;
+	case PIXMAN_XFORM_GENERAL:
+		pixman_transform_init_identity(&op->transform);
+		op->transform.matrix[0][0] = pixman_double_to_fixed(inverse->d[0]);
+		op->transform.matrix[0][1] = pixman_double_to_fixed(inverse->d[4]);
+		op->transform.matrix[0][2] = pixman_double_to_fixed(inverse->d[12]);
+		op->transform.matrix[1][0] = pixman_double_to_fixed(inverse->d[1]);
+		op->transform.matrix[1][1] = pixman_double_to_fixed(inverse->d[5]);
+		op->transform.matrix[1][2] = pixman_double_to_fixed(inverse->d[13]);
+		break;
+	}
+}
+
+static void
+draw_op(struct pixman_draw_op *op, pixman_image_t *src, pixman_image_t *dest,
+	int32_t y1, int32_t y2)
+{
+	pixman_box32_t *rects;
+	int nrects, i, src_x, src_y;
+	int32_t top, bottom;
+
+	if (op->kind != PIXMAN_XFORM_TRANSLATE) {
+		pixman_image_set_transform(src, &op->transform);
+		pixman_image_set_filter(src,
+					op->kind == PIXMAN_XFORM_EXACT ?
+					PIXMAN_FILTER_NEAREST :
+					PIXMAN_FILTER_BILINEAR,
+					NULL, 0);
+	}
 
-	rects = pixman_region32_rectangles(&final_region, &nrects);
+	rects = pixman_region32_rectangles(&op->region, &nrects);
 
 	for (i = 0; i < nrects; i++) {
+		top = rects[i].y1 > y1 ? rects[i].y1 : y1;
+		bottom = rects[i].y2 < y2 ? rects[i].y2 : y2;
+		if (top >= bottom)
+			continue;
 #if 0
-		weston_log("rect#%d: %d %d %d %d\n", i, rects[i].x1, rects[i].y1, rects[i].x2, rects[i].y2);
+		weston_log("rect#%d: %d %d %d %d\n", i, rects[i].x1, top, rects[i].x2, bottom);
 #endif
-		weston_surface_from_global(es, rects[i].x1, rects[i].y1, &src_x, &src_y);
-#if 0
-		weston_log("src_x: %d, src_y: %d\n", src_x, src_y);
-#endif
-		pixman_image_composite32(pixman_op,
-			ps->image, /* src */
+		/* With a transform set, pixman maps destination pixels
+		 * through it, so source and destination origins match. */
+		src_x = rects[i].x1;
+		src_y = top;
+		if (op->kind == PIXMAN_XFORM_TRANSLATE) {
+			src_x += op->dx;
+			src_y += op->dy;
+		}
+		pixman_image_composite32(op->op,
+			src, /* src */
 			NULL /* mask */,
-			po->hw_buffer, /* dest */
+			dest, /* dest */
 			src_x, src_y, /* src_x, src_y */
 			0, 0, /* mask_x, mask_y */
-			rects[i].x1, rects[i].y1, /* dest_x, dest_y */
+			rects[i].x1, top, /* dest_x, dest_y */
 			rects[i].x2 - rects[i].x1, /* width */
-			rects[i].y2 - rects[i].y1 /* height */);
+			bottom - top /* height */);
+	}
+
+	if (op->kind != PIXMAN_XFORM_TRANSLATE) {
+		pixman_image_set_transform(src, NULL);
+		pixman_image_set_filter(src, PIXMAN_FILTER_NEAREST, NULL, 0);
+	}
+}
+
+/* Composite every op of the job, clipped to one horizontal band.  When
+ * the job is split, each band works on its own image headers over the
+ * shared pixels: pixman images are not safe to use from several threads
+ * at once, but disjoint rows of the same memory are. */
+static void
+run_band(struct pixman_job *job, int band)
+{
+	struct pixman_draw_op *op;
+	struct pixman_surface_state *ps;
+	pixman_image_t *dest, *src;
+	int32_t y1, y2;
+
+	y1 = job->y + job->height * band / job->nbands;
+	y2 = job->y + job->height * (band + 1) / job->nbands;
+
+	if (job->nbands == 1) {
+		wl_array_for_each(op, &job->ops) {
+			ps = get_surface_state(op->surface);
+			draw_op(op, ps->image, job->dest, y1, y2);
+		}
+		return;
+	}
+
+	dest = clone_image(job->dest, NULL);
+	if (!dest)
+		return;
+
+	wl_array_for_each(op, &job->ops) {
+		ps = get_surface_state(op->surface);
+		src = clone_image(ps->image, &ps->color);
+		if (!src)
+			continue;
+		draw_op(op, src, dest, y1, y2);
+		pixman_image_unref(src);
+	}
+
+	pixman_image_unref(dest);
+}
+
+static void *
+worker_thread(void *data)
+{
+	struct pixman_worker *worker = data;
+	struct pixman_renderer *renderer = worker->renderer;
+	uint32_t serial = 0;
+
+	pthread_mutex_lock(&renderer->mutex);
+	while (1) {
+		while (!renderer->quit && renderer->job_serial == serial)
+			pthread_cond_wait(&renderer->job_cond,
+					  &renderer->mutex);
+		if (renderer->quit)
+			break;
+		serial = renderer->job_serial;
+		pthread_mutex_unlock(&renderer->mutex);
+
+		if (worker->band < renderer->job.nbands)
+			run_band(&renderer->job, worker->band);
+
+		pthread_mutex_lock(&renderer->mutex);
+		if (--renderer->jobs_pending == 0)
+			pthread_cond_signal(&renderer->done_cond);
+	}
+	pthread_mutex_unlock(&renderer->mutex);
+
+	return NULL;
+}
+
+static void
+run_job(struct pixman_renderer *renderer)
+{
+	struct pixman_job *job = &renderer->job;
+
+	if (job->nbands == 1) {
+		run_band(job, 0);
+		return;
 	}
-	pixman_region32_fini(&final_region);
+
+	pthread_mutex_lock(&renderer->mutex);
+	renderer->job_serial++;
+	renderer->jobs_pending = renderer->nworkers;
+	pthread_cond_broadcast(&renderer->job_cond);
+	pthread_mutex_unlock(&renderer->mutex);
+
+	run_band(job, 0);
+
+	pthread_mutex_lock(&renderer->mutex);
+	while (renderer->jobs_pending > 0)
+		pthread_cond_wait(&renderer->done_cond, &renderer->mutex);
+	pthread_mutex_unlock(&renderer->mutex);
 }
 
 static void
 draw_surface(struct weston_surface *es, struct weston_output *output,
+	     struct pixman_job *job,
 	     pixman_region32_t *damage) /* in global coordinates */
 {
 	struct pixman_surface_state *ps = get_surface_state(es);
 	/* repaint bounding region in global coordinates: */
 	pixman_region32_t repaint;
+	/* repaint region and surface regions in framebuffer coordinates: */
+	pixman_region32_t fb_repaint, fb_region;
 	/* non-opaque region in surface coordinates: */
 	pixman_region32_t surface_blend;
+	struct weston_matrix matrix, inverse, buffer, global;
+	enum pixman_xform_kind kind;
+	int32_t snapped[6];
 
 	/* No buffer attached */
 	if (!ps->image)
@@ -148,9 +543,32 @@ draw_surface(struct weston_surface *es, struct weston_output *output,
 	if (!pixman_region32_not_empty(&repaint))
 		goto out;
 
-	if (output->zoom.active) {
-		weston_log("pixman renderer does not support zoom\n");
+	/* surface to framebuffer, and framebuffer to buffer: */
+	if (es->transform.enabled) {
+		matrix = es->transform.matrix;
+	} else {
+		weston_matrix_init(&matrix);
+		weston_matrix_translate(&matrix,
+					es->geometry.x, es->geometry.y, 0);
+	}
+	output_fb_matrix(output, &matrix);
+	if (weston_matrix_invert(&inverse, &matrix) < 0)
 		goto out;
+	surface_to_buffer_matrix(es, &buffer);
+	weston_matrix_multiply(&inverse, &buffer);
+
+	weston_matrix_init(&global);
+	output_fb_matrix(output, &global);
+	transform_region(&fb_repaint, &repaint, &global);
+
+	kind = classify_matrix(&inverse, snapped);
+
+	/* Scaled or freely rotated surfaces are filtered, so their edges
+	 * are not pixel exact: blend the whole surface. */
+	if (kind == PIXMAN_XFORM_GENERAL) {
+		add_op(job, es, &fb_repaint, NULL, PIXMAN_OP_OVER,
+		       &inverse, kind, snapped);
+		goto out_fb;
 	}
 
 	/* blended region is whole surface minus opaque region: */
@@ -159,27 +577,67 @@ draw_surface(struct weston_surface *es, struct weston_output *output,
 	pixman_region32_subtract(&surface_blend, &surface_blend, &es->opaque);
 
 	if (pixman_region32_not_empty(&es->opaque)) {
-		repaint_region(es, output, &repaint, &es->opaque, PIXMAN_OP_SRC);
+		transform_region(&fb_region, &es->opaque, &matrix);
+		add_op(job, es, &fb_repaint, &fb_region, PIXMAN_OP_SRC,
+		       &inverse, kind, snapped);
+		pixman_region32_fini(&fb_region);
 	}
 
 	if (pixman_region32_not_empty(&surface_blend)) {
-		repaint_region(es, output, &repaint, &surface_blend, PIXMAN_OP_OVER);
+		transform_region(&fb_region, &surface_blend, &matrix);
+		add_op(job, es, &fb_repaint, &fb_region, PIXMAN_OP_OVER,
+		       &inverse, kind, snapped);
+		pixman_region32_fini(&fb_region);
 	}
 
 	pixman_region32_fini(&surface_blend);
 
+out_fb:
+	pixman_region32_fini(&fb_repaint);
 out:
 	pixman_region32_fini(&repaint);
 }
+
 static void
 repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
+	struct pixman_renderer *renderer = get_renderer(compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_job *job = &renderer->job;
 	struct weston_surface *surface;
-
+	struct pixman_draw_op *op;
+	struct weston_matrix global;
+	pixman_region32_t fb_damage;
+	pixman_box32_t *extents;
+
+	/* Snapshot what to draw on the main thread first, so the
+	 * workers never walk compositor state. */
+	job->ops.size = 0;
 	wl_list_for_each_reverse(surface, &compositor->surface_list, link)
-		if (surface->plane == &compositor->primary_plane)
-			draw_surface(surface, output, damage);
+		if (surface->plane == &compositor->primary_plane &&
+		    !(surface->occluded_mask & (1 << output->id)))
+			draw_surface(surface, output, job, damage);
+
+	/* Bands are cut from the damage as it lands in the framebuffer. */
+	weston_matrix_init(&global);
+	output_fb_matrix(output, &global);
+	transform_region(&fb_damage, damage, &global);
+	extents = pixman_region32_extents(&fb_damage);
+	job->dest = po->hw_buffer;
+	job->y = extents->y1;
+	job->height = extents->y2 - extents->y1;
+	job->nbands = job->height / PIXMAN_MIN_BAND_HEIGHT;
+	if (job->nbands > renderer->nworkers + 1)
+		job->nbands = renderer->nworkers + 1;
+	if (job->nbands < 1)
+		job->nbands = 1;
+
+	run_job(renderer);
+
+	wl_array_for_each(op, &job->ops)
+		pixman_region32_fini(&op->region);
+	pixman_region32_fini(&fb_damage);
 }
 
 static void
@@ -192,6 +650,7 @@ pixman_renderer_repaint_output(struct weston_output *output,
 		return;
 
 	repaint_surfaces(output, output_damage);
+	weston_output_timing_mark(output, WESTON_REPAINT_PHASE_RENDER);
 
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
@@ -282,7 +741,8 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	color.green = green * 255;
 	color.blue = blue * 255;
 	color.alpha = alpha * 255;
-	
+	ps->color = color;
+
 	if (ps->image) {
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
@@ -303,30 +763,107 @@ pixman_renderer_destroy_surface(struct weston_surface *surface)
 	free(ps);
 }
 
+static void
+pixman_renderer_stop_workers(struct pixman_renderer *renderer)
+{
+	int i;
+
+	pthread_mutex_lock(&renderer->mutex);
+	renderer->quit = 1;
+	pthread_cond_broadcast(&renderer->job_cond);
+	pthread_mutex_unlock(&renderer->mutex);
+
+	for (i = 0; i < renderer->nworkers; i++)
+		pthread_join(renderer->workers[i].thread, NULL);
+
+	free(renderer->workers);
+	renderer->workers = NULL;
+	renderer->nworkers = 0;
+	renderer->quit = 0;
+}
+
+WL_EXPORT int
+pixman_renderer_set_threads(struct weston_compositor *ec, int count)
+{
+	struct pixman_renderer *renderer = get_renderer(ec);
+	struct pixman_worker *worker;
+	sigset_t mask, old_mask;
+	int i;
+
+	pixman_renderer_stop_workers(renderer);
+
+	if (count <= 1)
+		return 0;
+
+	renderer->workers = calloc(count - 1, sizeof *renderer->workers);
+	if (!renderer->workers)
+		return -1;
+
+	/* The main loop takes signals through a signalfd, so keep them
+	 * blocked in the workers. */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+	for (i = 0; i < count - 1; i++) {
+		worker = &renderer->workers[i];
+		worker->renderer = renderer;
+		worker->band = i + 1;
+		if (pthread_create(&worker->thread, NULL,
+				   worker_thread, worker) != 0) {
+			weston_log("failed to start pixman render thread\n");
+			break;
+		}
+		renderer->nworkers++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+	weston_log("pixman renderer using %d threads\n",
+		   renderer->nworkers + 1);
+
+	return renderer->nworkers == count - 1 ? 0 : -1;
+}
+
 WL_EXPORT void
 pixman_renderer_destroy(struct weston_compositor *ec)
 {
-	free(ec->renderer);
+	struct pixman_renderer *renderer = get_renderer(ec);
+
+	pixman_renderer_stop_workers(renderer);
+	pthread_cond_destroy(&renderer->done_cond);
+	pthread_cond_destroy(&renderer->job_cond);
+	pthread_mutex_destroy(&renderer->mutex);
+	wl_array_release(&renderer->job.ops);
+
+	free(renderer);
 	ec->renderer = NULL;
 }
 
 WL_EXPORT int
 pixman_renderer_init(struct weston_compositor *ec)
 {
-	struct weston_renderer *renderer;
+	struct pixman_renderer *renderer;
 
-	renderer = malloc(sizeof *renderer);
+	renderer = calloc(1, sizeof *renderer);
 	if (renderer == NULL)
 		return -1;
 
-	renderer->read_pixels = pixman_renderer_read_pixels;
-	renderer->repaint_output = pixman_renderer_repaint_output;
-	renderer->flush_damage = pixman_renderer_flush_damage;
-	renderer->attach = pixman_renderer_attach;
-	renderer->create_surface = pixman_renderer_create_surface;
-	renderer->surface_set_color = pixman_renderer_surface_set_color;
-	renderer->destroy_surface = pixman_renderer_destroy_surface;
-	ec->renderer = renderer;
+	renderer->base.read_pixels = pixman_renderer_read_pixels;
+	renderer->base.output_image = pixman_renderer_output_image;
+	renderer->base.repaint_output = pixman_renderer_repaint_output;
+	renderer->base.flush_damage = pixman_renderer_flush_damage;
+	renderer->base.attach = pixman_renderer_attach;
+	renderer->base.create_surface = pixman_renderer_create_surface;
+	renderer->base.surface_set_color = pixman_renderer_surface_set_color;
+	renderer->base.destroy_surface = pixman_renderer_destroy_surface;
+
+	wl_array_init(&renderer->job.ops);
+	pthread_mutex_init(&renderer->mutex, NULL);
+	pthread_cond_init(&renderer->job_cond, NULL);
+	pthread_cond_init(&renderer->done_cond, NULL);
+
+	ec->renderer = &renderer->base;
+	ec->read_format = PIXMAN_a8r8g8b8;
 
 	return 0;
 }
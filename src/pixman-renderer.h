@@ -29,6 +29,9 @@ pixman_renderer_destroy(struct weston_compositor *ec);
 int
 pixman_renderer_init(struct weston_compositor *ec);
 
+int
+pixman_renderer_set_threads(struct weston_compositor *ec, int count);
+
 int
 pixman_renderer_output_create(struct weston_output *output);
 
@@ -26,12 +26,16 @@
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <sys/uio.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
 
 #include "compositor.h"
 #include "screenshooter-server-protocol.h"
+#include "../shared/os-compatibility.h"
 
-#include "../wcap/wcap-decode.h"
+#include "../wcap/wcap-encode.h"
 
 struct screenshooter {
 	struct wl_object base;
@@ -40,27 +44,111 @@ struct screenshooter {
 	struct wl_client *client;
 	struct weston_process process;
 	struct wl_listener destroy_listener;
-};
-
-struct screenshooter_frame_listener {
-	struct wl_listener listener;
-	struct wl_buffer *buffer;
-	struct wl_resource *resource;
+	struct wl_array allowed_clients;
+	int recorder_queue_length;
+	int recorder_drop_frames;
+	int recorder_keyframe_interval;
+	int recorder_compress;
+	int recorder_all_outputs;
+	int recorder_has_crop;
+	pixman_box32_t recorder_crop;
+	char *recorder_filename;
+	struct wl_list recorder_list;
+	struct wl_list stream_list;
 };
 
 static void
-copy_bgra_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+transform_rect(struct weston_output *output, pixman_box32_t *r)
 {
-	uint8_t *end;
+	pixman_box32_t s = *r;
 
-	end = dst + height * stride;
-	while (dst < end) {
-		memcpy(dst, src, stride);
-		dst += stride;
-		src -= stride;
+	switch(output->transform) {
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		s.x1 = output->width - r->x2;
+		s.x2 = output->width - r->x1;
+		break;
+	default:
+		break;
 	}
+
+        switch(output->transform) {
+        case WL_OUTPUT_TRANSFORM_NORMAL:
+        case WL_OUTPUT_TRANSFORM_FLIPPED:
+		r->x1 = s.x1;
+		r->x2 = s.x2;
+                break;
+        case WL_OUTPUT_TRANSFORM_90:
+        case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+		r->x1 = output->current->width - s.y2;
+		r->y1 = s.x1;
+		r->x2 = output->current->width - s.y1;
+		r->y2 = s.x2;
+                break;
+        case WL_OUTPUT_TRANSFORM_180:
+        case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+		r->x1 = output->current->width - s.x2;
+		r->y1 = output->current->height - s.y2;
+		r->x2 = output->current->width - s.x1;
+		r->y2 = output->current->height - s.y1;
+                break;
+        case WL_OUTPUT_TRANSFORM_270:
+        case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		r->x1 = s.y1; 
+		r->y1 = output->current->height - s.x2;
+		r->x2 = s.y2; 
+		r->y2 = output->current->height - s.x1;
+                break;
+        default:
+                break;
+        }
 }
 
+/* If the renderer keeps the framebuffer in memory as plain xrgb, the
+ * format both screenshots and the wcap encoder want, return it so
+ * pixels can be taken straight out of it instead of being copied by
+ * read_pixels() first. */
+static pixman_image_t *
+get_output_image(struct weston_output *output)
+{
+	struct weston_renderer *renderer = output->compositor->renderer;
+	pixman_image_t *image;
+
+	if (!renderer->output_image ||
+	    output->compositor->read_format != PIXMAN_a8r8g8b8)
+		return NULL;
+
+	image = renderer->output_image(output);
+	if (!image)
+		return NULL;
+
+	switch (pixman_image_get_format(image)) {
+	case PIXMAN_x8r8g8b8:
+	case PIXMAN_a8r8g8b8:
+		return image;
+	default:
+		return NULL;
+	}
+}
+
+/* A screenshot waiting for the next repaint of its output, and then for
+ * the pixels to be read back. */
+struct screenshooter_frame_listener {
+	struct wl_listener listener;
+	struct wl_listener output_destroy_listener;
+	struct wl_listener buffer_destroy_listener;
+	struct wl_buffer *buffer;
+	struct wl_resource *resource;
+	struct weston_output *output;
+	pixman_format_code_t format;
+	/* The captured area in global and in framebuffer coordinates. */
+	pixman_box32_t box, fb_box;
+	/* Send the captured event before done, for version 3 requests. */
+	int send_captured;
+};
+
 static void
 copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
 {
@@ -79,16 +167,162 @@ copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
 }
 
 static void
-copy_rgba_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_row(void *dst, void *src, int bytes, pixman_format_code_t format)
 {
-	uint8_t *end;
+	if (format == PIXMAN_a8b8g8r8)
+		copy_row_swap_RB(dst, src, bytes);
+	else
+		memcpy(dst, src, bytes);
+}
 
-	end = dst + height * stride;
+/* Copy height rows of width pixels, stored bottom-up with a stride of
+ * width * 4 the way read_pixels() returns them, into dst top-down. */
+static void
+copy_yflip(uint8_t *dst, int dst_stride, uint8_t *src,
+	   int width, int height, pixman_format_code_t format)
+{
+	uint8_t *end = dst + height * dst_stride;
+
+	src += width * 4 * (height - 1);
 	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src -= stride;
+		copy_row(dst, src, width * 4, format);
+		dst += dst_stride;
+		src -= width * 4;
+	}
+}
+
+/* Turn rows read bottom-up in place into top-down ones, by swapping
+ * rows from both ends. */
+static int
+yflip_in_place(uint8_t *data, int stride, int height,
+	       pixman_format_code_t format)
+{
+	uint8_t *top = data, *bottom = data + (height - 1) * stride, *row;
+
+	row = malloc(stride);
+	if (row == NULL)
+		return -1;
+
+	while (top < bottom) {
+		memcpy(row, top, stride);
+		copy_row(top, bottom, stride, format);
+		copy_row(bottom, row, stride, format);
+		top += stride;
+		bottom -= stride;
+	}
+	if (top == bottom && format == PIXMAN_a8b8g8r8)
+		copy_row_swap_RB(top, top, stride);
+
+	free(row);
+
+	return 0;
+}
+
+static void
+screenshooter_frame_listener_destroy(struct screenshooter_frame_listener *l)
+{
+	wl_list_remove(&l->output_destroy_listener.link);
+	if (l->buffer)
+		wl_list_remove(&l->buffer_destroy_listener.link);
+	free(l);
+}
+
+static void
+screenshooter_finish(struct screenshooter_frame_listener *l, int failed)
+{
+	pixman_box32_t *box = &l->box;
+
+	/* Without the buffer there's nowhere to put the pixels, and the
+	 * client is normally gone too. */
+	if (l->buffer) {
+		if (l->send_captured && !failed)
+			screenshooter_send_captured(l->resource,
+						    box->x1, box->y1,
+						    box->x2 - box->x1,
+						    box->y2 - box->y1);
+		screenshooter_send_done(l->resource);
+	}
+
+	screenshooter_frame_listener_destroy(l);
+}
+
+static void
+screenshooter_read_done(void *pixels, void *data)
+{
+	struct screenshooter_frame_listener *l = data;
+
+	if (pixels && l->buffer)
+		copy_yflip(wl_shm_buffer_get_data(l->buffer),
+			   wl_shm_buffer_get_stride(l->buffer), pixels,
+			   l->fb_box.x2 - l->fb_box.x1,
+			   l->fb_box.y2 - l->fb_box.y1, l->format);
+
+	screenshooter_finish(l, pixels == NULL);
+}
+
+/* Read the pixels without waiting for the GPU where the renderer can,
+ * otherwise read straight into the client's buffer and flip it there. */
+static int
+screenshooter_read(struct screenshooter_frame_listener *l)
+{
+	struct weston_output *output = l->output;
+	struct weston_renderer *renderer = output->compositor->renderer;
+	pixman_box32_t *r = &l->fb_box;
+	pixman_image_t *image;
+	int32_t stride, width, height, image_stride;
+	uint8_t *d, *s, *pixels;
+	int i;
+
+	width = r->x2 - r->x1;
+	height = r->y2 - r->y1;
+	d = wl_shm_buffer_get_data(l->buffer);
+	stride = wl_shm_buffer_get_stride(l->buffer);
+
+	image = get_output_image(output);
+	if (image) {
+		image_stride = pixman_image_get_stride(image);
+		s = (uint8_t *) pixman_image_get_data(image) +
+			r->y1 * image_stride + r->x1 * 4;
+		for (i = 0; i < height; i++)
+			memcpy(d + i * stride, s + i * image_stride, width * 4);
+		screenshooter_finish(l, 0);
+		return 0;
+	}
+
+	if (renderer->read_pixels_async &&
+	    renderer->read_pixels_async(output, l->format,
+					r->x1, output->current->height - r->y2,
+					width, height,
+					screenshooter_read_done, l) == 0)
+		return 0;
+
+	if (stride == width * 4) {
+		pixels = d;
+	} else {
+		pixels = malloc(width * height * 4);
+		if (pixels == NULL)
+			return -1;
 	}
+
+	if (renderer->read_pixels(output, l->format, pixels,
+				  r->x1, output->current->height - r->y2,
+				  width, height) < 0) {
+		if (pixels != d)
+			free(pixels);
+		return -1;
+	}
+
+	if (pixels == d) {
+		if (yflip_in_place(d, stride, height, l->format) < 0)
+			return -1;
+	} else {
+		copy_yflip(d, stride, pixels, width, height, l->format);
+		free(pixels);
+	}
+
+	screenshooter_finish(l, 0);
+
+	return 0;
 }
 
 static void
@@ -98,61 +332,75 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 		container_of(listener,
 			     struct screenshooter_frame_listener, listener);
 	struct weston_output *output = data;
-	int32_t stride;
-	uint8_t *pixels, *d, *s;
 
 	output->disable_planes--;
 	wl_list_remove(&listener->link);
-	stride = l->buffer->width * 4;
-	pixels = malloc(stride * l->buffer->height);
+	wl_list_init(&listener->link);
 
-	if (pixels == NULL) {
-		wl_resource_post_no_memory(l->resource);
-		free(l);
+	if (l->buffer == NULL) {
+		screenshooter_finish(l, 1);
 		return;
 	}
 
-	output->compositor->renderer->read_pixels(output,
-			     output->compositor->read_format, pixels,
-			     0, 0, output->current->width,
-			     output->current->height);
+	if (screenshooter_read(l) < 0) {
+		wl_resource_post_no_memory(l->resource);
+		screenshooter_frame_listener_destroy(l);
+	}
+}
 
-	stride = wl_shm_buffer_get_stride(l->buffer);
+static void
+screenshooter_output_destroyed(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_frame_listener *l =
+		container_of(listener, struct screenshooter_frame_listener,
+			     output_destroy_listener);
+
+	/* Once the read is under way, the renderer reports it as failed
+	 * when it lets go of the output. */
+	wl_list_remove(&l->output_destroy_listener.link);
+	wl_list_init(&l->output_destroy_listener.link);
+	if (wl_list_empty(&l->listener.link))
+		return;
 
-	d = wl_shm_buffer_get_data(l->buffer);
-	s = pixels + stride * (l->buffer->height - 1);
+	wl_list_remove(&l->listener.link);
+	wl_list_init(&l->listener.link);
+	screenshooter_finish(l, 1);
+}
 
-	switch (output->compositor->read_format) {
-	case PIXMAN_a8r8g8b8:
-		copy_bgra_yflip(d, s, output->current->height, stride);
-		break;
-	case PIXMAN_a8b8g8r8:
-		copy_rgba_yflip(d, s, output->current->height, stride);
-		break;
-	default:
-		break;
-	}
+static void
+screenshooter_buffer_destroyed(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_frame_listener *l =
+		container_of(listener, struct screenshooter_frame_listener,
+			     buffer_destroy_listener);
 
-	screenshooter_send_done(l->resource);
-	free(pixels);
-	free(l);
+	wl_list_remove(&l->buffer_destroy_listener.link);
+	l->buffer = NULL;
 }
 
+/* Capture box, in global coordinates and already clipped to output,
+ * into the top left corner of buffer_resource on the next repaint. */
 static void
-screenshooter_shoot(struct wl_client *client,
-		    struct wl_resource *resource,
-		    struct wl_resource *output_resource,
-		    struct wl_resource *buffer_resource)
+screenshooter_shoot_box(struct wl_resource *resource,
+			struct weston_output *output,
+			struct wl_resource *buffer_resource,
+			pixman_box32_t *box, int send_captured)
 {
-	struct weston_output *output = output_resource->data;
 	struct screenshooter_frame_listener *l;
 	struct wl_buffer *buffer = buffer_resource->data;
+	pixman_box32_t fb_box;
 
 	if (!wl_buffer_is_shm(buffer))
 		return;
 
-	if (buffer->width < output->current->width ||
-	    buffer->height < output->current->height)
+	fb_box.x1 = box->x1 - output->x;
+	fb_box.y1 = box->y1 - output->y;
+	fb_box.x2 = box->x2 - output->x;
+	fb_box.y2 = box->y2 - output->y;
+	transform_rect(output, &fb_box);
+
+	if (buffer->width < fb_box.x2 - fb_box.x1 ||
+	    buffer->height < fb_box.y2 - fb_box.y1)
 		return;
 
 	l = malloc(sizeof *l);
@@ -163,6 +411,17 @@ screenshooter_shoot(struct wl_client *client,
 
 	l->buffer = buffer;
 	l->resource = resource;
+	l->output = output;
+	l->format = output->compositor->read_format;
+	l->box = *box;
+	l->fb_box = fb_box;
+	l->send_captured = send_captured;
+
+	l->buffer_destroy_listener.notify = screenshooter_buffer_destroyed;
+	wl_signal_add(&buffer->resource.destroy_signal,
+		      &l->buffer_destroy_listener);
+	l->output_destroy_listener.notify = screenshooter_output_destroyed;
+	wl_signal_add(&output->destroy_signal, &l->output_destroy_listener);
 
 	l->listener.notify = screenshooter_frame_notify;
 	wl_signal_add(&output->frame_signal, &l->listener);
@@ -170,25 +429,90 @@ screenshooter_shoot(struct wl_client *client,
 	weston_output_schedule_repaint(output);
 }
 
-struct screenshooter_interface screenshooter_implementation = {
-	screenshooter_shoot
-};
+static void
+screenshooter_shoot(struct wl_client *client,
+		    struct wl_resource *resource,
+		    struct wl_resource *output_resource,
+		    struct wl_resource *buffer_resource)
+{
+	struct weston_output *output = output_resource->data;
+	pixman_box32_t box = {
+		output->x, output->y,
+		output->x + output->width, output->y + output->height
+	};
 
+	screenshooter_shoot_box(resource, output, buffer_resource, &box, 0);
+}
+
+/* Clip box to output and shoot what's left, or just answer with done
+ * if nothing is. */
 static void
-bind_shooter(struct wl_client *client,
-	     void *data, uint32_t version, uint32_t id)
+screenshooter_shoot_clipped(struct wl_resource *resource,
+			    struct weston_output *output,
+			    struct wl_resource *buffer_resource,
+			    pixman_box32_t *box)
 {
-	struct screenshooter *shooter = data;
-	struct wl_resource *resource;
+	pixman_region32_t region;
+	pixman_box32_t *extents;
+
+	pixman_region32_init_rect(&region, box->x1, box->y1,
+				  box->x2 - box->x1, box->y2 - box->y1);
+	pixman_region32_intersect(&region, &region, &output->region);
+	extents = pixman_region32_extents(&region);
+	*box = *extents;
+	pixman_region32_fini(&region);
+
+	if (box->x1 >= box->x2 || box->y1 >= box->y2) {
+		screenshooter_send_done(resource);
+		return;
+	}
 
-	resource = wl_client_add_object(client, &screenshooter_interface,
-			     &screenshooter_implementation, id, data);
+	screenshooter_shoot_box(resource, output, buffer_resource, box, 1);
+}
 
-	if (client != shooter->client) {
-		wl_resource_post_error(resource, WL_DISPLAY_ERROR_INVALID_OBJECT,
-				       "screenshooter failed: permission denied");
-		wl_resource_destroy(resource);
+static void
+screenshooter_shoot_region(struct wl_client *client,
+			   struct wl_resource *resource,
+			   struct wl_resource *output_resource,
+			   struct wl_resource *buffer_resource,
+			   int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	pixman_box32_t box = { x, y, x + width, y + height };
+
+	if (width <= 0 || height <= 0) {
+		screenshooter_send_done(resource);
+		return;
 	}
+
+	screenshooter_shoot_clipped(resource, output_resource->data,
+				    buffer_resource, &box);
+}
+
+static void
+screenshooter_shoot_surface(struct wl_client *client,
+			    struct wl_resource *resource,
+			    struct wl_resource *surface_resource,
+			    struct wl_resource *buffer_resource)
+{
+	struct weston_surface *surface = surface_resource->data;
+	struct wl_buffer *buffer = buffer_resource->data;
+	pixman_box32_t box;
+
+	if (surface->output == NULL || !weston_surface_is_mapped(surface)) {
+		screenshooter_send_done(resource);
+		return;
+	}
+
+	/* Take as much of the surface as fits in the buffer, starting
+	 * from its top left corner. */
+	box = *pixman_region32_extents(&surface->transform.boundingbox);
+	if (box.x2 - box.x1 > buffer->width)
+		box.x2 = box.x1 + buffer->width;
+	if (box.y2 - box.y1 > buffer->height)
+		box.y2 = box.y1 + buffer->height;
+
+	screenshooter_shoot_clipped(resource, surface->output,
+				    buffer_resource, &box);
 }
 
 static void
@@ -213,93 +537,201 @@ screenshooter_binding(struct wl_seat *seat, uint32_t time, uint32_t key,
 					screenshooter_exe, screenshooter_sigchld);
 }
 
+/* A damage snapshot taken on the main thread and handed to the encoder
+ * thread.  The pixels of each rectangle are packed back to back, rows
+ * bottom-up, the way read_pixels() returns them. */
+struct weston_recorder_frame {
+	struct wl_list link;
+	uint32_t msecs;
+	int keyframe;
+	int nrects;
+	pixman_box32_t *rects;
+	uint32_t *pixels;
+};
+
 struct weston_recorder {
+	struct wl_list link;
+	struct screenshooter *shooter;
+	struct wl_resource *resource;
 	struct weston_output *output;
-	uint32_t *frame, *rect;
-	uint32_t total;
+	struct wl_listener output_destroy_listener;
+	/* The recorded area, in global and in framebuffer coordinates. */
+	pixman_box32_t crop, fb_crop;
+	struct wcap_writer *writer;
 	int fd;
 	struct wl_listener frame_listener;
 	int count;
+	int write_failed;
+
+	int keyframe_interval;
+	int frames_since_keyframe;
+
+	pixman_region32_t dropped_damage;
+	int dropped;
+	int drop_frames;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t queue_cond;
+	pthread_cond_t space_cond;
+	struct wl_list queue;
+	int queue_length;
+	int max_queue_length;
+	int destroying;
 };
 
-static uint32_t *
-output_run(uint32_t *p, uint32_t delta, int run)
+static void
+weston_recorder_frame_destroy(struct weston_recorder_frame *frame)
 {
-	int i;
+	free(frame->rects);
+	free(frame->pixels);
+	free(frame);
+}
 
-	while (run > 0) {
-		if (run <= 0xe0) {
-			*p++ = delta | ((run - 1) << 24);
-			break;
-		}
+/* Encode one snapshot and append it to the capture file.  Runs on the
+ * recorder thread, which is the only one touching the writer once
+ * recording has started. */
+static void
+weston_recorder_write_frame(struct weston_recorder *recorder,
+			    struct weston_recorder_frame *frame)
+{
+	if (recorder->write_failed)
+		return;
 
-		i = 24 - __builtin_clz(run);
-		*p++ = delta | ((i + 0xe0) << 24);
-		run -= 1 << (7 + i);
+	if (wcap_writer_write_frame(recorder->writer, frame->msecs,
+				    frame->keyframe,
+				    (struct wcap_rectangle *) frame->rects,
+				    frame->nrects, frame->pixels) < 0) {
+		recorder->write_failed = 1;
+		return;
 	}
 
-	return p;
+	recorder->count++;
 }
 
-static uint32_t
-component_delta(uint32_t next, uint32_t prev)
+static void *
+weston_recorder_thread(void *data)
 {
-	unsigned char dr, dg, db;
+	struct weston_recorder *recorder = data;
+	struct weston_recorder_frame *frame;
+	sigset_t mask;
+
+	/* Leave signal handling to the compositor's event loop. */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	pthread_mutex_lock(&recorder->mutex);
+	for (;;) {
+		while (wl_list_empty(&recorder->queue) &&
+		       !recorder->destroying)
+			pthread_cond_wait(&recorder->queue_cond,
+					  &recorder->mutex);
+
+		/* Drain whatever is queued before exiting so a stopped
+		 * recording still ends with the last frames shown. */
+		if (wl_list_empty(&recorder->queue))
+			break;
+
+		frame = container_of(recorder->queue.next,
+				     struct weston_recorder_frame, link);
+		wl_list_remove(&frame->link);
+		recorder->queue_length--;
+		pthread_cond_signal(&recorder->space_cond);
+		pthread_mutex_unlock(&recorder->mutex);
+
+		weston_recorder_write_frame(recorder, frame);
+		weston_recorder_frame_destroy(frame);
 
-	dr = (next >> 16) - (prev >> 16);
-	dg = (next >>  8) - (prev >>  8);
-	db = (next >>  0) - (prev >>  0);
+		pthread_mutex_lock(&recorder->mutex);
+	}
+	pthread_mutex_unlock(&recorder->mutex);
 
-	return (dr << 16) | (dg << 8) | (db << 0);
+	return NULL;
 }
 
-static void
-transform_rect(struct weston_output *output, pixman_box32_t *r)
+/* Copy the damaged rectangles out of the framebuffer.  This is all the
+ * work done on the main thread; encoding and writing is left to the
+ * recorder thread. */
+static struct weston_recorder_frame *
+weston_recorder_capture(struct weston_recorder *recorder,
+			pixman_region32_t *damage, int keyframe)
 {
-	pixman_box32_t s = *r;
+	struct weston_output *output = recorder->output;
+	struct weston_recorder_frame *frame;
+	pixman_box32_t *r;
+	pixman_image_t *image;
+	uint32_t *dst, *src;
+	int i, j, n, width, height, image_stride, size;
+
+	r = pixman_region32_rectangles(damage, &n);
+
+	frame = malloc(sizeof *frame);
+	if (frame == NULL)
+		return NULL;
+
+	frame->msecs = output->frame_time;
+	frame->keyframe = keyframe;
+	frame->nrects = n;
+	frame->rects = malloc(n * sizeof *r);
+	if (frame->rects == NULL) {
+		free(frame);
+		return NULL;
+	}
 
-	switch(output->transform) {
-	case WL_OUTPUT_TRANSFORM_FLIPPED:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		s.x1 = output->width - r->x2;
-		s.x2 = output->width - r->x1;
-		break;
-	default:
-		break;
+	size = 0;
+	for (i = 0; i < n; i++) {
+		frame->rects[i].x1 = r[i].x1 - output->x;
+		frame->rects[i].y1 = r[i].y1 - output->y;
+		frame->rects[i].x2 = r[i].x2 - output->x;
+		frame->rects[i].y2 = r[i].y2 - output->y;
+		transform_rect(output, &frame->rects[i]);
+		size += (frame->rects[i].x2 - frame->rects[i].x1) *
+			(frame->rects[i].y2 - frame->rects[i].y1);
 	}
 
-        switch(output->transform) {
-        case WL_OUTPUT_TRANSFORM_NORMAL:
-        case WL_OUTPUT_TRANSFORM_FLIPPED:
-		r->x1 = s.x1;
-		r->x2 = s.x2;
-                break;
-        case WL_OUTPUT_TRANSFORM_90:
-        case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-		r->x1 = output->current->width - s.y2;
-		r->y1 = s.x1;
-		r->x2 = output->current->width - s.y1;
-		r->y2 = s.x2;
-                break;
-        case WL_OUTPUT_TRANSFORM_180:
-        case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-		r->x1 = output->current->width - s.x2;
-		r->y1 = output->current->height - s.y2;
-		r->x2 = output->current->width - s.x1;
-		r->y2 = output->current->height - s.y1;
-                break;
-        case WL_OUTPUT_TRANSFORM_270:
-        case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		r->x1 = s.y1; 
-		r->y1 = output->current->height - s.x2;
-		r->x2 = s.y2; 
-		r->y2 = output->current->height - s.x1;
-                break;
-        default:
-                break;
-        }
+	frame->pixels = malloc(size * 4);
+	if (frame->pixels == NULL) {
+		free(frame->rects);
+		free(frame);
+		return NULL;
+	}
+
+	image = get_output_image(output);
+	if (image)
+		image_stride = pixman_image_get_stride(image) / 4;
+	else
+		image_stride = 0;
+
+	r = frame->rects;
+	dst = frame->pixels;
+	for (i = 0; i < n; i++) {
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
+
+		if (image) {
+			src = pixman_image_get_data(image) +
+				image_stride * (r[i].y2 - 1) + r[i].x1;
+			for (j = 0; j < height; j++) {
+				memcpy(dst + j * width,
+				       src - j * image_stride, width * 4);
+			}
+		} else {
+			output->compositor->renderer->read_pixels(output,
+				     output->compositor->read_format, dst,
+				     r[i].x1, output->current->height - r[i].y2,
+				     width, height);
+		}
+
+		dst += width * height;
+
+		/* The file only covers the crop. */
+		r[i].x1 -= recorder->fb_crop.x1;
+		r[i].y1 -= recorder->fb_crop.y1;
+		r[i].x2 -= recorder->fb_crop.x1;
+		r[i].y2 -= recorder->fb_crop.y1;
+	}
+
+	return frame;
 }
 
 static void
@@ -308,171 +740,854 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 	struct weston_recorder *recorder =
 		container_of(listener, struct weston_recorder, frame_listener);
 	struct weston_output *output = data;
-	uint32_t msecs = output->frame_time;
-	pixman_box32_t *r;
+	struct weston_recorder_frame *frame;
 	pixman_region32_t damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
-	struct {
-		uint32_t msecs;
-		uint32_t nrects;
-	} header;
-	struct iovec v[2];
-
-	pixman_region32_init(&damage);
-	pixman_region32_intersect(&damage, &output->region,
-				  &output->previous_damage);
-
-	r = pixman_region32_rectangles(&damage, &n);
-	if (n == 0)
+	int full, keyframe;
+
+	keyframe = recorder->frames_since_keyframe < 0 ||
+		(recorder->keyframe_interval > 0 &&
+		 recorder->frames_since_keyframe >=
+		 recorder->keyframe_interval);
+
+	pixman_region32_init_rect(&damage, recorder->crop.x1, recorder->crop.y1,
+				  recorder->crop.x2 - recorder->crop.x1,
+				  recorder->crop.y2 - recorder->crop.y1);
+	if (!keyframe)
+		pixman_region32_intersect(&damage, &damage,
+					  &output->previous_damage);
+
+	/* Frames dropped earlier never made it into the capture, so
+	 * their damage has to be carried over or the decoder would keep
+	 * showing stale pixels there. */
+	pixman_region32_union(&damage, &damage, &recorder->dropped_damage);
+
+	if (!pixman_region32_not_empty(&damage)) {
+		pixman_region32_fini(&damage);
 		return;
+	}
 
-	for (i = 0; i < n; i++)
-		transform_rect(output, &r[i]);
+	pthread_mutex_lock(&recorder->mutex);
+	while (!recorder->drop_frames &&
+	       recorder->queue_length >= recorder->max_queue_length)
+		pthread_cond_wait(&recorder->space_cond, &recorder->mutex);
+	full = recorder->queue_length >= recorder->max_queue_length;
+	pthread_mutex_unlock(&recorder->mutex);
+
+	/* Only the main thread adds to the queue, so the slot seen above
+	 * can't be taken while the pixels are copied out. */
+	frame = full ? NULL :
+		weston_recorder_capture(recorder, &damage, keyframe);
+	if (frame == NULL) {
+		pixman_region32_copy(&recorder->dropped_damage, &damage);
+		recorder->dropped++;
+		pixman_region32_fini(&damage);
+		return;
+	}
 
-	header.msecs = msecs;
-	header.nrects = n;
-	v[0].iov_base = &header;
-	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current->width;
+	pixman_region32_fini(&recorder->dropped_damage);
+	pixman_region32_init(&recorder->dropped_damage);
+	pixman_region32_fini(&damage);
 
-	for (i = 0; i < n; i++) {
-		width = r[i].x2 - r[i].x1;
-		height = r[i].y2 - r[i].y1;
-		output->compositor->renderer->read_pixels(output,
-			     output->compositor->read_format, recorder->rect,
-			     r[i].x1, output->current->height - r[i].y2,
-			     width, height);
-
-		s = recorder->rect;
-		p = recorder->rect;
-		run = prev = 0; /* quiet gcc */
-		for (j = 0; j < height; j++) {
-			d = recorder->frame +
-				stride * (r[i].y2 - j - 1) + r[i].x1;
-			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
-				if (run == 0 || delta == prev) {
-					run++;
-				} else {
-					p = output_run(p, prev, run);
-					run = 1;
-				}
-				prev = delta;
-			}
-		}
+	if (keyframe)
+		recorder->frames_since_keyframe = 0;
+	recorder->frames_since_keyframe++;
 
-		p = output_run(p, prev, run);
+	pthread_mutex_lock(&recorder->mutex);
+	wl_list_insert(recorder->queue.prev, &frame->link);
+	recorder->queue_length++;
+	pthread_cond_signal(&recorder->queue_cond);
+	pthread_mutex_unlock(&recorder->mutex);
+}
 
-		recorder->total += write(recorder->fd,
-					 recorder->rect,
-					 (p - recorder->rect) * 4);
+static void
+weston_recorder_destroy(struct weston_recorder *recorder);
+
+static void
+weston_recorder_output_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_recorder *recorder =
+		container_of(listener, struct weston_recorder,
+			     output_destroy_listener);
 
-#if 0
-		fprintf(stderr,
-			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
-			width, height, r[i].x1, r[i].y1,
-			width * height * 4, (int) (p - recorder->rect) * 4,
-			(float) (p - recorder->rect) / (width * height),
-			recorder->total / 1024 / 1024);
-#endif
+	if (recorder->resource) {
+		screenshooter_recording_send_stopped(recorder->resource);
+		recorder->resource->data = NULL;
 	}
 
-	pixman_region32_fini(&damage);
+	weston_recorder_destroy(recorder);
 }
 
-static void
-weston_recorder_create(struct weston_output *output, const char *filename)
+/* Start recording output, or only the part of it inside crop if that
+ * isn't NULL, to filename.  open_flags is O_TRUNC to overwrite an
+ * existing file or O_EXCL to fail instead. */
+static struct weston_recorder *
+weston_recorder_create(struct screenshooter *shooter,
+		       struct weston_output *output, const char *filename,
+		       pixman_box32_t *crop, int open_flags)
 {
 	struct weston_recorder *recorder;
-	int stride, size;
-	struct { uint32_t magic, format, width, height; } header;
+	uint32_t format, flags;
+	pixman_region32_t region;
+	pixman_box32_t *extents;
 
 	recorder = malloc(sizeof *recorder);
+	if (recorder == NULL)
+		return NULL;
+
+	if (crop) {
+		pixman_region32_init_rect(&region, crop->x1, crop->y1,
+					  crop->x2 - crop->x1,
+					  crop->y2 - crop->y1);
+		pixman_region32_intersect(&region, &region, &output->region);
+	} else {
+		pixman_region32_init(&region);
+		pixman_region32_copy(&region, &output->region);
+	}
+	extents = pixman_region32_extents(&region);
+	recorder->crop = *extents;
+	pixman_region32_fini(&region);
+
+	if (recorder->crop.x1 >= recorder->crop.x2 ||
+	    recorder->crop.y1 >= recorder->crop.y2) {
+		weston_log("recorder region outside of output\n");
+		goto err_free;
+	}
+
+	recorder->fb_crop.x1 = recorder->crop.x1 - output->x;
+	recorder->fb_crop.y1 = recorder->crop.y1 - output->y;
+	recorder->fb_crop.x2 = recorder->crop.x2 - output->x;
+	recorder->fb_crop.y2 = recorder->crop.y2 - output->y;
+	transform_rect(output, &recorder->fb_crop);
 
-	stride = output->current->width;
-	size = stride * 4 * output->current->height;
-	recorder->frame = malloc(size);
-	recorder->rect = malloc(size);
-	recorder->total = 0;
+	recorder->shooter = shooter;
+	recorder->resource = NULL;
 	recorder->count = 0;
+	recorder->dropped = 0;
+	recorder->write_failed = 0;
 	recorder->output = output;
-	memset(recorder->frame, 0, size);
 
-	header.magic = WCAP_HEADER_MAGIC;
+	/* The first frame is always a keyframe, an interval of 0 means
+	 * there are no others. */
+	recorder->keyframe_interval = shooter->recorder_keyframe_interval;
+	recorder->frames_since_keyframe = -1;
 
 	switch (output->compositor->read_format) {
 	case PIXMAN_a8r8g8b8:
-		header.format = WCAP_FORMAT_XRGB8888;
+		format = WCAP_FORMAT_XRGB8888;
 		break;
 	case PIXMAN_a8b8g8r8:
-		header.format = WCAP_FORMAT_XBGR8888;
+		format = WCAP_FORMAT_XBGR8888;
 		break;
 	default:
 		weston_log("unknown recorder format\n");
-		return;
+		goto err_free;
 	}
 
 	recorder->fd = open(filename,
-			    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			    O_WRONLY | O_CREAT | O_CLOEXEC | open_flags, 0644);
 
 	if (recorder->fd < 0) {
 		weston_log("problem opening output file %s: %m\n", filename);
-		return;
+		goto err_free;
 	}
 
-	header.width = output->current->width;
-	header.height = output->current->height;
-	recorder->total += write(recorder->fd, &header, sizeof header);
+	flags = shooter->recorder_compress ? WCAP_WRITER_COMPRESS : 0;
+	recorder->writer = wcap_writer_create(recorder->fd, format,
+			recorder->fb_crop.x2 - recorder->fb_crop.x1,
+			recorder->fb_crop.y2 - recorder->fb_crop.y1, flags);
+	if (recorder->writer == NULL) {
+		weston_log("problem writing output file %s: %m\n", filename);
+		close(recorder->fd);
+		goto err_free;
+	}
+
+	pixman_region32_init(&recorder->dropped_damage);
+	wl_list_init(&recorder->queue);
+	recorder->queue_length = 0;
+	recorder->max_queue_length = shooter->recorder_queue_length;
+	if (recorder->max_queue_length < 1)
+		recorder->max_queue_length = 1;
+	recorder->drop_frames = shooter->recorder_drop_frames;
+	recorder->destroying = 0;
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->queue_cond, NULL);
+	pthread_cond_init(&recorder->space_cond, NULL);
+
+	if (pthread_create(&recorder->thread, NULL,
+			   weston_recorder_thread, recorder) != 0) {
+		weston_log("failed to start recorder thread\n");
+		pthread_cond_destroy(&recorder->space_cond);
+		pthread_cond_destroy(&recorder->queue_cond);
+		pthread_mutex_destroy(&recorder->mutex);
+		pixman_region32_fini(&recorder->dropped_damage);
+		wcap_writer_destroy(recorder->writer);
+		close(recorder->fd);
+		goto err_free;
+	}
 
 	recorder->frame_listener.notify = weston_recorder_frame_notify;
 	wl_signal_add(&output->frame_signal, &recorder->frame_listener);
+	recorder->output_destroy_listener.notify =
+		weston_recorder_output_destroy;
+	wl_signal_add(&output->destroy_signal,
+		      &recorder->output_destroy_listener);
+	wl_list_insert(&shooter->recorder_list, &recorder->link);
 	output->disable_planes++;
 	weston_output_damage(output);
+
+	fprintf(stderr, "starting recorder, file %s, %dx%d, %s encoder\n",
+		filename, recorder->crop.x2 - recorder->crop.x1,
+		recorder->crop.y2 - recorder->crop.y1,
+		wcap_encoder_get_name(wcap_encoder_get(NULL)));
+
+	return recorder;
+
+err_free:
+	free(recorder);
+	return NULL;
 }
 
 static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
+	wl_list_remove(&recorder->link);
 	wl_list_remove(&recorder->frame_listener.link);
+	wl_list_remove(&recorder->output_destroy_listener.link);
+
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->destroying = 1;
+	pthread_cond_signal(&recorder->queue_cond);
+	pthread_mutex_unlock(&recorder->mutex);
+	pthread_join(recorder->thread, NULL);
+
+	if (recorder->write_failed)
+		weston_log("recorder: failed to write frame, "
+			   "capture truncated\n");
+
+	fprintf(stderr,
+		"stopping recorder, total file size %dM, %d frames, "
+		"%d dropped\n",
+		(int) (wcap_writer_get_size(recorder->writer) / (1024 * 1024)),
+		recorder->count, recorder->dropped);
+	wcap_writer_destroy(recorder->writer);
+
+	pthread_cond_destroy(&recorder->space_cond);
+	pthread_cond_destroy(&recorder->queue_cond);
+	pthread_mutex_destroy(&recorder->mutex);
+	pixman_region32_fini(&recorder->dropped_damage);
 	close(recorder->fd);
-	free(recorder->frame);
-	free(recorder->rect);
 	recorder->output->disable_planes--;
 	free(recorder);
 }
 
+/* Started from the key binding, as opposed to by a client. */
+static int
+recorder_is_interactive(struct weston_recorder *recorder)
+{
+	return recorder->resource == NULL;
+}
+
 static void
 recorder_binding(struct wl_seat *seat, uint32_t time, uint32_t key, void *data)
 {
+	struct screenshooter *shooter = data;
 	struct weston_seat *ws = (struct weston_seat *) seat;
 	struct weston_compositor *ec = ws->compositor;
-	struct weston_output *output =
-		container_of(ec->output_list.next,
-			     struct weston_output, link);
-	struct wl_listener *listener;
-	struct weston_recorder *recorder;
-	static const char filename[] = "capture.wcap";
+	struct weston_output *output;
+	struct weston_recorder *recorder, *next;
+	pixman_box32_t *crop;
+	char filename[256];
+	const char *base, *ext;
+	int stopped = 0;
+
+	wl_list_for_each_safe(recorder, next, &shooter->recorder_list, link) {
+		if (recorder_is_interactive(recorder)) {
+			weston_recorder_destroy(recorder);
+			stopped = 1;
+		}
+	}
+	if (stopped)
+		return;
+
+	crop = shooter->recorder_has_crop ? &shooter->recorder_crop : NULL;
+
+	if (!shooter->recorder_all_outputs) {
+		output = container_of(ec->output_list.next,
+				      struct weston_output, link);
+		weston_recorder_create(shooter, output,
+				       shooter->recorder_filename, crop,
+				       O_TRUNC);
+		return;
+	}
 
-	listener = wl_signal_get(&output->frame_signal,
-				 weston_recorder_frame_notify);
-	if (listener) {
-		recorder = container_of(listener, struct weston_recorder,
-					frame_listener);
+	/* One file per output, named after the output id:
+	 * capture.wcap becomes capture-0.wcap, capture-1.wcap, ...
+	 * Only the last path component can have the extension. */
+	base = strrchr(shooter->recorder_filename, '/');
+	base = base ? base + 1 : shooter->recorder_filename;
+	ext = strrchr(base, '.');
+	if (ext == NULL)
+		ext = base + strlen(base);
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		if (crop && (crop->x2 <= output->x ||
+			     crop->x1 >= output->x + output->width ||
+			     crop->y2 <= output->y ||
+			     crop->y1 >= output->y + output->height))
+			continue;
+
+		snprintf(filename, sizeof filename, "%.*s-%u%s",
+			 (int) (ext - shooter->recorder_filename),
+			 shooter->recorder_filename, output->id, ext);
+		weston_recorder_create(shooter, output, filename, crop,
+				       O_TRUNC);
+	}
+}
+
+static void
+recording_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
 
-		fprintf(stderr,
-			"stopping recorder, total file size %dM, %d frames\n",
-			recorder->total / (1024 * 1024), recorder->count);
+static const struct screenshooter_recording_interface recording_implementation = {
+	recording_destroy
+};
 
+static void
+destroy_recording_resource(struct wl_resource *resource)
+{
+	struct weston_recorder *recorder = resource->data;
+
+	if (recorder) {
+		recorder->resource = NULL;
 		weston_recorder_destroy(recorder);
+	}
+
+	free(resource);
+}
+
+static void
+screenshooter_record(struct wl_client *client,
+		     struct wl_resource *resource, uint32_t id,
+		     struct weston_output *output, const char *filename,
+		     pixman_box32_t *crop)
+{
+	struct screenshooter *shooter = resource->data;
+	struct weston_recorder *recorder;
+	struct wl_resource *recording;
+
+	recording = wl_client_add_object(client,
+					 &screenshooter_recording_interface,
+					 &recording_implementation, id, NULL);
+	if (recording == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+	recording->destroy = destroy_recording_resource;
+
+	/* Clients only get to create new files in the compositor's
+	 * working directory, never to overwrite anything. */
+	if (filename[0] == '\0' || filename[0] == '.' ||
+	    strchr(filename, '/')) {
+		weston_log("recorder: refusing file name '%s' from client\n",
+			   filename);
+		screenshooter_recording_send_stopped(recording);
+		return;
+	}
+
+	recorder = weston_recorder_create(shooter, output, filename, crop,
+					  O_EXCL);
+	if (recorder == NULL) {
+		screenshooter_recording_send_stopped(recording);
+		return;
+	}
+
+	recorder->resource = recording;
+	recording->data = recorder;
+}
+
+static void
+screenshooter_record_output(struct wl_client *client,
+			    struct wl_resource *resource, uint32_t id,
+			    struct wl_resource *output_resource,
+			    const char *filename)
+{
+	screenshooter_record(client, resource, id, output_resource->data,
+			     filename, NULL);
+}
+
+static void
+screenshooter_record_region(struct wl_client *client,
+			    struct wl_resource *resource, uint32_t id,
+			    struct wl_resource *output_resource,
+			    const char *filename,
+			    int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	pixman_box32_t crop = { x, y, x + width, y + height };
+
+	screenshooter_record(client, resource, id, output_resource->data,
+			     filename, &crop);
+}
+
+/* A live capture handed to a client through a ring buffer in shared
+ * memory.  Each frame is written to the ring as its damage rectangles,
+ * relative to the streamed area, followed by the pixels of each
+ * rectangle, top-down xrgb.  The client gets the offset of every frame
+ * and releases them in order once it's done with them.  If the client
+ * falls behind and the ring fills up, frames are dropped and their
+ * damage folded into the next one, so repaint never waits on it. */
+struct weston_stream {
+	struct wl_list link;
+	struct wl_resource *resource;
+	struct weston_output *output;
+	struct wl_listener frame_listener;
+	struct wl_listener output_destroy_listener;
+	pixman_box32_t crop, fb_crop;
+
+	int fd;
+	uint8_t *data;
+	uint32_t size;
+	/* Frames sent but not released yet, oldest first. */
+	struct wl_list frame_list;
+
+	int keyframe;
+	pixman_region32_t dropped_damage;
+	int count, dropped;
+};
+
+struct weston_stream_frame {
+	struct wl_list link;
+	uint32_t offset, length;
+};
+
+#define WESTON_STREAM_ALIGN(n) (((n) + 15) & ~15)
+#define WESTON_STREAM_FRAMES 3
+
+/* Find room for length bytes in the ring, after the last frame still
+ * held by the client and before the first one.  Frames are never split
+ * across the end of the ring. */
+static int
+weston_stream_alloc(struct weston_stream *stream, uint32_t length)
+{
+	struct weston_stream_frame *first, *last;
+	uint32_t head, tail;
+
+	if (wl_list_empty(&stream->frame_list))
+		return length <= stream->size ? 0 : -1;
+
+	first = container_of(stream->frame_list.next,
+			     struct weston_stream_frame, link);
+	last = container_of(stream->frame_list.prev,
+			    struct weston_stream_frame, link);
+	tail = first->offset;
+	head = last->offset + last->length;
+
+	if (last->offset >= first->offset) {
+		if (stream->size - head >= length)
+			return head;
+		if (tail >= length)
+			return 0;
+	} else if (tail - head >= length) {
+		return head;
+	}
+
+	return -1;
+}
+
+static int
+weston_stream_capture(struct weston_stream *stream,
+		      pixman_region32_t *damage)
+{
+	struct weston_output *output = stream->output;
+	struct weston_renderer *renderer = output->compositor->renderer;
+	struct weston_stream_frame *frame;
+	pixman_format_code_t format = output->compositor->read_format;
+	pixman_box32_t *r, rect;
+	pixman_image_t *image;
+	int32_t *rects;
+	uint8_t *dst, *src;
+	uint32_t length;
+	int i, j, n, width, height, image_stride, offset;
+
+	r = pixman_region32_rectangles(damage, &n);
+
+	length = n * 4 * sizeof *rects;
+	for (i = 0; i < n; i++)
+		length += (r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1) * 4;
+	length = WESTON_STREAM_ALIGN(length);
+
+	offset = weston_stream_alloc(stream, length);
+	if (offset < 0)
+		return -1;
+
+	frame = malloc(sizeof *frame);
+	if (frame == NULL)
+		return -1;
+	frame->offset = offset;
+	frame->length = length;
+
+	image = get_output_image(output);
+	if (image)
+		image_stride = pixman_image_get_stride(image);
+	else
+		image_stride = 0;
+
+	rects = (int32_t *) (stream->data + offset);
+	dst = (uint8_t *) (rects + n * 4);
+	for (i = 0; i < n; i++) {
+		rect.x1 = r[i].x1 - output->x;
+		rect.y1 = r[i].y1 - output->y;
+		rect.x2 = r[i].x2 - output->x;
+		rect.y2 = r[i].y2 - output->y;
+		transform_rect(output, &rect);
+		width = rect.x2 - rect.x1;
+		height = rect.y2 - rect.y1;
+
+		/* Pixels go straight into the ring, there's no copy
+		 * for the client to wait for. */
+		if (image) {
+			src = (uint8_t *) pixman_image_get_data(image) +
+				rect.y1 * image_stride + rect.x1 * 4;
+			for (j = 0; j < height; j++)
+				memcpy(dst + j * width * 4,
+				       src + j * image_stride, width * 4);
+		} else if (renderer->read_pixels(output, format, dst, rect.x1,
+						 output->current->height -
+						 rect.y2, width, height) < 0 ||
+			   yflip_in_place(dst, width * 4, height,
+					  format) < 0) {
+			free(frame);
+			return -1;
+		}
+		dst += width * height * 4;
+
+		rects[i * 4 + 0] = rect.x1 - stream->fb_crop.x1;
+		rects[i * 4 + 1] = rect.y1 - stream->fb_crop.y1;
+		rects[i * 4 + 2] = rect.x2 - stream->fb_crop.x1;
+		rects[i * 4 + 3] = rect.y2 - stream->fb_crop.y1;
+	}
+
+	wl_list_insert(stream->frame_list.prev, &frame->link);
+	screenshooter_stream_send_frame(stream->resource, output->frame_time,
+					stream->keyframe, n, offset, length);
+
+	return 0;
+}
+
+static void
+weston_stream_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct weston_stream *stream =
+		container_of(listener, struct weston_stream, frame_listener);
+	struct weston_output *output = data;
+	pixman_region32_t damage;
+	pixman_box32_t extents;
+	int n;
+
+	pixman_region32_init_rect(&damage, stream->crop.x1, stream->crop.y1,
+				  stream->crop.x2 - stream->crop.x1,
+				  stream->crop.y2 - stream->crop.y1);
+	if (!stream->keyframe)
+		pixman_region32_intersect(&damage, &damage,
+					  &output->previous_damage);
+	pixman_region32_union(&damage, &damage, &stream->dropped_damage);
+
+	if (!pixman_region32_not_empty(&damage)) {
+		pixman_region32_fini(&damage);
+		return;
+	}
+
+	/* Keep the frame size bounded for very fragmented damage. */
+	pixman_region32_rectangles(&damage, &n);
+	if (n > stream->crop.y2 - stream->crop.y1) {
+		extents = *pixman_region32_extents(&damage);
+		pixman_region32_fini(&damage);
+		pixman_region32_init_rect(&damage, extents.x1, extents.y1,
+					  extents.x2 - extents.x1,
+					  extents.y2 - extents.y1);
+	}
+
+	if (weston_stream_capture(stream, &damage) < 0) {
+		pixman_region32_copy(&stream->dropped_damage, &damage);
+		stream->dropped++;
 	} else {
-		fprintf(stderr, "starting recorder, file %s\n", filename);
-		weston_recorder_create(output, filename);
+		pixman_region32_fini(&stream->dropped_damage);
+		pixman_region32_init(&stream->dropped_damage);
+		stream->keyframe = 0;
+		stream->count++;
+	}
+
+	pixman_region32_fini(&damage);
+}
+
+static void
+weston_stream_destroy(struct weston_stream *stream)
+{
+	struct weston_stream_frame *frame, *next;
+
+	wl_list_remove(&stream->link);
+	wl_list_remove(&stream->frame_listener.link);
+	wl_list_remove(&stream->output_destroy_listener.link);
+	stream->output->disable_planes--;
+
+	wl_list_for_each_safe(frame, next, &stream->frame_list, link)
+		free(frame);
+	pixman_region32_fini(&stream->dropped_damage);
+	munmap(stream->data, stream->size);
+	close(stream->fd);
+
+	weston_log("stopping stream, %d frames, %d dropped\n",
+		   stream->count, stream->dropped);
+
+	free(stream);
+}
+
+static void
+weston_stream_output_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_stream *stream =
+		container_of(listener, struct weston_stream,
+			     output_destroy_listener);
+
+	screenshooter_stream_send_stopped(stream->resource);
+	stream->resource->data = NULL;
+	weston_stream_destroy(stream);
+}
+
+static struct weston_stream *
+weston_stream_create(struct screenshooter *shooter,
+		     struct wl_resource *resource,
+		     struct weston_output *output, pixman_box32_t *crop)
+{
+	struct weston_stream *stream;
+	pixman_region32_t region;
+	uint32_t frame_size;
+	char path[64];
+	int fd;
+
+	/* The pixels are converted to xrgb on the way into the ring, a
+	 * format the renderer can't read back in isn't worth supporting. */
+	if (output->compositor->read_format != PIXMAN_a8r8g8b8 &&
+	    output->compositor->read_format != PIXMAN_a8b8g8r8)
+		return NULL;
+
+	stream = malloc(sizeof *stream);
+	if (stream == NULL)
+		return NULL;
+
+	pixman_region32_init_rect(&region, crop->x1, crop->y1,
+				  crop->x2 - crop->x1, crop->y2 - crop->y1);
+	pixman_region32_intersect(&region, &region, &output->region);
+	stream->crop = *pixman_region32_extents(&region);
+	pixman_region32_fini(&region);
+
+	if (stream->crop.x1 >= stream->crop.x2 ||
+	    stream->crop.y1 >= stream->crop.y2)
+		goto err_free;
+
+	stream->fb_crop.x1 = stream->crop.x1 - output->x;
+	stream->fb_crop.y1 = stream->crop.y1 - output->y;
+	stream->fb_crop.x2 = stream->crop.x2 - output->x;
+	stream->fb_crop.y2 = stream->crop.y2 - output->y;
+	transform_rect(output, &stream->fb_crop);
+
+	/* Room for a few full frames, so a client reading at the frame
+	 * rate never sees a drop.  Frames have at most a rectangle per
+	 * row of the crop, see weston_stream_frame_notify(), and their
+	 * rectangles don't overlap. */
+	frame_size = WESTON_STREAM_ALIGN((stream->fb_crop.x2 - stream->fb_crop.x1) *
+				  (stream->fb_crop.y2 - stream->fb_crop.y1) * 4 +
+				  (stream->crop.y2 - stream->crop.y1) * 16);
+	stream->size = frame_size * WESTON_STREAM_FRAMES;
+
+	fd = os_create_anonymous_file(stream->size);
+	if (fd < 0)
+		goto err_free;
+
+	stream->data = mmap(NULL, stream->size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, fd, 0);
+	if (stream->data == MAP_FAILED) {
+		close(fd);
+		goto err_free;
+	}
+
+	/* The client only reads the ring.  Hand it a read-only fd to the
+	 * same file, so it can't truncate the file and have us die of
+	 * SIGBUS writing the next frame. */
+	snprintf(path, sizeof path, "/proc/self/fd/%d", fd);
+	stream->fd = open(path, O_RDONLY | O_CLOEXEC);
+	close(fd);
+	if (stream->fd < 0) {
+		munmap(stream->data, stream->size);
+		goto err_free;
+	}
+
+	stream->resource = resource;
+	stream->output = output;
+	stream->keyframe = 1;
+	stream->count = 0;
+	stream->dropped = 0;
+	wl_list_init(&stream->frame_list);
+	pixman_region32_init(&stream->dropped_damage);
+
+	stream->frame_listener.notify = weston_stream_frame_notify;
+	wl_signal_add(&output->frame_signal, &stream->frame_listener);
+	stream->output_destroy_listener.notify = weston_stream_output_destroy;
+	wl_signal_add(&output->destroy_signal,
+		      &stream->output_destroy_listener);
+	wl_list_insert(&shooter->stream_list, &stream->link);
+	output->disable_planes++;
+	weston_output_damage(output);
+
+	weston_log("starting stream, %dx%d, %uk ring\n",
+		   stream->crop.x2 - stream->crop.x1,
+		   stream->crop.y2 - stream->crop.y1, stream->size / 1024);
+
+	return stream;
+
+err_free:
+	free(stream);
+	return NULL;
+}
+
+static void
+stream_release(struct wl_client *client, struct wl_resource *resource)
+{
+	struct weston_stream *stream = resource->data;
+	struct weston_stream_frame *frame;
+
+	if (stream == NULL)
+		return;
+
+	if (wl_list_empty(&stream->frame_list)) {
+		wl_resource_post_error(resource,
+				       WL_DISPLAY_ERROR_INVALID_METHOD,
+				       "no frame to release");
+		return;
+	}
+
+	frame = container_of(stream->frame_list.next,
+			     struct weston_stream_frame, link);
+	wl_list_remove(&frame->link);
+	free(frame);
+}
+
+static void
+stream_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct screenshooter_stream_interface stream_implementation = {
+	stream_release,
+	stream_destroy
+};
+
+static void
+destroy_stream_resource(struct wl_resource *resource)
+{
+	struct weston_stream *stream = resource->data;
+
+	if (stream)
+		weston_stream_destroy(stream);
+
+	free(resource);
+}
+
+static void
+screenshooter_stream(struct wl_client *client,
+		     struct wl_resource *resource, uint32_t id,
+		     struct wl_resource *output_resource,
+		     int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	struct screenshooter *shooter = resource->data;
+	struct weston_output *output = output_resource->data;
+	struct weston_stream *stream;
+	struct wl_resource *stream_resource;
+	pixman_box32_t crop = { x, y, x + width, y + height };
+
+	stream_resource = wl_client_add_object(client,
+					       &screenshooter_stream_interface,
+					       &stream_implementation, id, NULL);
+	if (stream_resource == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+	stream_resource->destroy = destroy_stream_resource;
+
+	if (width <= 0 || height <= 0)
+		stream = NULL;
+	else
+		stream = weston_stream_create(shooter, stream_resource,
+					      output, &crop);
+	if (stream == NULL) {
+		screenshooter_stream_send_stopped(stream_resource);
+		return;
+	}
+
+	stream_resource->data = stream;
+	screenshooter_stream_send_buffer(stream_resource, stream->fd,
+					 stream->size,
+					 stream->fb_crop.x2 - stream->fb_crop.x1,
+					 stream->fb_crop.y2 - stream->fb_crop.y1);
+}
+
+struct screenshooter_interface screenshooter_implementation = {
+	screenshooter_shoot,
+	screenshooter_record_output,
+	screenshooter_record_region,
+	screenshooter_shoot_region,
+	screenshooter_shoot_surface,
+	screenshooter_stream
+};
+
+/* Besides the weston-screenshooter started from the key binding, the
+ * executables listed in the clients key of the [screenshooter] section
+ * of weston.ini may use the screenshooter. */
+static int
+screenshooter_client_allowed(struct screenshooter *shooter,
+			     struct wl_client *client)
+{
+	char path[64], exe[PATH_MAX];
+	char **allowed;
+	ssize_t len;
+	pid_t pid;
+
+	if (client == shooter->client)
+		return 1;
+
+	if (shooter->allowed_clients.size == 0)
+		return 0;
+
+	wl_client_get_credentials(client, &pid, NULL, NULL);
+	snprintf(path, sizeof path, "/proc/%d/exe", (int) pid);
+	len = readlink(path, exe, sizeof exe - 1);
+	if (len < 0)
+		return 0;
+	exe[len] = '\0';
+
+	wl_array_for_each(allowed, &shooter->allowed_clients)
+		if (strcmp(*allowed, exe) == 0)
+			return 1;
+
+	return 0;
+}
+
+static void
+bind_shooter(struct wl_client *client,
+	     void *data, uint32_t version, uint32_t id)
+{
+	struct screenshooter *shooter = data;
+	struct wl_resource *resource;
+
+	resource = wl_client_add_object(client, &screenshooter_interface,
+			     &screenshooter_implementation, id, data);
+
+	if (!screenshooter_client_allowed(shooter, client)) {
+		wl_resource_post_error(resource, WL_DISPLAY_ERROR_INVALID_OBJECT,
+				       "screenshooter failed: permission denied");
+		wl_resource_destroy(resource);
 	}
 }
 
@@ -481,25 +1596,141 @@ screenshooter_destroy(struct wl_listener *listener, void *data)
 {
 	struct screenshooter *shooter =
 		container_of(listener, struct screenshooter, destroy_listener);
+	struct weston_recorder *recorder, *next;
+	struct weston_stream *stream, *snext;
+	char **allowed;
+
+	wl_list_for_each_safe(recorder, next, &shooter->recorder_list, link) {
+		if (recorder->resource)
+			recorder->resource->data = NULL;
+		weston_recorder_destroy(recorder);
+	}
+
+	wl_list_for_each_safe(stream, snext, &shooter->stream_list, link) {
+		stream->resource->data = NULL;
+		weston_stream_destroy(stream);
+	}
 
 	wl_display_remove_global(shooter->ec->wl_display, shooter->global);
+	wl_array_for_each(allowed, &shooter->allowed_clients)
+		free(*allowed);
+	wl_array_release(&shooter->allowed_clients);
+	free(shooter->recorder_filename);
 	free(shooter);
 }
 
+/* clients is a comma separated list of executables, which are looked
+ * up by their real path, as /proc/<pid>/exe reports it. */
+static void
+screenshooter_add_allowed_clients(struct screenshooter *shooter,
+				  char *clients)
+{
+	char *name, *save, *path, **allowed;
+
+	for (name = strtok_r(clients, ",", &save); name;
+	     name = strtok_r(NULL, ",", &save)) {
+		path = realpath(name, NULL);
+		if (path == NULL) {
+			weston_log("screenshooter: ignoring client %s: %m\n",
+				   name);
+			continue;
+		}
+
+		allowed = wl_array_add(&shooter->allowed_clients,
+				       sizeof *allowed);
+		if (allowed == NULL) {
+			free(path);
+			return;
+		}
+		*allowed = path;
+		weston_log("screenshooter: allowing %s\n", path);
+	}
+}
+
 void
-screenshooter_create(struct weston_compositor *ec)
+screenshooter_create(struct weston_compositor *ec, const char *config_file)
 {
 	struct screenshooter *shooter;
+	int queue_length = 8, drop_frames = 1;
+	int keyframe_interval = 300, compress = 1;
+	char *output = NULL, *crop = NULL, *filename = NULL, *clients = NULL;
+	const struct config_key screenshooter_config_keys[] = {
+		{ "clients", CONFIG_KEY_STRING, &clients },
+	};
+	const struct config_key recorder_config_keys[] = {
+		{ "output", CONFIG_KEY_STRING, &output },
+		{ "crop", CONFIG_KEY_STRING, &crop },
+		{ "filename", CONFIG_KEY_STRING, &filename },
+		{ "queue-length", CONFIG_KEY_INTEGER, &queue_length },
+		{ "drop-frames", CONFIG_KEY_BOOLEAN, &drop_frames },
+		{ "keyframe-interval", CONFIG_KEY_INTEGER, &keyframe_interval },
+		{ "compress", CONFIG_KEY_BOOLEAN, &compress },
+	};
+	const struct config_section cs[] = {
+		{ "screenshooter",
+		  screenshooter_config_keys,
+		  ARRAY_LENGTH(screenshooter_config_keys) },
+		{ "recorder",
+		  recorder_config_keys, ARRAY_LENGTH(recorder_config_keys) },
+	};
+
+	parse_config_file(config_file, cs, ARRAY_LENGTH(cs), NULL);
 
 	shooter = malloc(sizeof *shooter);
-	if (shooter == NULL)
+	if (shooter == NULL) {
+		free(output);
+		free(crop);
+		free(filename);
+		free(clients);
 		return;
+	}
 
 	shooter->base.interface = &screenshooter_interface;
 	shooter->base.implementation =
 		(void(**)(void)) &screenshooter_implementation;
 	shooter->ec = ec;
 	shooter->client = NULL;
+	shooter->recorder_queue_length = queue_length;
+	shooter->recorder_drop_frames = drop_frames;
+	shooter->recorder_keyframe_interval = keyframe_interval;
+	shooter->recorder_compress = compress;
+	wl_list_init(&shooter->recorder_list);
+	wl_list_init(&shooter->stream_list);
+
+	wl_array_init(&shooter->allowed_clients);
+	if (clients) {
+		screenshooter_add_allowed_clients(shooter, clients);
+		free(clients);
+	}
+
+	shooter->recorder_all_outputs = 0;
+	if (output && strcmp(output, "all") == 0)
+		shooter->recorder_all_outputs = 1;
+	else if (output && strcmp(output, "first") != 0)
+		weston_log("recorder: unknown output '%s', "
+			   "recording the first output\n", output);
+	free(output);
+
+	/* crop=x,y,width,height in global coordinates */
+	shooter->recorder_has_crop = 0;
+	if (crop) {
+		int x, y, width, height;
+
+		if (sscanf(crop, "%d,%d,%d,%d",
+			   &x, &y, &width, &height) == 4 &&
+		    width > 0 && height > 0) {
+			shooter->recorder_crop.x1 = x;
+			shooter->recorder_crop.y1 = y;
+			shooter->recorder_crop.x2 = x + width;
+			shooter->recorder_crop.y2 = y + height;
+			shooter->recorder_has_crop = 1;
+		} else {
+			weston_log("recorder: invalid crop '%s'\n", crop);
+		}
+		free(crop);
+	}
+
+	shooter->recorder_filename = filename ? filename : strdup("capture.wcap");
 
 	shooter->global = wl_display_add_global(ec->wl_display,
 						&screenshooter_interface,
@@ -570,6 +570,7 @@ activate_workspace(struct desktop_shell *shell, unsigned int index)
 
 	ws = get_workspace(shell, index);
 	wl_list_insert(&shell->panel_layer.link, &ws->layer.link);
+	weston_compositor_mark_layers_dirty(shell->compositor);
 
 	shell->workspaces.current = index;
 }
@@ -687,6 +688,7 @@ finish_workspace_change_animation(struct desktop_shell *shell,
 	shell->workspaces.anim_to = NULL;
 
 	wl_list_remove(&shell->workspaces.anim_from->layer.link);
+	weston_compositor_mark_layers_dirty(shell->compositor);
 }
 
 static void
@@ -769,6 +771,7 @@ animate_workspace_change(struct desktop_shell *shell,
 		       &shell->workspaces.animation.link);
 
 	wl_list_insert(from->layer.link.prev, &to->layer.link);
+	weston_compositor_mark_layers_dirty(shell->compositor);
 
 	workspace_translate_in(to, 0);
 
@@ -784,6 +787,7 @@ update_workspace(struct desktop_shell *shell, unsigned int index,
 	shell->workspaces.current = index;
 	wl_list_insert(&from->layer.link, &to->layer.link);
 	wl_list_remove(&from->layer.link);
+	weston_compositor_mark_layers_dirty(shell->compositor);
 }
 
 static void
@@ -862,6 +866,7 @@ move_surface_to_workspace(struct desktop_shell *shell,
 
 	wl_list_remove(&surface->layer_link);
 	wl_list_insert(&to->layer.surface_list, &surface->layer_link);
+	weston_compositor_mark_layers_dirty(shell->compositor);
 
 	drop_focus_state(shell, from, surface);
 	wl_list_for_each(seat, &shell->compositor->seat_list, link)
@@ -894,6 +899,7 @@ take_surface_to_workspace_by_seat(struct desktop_shell *shell,
 
 	wl_list_remove(&surface->layer_link);
 	wl_list_insert(&to->layer.surface_list, &surface->layer_link);
+	weston_compositor_mark_layers_dirty(shell->compositor);
 
 	replace_focus_state(shell, to, seat);
 	drop_focus_state(shell, from, surface);
@@ -902,6 +908,7 @@ take_surface_to_workspace_by_seat(struct desktop_shell *shell,
 	    shell->workspaces.anim_to == from) {
 		wl_list_remove(&to->layer.link);
 		wl_list_insert(from->layer.link.prev, &to->layer.link);
+		weston_compositor_mark_layers_dirty(shell->compositor);
 
 		reverse_workspace_change_animation(shell, index, from, to);
 		broadcast_current_workspace_state(shell);
@@ -1451,6 +1458,7 @@ shell_unset_fullscreen(struct shell_surface *shsurf)
 	ws = get_current_workspace(shsurf->shell);
 	wl_list_remove(&shsurf->surface->layer_link);
 	wl_list_insert(&ws->layer.surface_list, &shsurf->surface->layer_link);
+	weston_compositor_mark_layers_dirty(shsurf->surface->compositor);
 }
 
 static int
@@ -1663,6 +1671,7 @@ shell_configure_fullscreen(struct shell_surface *shsurf)
 	wl_list_remove(&shsurf->fullscreen.black_surface->layer_link);
 	wl_list_insert(&surface->layer_link,
 		       &shsurf->fullscreen.black_surface->layer_link);
+	weston_compositor_mark_layers_dirty(surface->compositor);
 	shsurf->fullscreen.black_surface->output = output;
 
 	switch (shsurf->fullscreen.type) {
@@ -1729,6 +1738,7 @@ shell_stack_fullscreen(struct shell_surface *shsurf)
 	wl_list_remove(&surface->layer_link);
 	wl_list_insert(&shell->fullscreen_layer.surface_list,
 		       &surface->layer_link);
+	weston_compositor_mark_layers_dirty(surface->compositor);
 	weston_surface_damage(surface);
 
 	if (!shsurf->fullscreen.black_surface)
@@ -1742,6 +1752,7 @@ shell_stack_fullscreen(struct shell_surface *shsurf)
 	wl_list_remove(&shsurf->fullscreen.black_surface->layer_link);
 	wl_list_insert(&surface->layer_link,
 		       &shsurf->fullscreen.black_surface->layer_link);
+	weston_compositor_mark_layers_dirty(surface->compositor);
 	weston_surface_damage(shsurf->fullscreen.black_surface);
 }
 
@@ -2134,6 +2145,7 @@ configure_static_surface(struct weston_surface *es, struct weston_layer *layer)
 
 	if (wl_list_empty(&es->layer_link)) {
 		wl_list_insert(&layer->surface_list, &es->layer_link);
+		weston_compositor_mark_layers_dirty(es->compositor);
 		weston_compositor_schedule_repaint(es->compositor);
 	}
 }
@@ -2214,6 +2226,7 @@ lock_surface_configure(struct weston_surface *surface, int32_t sx, int32_t sy)
 	if (!weston_surface_is_mapped(surface)) {
 		wl_list_insert(&shell->lock_layer.surface_list,
 			       &surface->layer_link);
+		weston_compositor_mark_layers_dirty(surface->compositor);
 		weston_surface_update_transform(surface);
 		weston_compositor_wake(shell->compositor);
 	}
@@ -2276,6 +2289,7 @@ resume_desktop(struct desktop_shell *shell)
 	} else {
 		wl_list_insert(&shell->panel_layer.link, &ws->layer.link);
 	}
+	weston_compositor_mark_layers_dirty(shell->compositor);
 
 	restore_focus_state(shell, get_current_workspace(shell));
 
@@ -2737,6 +2751,7 @@ lock(struct wl_listener *listener, void *data)
 	wl_list_remove(&ws->layer.link);
 	wl_list_insert(&shell->compositor->cursor_layer.link,
 		       &shell->lock_layer.link);
+	weston_compositor_mark_layers_dirty(shell->compositor);
 
 	launch_screensaver(shell);
 
@@ -2783,6 +2798,7 @@ show_input_panels(struct wl_listener *listener, void *data)
 	if (!shell->locked)
 		wl_list_insert(&shell->panel_layer.link,
 			       &shell->input_panel_layer.link);
+	weston_compositor_mark_layers_dirty(shell->compositor);
 
 	wl_list_for_each_safe(surface, next,
 			      &shell->input_panel.surfaces, link) {
@@ -2806,8 +2822,10 @@ hide_input_panels(struct wl_listener *listener, void *data)
 
 	shell->showing_input_panels = false;
 
-	if (!shell->locked)
+	if (!shell->locked) {
 		wl_list_remove(&shell->input_panel_layer.link);
+		weston_compositor_mark_layers_dirty(shell->compositor);
+	}
 
 	wl_list_for_each_safe(surface, next,
 			      &shell->input_panel_layer.surface_list, layer_link)
@@ -2947,6 +2965,7 @@ map(struct desktop_shell *shell, struct weston_surface *surface,
 		wl_list_insert(&ws->layer.surface_list, &surface->layer_link);
 		break;
 	}
+	weston_compositor_mark_layers_dirty(shell->compositor);
 
 	if (surface_type != SHELL_SURFACE_NONE) {
 		weston_surface_update_transform(surface);
@@ -3162,6 +3181,7 @@ screensaver_configure(struct weston_surface *surface, int32_t sx, int32_t sy)
 	if (wl_list_empty(&surface->layer_link)) {
 		wl_list_insert(shell->lock_layer.surface_list.prev,
 			       &surface->layer_link);
+		weston_compositor_mark_layers_dirty(surface->compositor);
 		weston_surface_update_transform(surface);
 		shell->compositor->idle_time = shell->screensaver.duration;
 		weston_compositor_wake(shell->compositor);
@@ -162,6 +162,7 @@ tablet_shell_surface_configure(struct weston_surface *surface,
 			       &surface->layer_link);
 	}
 
+	weston_compositor_mark_layers_dirty(surface->compositor);
 	weston_surface_update_transform(surface);
 }
 
@@ -0,0 +1,189 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/drm-plane-assign.h"
+
+#define WIDTH		1920
+#define HEIGHT		1080
+#define SCENES		256
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+/* A stack of windows at random places, a few of them with buffers that
+ * could go on an overlay, and a cursor on top. */
+static void
+fill_scene(struct drm_plane_candidate *c, int count)
+{
+	int i, w, h;
+
+	for (i = 0; i < count; i++) {
+		memset(&c[i], 0, sizeof c[i]);
+		if (i == 0) {
+			w = h = 32;
+			c[i].kinds = DRM_PLANE_KIND_BIT(DRM_PLANE_CURSOR);
+			c[i].commit_rate = 0.0f;
+		} else {
+			w = 64 + rand() % (WIDTH / 2);
+			h = 64 + rand() % (HEIGHT / 2);
+			if (rand() % 3 == 0)
+				c[i].kinds =
+					DRM_PLANE_KIND_BIT(DRM_PLANE_OVERLAY);
+			c[i].commit_rate = rand() % 4 ? 0.0f : rand() % 61;
+		}
+		c[i].box.x1 = rand() % (WIDTH - w);
+		c[i].box.y1 = rand() % (HEIGHT - h);
+		c[i].box.x2 = c[i].box.x1 + w;
+		c[i].box.y2 = c[i].box.y1 + h;
+		c[i].opaque = rand() % 4 != 0;
+	}
+}
+
+static int
+overlaps(const struct drm_plane_box *a, const struct drm_plane_box *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+		a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+/* What drm_assign_planes() used to do: take the first plane that fits,
+ * from the top of the stack down, under the same stacking rules. */
+static uint64_t
+assign_greedy(const struct drm_plane_layout *layout,
+	      struct drm_plane_candidate *c, int count)
+{
+	static const enum drm_plane_kind order[] = {
+		DRM_PLANE_CURSOR, DRM_PLANE_SCANOUT, DRM_PLANE_OVERLAY
+	};
+	static const int z[DRM_PLANE_KIND_COUNT] = { 0, 0, 1, 2 };
+	int used[DRM_PLANE_KIND_COUNT] = { 0 };
+	uint64_t score = 0;
+	int i, j, k, blocked;
+
+	for (i = 0; i < count; i++) {
+		c[i].assigned = DRM_PLANE_PRIMARY;
+		if (used[DRM_PLANE_SCANOUT])
+			continue;
+
+		for (k = 0; k < 3; k++) {
+			if (!(c[i].kinds & DRM_PLANE_KIND_BIT(order[k])) ||
+			    used[order[k]] >= layout->count[order[k]])
+				continue;
+
+			blocked = 0;
+			for (j = 0; j < i; j++)
+				if (z[c[j].assigned] <= z[order[k]] &&
+				    overlaps(&c[j].box, &c[i].box))
+					blocked = 1;
+			if (blocked)
+				continue;
+
+			c[i].assigned = order[k];
+			used[order[k]]++;
+			break;
+		}
+
+		score += drm_plane_score(layout, &c[i], c[i].assigned);
+	}
+
+	return score;
+}
+
+static void
+run_bench(int count, int overlays)
+{
+	struct drm_plane_layout layout;
+	struct drm_plane_candidate *scenes;
+	unsigned long n = 0;
+	double t, saved = 0.0, greedy = 0.0;
+	int i;
+
+	memset(&layout, 0, sizeof layout);
+	layout.output.x2 = WIDTH;
+	layout.output.y2 = HEIGHT;
+	layout.count[DRM_PLANE_SCANOUT] = 1;
+	layout.count[DRM_PLANE_OVERLAY] = overlays;
+	layout.count[DRM_PLANE_CURSOR] = 1;
+
+	scenes = malloc(SCENES * count * sizeof *scenes);
+	if (!scenes) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	srand(count * 16 + overlays);
+	for (i = 0; i < SCENES; i++)
+		fill_scene(scenes + i * count, count);
+
+	for (i = 0; i < SCENES; i++)
+		greedy += assign_greedy(&layout, scenes + i * count, count);
+
+	reset_timer();
+	do {
+		i = n % SCENES;
+		saved += drm_plane_assign(&layout, scenes + i * count, count);
+		n++;
+		t = read_timer();
+	} while (t < 1.0 || n < SCENES);
+
+	printf("%3d surfaces %d overlays: %8.1f us per assignment, "
+	       "saves %6.1f MB/s, greedy %6.1f MB/s\n",
+	       count, overlays, t / n * 1e6,
+	       saved / n / (1024 * 1024),
+	       greedy / SCENES / (1024 * 1024));
+
+	free(scenes);
+}
+
+int main(void)
+{
+	static const int counts[] = { 4, 8, 16, 32, 64 };
+	unsigned int i;
+
+	for (i = 0; i < sizeof counts / sizeof counts[0]; i++) {
+		run_bench(counts[i], 1);
+		run_bench(counts[i], 3);
+	}
+
+	return 0;
+}
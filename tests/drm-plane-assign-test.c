@@ -0,0 +1,223 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "weston-test-runner.h"
+#include "../src/drm-plane-assign.h"
+
+#define PRIMARY	DRM_PLANE_KIND_BIT(DRM_PLANE_PRIMARY)
+#define SCANOUT	DRM_PLANE_KIND_BIT(DRM_PLANE_SCANOUT)
+#define OVERLAY	DRM_PLANE_KIND_BIT(DRM_PLANE_OVERLAY)
+#define CURSOR	DRM_PLANE_KIND_BIT(DRM_PLANE_CURSOR)
+
+static void
+init_layout(struct drm_plane_layout *layout, int overlays)
+{
+	memset(layout, 0, sizeof *layout);
+	layout->output.x2 = 1024;
+	layout->output.y2 = 768;
+	layout->count[DRM_PLANE_SCANOUT] = 1;
+	layout->count[DRM_PLANE_OVERLAY] = overlays;
+	layout->count[DRM_PLANE_CURSOR] = 1;
+}
+
+static void
+init_candidate(struct drm_plane_candidate *c, int32_t x, int32_t y,
+	       int32_t w, int32_t h, uint32_t kinds, float commit_rate)
+{
+	memset(c, 0, sizeof *c);
+	c->box.x1 = x;
+	c->box.y1 = y;
+	c->box.x2 = x + w;
+	c->box.y2 = y + h;
+	c->kinds = kinds;
+	c->opaque = 1;
+	c->commit_rate = commit_rate;
+}
+
+TEST(score)
+{
+	struct drm_plane_layout layout;
+	struct drm_plane_candidate c;
+
+	init_layout(&layout, 1);
+	init_candidate(&c, 0, 0, 100, 100, OVERLAY, 0.0f);
+
+	assert(drm_plane_score(&layout, &c, DRM_PLANE_PRIMARY) == 0);
+	assert(drm_plane_score(&layout, &c, DRM_PLANE_OVERLAY) ==
+	       100 * 100 * 4 * 2);
+
+	/* Blending also reads what is underneath. */
+	c.opaque = 0;
+	assert(drm_plane_score(&layout, &c, DRM_PLANE_OVERLAY) ==
+	       100 * 100 * 4 * 3);
+
+	/* Only the part on the output counts. */
+	c.opaque = 1;
+	c.box.x1 = -50;
+	c.box.x2 = 50;
+	assert(drm_plane_score(&layout, &c, DRM_PLANE_OVERLAY) ==
+	       50 * 100 * 4 * 2);
+
+	c.commit_rate = 59.0f;
+	assert(drm_plane_score(&layout, &c, DRM_PLANE_OVERLAY) ==
+	       50 * 100 * 4 * 2 * 60);
+	assert(drm_plane_score(&layout, &c, DRM_PLANE_SCANOUT) ==
+	       1024 * 768 * 4 * 2 * 60);
+}
+
+TEST(empty)
+{
+	struct drm_plane_layout layout;
+
+	init_layout(&layout, 2);
+	assert(drm_plane_assign(&layout, NULL, 0) == 0);
+}
+
+TEST(prefer_busy_surface)
+{
+	struct drm_plane_layout layout;
+	struct drm_plane_candidate c[2];
+
+	/* A greedy pass would give the only overlay to the top surface,
+	 * but the video below saves far more. */
+	init_layout(&layout, 1);
+	init_candidate(&c[0], 0, 0, 300, 300, OVERLAY, 0.0f);
+	init_candidate(&c[1], 400, 0, 320, 240, OVERLAY, 30.0f);
+
+	drm_plane_assign(&layout, c, 2);
+	assert(c[0].assigned == DRM_PLANE_PRIMARY);
+	assert(c[1].assigned == DRM_PLANE_OVERLAY);
+
+	/* With two overlays both go on one. */
+	init_layout(&layout, 2);
+	drm_plane_assign(&layout, c, 2);
+	assert(c[0].assigned == DRM_PLANE_OVERLAY);
+	assert(c[1].assigned == DRM_PLANE_OVERLAY);
+}
+
+TEST(stacking)
+{
+	struct drm_plane_layout layout;
+	struct drm_plane_candidate c[4];
+
+	init_layout(&layout, 2);
+
+	/* A cursor over an overlay is fine, but nothing can go on an
+	 * overlay under a surface that stays on the primary plane, and
+	 * overlays must not overlap each other. */
+	init_candidate(&c[0], 110, 110, 32, 32, CURSOR, 0.0f);
+	init_candidate(&c[1], 100, 100, 200, 200, OVERLAY, 60.0f);
+	init_candidate(&c[2], 150, 150, 200, 200, OVERLAY, 30.0f);
+	init_candidate(&c[3], 500, 100, 200, 200, OVERLAY, 30.0f);
+
+	drm_plane_assign(&layout, c, 4);
+	assert(c[0].assigned == DRM_PLANE_CURSOR);
+	assert(c[1].assigned == DRM_PLANE_OVERLAY);
+	assert(c[2].assigned == DRM_PLANE_PRIMARY);
+	assert(c[3].assigned == DRM_PLANE_OVERLAY);
+
+	/* A surface on the primary plane blocks what is below. */
+	init_candidate(&c[0], 0, 0, 1024, 768, 0, 0.0f);
+	drm_plane_assign(&layout, c, 4);
+	assert(c[1].assigned == DRM_PLANE_PRIMARY);
+	assert(c[2].assigned == DRM_PLANE_PRIMARY);
+	assert(c[3].assigned == DRM_PLANE_PRIMARY);
+}
+
+TEST(scanout)
+{
+	struct drm_plane_layout layout;
+	struct drm_plane_candidate c[3];
+
+	init_layout(&layout, 1);
+
+	/* Fullscreen video with a cursor on top, nothing below it can
+	 * use a plane. */
+	init_candidate(&c[0], 500, 300, 32, 32, CURSOR, 0.0f);
+	init_candidate(&c[1], 0, 0, 1024, 768, SCANOUT | OVERLAY, 24.0f);
+	init_candidate(&c[2], 0, 0, 300, 300, OVERLAY, 60.0f);
+
+	drm_plane_assign(&layout, c, 3);
+	assert(c[0].assigned == DRM_PLANE_CURSOR);
+	assert(c[1].assigned == DRM_PLANE_SCANOUT);
+	assert(c[2].assigned == DRM_PLANE_PRIMARY);
+
+	/* Without the scanout plane the video takes the overlay. */
+	layout.count[DRM_PLANE_SCANOUT] = 0;
+	drm_plane_assign(&layout, c, 3);
+	assert(c[1].assigned == DRM_PLANE_OVERLAY);
+	assert(c[2].assigned == DRM_PLANE_PRIMARY);
+}
+
+TEST(fixed)
+{
+	struct drm_plane_layout layout;
+	struct drm_plane_candidate c[2];
+
+	init_layout(&layout, 1);
+	init_candidate(&c[0], 0, 0, 100, 100, OVERLAY, 0.0f);
+	init_candidate(&c[1], 200, 0, 300, 300, OVERLAY, 60.0f);
+
+	/* As when putting c[0] on its overlay worked, then the overlay
+	 * was found not to support c[1]'s format. */
+	c[0].fixed = 1;
+	c[0].assigned = DRM_PLANE_OVERLAY;
+	c[1].kinds &= ~OVERLAY;
+
+	drm_plane_assign(&layout, c, 2);
+	assert(c[0].assigned == DRM_PLANE_OVERLAY);
+	assert(c[1].assigned == DRM_PLANE_PRIMARY);
+
+	/* A fixed surface keeps its overlay, even if c[1] would save
+	 * more. */
+	c[1].kinds |= OVERLAY;
+	drm_plane_assign(&layout, c, 2);
+	assert(c[0].assigned == DRM_PLANE_OVERLAY);
+	assert(c[1].assigned == DRM_PLANE_PRIMARY);
+}
+
+TEST(many_surfaces)
+{
+	struct drm_plane_layout layout;
+	struct drm_plane_candidate c[64];
+	int i, overlays = 0;
+
+	init_layout(&layout, 3);
+	for (i = 0; i < 64; i++)
+		init_candidate(&c[i], (i % 8) * 128, (i / 8) * 96, 128, 96,
+			       OVERLAY, i);
+
+	drm_plane_assign(&layout, c, 64);
+
+	/* The three busiest surfaces are at the bottom of the stack. */
+	for (i = 0; i < 64; i++) {
+		if (c[i].assigned == DRM_PLANE_OVERLAY) {
+			assert(i >= 61);
+			overlays++;
+		}
+	}
+	assert(overlays == 3);
+}
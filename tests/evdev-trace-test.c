@@ -0,0 +1,191 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "weston-test-runner.h"
+#include "../src/evdev-trace.h"
+
+#define NEVENTS		200
+
+static void
+fill_events(struct input_event *ev, int count)
+{
+	uint64_t usecs = 1349000000ULL * 1000000 + 999000;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		/* Mostly 8 ms apart, some within the same report. */
+		if (i % 3 == 0)
+			usecs += 8000;
+		ev[i].time.tv_sec = usecs / 1000000;
+		ev[i].time.tv_usec = usecs % 1000000;
+		if (i % 3 == 2) {
+			ev[i].type = EV_SYN;
+			ev[i].code = SYN_REPORT;
+			ev[i].value = 0;
+		} else {
+			ev[i].type = EV_REL;
+			ev[i].code = i % 3 ? REL_Y : REL_X;
+			ev[i].value = (i * 7) % 11 - 5;
+		}
+	}
+}
+
+static void
+assert_events_equal(const struct input_event *a,
+		    const struct input_event *b, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		assert(a[i].time.tv_sec == b[i].time.tv_sec);
+		assert(a[i].time.tv_usec == b[i].time.tv_usec);
+		assert(a[i].type == b[i].type);
+		assert(a[i].code == b[i].code);
+		assert(a[i].value == b[i].value);
+	}
+}
+
+TEST(round_trip)
+{
+	char filename[] = "/tmp/evdev-trace-test-XXXXXX";
+	struct evdev_trace_writer *writer;
+	struct evdev_trace_reader *reader;
+	struct evdev_trace_device desc;
+	struct evdev_trace_chunk chunk;
+	struct input_event ev[NEVENTS], key[2];
+	uint32_t mouse, keyboard;
+	int fd, n;
+
+	fd = mkstemp(filename);
+	assert(fd >= 0);
+	close(fd);
+
+	fill_events(ev, NEVENTS);
+	memset(key, 0, sizeof key);
+	key[0].time = ev[10].time;
+	key[0].type = EV_KEY;
+	key[0].code = KEY_A;
+	key[0].value = 1;
+	key[1].time = ev[10].time;
+	key[1].type = EV_SYN;
+
+	writer = evdev_trace_writer_create(filename);
+	assert(writer);
+
+	memset(&desc, 0, sizeof desc);
+	desc.caps = 0x0a;
+	desc.vendor = 0x046d;
+	strcpy(desc.name, "mouse");
+	mouse = evdev_trace_write_device(writer, &desc);
+	strcpy(desc.name, "keyboard");
+	desc.caps = 0x01;
+	keyboard = evdev_trace_write_device(writer, &desc);
+	assert(mouse != keyboard);
+
+	/* More events than fit in one chunk. */
+	assert(evdev_trace_write_events(writer, mouse, ev, NEVENTS) == 0);
+	assert(evdev_trace_write_events(writer, keyboard, key, 2) == 0);
+	evdev_trace_writer_destroy(writer);
+
+	reader = evdev_trace_reader_open(filename);
+	assert(reader);
+
+	assert(evdev_trace_read(reader, &chunk) == 1);
+	assert(chunk.type == EVDEV_TRACE_DEVICE);
+	assert(chunk.device == mouse);
+	assert(chunk.desc.caps == 0x0a);
+	assert(chunk.desc.vendor == 0x046d);
+	assert(strcmp(chunk.desc.name, "mouse") == 0);
+
+	assert(evdev_trace_read(reader, &chunk) == 1);
+	assert(chunk.type == EVDEV_TRACE_DEVICE);
+	assert(chunk.device == keyboard);
+	assert(strcmp(chunk.desc.name, "keyboard") == 0);
+
+	n = 0;
+	while (n < NEVENTS) {
+		assert(evdev_trace_read(reader, &chunk) == 1);
+		assert(chunk.type == EVDEV_TRACE_EVENTS);
+		assert(chunk.device == mouse);
+		assert(chunk.count > 0 && n + chunk.count <= NEVENTS);
+		assert_events_equal(chunk.events, ev + n, chunk.count);
+		n += chunk.count;
+	}
+
+	assert(evdev_trace_read(reader, &chunk) == 1);
+	assert(chunk.device == keyboard);
+	assert(chunk.count == 2);
+	assert_events_equal(chunk.events, key, 2);
+
+	assert(evdev_trace_read(reader, &chunk) == 0);
+	evdev_trace_reader_close(reader);
+
+	unlink(filename);
+}
+
+TEST(broken_file)
+{
+	char filename[] = "/tmp/evdev-trace-test-XXXXXX";
+	struct evdev_trace_writer *writer;
+	struct evdev_trace_reader *reader;
+	struct evdev_trace_chunk chunk;
+	struct input_event ev[8];
+	FILE *fp;
+	long size;
+	int fd;
+
+	fd = mkstemp(filename);
+	assert(fd >= 0);
+	close(fd);
+
+	/* Not a recording. */
+	fp = fopen(filename, "w");
+	fputs("not an evdev recording\n", fp);
+	fclose(fp);
+	assert(evdev_trace_reader_open(filename) == NULL);
+
+	/* Cut off in the middle of a chunk. */
+	fill_events(ev, 8);
+	writer = evdev_trace_writer_create(filename);
+	assert(writer);
+	evdev_trace_write_events(writer, 0, ev, 8);
+	evdev_trace_writer_destroy(writer);
+
+	fp = fopen(filename, "r+");
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fclose(fp);
+	assert(truncate(filename, size - 4) == 0);
+
+	reader = evdev_trace_reader_open(filename);
+	assert(reader);
+	assert(evdev_trace_read(reader, &chunk) == -1);
+	evdev_trace_reader_close(reader);
+
+	unlink(filename);
+}
@@ -0,0 +1,391 @@
+/*
+ * Copyright © 2012 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "../shared/os-compatibility.h"
+#include "weston-test-client-helper.h"
+#include "../clients/screenshooter-client-protocol.h"
+
+/* The test environment lists this test in the clients key of the
+ * [screenshooter] section, so it may use the screenshooter. */
+
+#define COLOR 0xff2080c0
+#define SQUARE_COLOR 0xffc08020
+
+struct shot {
+	struct screenshooter *screenshooter;
+	struct wl_buffer *wl_buffer;
+	uint32_t *data;
+	int width, height;
+	int done, captured;
+	int x, y, captured_width, captured_height;
+};
+
+static void
+shot_done(void *data, struct screenshooter *screenshooter)
+{
+	struct shot *shot = data;
+
+	shot->done = 1;
+}
+
+static void
+shot_captured(void *data, struct screenshooter *screenshooter,
+	      int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	struct shot *shot = data;
+
+	shot->captured = 1;
+	shot->x = x;
+	shot->y = y;
+	shot->captured_width = width;
+	shot->captured_height = height;
+}
+
+static const struct screenshooter_listener screenshooter_listener = {
+	shot_done,
+	shot_captured
+};
+
+static struct screenshooter *
+bind_screenshooter(struct client *client, uint32_t version)
+{
+	struct global *global;
+
+	wl_list_for_each(global, &client->global_list, link) {
+		if (strcmp(global->interface, "screenshooter") == 0) {
+			assert(global->version >= version);
+			return wl_registry_bind(client->wl_registry,
+						global->name,
+						&screenshooter_interface,
+						version);
+		}
+	}
+
+	return NULL;
+}
+
+/* Fill the client's surface with an opaque color and wait until it is
+ * shown at x, y. */
+static struct client *
+create_colored_client(int x, int y, int width, int height)
+{
+	struct client *client;
+	uint32_t *p;
+	int i;
+
+	client = client_create(x, y, width, height);
+	assert(client);
+
+	p = client->surface->data;
+	for (i = 0; i < width * height; i++)
+		p[i] = COLOR;
+	move_client(client, x, y);
+
+	return client;
+}
+
+static struct shot *
+shot_create(struct client *client, int width, int height)
+{
+	struct wl_shm_pool *pool;
+	struct shot *shot;
+	int fd, size;
+
+	shot = calloc(1, sizeof *shot);
+	assert(shot);
+	shot->width = width;
+	shot->height = height;
+
+	size = width * height * 4;
+	fd = os_create_anonymous_file(size);
+	assert(fd >= 0);
+	shot->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			  fd, 0);
+	assert(shot->data != MAP_FAILED);
+	memset(shot->data, 0, size);
+
+	pool = wl_shm_create_pool(client->wl_shm, fd, size);
+	shot->wl_buffer =
+		wl_shm_pool_create_buffer(pool, 0, width, height, width * 4,
+					  WL_SHM_FORMAT_XRGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	shot->screenshooter = bind_screenshooter(client, 3);
+	assert(shot->screenshooter);
+	screenshooter_add_listener(shot->screenshooter,
+				   &screenshooter_listener, shot);
+
+	return shot;
+}
+
+static void
+shot_wait(struct client *client, struct shot *shot)
+{
+	while (!shot->done)
+		assert(wl_display_dispatch(client->wl_display) >= 0);
+}
+
+/* Check that the top left width x height pixels of the shot have
+ * the color. */
+static void
+check_shot(struct shot *shot, int width, int height)
+{
+	int x, y;
+
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++)
+			assert((shot->data[y * shot->width + x] & 0xffffff) ==
+			       (COLOR & 0xffffff));
+}
+
+TEST(shoot_region)
+{
+	struct client *client;
+	struct shot *shot;
+
+	client = create_colored_client(100, 100, 100, 100);
+	shot = shot_create(client, 64, 64);
+
+	screenshooter_shoot_region(shot->screenshooter,
+				   client->output->wl_output, shot->wl_buffer,
+				   120, 130, 40, 30);
+	shot_wait(client, shot);
+	assert(shot->captured);
+	assert(shot->x == 120 && shot->y == 130);
+	assert(shot->captured_width == 40 && shot->captured_height == 30);
+	check_shot(shot, 40, 30);
+}
+
+TEST(shoot_region_clipped)
+{
+	struct client *client;
+	struct output *output;
+	struct shot *shot;
+
+	client = create_colored_client(100, 100, 100, 100);
+	output = client->output;
+	shot = shot_create(client, 64, 64);
+
+	/* Half of the rectangle is above and left of the output. */
+	screenshooter_shoot_region(shot->screenshooter, output->wl_output,
+				   shot->wl_buffer,
+				   output->x - 32, output->y - 32, 64, 64);
+	shot_wait(client, shot);
+	assert(shot->captured);
+	assert(shot->x == output->x && shot->y == output->y);
+	assert(shot->captured_width == 32 && shot->captured_height == 32);
+
+	/* Nothing is left of a rectangle outside of the output. */
+	shot->done = 0;
+	shot->captured = 0;
+	screenshooter_shoot_region(shot->screenshooter, output->wl_output,
+				   shot->wl_buffer,
+				   output->x - 64, output->y, 64, 64);
+	shot_wait(client, shot);
+	assert(!shot->captured);
+}
+
+TEST(shoot_surface)
+{
+	struct client *client;
+	struct shot *shot;
+
+	client = create_colored_client(100, 100, 100, 100);
+	shot = shot_create(client, 100, 100);
+
+	screenshooter_shoot_surface(shot->screenshooter,
+				    client->surface->wl_surface,
+				    shot->wl_buffer);
+	shot_wait(client, shot);
+	assert(shot->captured);
+	assert(shot->x == 100 && shot->y == 100);
+	assert(shot->captured_width == 100 && shot->captured_height == 100);
+	check_shot(shot, 100, 100);
+}
+
+struct stream {
+	struct screenshooter_stream *screenshooter_stream;
+	uint8_t *data;
+	uint32_t size;
+	int width, height;
+	int frames, stopped;
+	uint32_t keyframe, nrects, offset, length;
+};
+
+static void
+stream_buffer(void *data, struct screenshooter_stream *screenshooter_stream,
+	      int32_t fd, uint32_t size, int32_t width, int32_t height)
+{
+	struct stream *stream = data;
+
+	/* The ring is only ever handed out for reading. */
+	assert(mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0) == MAP_FAILED);
+	assert(errno == EACCES);
+
+	stream->data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	assert(stream->data != MAP_FAILED);
+	stream->size = size;
+	stream->width = width;
+	stream->height = height;
+	close(fd);
+}
+
+static void
+stream_frame(void *data, struct screenshooter_stream *screenshooter_stream,
+	     uint32_t msecs, uint32_t keyframe, uint32_t nrects,
+	     uint32_t offset, uint32_t length)
+{
+	struct stream *stream = data;
+
+	/* Only the last frame is checked, but all need to be released. */
+	stream->frames++;
+	stream->keyframe = keyframe;
+	stream->nrects = nrects;
+	stream->offset = offset;
+	stream->length = length;
+}
+
+static void
+stream_stopped(void *data, struct screenshooter_stream *screenshooter_stream)
+{
+	struct stream *stream = data;
+
+	stream->stopped = 1;
+}
+
+static const struct screenshooter_stream_listener stream_listener = {
+	stream_buffer,
+	stream_frame,
+	stream_stopped
+};
+
+static void
+stream_wait(struct client *client, struct stream *stream)
+{
+	while (!stream->frames && !stream->stopped)
+		assert(wl_display_dispatch(client->wl_display) >= 0);
+	assert(!stream->stopped);
+	assert(stream->data);
+	assert(stream->offset + stream->length <= stream->size);
+}
+
+/* Look up the pixel at x, y of the streamed area in the current frame,
+ * or return 0 if the frame doesn't cover it. */
+static uint32_t
+stream_get_pixel(struct stream *stream, int x, int y)
+{
+	int32_t *rects = (int32_t *) (stream->data + stream->offset);
+	uint32_t *pixels = (uint32_t *) (rects + stream->nrects * 4);
+	int32_t *r;
+	uint32_t i;
+
+	for (i = 0; i < stream->nrects; i++) {
+		r = &rects[i * 4];
+		assert(r[0] >= 0 && r[1] >= 0);
+		assert(r[2] <= stream->width && r[3] <= stream->height);
+		if (x >= r[0] && x < r[2] && y >= r[1] && y < r[3])
+			return pixels[(y - r[1]) * (r[2] - r[0]) + x - r[0]];
+		pixels += (r[2] - r[0]) * (r[3] - r[1]);
+	}
+
+	return 0;
+}
+
+static void
+stream_release(struct stream *stream)
+{
+	for (; stream->frames > 0; stream->frames--)
+		screenshooter_stream_release(stream->screenshooter_stream);
+}
+
+/* Paint a 10x10 square of color at x, y into the client's surface. */
+static void
+paint_square(struct client *client, int x, int y, uint32_t color)
+{
+	struct surface *surface = client->surface;
+	uint32_t *p = surface->data;
+	int i, j;
+
+	for (j = y; j < y + 10; j++)
+		for (i = x; i < x + 10; i++)
+			p[j * surface->width + i] = color;
+
+	wl_surface_attach(surface->wl_surface, surface->wl_buffer, 0, 0);
+	wl_surface_damage(surface->wl_surface, x, y, 10, 10);
+	wl_surface_commit(surface->wl_surface);
+}
+
+TEST(stream_frames)
+{
+	struct client *client;
+	struct screenshooter *screenshooter;
+	struct stream stream;
+	uint32_t color;
+	int i, x, y;
+
+	client = create_colored_client(100, 100, 100, 100);
+	screenshooter = bind_screenshooter(client, 4);
+	assert(screenshooter);
+
+	memset(&stream, 0, sizeof stream);
+	stream.screenshooter_stream =
+		screenshooter_stream(screenshooter, client->output->wl_output,
+				     100, 100, 100, 100);
+	screenshooter_stream_add_listener(stream.screenshooter_stream,
+					  &stream_listener, &stream);
+
+	/* The first frame covers the whole area. */
+	stream_wait(client, &stream);
+	assert(stream.width == 100 && stream.height == 100);
+	assert(stream.keyframe);
+	for (y = 0; y < 100; y++)
+		for (x = 0; x < 100; x++)
+			assert((stream_get_pixel(&stream, x, y) & 0xffffff) ==
+			       (COLOR & 0xffffff));
+	stream_release(&stream);
+
+	/* More frames than fit in the ring at once, each only bringing
+	 * what changed. */
+	for (i = 0; i < 8; i++) {
+		x = 10 * i;
+		y = 5 * i;
+		color = i % 2 ? SQUARE_COLOR : COLOR;
+		paint_square(client, x, y, color);
+		stream_wait(client, &stream);
+		assert(!stream.keyframe);
+		assert((stream_get_pixel(&stream, x + 5, y + 5) & 0xffffff) ==
+		       (color & 0xffffff));
+		stream_release(&stream);
+	}
+
+	screenshooter_stream_destroy(stream.screenshooter_stream);
+	client_roundtrip(client);
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright © 2012 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "../wcap/wcap-encode.h"
+
+#define WIDTH	1920
+#define HEIGHT	1080
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+/* Two screens that alternate, so every pass encodes real changes.
+ * "desktop" is mostly flat with a few windows of text-like noise,
+ * "video" changes every pixel. */
+static void
+fill_screens(uint32_t **screens, const char *kind)
+{
+	int i, x, y;
+	uint32_t v;
+
+	for (i = 0; i < 2; i++) {
+		for (y = 0; y < HEIGHT; y++) {
+			for (x = 0; x < WIDTH; x++) {
+				if (strcmp(kind, "video") == 0)
+					v = rand();
+				else if (x > 200 + i * 40 && x < 1000 &&
+					 y > 100 && y < 700)
+					v = (x + y) & 3 ? 0xffffff : rand();
+				else
+					v = 0x203040 + i;
+				screens[i][y * WIDTH + x] = 0xff000000 | v;
+			}
+		}
+	}
+}
+
+static void
+run_bench(const struct wcap_encoder *encoder, const char *kind,
+	  uint32_t **screens, uint32_t *frame, uint32_t *out)
+{
+	struct wcap_rectangle rect = { 0, 0, WIDTH, HEIGHT };
+	uint32_t *end = out;
+	unsigned long count = 0;
+	double t, bytes = 0.0;
+
+	memset(frame, 0, WIDTH * HEIGHT * 4);
+	reset_timer();
+	do {
+		end = wcap_encoder_encode_rect(encoder, frame, WIDTH, &rect,
+					       screens[count & 1] +
+					       (HEIGHT - 1) * WIDTH,
+					       -WIDTH, out);
+		bytes += WIDTH * HEIGHT * 4;
+		count++;
+		t = read_timer();
+	} while (t < 2.0);
+
+	printf("%-5s %-8s %5lu frames in %.2f s, %8.1f MB/s, "
+	       "last frame %.1f%% of raw\n",
+	       wcap_encoder_get_name(encoder), kind, count, t,
+	       bytes / t / (1024 * 1024),
+	       100.0 * (end - out) / (WIDTH * HEIGHT));
+}
+
+int main(void)
+{
+	static const char *names[] = { "c", "sse2", "avx2" };
+	static const char *kinds[] = { "desktop", "video" };
+	const struct wcap_encoder *encoder;
+	uint32_t *screens[2], *frame, *out;
+	unsigned int i, j;
+
+	screens[0] = malloc(WIDTH * HEIGHT * 4);
+	screens[1] = malloc(WIDTH * HEIGHT * 4);
+	frame = malloc(WIDTH * HEIGHT * 4);
+	out = malloc(WIDTH * HEIGHT * 4);
+	if (!screens[0] || !screens[1] || !frame || !out) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	printf("encoding %dx%d frames, best encoder is %s\n",
+	       WIDTH, HEIGHT, wcap_encoder_get_name(wcap_encoder_get(NULL)));
+
+	for (j = 0; j < sizeof kinds / sizeof kinds[0]; j++) {
+		fill_screens(screens, kinds[j]);
+		for (i = 0; i < sizeof names / sizeof names[0]; i++) {
+			encoder = wcap_encoder_get(names[i]);
+			if (encoder)
+				run_bench(encoder, kinds[j],
+					  screens, frame, out);
+		}
+	}
+
+	free(screens[0]);
+	free(screens[1]);
+	free(frame);
+	free(out);
+
+	return 0;
+}
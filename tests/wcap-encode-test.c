@@ -0,0 +1,671 @@
+/*
+ * Copyright © 2012 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+
+#include "weston-test-runner.h"
+#include "../wcap/wcap-encode.h"
+
+#define WIDTH	301
+#define HEIGHT	67
+#define FRAMES	12
+
+static const char *encoder_names[] = { "c", "sse2", "avx2" };
+
+/* Fill a top-down WIDTH x HEIGHT image with a mix of flat areas, long
+ * runs, gradients and noise, so that all run lengths, including the
+ * extended ones above 0xe0, show up in the encoding. */
+static void
+fill_screen(uint32_t *screen, int frame)
+{
+	int x, y;
+	uint32_t v;
+
+	for (y = 0; y < HEIGHT; y++) {
+		for (x = 0; x < WIDTH; x++) {
+			switch ((y / 8 + frame) % 4) {
+			case 0:
+				v = 0xff000000 | (frame * 0x010203);
+				break;
+			case 1:
+				v = 0xff000000 | (x * 0x000101) | (y << 16);
+				break;
+			case 2:
+				v = (x / (1 + frame)) & 1 ?
+					0xffffffff : 0xff000000;
+				break;
+			default:
+				v = 0xff000000 | (rand() & 0xffffff);
+				break;
+			}
+			screen[y * WIDTH + x] = v;
+		}
+	}
+}
+
+static void
+pick_rects(struct wcap_rectangle *rects, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		rects[i].x1 = rand() % WIDTH;
+		rects[i].y1 = rand() % HEIGHT;
+		rects[i].x2 = rects[i].x1 + 1 + rand() % (WIDTH - rects[i].x1);
+		rects[i].y2 = rects[i].y1 + 1 + rand() % (HEIGHT - rects[i].y1);
+	}
+
+	/* Always have one full frame rectangle in the mix. */
+	rects[0].x1 = 0;
+	rects[0].y1 = 0;
+	rects[0].x2 = WIDTH;
+	rects[0].y2 = HEIGHT;
+}
+
+static uint32_t *
+encode(const struct wcap_encoder *encoder, uint32_t *frame,
+       uint32_t *screen, struct wcap_rectangle *r, uint32_t *p)
+{
+	/* Point at the bottom row and walk upwards, like the recorder
+	 * does when encoding straight out of the framebuffer. */
+	return wcap_encoder_encode_rect(encoder, frame, WIDTH, r,
+					screen + (r->y2 - 1) * WIDTH + r->x1,
+					-WIDTH, p);
+}
+
+TEST(encoders_match_reference)
+{
+	const struct wcap_encoder *reference, *encoder;
+	uint32_t *screen, *ref_frame, *frame, *ref_out, *out, *ref_end, *end;
+	struct wcap_rectangle rects[4];
+	int i, f, size, tested = 0;
+
+	size = WIDTH * HEIGHT;
+	screen = malloc(size * 4);
+	ref_frame = calloc(size, 4);
+	frame = malloc(size * 4);
+	/* Worst case is one word per pixel. */
+	ref_out = malloc(size * 4);
+	out = malloc(size * 4);
+	assert(screen && ref_frame && frame && ref_out && out);
+
+	reference = wcap_encoder_get("c");
+	assert(reference);
+
+	for (i = 0; i < (int) (sizeof encoder_names / sizeof *encoder_names); i++) {
+		encoder = wcap_encoder_get(encoder_names[i]);
+		if (!encoder) {
+			fprintf(stderr, "%s encoder not supported, skipping\n",
+				encoder_names[i]);
+			continue;
+		}
+
+		srand(1);
+		memset(ref_frame, 0, size * 4);
+		memset(frame, 0, size * 4);
+		for (f = 0; f < FRAMES; f++) {
+			fill_screen(screen, f);
+			pick_rects(rects, 4);
+
+			ref_end = encode(reference, ref_frame,
+					 screen, &rects[f % 4], ref_out);
+			end = encode(encoder, frame,
+				     screen, &rects[f % 4], out);
+
+			assert(end - out == ref_end - ref_out);
+			assert(memcmp(out, ref_out, (end - out) * 4) == 0);
+			assert(memcmp(frame, ref_frame, size * 4) == 0);
+		}
+		tested++;
+	}
+
+	assert(tested > 0);
+
+	free(screen);
+	free(ref_frame);
+	free(frame);
+	free(ref_out);
+	free(out);
+}
+
+TEST(round_trip)
+{
+	const struct wcap_encoder *encoder;
+	struct wcap_decoder *decoder;
+	struct wcap_header header;
+	struct wcap_frame_header frame_header;
+	struct wcap_rectangle rects[4];
+	uint32_t *screen, *frame, *out, *end;
+	char filename[] = "/tmp/wcap-encode-test-XXXXXX";
+	int fd, i, f, size;
+
+	size = WIDTH * HEIGHT;
+	screen = malloc(size * 4);
+	frame = calloc(size, 4);
+	out = malloc(size * 4);
+	assert(screen && frame && out);
+
+	encoder = wcap_encoder_get(NULL);
+	assert(encoder);
+
+	fd = mkstemp(filename);
+	assert(fd >= 0);
+
+	header.magic = WCAP_HEADER_MAGIC;
+	header.format = WCAP_FORMAT_XRGB8888;
+	header.width = WIDTH;
+	header.height = HEIGHT;
+	assert(write(fd, &header, sizeof header) == sizeof header);
+
+	srand(2);
+	for (f = 0; f < FRAMES; f++) {
+		fill_screen(screen, f);
+		pick_rects(rects, 4);
+
+		frame_header.msecs = f * 16;
+		frame_header.nrects = 4;
+		assert(write(fd, &frame_header, sizeof frame_header) ==
+		       sizeof frame_header);
+		assert(write(fd, rects, sizeof rects) == sizeof rects);
+		for (i = 0; i < 4; i++) {
+			end = encode(encoder, frame, screen, &rects[i], out);
+			assert(write(fd, out, (end - out) * 4) ==
+			       (end - out) * 4);
+		}
+	}
+	close(fd);
+
+	decoder = wcap_decoder_create(filename);
+	assert(decoder);
+	unlink(filename);
+
+	/* Decode alongside a second encoding pass so every frame can be
+	 * compared, not just the last one. */
+	srand(2);
+	memset(frame, 0, size * 4);
+	for (f = 0; f < FRAMES; f++) {
+		fill_screen(screen, f);
+		pick_rects(rects, 4);
+		for (i = 0; i < 4; i++)
+			encode(encoder, frame, screen, &rects[i], out);
+
+		assert(wcap_decoder_get_frame(decoder));
+		assert(decoder->msecs == (uint32_t) f * 16);
+		for (i = 0; i < size; i++)
+			assert((decoder->frame[i] & 0xffffff) ==
+			       (frame[i] & 0xffffff));
+	}
+	assert(!wcap_decoder_get_frame(decoder));
+
+	wcap_decoder_destroy(decoder);
+	free(screen);
+	free(frame);
+	free(out);
+}
+
+/* Pack the rectangles of screen bottom-up, the way the recorder hands
+ * them to the writer. */
+static uint32_t *
+pack_rects(uint32_t *screen, struct wcap_rectangle *rects, int n,
+	   uint32_t *pixels)
+{
+	uint32_t *p = pixels;
+	int i, y;
+
+	for (i = 0; i < n; i++) {
+		for (y = rects[i].y2 - 1; y >= rects[i].y1; y--) {
+			memcpy(p, screen + y * WIDTH + rects[i].x1,
+			       (rects[i].x2 - rects[i].x1) * 4);
+			p += rects[i].x2 - rects[i].x1;
+		}
+	}
+
+	return pixels;
+}
+
+static void
+write_v2(const char *filename, uint32_t flags, int keyframe_interval,
+	 int truncate, uint32_t *expected)
+{
+	struct wcap_writer *writer;
+	struct wcap_rectangle rects[4];
+	uint32_t *screen, *pixels;
+	int fd, f, i, n, keyframe, size = WIDTH * HEIGHT;
+
+	screen = malloc(size * 4);
+	pixels = malloc(size * 4 * 4);
+	assert(screen && pixels);
+
+	fd = open(filename, O_WRONLY | O_TRUNC);
+	assert(fd >= 0);
+	writer = wcap_writer_create(fd, WCAP_FORMAT_XRGB8888,
+				    WIDTH, HEIGHT, flags);
+	assert(writer);
+
+	srand(3);
+	for (f = 0; f < FRAMES; f++) {
+		fill_screen(screen, f);
+		keyframe = f % keyframe_interval == 0;
+		if (keyframe) {
+			pick_rects(rects, 1);
+			n = 1;
+		} else {
+			pick_rects(rects, 4);
+			n = 4;
+		}
+
+		pack_rects(screen, rects, n, pixels);
+		assert(wcap_writer_write_frame(writer, f * 16, keyframe,
+					       rects, n, pixels) == 0);
+
+		/* Track what the decoder should show after each frame. */
+		if (keyframe)
+			memset(expected, 0, size * 4);
+		else if (f > 0)
+			memcpy(expected, expected - size, size * 4);
+		for (i = 0; i < n; i++) {
+			int x, y;
+
+			for (y = rects[i].y1; y < rects[i].y2; y++)
+				for (x = rects[i].x1; x < rects[i].x2; x++)
+					expected[y * WIDTH + x] =
+						screen[y * WIDTH + x];
+		}
+		expected += size;
+	}
+
+	/* A recording cut short never gets its index written. */
+	if (truncate)
+		free(writer);
+	else
+		assert(wcap_writer_destroy(writer) == 0);
+	close(fd);
+
+	free(screen);
+	free(pixels);
+}
+
+static void
+check_frame(struct wcap_decoder *decoder, uint32_t *expected)
+{
+	int i;
+
+	for (i = 0; i < WIDTH * HEIGHT; i++)
+		assert((decoder->frame[i] & 0xffffff) ==
+		       (expected[i] & 0xffffff));
+}
+
+static void
+check_v2(uint32_t flags, int keyframe_interval, int truncate)
+{
+	struct wcap_decoder *decoder;
+	uint32_t *expected;
+	char filename[] = "/tmp/wcap-encode-test-XXXXXX";
+	int fd, f, size = WIDTH * HEIGHT;
+	static const int seeks[] = { 7, 0, FRAMES - 1, 3, 3, 4, 11 };
+
+	expected = malloc(size * 4 * FRAMES);
+	assert(expected);
+
+	fd = mkstemp(filename);
+	assert(fd >= 0);
+	close(fd);
+	write_v2(filename, flags, keyframe_interval, truncate, expected);
+
+	decoder = wcap_decoder_create(filename);
+	assert(decoder);
+	unlink(filename);
+
+	assert(decoder->version == 2);
+	assert(decoder->nframes == FRAMES);
+	for (f = 0; f < FRAMES; f++) {
+		assert(decoder->index[f].keyframe ==
+		       (uint32_t) (f - f % keyframe_interval));
+		assert(wcap_decoder_get_frame(decoder));
+		assert(decoder->msecs == (uint32_t) f * 16);
+		check_frame(decoder, expected + f * size);
+	}
+	assert(!wcap_decoder_get_frame(decoder));
+
+	for (f = 0; f < (int) (sizeof seeks / sizeof seeks[0]); f++) {
+		assert(wcap_decoder_seek(decoder, seeks[f]));
+		check_frame(decoder, expected + seeks[f] * size);
+		assert(decoder->count == (uint32_t) seeks[f] + 1);
+	}
+	assert(!wcap_decoder_seek(decoder, FRAMES));
+
+	wcap_decoder_destroy(decoder);
+	free(expected);
+}
+
+TEST(v2_keyframes_and_seek)
+{
+	check_v2(0, 5, 0);
+}
+
+TEST(v2_compressed)
+{
+	check_v2(WCAP_WRITER_COMPRESS, 4, 0);
+}
+
+TEST(v2_missing_index)
+{
+	check_v2(WCAP_WRITER_COMPRESS, 3, 1);
+}
+
+static void
+check_frame_info(uint32_t flags)
+{
+	struct wcap_decoder *decoder;
+	struct wcap_frame_info info;
+	uint32_t *expected, i, area, covered;
+	char filename[] = "/tmp/wcap-encode-test-XXXXXX";
+	int fd, f;
+
+	expected = malloc(WIDTH * HEIGHT * 4 * FRAMES);
+	assert(expected);
+
+	fd = mkstemp(filename);
+	assert(fd >= 0);
+	close(fd);
+	write_v2(filename, flags, 4, 0, expected);
+
+	decoder = wcap_decoder_create(filename);
+	assert(decoder);
+	unlink(filename);
+
+	for (f = 0; f < FRAMES; f++) {
+		assert(wcap_decoder_next_frame_info(decoder, &info));
+		assert(info.msecs == (uint32_t) f * 16);
+		assert(!(info.flags & WCAP_FRAME_KEYFRAME) == !!(f % 4));
+		assert(info.nrects == (f % 4 ? 4u : 1u));
+		if (f + 1 < FRAMES)
+			assert(info.size == decoder->index[f + 1].offset -
+			       decoder->index[f].offset);
+
+		area = 0;
+		for (i = 0; i < info.nrects; i++)
+			area += (info.rects[i].x2 - info.rects[i].x1) *
+				(info.rects[i].y2 - info.rects[i].y1);
+		covered = 0;
+		for (i = 0; i < info.nruns; i++)
+			covered += wcap_run_length(info.runs[i]);
+		assert(covered == area);
+	}
+	assert(!wcap_decoder_next_frame_info(decoder, &info));
+
+	wcap_decoder_destroy(decoder);
+	free(expected);
+}
+
+TEST(frame_info)
+{
+	check_frame_info(0);
+	check_frame_info(WCAP_WRITER_COMPRESS);
+}
+
+TEST(clip)
+{
+	struct wcap_decoder *decoder;
+	struct wcap_rectangle clip = { 13, 5, 57, 40 };
+	struct wcap_rectangle bad = { 0, 0, WIDTH + 1, HEIGHT };
+	uint32_t *expected, *e;
+	char filename[] = "/tmp/wcap-encode-test-XXXXXX";
+	int fd, f, x, y, stride = clip.x2 - clip.x1;
+
+	expected = malloc(WIDTH * HEIGHT * 4 * FRAMES);
+	assert(expected);
+
+	fd = mkstemp(filename);
+	assert(fd >= 0);
+	close(fd);
+	write_v2(filename, WCAP_WRITER_COMPRESS, 5, 0, expected);
+
+	decoder = wcap_decoder_create(filename);
+	assert(decoder);
+	unlink(filename);
+
+	/* Decode a frame first to check the clip starts over. */
+	assert(wcap_decoder_get_frame(decoder));
+	assert(wcap_decoder_set_clip(decoder, &bad) < 0);
+	assert(wcap_decoder_set_clip(decoder, &clip) == 0);
+
+	for (f = 0; f < FRAMES; f++) {
+		assert(wcap_decoder_get_frame(decoder));
+		e = expected + f * WIDTH * HEIGHT;
+		for (y = clip.y1; y < clip.y2; y++)
+			for (x = clip.x1; x < clip.x2; x++)
+				assert((decoder->frame[(y - clip.y1) * stride +
+						       x - clip.x1] & 0xffffff) ==
+				       (e[y * WIDTH + x] & 0xffffff));
+	}
+
+	assert(wcap_decoder_seek(decoder, 7));
+	e = expected + 7 * WIDTH * HEIGHT;
+	for (y = clip.y1; y < clip.y2; y++)
+		for (x = clip.x1; x < clip.x2; x++)
+			assert((decoder->frame[(y - clip.y1) * stride +
+					       x - clip.x1] & 0xffffff) ==
+			       (e[y * WIDTH + x] & 0xffffff));
+
+	wcap_decoder_destroy(decoder);
+	free(expected);
+}
+
+TEST(write_error)
+{
+	struct wcap_writer *writer;
+	struct wcap_decoder *decoder;
+	struct wcap_rectangle rect = { 0, 0, WIDTH, HEIGHT };
+	struct rlimit limit, saved;
+	uint32_t *screen;
+	uint64_t size;
+	char filename[] = "/tmp/wcap-encode-test-XXXXXX";
+	int fd, f;
+
+	screen = malloc(WIDTH * HEIGHT * 4);
+	assert(screen);
+
+	fd = mkstemp(filename);
+	assert(fd >= 0);
+	writer = wcap_writer_create(fd, WCAP_FORMAT_XRGB8888,
+				    WIDTH, HEIGHT, 0);
+	assert(writer);
+
+	srand(5);
+	for (f = 0; f < 3; f++) {
+		fill_screen(screen, f);
+		assert(wcap_writer_write_frame(writer, f * 16, 1, &rect, 1,
+					       screen) == 0);
+	}
+
+	/* Let the next frame get only partly written. */
+	signal(SIGXFSZ, SIG_IGN);
+	assert(getrlimit(RLIMIT_FSIZE, &saved) == 0);
+	size = wcap_writer_get_size(writer);
+	limit = saved;
+	limit.rlim_cur = size + 100;
+	assert(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+
+	fill_screen(screen, 3);
+	assert(wcap_writer_write_frame(writer, 48, 1, &rect, 1, screen) < 0);
+
+	assert(setrlimit(RLIMIT_FSIZE, &saved) == 0);
+	signal(SIGXFSZ, SIG_DFL);
+
+	/* The index follows the complete frames, not the partial one. */
+	assert(wcap_writer_destroy(writer) == 0);
+	assert((uint64_t) lseek(fd, 0, SEEK_END) ==
+	       size + 3 * sizeof(struct wcap_index_entry) +
+	       sizeof(struct wcap_trailer));
+	close(fd);
+
+	decoder = wcap_decoder_create(filename);
+	assert(decoder);
+	unlink(filename);
+
+	assert(decoder->nframes == 3);
+	for (f = 0; f < 3; f++)
+		assert(wcap_decoder_get_frame(decoder));
+	assert(!wcap_decoder_get_frame(decoder));
+
+	wcap_decoder_destroy(decoder);
+	free(screen);
+}
+
+static void
+check_bad_raw_size(uint32_t flags, uint32_t raw_size)
+{
+	struct wcap_decoder *decoder;
+	struct wcap_frame_header_v2 header;
+	struct wcap_frame_info info;
+	uint32_t *expected;
+	char filename[] = "/tmp/wcap-encode-test-XXXXXX";
+	int fd;
+
+	expected = malloc(WIDTH * HEIGHT * 4 * FRAMES);
+	assert(expected);
+
+	fd = mkstemp(filename);
+	assert(fd >= 0);
+	close(fd);
+	write_v2(filename, flags, 4, 0, expected);
+
+	fd = open(filename, O_RDWR);
+	assert(fd >= 0);
+	assert(pread(fd, &header, sizeof header,
+		     sizeof(struct wcap_header_v2)) == sizeof header);
+	header.raw_size = raw_size;
+	assert(pwrite(fd, &header, sizeof header,
+		      sizeof(struct wcap_header_v2)) == sizeof header);
+	close(fd);
+
+	decoder = wcap_decoder_create(filename);
+	assert(decoder);
+	unlink(filename);
+
+	assert(!wcap_decoder_next_frame_info(decoder, &info));
+
+	wcap_decoder_destroy(decoder);
+	free(expected);
+}
+
+TEST(bad_raw_size)
+{
+	/* Too small for the rectangle, bigger than the payload. */
+	check_bad_raw_size(0, sizeof(struct wcap_rectangle) - 4);
+	check_bad_raw_size(0, UINT32_MAX);
+	check_bad_raw_size(WCAP_WRITER_COMPRESS, 0);
+	check_bad_raw_size(WCAP_WRITER_COMPRESS, UINT32_MAX);
+}
+
+enum bad_index {
+	BAD_INDEX_NFRAMES,
+	BAD_INDEX_OFFSET,
+	BAD_INDEX_ENTRY_OFFSET,
+	BAD_INDEX_ENTRY_KEYFRAME,
+};
+
+static void
+check_bad_index(enum bad_index bad)
+{
+	struct wcap_decoder *decoder;
+	struct wcap_trailer trailer;
+	struct wcap_index_entry entry;
+	uint32_t *expected;
+	off_t size, offset;
+	char filename[] = "/tmp/wcap-encode-test-XXXXXX";
+	int fd, f;
+
+	expected = malloc(WIDTH * HEIGHT * 4 * FRAMES);
+	assert(expected);
+
+	fd = mkstemp(filename);
+	assert(fd >= 0);
+	close(fd);
+	write_v2(filename, 0, 4, 0, expected);
+
+	fd = open(filename, O_RDWR);
+	assert(fd >= 0);
+	size = lseek(fd, 0, SEEK_END);
+	assert(pread(fd, &trailer, sizeof trailer,
+		     size - sizeof trailer) == sizeof trailer);
+	offset = trailer.index_offset + 3 * sizeof entry;
+	assert(pread(fd, &entry, sizeof entry, offset) == sizeof entry);
+
+	switch (bad) {
+	case BAD_INDEX_NFRAMES:
+		/* Makes the size check wrap around. */
+		trailer.nframes += UINT32_MAX / sizeof entry + 1;
+		trailer.index_offset -= (uint64_t) (UINT32_MAX /
+			sizeof entry + 1) * sizeof entry;
+		break;
+	case BAD_INDEX_OFFSET:
+		trailer.index_offset = size;
+		break;
+	case BAD_INDEX_ENTRY_OFFSET:
+		entry.offset = size * 2;
+		break;
+	case BAD_INDEX_ENTRY_KEYFRAME:
+		entry.keyframe = 5;
+		break;
+	}
+
+	assert(pwrite(fd, &trailer, sizeof trailer,
+		      size - sizeof trailer) == sizeof trailer);
+	assert(pwrite(fd, &entry, sizeof entry, offset) == sizeof entry);
+	close(fd);
+
+	/* The index is rebuilt from the frame headers. */
+	decoder = wcap_decoder_create(filename);
+	assert(decoder);
+	unlink(filename);
+
+	assert(decoder->nframes >= FRAMES);
+	for (f = 0; f < FRAMES; f++) {
+		assert(decoder->index[f].keyframe == (uint32_t) (f - f % 4));
+		assert(wcap_decoder_get_frame(decoder));
+		check_frame(decoder, expected + f * WIDTH * HEIGHT);
+	}
+
+	assert(wcap_decoder_seek(decoder, 7));
+	check_frame(decoder, expected + 7 * WIDTH * HEIGHT);
+
+	wcap_decoder_destroy(decoder);
+	free(expected);
+}
+
+TEST(bad_index)
+{
+	check_bad_index(BAD_INDEX_NFRAMES);
+	check_bad_index(BAD_INDEX_OFFSET);
+	check_bad_index(BAD_INDEX_ENTRY_OFFSET);
+	check_bad_index(BAD_INDEX_ENTRY_KEYFRAME);
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright © 2012 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "weston-test-runner.h"
+#include "../wcap/wcap-decode.h"
+#include "../wcap/wcap-stats.h"
+
+#define WIDTH	40
+#define HEIGHT	30
+
+static void
+add_frame_flags(struct wcap_stats *stats, uint32_t msecs, uint32_t flags,
+		const struct wcap_rectangle *rects, uint32_t nrects)
+{
+	struct wcap_frame_info info;
+
+	memset(&info, 0, sizeof info);
+	info.msecs = msecs;
+	info.flags = flags;
+	info.nrects = nrects;
+	info.rects = rects;
+	assert(wcap_stats_add_frame(stats, &info) == 0);
+}
+
+static void
+add_frame(struct wcap_stats *stats, uint32_t msecs,
+	  const struct wcap_rectangle *rects, uint32_t nrects)
+{
+	add_frame_flags(stats, msecs, 0, rects, nrects);
+}
+
+TEST(intervals)
+{
+	struct wcap_stats *stats;
+	struct wcap_rectangle full = { 0, 0, WIDTH, HEIGHT };
+	static const uint32_t msecs[] = {
+		0, 16, 33, 50, 83, 150, 1150, 1166, 1400
+	};
+	uint32_t i;
+
+	stats = wcap_stats_create(WIDTH, HEIGHT, 60000);
+	assert(stats);
+
+	for (i = 0; i < sizeof msecs / sizeof msecs[0]; i++)
+		add_frame(stats, msecs[i], &full, 1);
+
+	assert(stats->nframes == 9);
+	/* 16, 17, 17 and 16 ms are on time, 33 misses one vblank,
+	 * 67 misses three, 1000 is idle and 234 lands in the last
+	 * bucket. */
+	assert(stats->idle == 1);
+	assert(stats->histogram[0] == 4);
+	assert(stats->histogram[1] == 1);
+	assert(stats->histogram[3] == 1);
+	assert(stats->histogram[WCAP_STATS_BUCKETS - 1] == 1);
+	assert(stats->frames[4].missed == 1);
+	assert(stats->frames[5].missed == 3);
+	assert(stats->frames[6].missed == 0);
+	assert(stats->frames[8].missed == 13);
+	assert(stats->missed == 17);
+	/* The first frame is a keyframe. */
+	assert(stats->keyframes == 1);
+	assert(stats->area == 8 * WIDTH * HEIGHT);
+
+	wcap_stats_destroy(stats);
+}
+
+TEST(high_refresh)
+{
+	struct wcap_stats *stats;
+	struct wcap_rectangle full = { 0, 0, WIDTH, HEIGHT };
+	FILE *fp;
+
+	/* Above 1 MHz a refresh period rounds down to 0 us. */
+	stats = wcap_stats_create(WIDTH, HEIGHT, 2000000000);
+	assert(stats);
+
+	add_frame(stats, 0, &full, 1);
+	add_frame(stats, 16, &full, 1);
+	assert(stats->nframes == 2);
+
+	fp = fopen("/dev/null", "w");
+	assert(fp);
+	wcap_stats_print(stats, fp, 1);
+	fclose(fp);
+
+	wcap_stats_destroy(stats);
+}
+
+TEST(heatmap)
+{
+	struct wcap_stats *stats;
+	struct wcap_rectangle rects[] = {
+		{ 0, 0, 10, 10 },
+		{ 5, 5, 20, 15 },
+		{ 30, 20, 50, 40 },
+	};
+	struct wcap_rectangle full = { 0, 0, WIDTH, HEIGHT };
+	uint32_t *heatmap;
+	int x, y;
+
+	stats = wcap_stats_create(WIDTH, HEIGHT, 60000);
+	assert(stats);
+	heatmap = malloc(WIDTH * HEIGHT * 4);
+	assert(heatmap);
+
+	/* Keyframes don't show up in the heatmap. */
+	add_frame(stats, 0, &full, 1);
+	add_frame(stats, 16, rects, 2);
+	add_frame_flags(stats, 33, WCAP_FRAME_KEYFRAME, &full, 1);
+	add_frame(stats, 50, rects + 1, 2);
+
+	assert(stats->keyframes == 2);
+	assert(stats->frames[2].keyframe);
+	assert(stats->frames[2].area == WIDTH * HEIGHT);
+	/* The last rectangle sticks out of the frame. */
+	assert(stats->frames[3].area == 15 * 10 + 10 * 10);
+	assert(stats->area == 10 * 10 + 15 * 10 + 15 * 10 + 10 * 10);
+
+	wcap_stats_get_heatmap(stats, heatmap);
+	for (y = 0; y < HEIGHT; y++) {
+		for (x = 0; x < WIDTH; x++) {
+			int n = 0;
+
+			if (x < 10 && y < 10)
+				n++;
+			if (x >= 5 && x < 20 && y >= 5 && y < 15)
+				n += 2;
+			if (x >= 30 && y >= 20)
+				n++;
+
+			switch (n) {
+			case 0:
+				assert(heatmap[y * WIDTH + x] == 0xff000000);
+				break;
+			case 1:
+				assert(heatmap[y * WIDTH + x] == 0xff0000ff);
+				break;
+			case 2:
+				assert(heatmap[y * WIDTH + x] == 0xffff0000);
+				break;
+			case 3:
+				assert(heatmap[y * WIDTH + x] == 0xffffffff);
+				break;
+			}
+		}
+	}
+
+	free(heatmap);
+	wcap_stats_destroy(stats);
+}
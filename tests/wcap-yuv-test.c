@@ -0,0 +1,119 @@
+/*
+ * Copyright © 2012 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "weston-test-runner.h"
+#include "../wcap/wcap-decode.h"
+#include "../wcap/wcap-yuv.h"
+
+/* Not a multiple of any vector width, so the tails get exercised. */
+#define WIDTH	302
+#define HEIGHT	66
+
+static void
+check_format(uint32_t format)
+{
+	static const char *names[] = { "c", "sse4.1", "avx2" };
+	const struct wcap_yuv_converter *reference, *converter;
+	unsigned char *ref_out, *out;
+	uint32_t *frame;
+	int i, size, tested = 0;
+
+	size = WIDTH * HEIGHT * 3 / 2;
+	frame = malloc(WIDTH * HEIGHT * 4);
+	ref_out = malloc(size);
+	out = malloc(size);
+	assert(frame && ref_out && out);
+
+	/* Random pixels, plus the extremes that saturate the chroma. */
+	srand(format);
+	for (i = 0; i < WIDTH * HEIGHT; i++)
+		frame[i] = 0xff000000 | (rand() & 0xffffff);
+	for (i = 0; i < WIDTH * 4; i++) {
+		frame[i] = 0xffff0000 >> (8 * (i & 3));
+		frame[WIDTH * 4 + i] = 0xff000000 | (0xff << (8 * (i & 3)));
+	}
+
+	reference = wcap_yuv_converter_get("c");
+	assert(reference);
+	wcap_yuv_converter_convert(reference, format, frame,
+				   WIDTH, HEIGHT, ref_out);
+
+	for (i = 0; i < (int) (sizeof names / sizeof names[0]); i++) {
+		converter = wcap_yuv_converter_get(names[i]);
+		if (!converter) {
+			fprintf(stderr, "%s converter not supported, "
+				"skipping\n", names[i]);
+			continue;
+		}
+
+		memset(out, 0xaa, size);
+		wcap_yuv_converter_convert(converter, format, frame,
+					   WIDTH, HEIGHT, out);
+		assert(memcmp(out, ref_out, size) == 0);
+		tested++;
+	}
+
+	assert(tested > 0);
+
+	free(frame);
+	free(ref_out);
+	free(out);
+}
+
+TEST(xrgb_converters_match_reference)
+{
+	check_format(WCAP_FORMAT_XRGB8888);
+}
+
+TEST(xbgr_converters_match_reference)
+{
+	check_format(WCAP_FORMAT_XBGR8888);
+}
+
+TEST(reference_values)
+{
+	const struct wcap_yuv_converter *converter;
+	uint32_t frame[4] = { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff };
+	unsigned char out[6];
+
+	converter = wcap_yuv_converter_get(NULL);
+	assert(converter);
+
+	/* White is full luma and neutral chroma. */
+	wcap_yuv_converter_convert(converter, WCAP_FORMAT_XRGB8888,
+				   frame, 2, 2, out);
+	assert(out[0] == 255 && out[3] == 255);
+	assert(out[4] == 128 && out[5] == 128);
+
+	/* Pure red pushes the first chroma plane to its maximum. */
+	frame[0] = frame[1] = frame[2] = frame[3] = 0xffff0000;
+	wcap_yuv_converter_convert(converter, WCAP_FORMAT_XRGB8888,
+				   frame, 2, 2, out);
+	assert(out[0] == 76);
+	assert(out[5] == 255);
+}
@@ -79,9 +79,11 @@ test_surface_configure(struct weston_surface *surface, int32_t sx, int32_t sy)
 	struct weston_test_surface *test_surface = surface->private;
 	struct weston_test *test = test_surface->test;
 
-	if (wl_list_empty(&surface->layer_link))
+	if (wl_list_empty(&surface->layer_link)) {
 		wl_list_insert(&test->layer.surface_list,
 			       &surface->layer_link);
+		weston_compositor_mark_layers_dirty(surface->compositor);
+	}
 
 	surface->geometry.x = test_surface->x;
 	surface->geometry.y = test_surface->y;
@@ -31,120 +31,320 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <cairo.h>
 
 #include "wcap-decode.h"
+#include "wcap-yuv.h"
+#include "wcap-stats.h"
 
 static void
-write_png(struct wcap_decoder *decoder, const char *filename)
+write_png(uint32_t *frame, int width, int height, const char *filename)
 {
 	cairo_surface_t *surface;
 
-	surface = cairo_image_surface_create_for_data((unsigned char *) decoder->frame,
+	surface = cairo_image_surface_create_for_data((unsigned char *) frame,
 						      CAIRO_FORMAT_ARGB32,
-						      decoder->width,
-						      decoder->height,
-						      decoder->width * 4);
+						      width, height,
+						      width * 4);
 	cairo_surface_write_to_png(surface, filename);
 	cairo_surface_destroy(surface);
 }
 
-static inline int
-rgb_to_yuv(uint32_t format, uint32_t p, int *u, int *v)
+/* Frames are decoded on the main thread and handed out as jobs to a
+ * pool of workers, which write the pngs and do the yuv conversion.  A
+ * separate writer thread puts the converted frames on stdout in the
+ * order they were decoded and recycles the jobs. */
+struct job {
+	struct job *next;
+	int seq;
+	int png_frame;
+	int yuv;
+	int done;
+	uint32_t *frame;
+	unsigned char *out;
+};
+
+struct pipeline {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct job *jobs, *free_list, *todo, **todo_tail;
+	int njobs, seq, next_seq, quit;
+
+	pthread_t *workers, writer;
+	int nworkers;
+
+	const struct wcap_yuv_converter *converter;
+	uint32_t format;
+	int width, height;
+};
+
+static void *
+worker_thread(void *data)
 {
-	int r, g, b, y;
-
-	switch (format) {
-	case WCAP_FORMAT_XRGB8888:
-		r = (p >> 16) & 0xff;
-		g = (p >> 8) & 0xff;
-		b = (p >> 0) & 0xff;
-		break;
-	case WCAP_FORMAT_XBGR8888:
-		r = (p >> 0) & 0xff;
-		g = (p >> 8) & 0xff;
-		b = (p >> 16) & 0xff;
-		break;
-	default:
-		assert(0);
-	}
-
-	y = (19595 * r + 38469 * g + 7472 * b) >> 16;
-	if (y > 255)
-		y = 255;
-
-	*u += 46727 * (r - y);
-	*v += 36962 * (b - y);
-
-	return y;
+	struct pipeline *pipeline = data;
+	char filename[200];
+	struct job *job;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	for (;;) {
+		while (!pipeline->todo && !pipeline->quit)
+			pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+		if (!pipeline->todo)
+			break;
+
+		job = pipeline->todo;
+		pipeline->todo = job->next;
+		if (!pipeline->todo)
+			pipeline->todo_tail = &pipeline->todo;
+		pthread_mutex_unlock(&pipeline->mutex);
+
+		if (job->png_frame >= 0) {
+			snprintf(filename, sizeof filename,
+				 "wcap-frame-%d.png", job->png_frame);
+			write_png(job->frame,
+				  pipeline->width, pipeline->height, filename);
+			fprintf(stderr, "wrote %s\n", filename);
+		}
+
+		if (job->yuv)
+			wcap_yuv_converter_convert(pipeline->converter,
+						   pipeline->format,
+						   job->frame,
+						   pipeline->width,
+						   pipeline->height,
+						   job->out);
+
+		pthread_mutex_lock(&pipeline->mutex);
+		job->done = 1;
+		pthread_cond_broadcast(&pipeline->cond);
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	return NULL;
 }
 
-static inline
-int clamp_uv(int u)
+static struct job *
+find_next_job(struct pipeline *pipeline)
 {
-	int clamp = (u >> 18) + 128;
-
-	if (clamp < 0)
-		return 0;
-	else if (clamp > 255)
-		return 255;
-	else
-		return clamp;
+	int i;
+
+	for (i = 0; i < pipeline->njobs; i++)
+		if (pipeline->jobs[i].seq == pipeline->next_seq &&
+		    pipeline->jobs[i].done)
+			return &pipeline->jobs[i];
+
+	return NULL;
 }
 
-static void
-convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
+static void *
+writer_thread(void *data)
 {
-	unsigned char *y1, *y2, *u, *v;
-	uint32_t *p1, *p2, *end;
-	int i, u_accum, v_accum, stride0, stride1;
-	uint32_t format = decoder->format;
-
-	stride0 = decoder->width;
-	stride1 = decoder->width / 2;
-	for (i = 0; i < decoder->height; i += 2) {
-		y1 = out + stride0 * i;
-		y2 = y1 + stride0;
-		v = out + stride0 * decoder->height + stride1 * i / 2;
-		u = v + stride1 * decoder->height / 2;
-		p1 = decoder->frame + decoder->width * i;
-		p2 = p1 + decoder->width;
-		end = p1 + decoder->width;
-
-		while (p1 < end) {
-			u_accum = 0;
-			v_accum = 0;
-			y1[0] = rgb_to_yuv(format, p1[0], &u_accum, &v_accum);
-			y1[1] = rgb_to_yuv(format, p1[1], &u_accum, &v_accum);
-			y2[0] = rgb_to_yuv(format, p2[0], &u_accum, &v_accum);
-			y2[1] = rgb_to_yuv(format, p2[1], &u_accum, &v_accum);
-			u[0] = clamp_uv(u_accum);
-			v[0] = clamp_uv(v_accum);
-
-			y1 += 2;
-			p1 += 2;
-			y2 += 2;
-			p2 += 2;
-			u++;
-			v++;
+	struct pipeline *pipeline = data;
+	int size = pipeline->width * pipeline->height * 3 / 2;
+	struct job *job;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	for (;;) {
+		while (!(job = find_next_job(pipeline)) &&
+		       !(pipeline->quit &&
+			 pipeline->next_seq == pipeline->seq))
+			pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+		if (!job)
+			break;
+		pthread_mutex_unlock(&pipeline->mutex);
+
+		if (job->yuv) {
+			printf("FRAME\n");
+			fwrite(job->out, 1, size, stdout);
 		}
+
+		pthread_mutex_lock(&pipeline->mutex);
+		job->seq = -1;
+		job->done = 0;
+		job->next = pipeline->free_list;
+		pipeline->free_list = job;
+		pipeline->next_seq++;
+		pthread_cond_broadcast(&pipeline->cond);
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	return NULL;
+}
+
+static int
+pipeline_init(struct pipeline *pipeline, struct wcap_decoder *decoder,
+	      int nworkers, int yuv)
+{
+	int i, frame_size, out_size;
+
+	memset(pipeline, 0, sizeof *pipeline);
+	pthread_mutex_init(&pipeline->mutex, NULL);
+	pthread_cond_init(&pipeline->cond, NULL);
+	pipeline->todo_tail = &pipeline->todo;
+	pipeline->converter = wcap_yuv_converter_get(NULL);
+	pipeline->format = decoder->format;
+	pipeline->width = decoder->width;
+	pipeline->height = decoder->height;
+
+	/* A couple of spare jobs let the decoder run ahead while the
+	 * writer is busy. */
+	pipeline->njobs = nworkers + 2;
+	pipeline->jobs = calloc(pipeline->njobs, sizeof *pipeline->jobs);
+	pipeline->workers = calloc(nworkers, sizeof *pipeline->workers);
+	if (!pipeline->jobs || !pipeline->workers)
+		return -1;
+
+	frame_size = decoder->width * decoder->height * 4;
+	out_size = yuv ? decoder->width * decoder->height * 3 / 2 : 0;
+	for (i = 0; i < pipeline->njobs; i++) {
+		pipeline->jobs[i].seq = -1;
+		pipeline->jobs[i].frame = malloc(frame_size);
+		pipeline->jobs[i].out = malloc(out_size);
+		if (!pipeline->jobs[i].frame || (yuv && !pipeline->jobs[i].out))
+			return -1;
+		pipeline->jobs[i].next = pipeline->free_list;
+		pipeline->free_list = &pipeline->jobs[i];
 	}
+
+	for (i = 0; i < nworkers; i++) {
+		if (pthread_create(&pipeline->workers[i], NULL,
+				   worker_thread, pipeline) != 0)
+			return -1;
+		pipeline->nworkers++;
+	}
+
+	if (pthread_create(&pipeline->writer, NULL,
+			   writer_thread, pipeline) != 0)
+		return -1;
+
+	return 0;
 }
 
 static void
-output_yuv_frame(struct wcap_decoder *decoder)
+pipeline_submit(struct pipeline *pipeline, struct wcap_decoder *decoder,
+		int png_frame, int yuv)
+{
+	struct job *job;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	while (!pipeline->free_list)
+		pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+	job = pipeline->free_list;
+	pipeline->free_list = job->next;
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	memcpy(job->frame, decoder->frame,
+	       decoder->width * decoder->height * 4);
+	job->png_frame = png_frame;
+	job->yuv = yuv;
+	job->next = NULL;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	job->seq = pipeline->seq++;
+	*pipeline->todo_tail = job;
+	pipeline->todo_tail = &job->next;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+}
+
+/* Wait for everything submitted to be written out. */
+static void
+pipeline_finish(struct pipeline *pipeline)
+{
+	int i;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->quit = 1;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	for (i = 0; i < pipeline->nworkers; i++)
+		pthread_join(pipeline->workers[i], NULL);
+	pthread_join(pipeline->writer, NULL);
+
+	for (i = 0; i < pipeline->njobs; i++) {
+		free(pipeline->jobs[i].frame);
+		free(pipeline->jobs[i].out);
+	}
+	free(pipeline->jobs);
+	free(pipeline->workers);
+	pthread_cond_destroy(&pipeline->cond);
+	pthread_mutex_destroy(&pipeline->mutex);
+}
+
+/* Work out which recorded frame the decode loop in main() would be on
+ * when it writes out output frame number output_frame, stepping
+ * through the recording frame_time ms at a time.  Only the msecs in the
+ * index are needed, so nothing gets decoded.  Returns -1 if the
+ * recording is shorter than that; *total is set to the number of
+ * output frames. */
+static int
+find_indexed_frame(struct wcap_decoder *decoder,
+		   int output_frame, uint32_t frame_time, int *total)
+{
+	struct wcap_index_entry *index = decoder->index;
+	uint32_t msecs;
+	int i, j, found = -1;
+
+	*total = 0;
+	if (decoder->nframes == 0)
+		return -1;
+
+	msecs = index[0].msecs;
+	for (i = 0, j = 0; j < decoder->nframes; i++) {
+		if (i == output_frame)
+			found = j;
+		msecs += frame_time;
+		while (j < decoder->nframes && index[j].msecs < msecs)
+			j++;
+	}
+	*total = i;
+
+	return found;
+}
+
+/* Only looks at the frame headers and damage rectangles, the pixels
+ * are never decoded. */
+static int
+write_stats(struct wcap_decoder *decoder, int print, double refresh,
+	    const char *heatmap_filename)
 {
-	static unsigned char *out;
-	int size;
+	struct wcap_stats *stats;
+	struct wcap_frame_info info;
+	uint32_t *heatmap;
+
+	stats = wcap_stats_create(decoder->width, decoder->height,
+				  refresh * 1000);
+	if (stats == NULL)
+		return -1;
+
+	while (wcap_decoder_next_frame_info(decoder, &info))
+		if (wcap_stats_add_frame(stats, &info) < 0)
+			goto err;
+
+	if (print)
+		wcap_stats_print(stats, stdout, 1);
+
+	if (heatmap_filename) {
+		heatmap = malloc(decoder->width * decoder->height * 4);
+		if (heatmap == NULL)
+			goto err;
+		wcap_stats_get_heatmap(stats, heatmap);
+		write_png(heatmap, decoder->width, decoder->height,
+			  heatmap_filename);
+		fprintf(stderr, "wrote %s\n", heatmap_filename);
+		free(heatmap);
+	}
 
-	size = decoder->width * decoder->height * 3 / 2;
-	if (out == NULL)
-		out = malloc(size);
+	wcap_stats_destroy(stats);
 
-	convert_to_yv12(decoder, out);
-	printf("FRAME\n");
-	fwrite(out, 1, size, stdout);
+	return 0;
+
+err:
+	wcap_stats_destroy(stats);
+	return -1;
 }
 
 static void
@@ -152,13 +352,23 @@ usage(int exit_code)
 {
 	fprintf(stderr, "usage: wcap-decode "
 		"[--help] [--yuv4mpeg2] [--frame=<frame>] [--all] \n"
-		"\t[--rate=<num:denom>] <wcap file>\n\n"
+		"\t[--rate=<num:denom>] [--jobs=<n>] [--stats]\n"
+		"\t[--refresh=<hz>] [--heatmap=<png file>] <wcap file>\n\n"
 		"\t--help\t\t\tthis help text\n"
 		"\t--yuv4mpeg2\t\tdump wcap file to stdout in yuv4mpeg2 format\n"
 		"\t--frame=<frame>\t\twrite out the given frame number as png\n"
 		"\t--all\t\t\twrite all frames as pngs\n"
 		"\t--rate=<num:denom>\treplay frame rate for yuv4mpeg2,\n"
-		"\t\t\t\tspecified as an integer fraction\n\n");
+		"\t\t\t\tspecified as an integer fraction\n"
+		"\t--jobs=<n>\t\tnumber of threads writing pngs or\n"
+		"\t\t\t\tconverting to yuv, defaults to the\n"
+		"\t\t\t\tnumber of cpus\n"
+		"\t--stats\t\t\tprint frame intervals, damage and missed\n"
+		"\t\t\t\tvblanks for each frame and a summary\n"
+		"\t--refresh=<hz>\t\tdisplay refresh rate used to estimate\n"
+		"\t\t\t\tmissed vblanks, defaults to 60\n"
+		"\t--heatmap=<png file>\twrite an image of how often each pixel\n"
+		"\t\t\t\twas damaged, not counting keyframes\n\n");
 
 	exit(exit_code);
 }
@@ -166,10 +376,15 @@ usage(int exit_code)
 int main(int argc, char *argv[])
 {
 	struct wcap_decoder *decoder;
+	struct pipeline pipeline;
 	int i, j, output_frame = -1, yuv4mpeg2 = 0, all = 0, has_frame;
-	int num = 30, denom = 1;
+	int num = 30, denom = 1, jobs, stats = 0;
+	double refresh = 60.0;
+	const char *heatmap = NULL;
 	char filename[200];
-	uint32_t msecs, frame_time, *frame, frame_size;
+	uint32_t msecs, frame_time;
+
+	jobs = sysconf(_SC_NPROCESSORS_ONLN);
 
 	for (i = 1, j = 1; i < argc; i++) {
 		if (strcmp(argv[i], "--yuv4mpeg2") == 0) {
@@ -184,6 +399,14 @@ int main(int argc, char *argv[])
 			;
 		} else if (sscanf(argv[i], "--rate=%d:%d", &num, &denom) == 2) {
 			;
+		} else if (sscanf(argv[i], "--jobs=%d", &jobs) == 1) {
+			;
+		} else if (strcmp(argv[i], "--stats") == 0) {
+			stats = 1;
+		} else if (sscanf(argv[i], "--refresh=%lf", &refresh) == 1) {
+			;
+		} else if (strncmp(argv[i], "--heatmap=", 10) == 0) {
+			heatmap = argv[i] + 10;
 		} else if (strcmp(argv[i], "--") == 0) {
 			break;
 		} else if (argv[i][0] == '-') {
@@ -202,8 +425,29 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "invalid rate, denom can not be 0\n");
 		exit(EXIT_FAILURE);
 	}
+	if (jobs < 1)
+		jobs = 1;
+	if (refresh <= 0 || refresh > 1000000) {
+		fprintf(stderr, "invalid refresh rate, must be positive "
+			"and at most 1000000 hz\n");
+		exit(EXIT_FAILURE);
+	}
 
 	decoder = wcap_decoder_create(argv[1]);
+	if (decoder == NULL) {
+		fprintf(stderr, "failed to open wcap file %s\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (stats || heatmap) {
+		if (write_stats(decoder, stats, refresh, heatmap) < 0) {
+			fprintf(stderr, "failed to gather statistics\n");
+			exit(EXIT_FAILURE);
+		}
+		wcap_decoder_destroy(decoder);
+
+		return EXIT_SUCCESS;
+	}
 
 	if (yuv4mpeg2 && isatty(1)) {
 		fprintf(stderr, "Not dumping yuv4mpeg2 data to terminal.  Pipe output to a file or a process.\n");
@@ -220,29 +464,48 @@ int main(int argc, char *argv[])
 		fflush(stdout);
 	}
 
-	i = 0;
-	has_frame = wcap_decoder_get_frame(decoder);
-	msecs = decoder->msecs;
 	frame_time = 1000 * denom / num;
-	frame_size = decoder->width * decoder->height * 4;
-	frame = malloc(frame_size);
-	while (has_frame) {
-		if (decoder->msecs >= msecs)
-			memcpy(frame, decoder->frame, frame_size);
-		if (all || i == output_frame) {
+
+	/* With an index, a single frame can be decoded starting from the
+	 * keyframe before it instead of replaying the whole recording. */
+	if (output_frame >= 0 && !all && !yuv4mpeg2 && decoder->index) {
+		j = find_indexed_frame(decoder, output_frame, frame_time, &i);
+		if (j >= 0 && wcap_decoder_seek(decoder, j)) {
 			snprintf(filename, sizeof filename,
-				 "wcap-frame-%d.png", i);
-			write_png(decoder, filename);
+				 "wcap-frame-%d.png", output_frame);
+			write_png(decoder->frame,
+				  decoder->width, decoder->height, filename);
 			fprintf(stderr, "wrote %s\n", filename);
 		}
-		if (yuv4mpeg2)
-			output_yuv_frame(decoder);
+
+		fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
+			decoder->width, decoder->height, i);
+		wcap_decoder_destroy(decoder);
+
+		return EXIT_SUCCESS;
+	}
+
+	if (pipeline_init(&pipeline, decoder, jobs, yuv4mpeg2) < 0) {
+		fprintf(stderr, "failed to set up decoding threads\n");
+		exit(EXIT_FAILURE);
+	}
+
+	i = 0;
+	has_frame = wcap_decoder_get_frame(decoder);
+	msecs = decoder->msecs;
+	while (has_frame) {
+		if (all || i == output_frame || yuv4mpeg2)
+			pipeline_submit(&pipeline, decoder,
+					all || i == output_frame ? i : -1,
+					yuv4mpeg2);
 		i++;
 		msecs += frame_time;
 		while (decoder->msecs < msecs && has_frame)
 			has_frame = wcap_decoder_get_frame(decoder);
 	}
 
+	pipeline_finish(&pipeline);
+
 	fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
 		decoder->width, decoder->height, i);
 
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <limits.h>
 #include <sys/mman.h>
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -31,83 +32,470 @@
 #include <string.h>
 #include <fcntl.h>
 
-#include <cairo.h>
+#include "config.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "wcap-decode.h"
 
-static void
+static inline int
+min(int a, int b)
+{
+	return a < b ? a : b;
+}
+
+static inline int
+max(int a, int b)
+{
+	return a > b ? a : b;
+}
+
+/* Skip over the runs of a rectangle that's entirely outside the clip,
+ * without touching any pixels. */
+static const uint32_t *
+skip_rectangle(const struct wcap_rectangle *rect, const uint32_t *p,
+	       const uint32_t *end)
+{
+	int i = 0, count = (rect->x2 - rect->x1) * (rect->y2 - rect->y1);
+
+	while (i < count && p < end)
+		i += wcap_run_length(*p++);
+
+	return p;
+}
+
+/* Apply the runs of rect to the part of the frame inside the clip.
+ * Runs are split up into the spans they cover on each row, so pixels
+ * outside the clip cost nothing. */
+static const uint32_t *
 wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
-			      struct wcap_rectangle *rect)
+			      const struct wcap_rectangle *rect,
+			      const uint32_t *p, const uint32_t *end)
 {
-	uint32_t v, *p = decoder->p, *d;
+	const struct wcap_rectangle *clip = &decoder->clip;
+	int stride = clip->x2 - clip->x1;
 	int width = rect->x2 - rect->x1, height = rect->y2 - rect->y1;
-	int x, i, j, k, l, count = width * height;
+	int x, y, i, j, k, n, x1, x2, count = width * height;
 	unsigned char r, g, b, dr, dg, db;
+	uint32_t v, *d;
+
+	if (rect->x2 <= clip->x1 || rect->x1 >= clip->x2 ||
+	    rect->y2 <= clip->y1 || rect->y1 >= clip->y2)
+		return skip_rectangle(rect, p, end);
 
-	d = decoder->frame + (rect->y2 - 1) * decoder->width;
 	x = rect->x1;
+	y = rect->y2 - 1;
 	i = 0;
-	while (i < count) {
+	while (i < count && p < end) {
 		v = *p++;
-		l = v >> 24;
-		if (l < 0xe0) {
-			j = l + 1;
-		} else {
-			j = 1 << (l - 0xe0 + 7);
-		}
+		j = wcap_run_length(v);
+		i += j;
 
 		dr = (v >> 16);
 		dg = (v >>  8);
 		db = (v >>  0);
-		for (k = 0; k < j; k++) {
-			r = (d[x] >> 16) + dr;
-			g = (d[x] >>  8) + dg;
-			b = (d[x] >>  0) + db;
-			d[x] = 0xff000000 | (r << 16) | (g << 8) | b;
-			x++;
+		while (j > 0 && y >= rect->y1) {
+			n = min(j, rect->x2 - x);
+			if (y >= clip->y1 && y < clip->y2) {
+				x1 = max(x, clip->x1);
+				x2 = min(x + n, clip->x2);
+				d = decoder->frame + (y - clip->y1) * stride -
+					clip->x1;
+				for (k = x1; k < x2; k++) {
+					r = (d[k] >> 16) + dr;
+					g = (d[k] >>  8) + dg;
+					b = (d[k] >>  0) + db;
+					d[k] = 0xff000000 |
+						(r << 16) | (g << 8) | b;
+				}
+			}
+
+			x += n;
+			j -= n;
 			if (x == rect->x2) {
 				x = rect->x1;
-				d -= decoder->width;
+				y--;
 			}
 		}
-		i += j;
 	}
 
 	if (i != count)
 		printf("rle encoding longer than expected (%d expected %d)\n",
 		       i, count);
 
-	decoder->p = p;
+	return p;
 }
 
-int
-wcap_decoder_get_frame(struct wcap_decoder *decoder)
+static int
+wcap_decoder_ensure_frame(struct wcap_decoder *decoder)
+{
+	const struct wcap_rectangle *clip = &decoder->clip;
+	int size;
+
+	if (decoder->frame)
+		return 0;
+
+	size = (clip->x2 - clip->x1) * (clip->y2 - clip->y1) * 4;
+	decoder->frame = malloc(size);
+	if (decoder->frame == NULL)
+		return -1;
+	memset(decoder->frame, 0, size);
+
+	return 0;
+}
+
+static void
+wcap_decoder_clear_frame(struct wcap_decoder *decoder)
+{
+	const struct wcap_rectangle *clip = &decoder->clip;
+
+	memset(decoder->frame, 0,
+	       (clip->x2 - clip->x1) * (clip->y2 - clip->y1) * 4);
+}
+
+static int
+wcap_decoder_read_frame_v1(struct wcap_decoder *decoder,
+			   struct wcap_frame_info *info)
 {
-	struct wcap_rectangle *rects;
 	struct wcap_frame_header *header;
+	const uint32_t *p, *end = decoder->end;
 	uint32_t i;
 
-	if (decoder->p == decoder->end)
+	if ((char *) end - (char *) decoder->p < (long) sizeof *header)
 		return 0;
 
 	header = decoder->p;
-	decoder->msecs = header->msecs;
-	decoder->count++;
+	info->msecs = header->msecs;
+	info->nrects = header->nrects;
+	info->flags = 0;
+	info->rects = (void *) (header + 1);
+	info->runs = (const uint32_t *) (info->rects + header->nrects);
 
-	rects = (void *) (header + 1);
-	decoder->p = (uint32_t *) (rects + header->nrects);
+	/* v1 frames don't record their size, the runs have to be walked
+	 * to find where the next frame starts. */
+	p = info->runs;
 	for (i = 0; i < header->nrects; i++)
-		wcap_decoder_decode_rectangle(decoder, &rects[i]);
+		p = skip_rectangle(&info->rects[i], p, end);
+	info->nruns = p - info->runs;
+	info->size = (char *) p - (char *) decoder->p;
+
+	decoder->p = (void *) p;
 
 	return 1;
 }
 
+/* raw_size has to hold the rectangles, and can't be more than the
+ * stored payload or, compressed, one run for every pixel of every
+ * rectangle. */
+static int
+frame_raw_size_valid(struct wcap_decoder *decoder,
+		     const struct wcap_frame_header_v2 *header)
+{
+	uint64_t rects, max;
+
+	rects = (uint64_t) header->nrects * sizeof(struct wcap_rectangle);
+	if (header->raw_size < rects)
+		return 0;
+
+	if (!(header->flags & WCAP_FRAME_COMPRESSED))
+		return header->raw_size <= header->size;
+
+	max = rects + (uint64_t) header->nrects *
+		decoder->width * decoder->height * 4;
+
+	return header->raw_size <= max;
+}
+
+static int
+wcap_decoder_read_frame_v2(struct wcap_decoder *decoder,
+			   struct wcap_frame_info *info)
+{
+	struct wcap_frame_header_v2 *header = decoder->p;
+	const void *data;
+	uint32_t stored;
+	void *payload;
+
+	if ((char *) decoder->end - (char *) decoder->p < (long) sizeof *header)
+		return 0;
+
+	payload = header + 1;
+	stored = (header->size + 3) & ~3;
+	if ((char *) decoder->end - (char *) payload < (long) stored)
+		return 0;
+
+	if (!frame_raw_size_valid(decoder, header)) {
+		printf("corrupt frame %d\n", decoder->count);
+		return 0;
+	}
+
+	if (header->flags & WCAP_FRAME_COMPRESSED) {
+#ifdef HAVE_ZLIB
+		uLongf size = header->raw_size;
+
+		if (decoder->buffer_size < header->raw_size) {
+			free(decoder->buffer);
+			decoder->buffer = malloc(header->raw_size);
+			if (decoder->buffer == NULL) {
+				decoder->buffer_size = 0;
+				return 0;
+			}
+			decoder->buffer_size = header->raw_size;
+		}
+
+		if (uncompress(decoder->buffer, &size,
+			       payload, header->size) != Z_OK ||
+		    size != header->raw_size) {
+			printf("corrupt compressed frame %d\n", decoder->count);
+			return 0;
+		}
+		data = decoder->buffer;
+#else
+		printf("compressed frames not supported, "
+		       "built without zlib\n");
+		return 0;
+#endif
+	} else {
+		data = payload;
+	}
+
+	info->msecs = header->msecs;
+	info->nrects = header->nrects;
+	info->flags = header->flags;
+	info->rects = data;
+	info->runs = (const uint32_t *) (info->rects + header->nrects);
+	info->nruns = (header->raw_size -
+		       header->nrects * sizeof *info->rects) / 4;
+	info->size = sizeof *header + stored;
+
+	decoder->p = (char *) payload + stored;
+
+	return 1;
+}
+
+int
+wcap_decoder_next_frame_info(struct wcap_decoder *decoder,
+			     struct wcap_frame_info *info)
+{
+	int ret;
+
+	if (decoder->version == 1)
+		ret = wcap_decoder_read_frame_v1(decoder, info);
+	else
+		ret = wcap_decoder_read_frame_v2(decoder, info);
+
+	if (ret) {
+		decoder->msecs = info->msecs;
+		decoder->count++;
+		/* The frame contents no longer match. */
+		decoder->frame_valid = 0;
+	}
+
+	return ret;
+}
+
+int
+wcap_decoder_get_frame(struct wcap_decoder *decoder)
+{
+	struct wcap_frame_info info;
+	const uint32_t *p, *end;
+	uint32_t i;
+	int valid;
+
+	if (wcap_decoder_ensure_frame(decoder) < 0)
+		return 0;
+
+	valid = decoder->frame_valid;
+	if (!wcap_decoder_next_frame_info(decoder, &info))
+		return 0;
+
+	/* A keyframe is encoded against an all black frame, so it can
+	 * be decoded without any of the frames before it. */
+	if (info.flags & WCAP_FRAME_KEYFRAME)
+		wcap_decoder_clear_frame(decoder);
+	else if (!valid)
+		printf("frame %d decoded after skipping frames, "
+		       "contents will be wrong\n", decoder->count - 1);
+
+	p = info.runs;
+	end = info.runs + info.nruns;
+	for (i = 0; i < info.nrects; i++)
+		p = wcap_decoder_decode_rectangle(decoder, &info.rects[i],
+						  p, end);
+	decoder->frame_valid = 1;
+
+	return 1;
+}
+
+/* Only keep track of the pixels inside clip from now on, which must be
+ * within the frame.  decoder->frame becomes a clip sized image and the
+ * decoder goes back to the start of the file. */
+int
+wcap_decoder_set_clip(struct wcap_decoder *decoder,
+		      const struct wcap_rectangle *clip)
+{
+	if (clip->x1 < 0 || clip->y1 < 0 ||
+	    clip->x2 > decoder->width || clip->y2 > decoder->height ||
+	    clip->x1 >= clip->x2 || clip->y1 >= clip->y2)
+		return -1;
+
+	free(decoder->frame);
+	decoder->frame = NULL;
+	decoder->clip = *clip;
+	decoder->p = decoder->start;
+	decoder->count = 0;
+	decoder->frame_valid = 1;
+
+	return 0;
+}
+
+/* Decode frame number frame, counting from 0, so that decoder->frame
+ * holds its contents and the next wcap_decoder_get_frame() returns the
+ * frame after it.  For v2 files this starts from the closest keyframe
+ * given by the index; v1 files have to be replayed from the start.
+ * Returns 0 if the file has fewer frames. */
+int
+wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t frame)
+{
+	uint32_t start = 0;
+
+	if (decoder->index) {
+		if (frame >= (uint32_t) decoder->nframes)
+			return 0;
+		start = decoder->index[frame].keyframe;
+		decoder->p = (char *) decoder->map +
+			decoder->index[start].offset;
+	} else {
+		decoder->p = decoder->start;
+	}
+
+	if (wcap_decoder_ensure_frame(decoder) < 0)
+		return 0;
+
+	decoder->count = start;
+	wcap_decoder_clear_frame(decoder);
+	decoder->frame_valid = 1;
+	while (decoder->count <= frame)
+		if (!wcap_decoder_get_frame(decoder))
+			return 0;
+
+	return 1;
+}
+
+/* Check the trailer and every index entry before using the index: the
+ * frames must lie between the header and the index, in order, each
+ * pointing back at a keyframe at or before it.  Returns 1 if the index
+ * is usable, 0 if it isn't and -1 if it couldn't be allocated. */
+static int
+wcap_decoder_read_index(struct wcap_decoder *decoder)
+{
+	struct wcap_trailer trailer;
+	struct wcap_index_entry *index;
+	uint64_t start, end, prev = 0;
+	size_t nframes, i;
+
+	start = (char *) decoder->start - (char *) decoder->map;
+	if (decoder->size < start + sizeof trailer)
+		return 0;
+
+	memcpy(&trailer, (char *) decoder->map + decoder->size -
+	       sizeof trailer, sizeof trailer);
+	end = decoder->size - sizeof trailer;
+	if (trailer.magic != WCAP_INDEX_MAGIC ||
+	    trailer.index_offset < start || trailer.index_offset > end ||
+	    (end - trailer.index_offset) % sizeof *index)
+		return 0;
+
+	nframes = (end - trailer.index_offset) / sizeof *index;
+	if (nframes != trailer.nframes || nframes > INT_MAX)
+		return 0;
+
+	index = malloc(nframes * sizeof *index + 1);
+	if (index == NULL)
+		return -1;
+	memcpy(index, (char *) decoder->map + trailer.index_offset,
+	       nframes * sizeof *index);
+
+	for (i = 0; i < nframes; i++) {
+		if (index[i].offset < start ||
+		    index[i].offset >= trailer.index_offset ||
+		    (index[i].offset & 3) ||
+		    (i > 0 && index[i].offset <= prev) ||
+		    index[i].keyframe > i) {
+			free(index);
+			return 0;
+		}
+		prev = index[i].offset;
+	}
+
+	decoder->index = index;
+	decoder->nframes = nframes;
+	decoder->end = (char *) decoder->map + trailer.index_offset;
+
+	return 1;
+}
+
+/* Use the index at the end of the file if there is one.  If the
+ * recording was cut short and the index never got written, or it
+ * doesn't check out, rebuild it from the frame headers, which doesn't
+ * need any decoding. */
+static int
+wcap_decoder_load_index(struct wcap_decoder *decoder)
+{
+	struct wcap_frame_header_v2 *header;
+	struct wcap_index_entry *index = NULL, *entry;
+	char *p, *end;
+	uint32_t keyframe = 0, stored;
+	int n = 0, size = 0, ret;
+
+	ret = wcap_decoder_read_index(decoder);
+	if (ret < 0)
+		return -1;
+	if (ret > 0)
+		return 0;
+
+	p = decoder->start;
+	end = decoder->end;
+	while (end - p >= (long) sizeof *header) {
+		header = (struct wcap_frame_header_v2 *) p;
+		stored = (header->size + 3) & ~3;
+		if (end - (char *) (header + 1) < (long) stored)
+			break;
+
+		if (n == size) {
+			size = size ? size * 2 : 256;
+			entry = realloc(index, size * sizeof *index);
+			if (entry == NULL) {
+				free(index);
+				return -1;
+			}
+			index = entry;
+		}
+
+		if (header->flags & WCAP_FRAME_KEYFRAME)
+			keyframe = n;
+		index[n].offset = p - (char *) decoder->map;
+		index[n].msecs = header->msecs;
+		index[n].keyframe = keyframe;
+		n++;
+
+		p = (char *) (header + 1) + stored;
+	}
+
+	decoder->index = index;
+	decoder->nframes = n;
+	decoder->end = p;
+
+	return 0;
+}
+
 struct wcap_decoder *
 wcap_decoder_create(const char *filename)
 {
 	struct wcap_decoder *decoder;
 	struct wcap_header *header;
-	int frame_size;
+	struct wcap_header_v2 *header_v2;
 	struct stat buf;
 
 	decoder = malloc(sizeof *decoder);
@@ -122,28 +510,68 @@ wcap_decoder_create(const char *filename)
 
 	fstat(decoder->fd, &buf);
 	decoder->size = buf.st_size;
+	if (decoder->size < sizeof *header)
+		goto err_close;
+
 	decoder->map = mmap(NULL, decoder->size,
 			    PROT_READ, MAP_PRIVATE, decoder->fd, 0);
-		
+	if (decoder->map == MAP_FAILED)
+		goto err_close;
+
 	header = decoder->map;
 	decoder->format = header->format;
 	decoder->count = 0;
 	decoder->width = header->width;
 	decoder->height = header->height;
-	decoder->p = header + 1;
-	decoder->end = decoder->map + decoder->size;
+	decoder->end = (char *) decoder->map + decoder->size;
+	decoder->index = NULL;
+	decoder->nframes = -1;
+	decoder->buffer = NULL;
+	decoder->buffer_size = 0;
+	decoder->clip.x1 = 0;
+	decoder->clip.y1 = 0;
+	decoder->clip.x2 = header->width;
+	decoder->clip.y2 = header->height;
+	decoder->frame = NULL;
+	decoder->frame_valid = 1;
 
-	frame_size = header->width * header->height * 4;
-	decoder->frame = malloc(frame_size);
-	memset(decoder->frame, 0, frame_size);
+	switch (header->magic) {
+	case WCAP_HEADER_MAGIC:
+		decoder->version = 1;
+		decoder->start = header + 1;
+		break;
+	case WCAP_HEADER_MAGIC_V2:
+		header_v2 = decoder->map;
+		if (decoder->size < sizeof *header_v2 ||
+		    header_v2->version != 2)
+			goto err_unmap;
+		decoder->version = 2;
+		decoder->start = header_v2 + 1;
+		if (wcap_decoder_load_index(decoder) < 0)
+			goto err_unmap;
+		break;
+	default:
+		goto err_unmap;
+	}
+	decoder->p = decoder->start;
 
 	return decoder;
+
+err_unmap:
+	munmap(decoder->map, decoder->size);
+err_close:
+	close(decoder->fd);
+	free(decoder);
+	return NULL;
 }
 
 void
 wcap_decoder_destroy(struct wcap_decoder *decoder)
 {
 	munmap(decoder->map, decoder->size);
+	close(decoder->fd);
+	free(decoder->index);
+	free(decoder->buffer);
 	free(decoder->frame);
 	free(decoder);
 }
@@ -24,6 +24,8 @@
 #define _WCAP_DECODE_
 
 #define WCAP_HEADER_MAGIC	0x57434150
+#define WCAP_HEADER_MAGIC_V2	0x57434132
+#define WCAP_INDEX_MAGIC	0x57494458
 
 #define WCAP_FORMAT_XRGB8888	0x34325258
 #define WCAP_FORMAT_XBGR8888	0x34324258
@@ -36,27 +38,104 @@ struct wcap_header {
 	uint32_t width, height;
 };
 
+struct wcap_header_v2 {
+	uint32_t magic;
+	uint32_t format;
+	uint32_t width, height;
+	uint32_t version;
+	uint32_t reserved;
+};
+
 struct wcap_frame_header {
 	uint32_t msecs;
 	uint32_t nrects;
 };
 
+#define WCAP_FRAME_KEYFRAME	0x01
+#define WCAP_FRAME_COMPRESSED	0x02
+
+/* In a v2 file the rectangles and run-length encoded pixels of a frame
+ * form its payload, which is size bytes long, padded to a multiple of
+ * 4 bytes, and raw_size bytes long once uncompressed. */
+struct wcap_frame_header_v2 {
+	uint32_t msecs;
+	uint32_t nrects;
+	uint32_t flags;
+	uint32_t size;
+	uint32_t raw_size;
+};
+
+struct wcap_index_entry {
+	uint64_t offset;
+	uint32_t msecs;
+	uint32_t keyframe;
+};
+
+struct wcap_trailer {
+	uint64_t index_offset;
+	uint32_t nframes;
+	uint32_t magic;
+};
+
 struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
 
+/* A frame as stored in the file, without expanding the runs.  rects
+ * and runs point into the file mapping, or into the decoder's buffer
+ * for compressed frames, and are only valid until the next frame is
+ * read.  The runs of all rectangles follow each other, each rectangle
+ * taking as many as it needs to cover its pixels. */
+struct wcap_frame_info {
+	uint32_t msecs;
+	uint32_t nrects;
+	uint32_t flags;
+	const struct wcap_rectangle *rects;
+	const uint32_t *runs;
+	uint32_t nruns;
+	/* Bytes taken up in the file, including the header. */
+	uint32_t size;
+};
+
+/* Number of pixels covered by a run. */
+static inline int
+wcap_run_length(uint32_t run)
+{
+	uint32_t l = run >> 24;
+
+	return l < 0xe0 ? (int) l + 1 : 1 << (l - 0xe0 + 7);
+}
+
 struct wcap_decoder {
 	int fd;
 	size_t size;
-	void *map, *p, *end;
+	void *map, *p, *end, *start;
 	uint32_t *frame;
 	uint32_t format;
 	uint32_t msecs;
 	uint32_t count;
 	int width, height;
+
+	int version;
+	/* Only known up front for v2 files, -1 otherwise. */
+	int nframes;
+	struct wcap_index_entry *index;
+	void *buffer;
+	uint32_t buffer_size;
+
+	/* decoder->frame only holds this part of the frame, with a stride
+	 * of its width.  The whole frame unless changed with
+	 * wcap_decoder_set_clip(). */
+	struct wcap_rectangle clip;
+	int frame_valid;
 };
 
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
+int wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t frame);
+int wcap_decoder_next_frame_info(struct wcap_decoder *decoder,
+				 struct wcap_frame_info *info);
+int wcap_decoder_set_clip(struct wcap_decoder *decoder,
+			  const struct wcap_rectangle *clip);
 struct wcap_decoder *wcap_decoder_create(const char *filename);
 void wcap_decoder_destroy(struct wcap_decoder *decoder);
 
@@ -0,0 +1,518 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "config.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "wcap-encode.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define WCAP_ENCODE_X86 1
+#include <immintrin.h>
+#endif
+
+/* Encoder state carried from one row to the next; runs are allowed to
+ * span rows. */
+struct wcap_encode_state {
+	uint32_t *p;
+	uint32_t prev;
+	int run;
+};
+
+struct wcap_encoder {
+	const char *name;
+	int (*supported)(void);
+	void (*encode_row)(struct wcap_encode_state *state,
+			   uint32_t *d, const uint32_t *s, int width);
+};
+
+static uint32_t *
+output_run(uint32_t *p, uint32_t delta, int run)
+{
+	int i;
+
+	while (run > 0) {
+		if (run <= 0xe0) {
+			*p++ = delta | ((run - 1) << 24);
+			break;
+		}
+
+		i = 24 - __builtin_clz(run);
+		*p++ = delta | ((i + 0xe0) << 24);
+		run -= 1 << (7 + i);
+	}
+
+	return p;
+}
+
+static inline uint32_t
+component_delta(uint32_t next, uint32_t prev)
+{
+	unsigned char dr, dg, db;
+
+	dr = (next >> 16) - (prev >> 16);
+	dg = (next >>  8) - (prev >>  8);
+	db = (next >>  0) - (prev >>  0);
+
+	return (dr << 16) | (dg << 8) | (db << 0);
+}
+
+static inline void
+encode_delta(struct wcap_encode_state *state, uint32_t delta)
+{
+	if (state->run == 0 || delta == state->prev) {
+		state->run++;
+	} else {
+		state->p = output_run(state->p, state->prev, state->run);
+		state->run = 1;
+	}
+	state->prev = delta;
+}
+
+/* Feed a group of deltas whose equality with their predecessor is
+ * already known: bit i of equal is set if delta[i] continues the run
+ * of the delta before it. */
+static inline void
+encode_group(struct wcap_encode_state *state,
+	     const uint32_t *delta, unsigned int equal, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (equal & (1 << i)) {
+			state->run++;
+		} else {
+			state->p = output_run(state->p,
+					      state->prev, state->run);
+			state->run = 1;
+			state->prev = delta[i];
+		}
+	}
+}
+
+static int
+supported_always(void)
+{
+	return 1;
+}
+
+static void
+encode_row_c(struct wcap_encode_state *state,
+	     uint32_t *d, const uint32_t *s, int width)
+{
+	uint32_t next;
+	int k;
+
+	for (k = 0; k < width; k++) {
+		next = *s++;
+		encode_delta(state, component_delta(next, *d));
+		*d++ = next;
+	}
+}
+
+#ifdef WCAP_ENCODE_X86
+
+static int
+supported_sse2(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+static int
+supported_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+/* The channel deltas are a plain bytewise subtraction with the alpha
+ * byte masked off, which is exactly what component_delta() computes.
+ * Each delta is then compared against its left neighbour (the last
+ * delta of the previous group for lane 0); a group that only extends
+ * the current run costs a single compare. */
+__attribute__((target("sse2"))) static void
+encode_row_sse2(struct wcap_encode_state *state,
+		uint32_t *d, const uint32_t *s, int width)
+{
+	const __m128i mask = _mm_set1_epi32(0x00ffffff);
+	__m128i next, delta, shifted;
+	uint32_t lanes[4];
+	unsigned int equal;
+	int k = 0;
+
+	if (state->run == 0 && width > 0) {
+		encode_row_c(state, d, s, 1);
+		k = 1;
+	}
+
+	for (; k + 4 <= width; k += 4) {
+		next = _mm_loadu_si128((const __m128i *) (s + k));
+		delta = _mm_and_si128(_mm_sub_epi8(next,
+				_mm_loadu_si128((const __m128i *) (d + k))),
+				mask);
+		_mm_storeu_si128((__m128i *) (d + k), next);
+
+		shifted = _mm_or_si128(_mm_slli_si128(delta, 4),
+				       _mm_cvtsi32_si128(state->prev));
+		equal = _mm_movemask_ps(_mm_castsi128_ps(
+				_mm_cmpeq_epi32(delta, shifted)));
+
+		if (equal == 0xf) {
+			state->run += 4;
+			continue;
+		}
+
+		_mm_storeu_si128((__m128i *) lanes, delta);
+		encode_group(state, lanes, equal, 4);
+	}
+
+	encode_row_c(state, d + k, s + k, width - k);
+}
+
+__attribute__((target("avx2"))) static void
+encode_row_avx2(struct wcap_encode_state *state,
+		uint32_t *d, const uint32_t *s, int width)
+{
+	const __m256i mask = _mm256_set1_epi32(0x00ffffff);
+	const __m256i rotate = _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6);
+	__m256i next, delta, shifted;
+	uint32_t lanes[8];
+	unsigned int equal;
+	int k = 0;
+
+	if (state->run == 0 && width > 0) {
+		encode_row_c(state, d, s, 1);
+		k = 1;
+	}
+
+	for (; k + 8 <= width; k += 8) {
+		next = _mm256_loadu_si256((const __m256i *) (s + k));
+		delta = _mm256_and_si256(_mm256_sub_epi8(next,
+				_mm256_loadu_si256((const __m256i *) (d + k))),
+				mask);
+		_mm256_storeu_si256((__m256i *) (d + k), next);
+
+		shifted = _mm256_blend_epi32(
+				_mm256_permutevar8x32_epi32(delta, rotate),
+				_mm256_set1_epi32(state->prev), 0x01);
+		equal = _mm256_movemask_ps(_mm256_castsi256_ps(
+				_mm256_cmpeq_epi32(delta, shifted)));
+
+		if (equal == 0xff) {
+			state->run += 8;
+			continue;
+		}
+
+		_mm256_storeu_si256((__m256i *) lanes, delta);
+		encode_group(state, lanes, equal, 8);
+	}
+
+	encode_row_c(state, d + k, s + k, width - k);
+}
+
+#endif
+
+/* Fastest first. */
+static const struct wcap_encoder encoders[] = {
+#ifdef WCAP_ENCODE_X86
+	{ "avx2", supported_avx2, encode_row_avx2 },
+	{ "sse2", supported_sse2, encode_row_sse2 },
+#endif
+	{ "c", supported_always, encode_row_c },
+};
+
+const struct wcap_encoder *
+wcap_encoder_get(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof encoders / sizeof encoders[0]; i++) {
+		if (name && strcmp(name, encoders[i].name) != 0)
+			continue;
+		if (encoders[i].supported())
+			return &encoders[i];
+		if (name)
+			return NULL;
+	}
+
+	return NULL;
+}
+
+const char *
+wcap_encoder_get_name(const struct wcap_encoder *encoder)
+{
+	return encoder->name;
+}
+
+uint32_t *
+wcap_encoder_encode_rect(const struct wcap_encoder *encoder,
+			 uint32_t *frame, int frame_stride,
+			 const struct wcap_rectangle *rect,
+			 const uint32_t *src, int src_stride, uint32_t *p)
+{
+	struct wcap_encode_state state;
+	int j, width, height;
+
+	width = rect->x2 - rect->x1;
+	height = rect->y2 - rect->y1;
+
+	state.p = p;
+	state.prev = 0;
+	state.run = 0;
+	for (j = 0; j < height; j++)
+		encoder->encode_row(&state,
+				    frame + frame_stride * (rect->y2 - j - 1) +
+				    rect->x1,
+				    src + j * src_stride, width);
+
+	return output_run(state.p, state.prev, state.run);
+}
+
+struct wcap_writer {
+	int fd;
+	uint32_t flags;
+	int width, height;
+	uint64_t size;
+	const struct wcap_encoder *encoder;
+	uint32_t *frame;
+
+	void *payload, *compressed;
+	size_t payload_size, compressed_size;
+
+	struct wcap_index_entry *index;
+	uint32_t nframes, index_size;
+	uint32_t keyframe;
+
+	/* Set after a write failed, the file may end in part of a frame. */
+	int failed;
+};
+
+static int
+write_all(int fd, const void *data, size_t size)
+{
+	const char *p = data;
+	ssize_t len;
+
+	while (size > 0) {
+		len = write(fd, p, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return -1;
+		p += len;
+		size -= len;
+	}
+
+	return 0;
+}
+
+static void *
+ensure_buffer(void **buffer, size_t *size, size_t needed)
+{
+	void *data;
+
+	if (*size >= needed)
+		return *buffer;
+
+	data = realloc(*buffer, needed);
+	if (data == NULL)
+		return NULL;
+
+	*buffer = data;
+	*size = needed;
+
+	return data;
+}
+
+struct wcap_writer *
+wcap_writer_create(int fd, uint32_t format, int width, int height,
+		   uint32_t flags)
+{
+	struct wcap_writer *writer;
+	struct wcap_header_v2 header;
+
+	writer = malloc(sizeof *writer);
+	if (writer == NULL)
+		return NULL;
+
+	memset(writer, 0, sizeof *writer);
+	writer->fd = fd;
+	writer->flags = flags;
+	writer->width = width;
+	writer->height = height;
+	writer->encoder = wcap_encoder_get(NULL);
+	writer->frame = calloc(width * height, 4);
+	if (writer->frame == NULL) {
+		free(writer);
+		return NULL;
+	}
+
+	header.magic = WCAP_HEADER_MAGIC_V2;
+	header.format = format;
+	header.width = width;
+	header.height = height;
+	header.version = 2;
+	header.reserved = 0;
+	if (write_all(fd, &header, sizeof header) < 0) {
+		free(writer->frame);
+		free(writer);
+		return NULL;
+	}
+	writer->size = sizeof header;
+
+	return writer;
+}
+
+int
+wcap_writer_write_frame(struct wcap_writer *writer, uint32_t msecs,
+			int keyframe, const struct wcap_rectangle *rects,
+			int nrects, const uint32_t *pixels)
+{
+	struct wcap_frame_header_v2 header;
+	struct wcap_index_entry *entry;
+	uint32_t *p, pad = 0;
+	const void *data;
+	size_t size;
+	int i, width, height;
+
+	/* The run-length encoding never takes more than a word per
+	 * pixel. */
+	size = nrects * sizeof *rects;
+	for (i = 0; i < nrects; i++)
+		size += (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1) * 4;
+	if (!ensure_buffer(&writer->payload, &writer->payload_size, size))
+		return -1;
+
+	if (writer->nframes == writer->index_size) {
+		entry = realloc(writer->index, (writer->index_size * 2 + 256) *
+				sizeof *entry);
+		if (entry == NULL)
+			return -1;
+		writer->index = entry;
+		writer->index_size = writer->index_size * 2 + 256;
+	}
+
+	if (keyframe) {
+		memset(writer->frame, 0, writer->width * writer->height * 4);
+		writer->keyframe = writer->nframes;
+	}
+
+	memcpy(writer->payload, rects, nrects * sizeof *rects);
+	p = (uint32_t *) ((char *) writer->payload +
+			  nrects * sizeof *rects);
+	for (i = 0; i < nrects; i++) {
+		width = rects[i].x2 - rects[i].x1;
+		height = rects[i].y2 - rects[i].y1;
+		p = wcap_encoder_encode_rect(writer->encoder,
+					     writer->frame, writer->width,
+					     &rects[i], pixels, width, p);
+		pixels += width * height;
+	}
+
+	header.msecs = msecs;
+	header.nrects = nrects;
+	header.flags = keyframe ? WCAP_FRAME_KEYFRAME : 0;
+	header.raw_size = (char *) p - (char *) writer->payload;
+	header.size = header.raw_size;
+	data = writer->payload;
+
+#ifdef HAVE_ZLIB
+	if (writer->flags & WCAP_WRITER_COMPRESS) {
+		uLongf len = compressBound(header.raw_size);
+
+		if (ensure_buffer(&writer->compressed,
+				  &writer->compressed_size, len) &&
+		    compress2(writer->compressed, &len, writer->payload,
+			      header.raw_size, Z_BEST_SPEED) == Z_OK &&
+		    len < header.raw_size) {
+			header.flags |= WCAP_FRAME_COMPRESSED;
+			header.size = len;
+			data = writer->compressed;
+		}
+	}
+#endif
+
+	if (write_all(writer->fd, &header, sizeof header) < 0 ||
+	    write_all(writer->fd, data, header.size) < 0 ||
+	    write_all(writer->fd, &pad, -header.size & 3) < 0) {
+		writer->failed = 1;
+		return -1;
+	}
+
+	entry = &writer->index[writer->nframes++];
+	entry->offset = writer->size;
+	entry->msecs = msecs;
+	entry->keyframe = writer->keyframe;
+
+	writer->size += sizeof header + ((header.size + 3) & ~3);
+
+	return 0;
+}
+
+uint64_t
+wcap_writer_get_size(struct wcap_writer *writer)
+{
+	return writer->size;
+}
+
+int
+wcap_writer_destroy(struct wcap_writer *writer)
+{
+	struct wcap_trailer trailer;
+	int ret = 0;
+
+	trailer.index_offset = writer->size;
+	trailer.nframes = writer->nframes;
+	trailer.magic = WCAP_INDEX_MAGIC;
+
+	/* Cut off whatever part of a frame a failed write left behind,
+	 * so the index goes where the trailer says it is.  If that's not
+	 * possible, leave the index out; readers can do without. */
+	if (writer->failed &&
+	    (ftruncate(writer->fd, writer->size) < 0 ||
+	     lseek(writer->fd, writer->size, SEEK_SET) < 0))
+		ret = -1;
+
+	if (ret == 0)
+		ret = write_all(writer->fd, writer->index,
+				writer->nframes * sizeof *writer->index);
+	if (ret == 0)
+		ret = write_all(writer->fd, &trailer, sizeof trailer);
+
+	free(writer->index);
+	free(writer->payload);
+	free(writer->compressed);
+	free(writer->frame);
+	free(writer);
+
+	return ret;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WCAP_ENCODE_
+#define _WCAP_ENCODE_
+
+#include <stdint.h>
+
+#include "wcap-decode.h"
+
+struct wcap_encoder;
+
+/* Look up an encoder implementation by name ("c", "sse2" or "avx2").
+ * With a NULL name the fastest one the CPU supports is returned.
+ * Returns NULL if the implementation is unknown or not supported on
+ * this machine. */
+const struct wcap_encoder *wcap_encoder_get(const char *name);
+const char *wcap_encoder_get_name(const struct wcap_encoder *encoder);
+
+/* Delta and run-length encode rect into p.  frame holds the previous
+ * contents of the output, frame_stride pixels per row, and is updated
+ * with the new pixels.  The source rows are consumed bottom-up,
+ * starting at row src and advancing by src_stride pixels per row, to
+ * match the order read_pixels() returns them in.  All implementations
+ * produce the same output.  Returns the end of the encoded data. */
+uint32_t *
+wcap_encoder_encode_rect(const struct wcap_encoder *encoder,
+			 uint32_t *frame, int frame_stride,
+			 const struct wcap_rectangle *rect,
+			 const uint32_t *src, int src_stride, uint32_t *p);
+
+#define WCAP_WRITER_COMPRESS	0x01
+
+struct wcap_writer;
+
+/* Write a v2 capture to fd, starting with the file header.  With
+ * WCAP_WRITER_COMPRESS each frame payload is deflated, if zlib support
+ * was built in. */
+struct wcap_writer *
+wcap_writer_create(int fd, uint32_t format, int width, int height,
+		   uint32_t flags);
+
+/* Encode and write one frame.  pixels holds the contents of each of
+ * the nrects rectangles in turn, rows bottom-up, as read_pixels()
+ * returns them.  A keyframe is encoded against a black frame rather
+ * than the previous one, so it should cover the whole output.  Returns
+ * -1 if the frame couldn't be written. */
+int
+wcap_writer_write_frame(struct wcap_writer *writer, uint32_t msecs,
+			int keyframe, const struct wcap_rectangle *rects,
+			int nrects, const uint32_t *pixels);
+
+/* Number of bytes written so far. */
+uint64_t
+wcap_writer_get_size(struct wcap_writer *writer);
+
+/* Append the frame index and free the writer.  After a failed write
+ * the file is first cut back to the frames written completely.  The fd
+ * is left open. */
+int
+wcap_writer_destroy(struct wcap_writer *writer);
+
+#endif
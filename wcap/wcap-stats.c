@@ -0,0 +1,283 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "wcap-stats.h"
+
+struct wcap_stats *
+wcap_stats_create(int width, int height, uint32_t refresh_mhz)
+{
+	struct wcap_stats *stats;
+
+	stats = malloc(sizeof *stats);
+	if (stats == NULL)
+		return NULL;
+
+	memset(stats, 0, sizeof *stats);
+	stats->width = width;
+	stats->height = height;
+	stats->refresh_mhz = refresh_mhz ? refresh_mhz : 60000;
+
+	stats->damage = calloc((width + 1) * (height + 1),
+			       sizeof *stats->damage);
+	if (stats->damage == NULL) {
+		free(stats);
+		return NULL;
+	}
+
+	return stats;
+}
+
+void
+wcap_stats_destroy(struct wcap_stats *stats)
+{
+	free(stats->damage);
+	free(stats->frames);
+	free(stats);
+}
+
+/* Never 0, even for refresh rates above 1 MHz. */
+static uint32_t
+refresh_usecs(struct wcap_stats *stats)
+{
+	uint32_t usecs = 1000000000 / stats->refresh_mhz;
+
+	return usecs ? usecs : 1;
+}
+
+int
+wcap_stats_add_frame(struct wcap_stats *stats,
+		     const struct wcap_frame_info *info)
+{
+	struct wcap_stats_frame *frame;
+	const struct wcap_rectangle *r;
+	int32_t *d = stats->damage;
+	int x1, y1, x2, y2, stride = stats->width + 1;
+	uint32_t i, n, period = refresh_usecs(stats);
+
+	if (stats->nframes == stats->size) {
+		n = stats->size ? stats->size * 2 : 1024;
+		frame = realloc(stats->frames, n * sizeof *frame);
+		if (frame == NULL)
+			return -1;
+		stats->frames = frame;
+		stats->size = n;
+	}
+
+	frame = &stats->frames[stats->nframes];
+	frame->msecs = info->msecs;
+	frame->interval = 0;
+	frame->area = 0;
+	frame->missed = 0;
+	frame->keyframe = stats->nframes == 0 ||
+		(info->flags & WCAP_FRAME_KEYFRAME);
+
+	for (i = 0; i < info->nrects; i++) {
+		r = &info->rects[i];
+		x1 = r->x1 < 0 ? 0 : r->x1;
+		y1 = r->y1 < 0 ? 0 : r->y1;
+		x2 = r->x2 > stats->width ? stats->width : r->x2;
+		y2 = r->y2 > stats->height ? stats->height : r->y2;
+		if (x1 >= x2 || y1 >= y2)
+			continue;
+
+		frame->area += (x2 - x1) * (y2 - y1);
+		if (frame->keyframe)
+			continue;
+		d[y1 * stride + x1]++;
+		d[y1 * stride + x2]--;
+		d[y2 * stride + x1]--;
+		d[y2 * stride + x2]++;
+	}
+
+	if (frame->keyframe)
+		stats->keyframes++;
+	else
+		stats->area += frame->area;
+
+	if (stats->nframes > 0) {
+		frame->interval = info->msecs - frame[-1].msecs;
+		if (frame->interval > WCAP_STATS_IDLE_MSECS) {
+			stats->idle++;
+		} else {
+			/* Round to the nearest number of refresh
+			 * periods; anything quicker than one still
+			 * took a vblank. */
+			n = (frame->interval * 1000 + period / 2) / period;
+			if (n == 0)
+				n = 1;
+			frame->missed = n - 1;
+			stats->missed += frame->missed;
+			if (n > WCAP_STATS_BUCKETS)
+				n = WCAP_STATS_BUCKETS;
+			stats->histogram[n - 1]++;
+		}
+	}
+
+	stats->nframes++;
+
+	return 0;
+}
+
+static int
+compare_uint32(const void *a, const void *b)
+{
+	uint32_t ua = *(const uint32_t *) a, ub = *(const uint32_t *) b;
+
+	return ua < ub ? -1 : ua > ub;
+}
+
+void
+wcap_stats_print(struct wcap_stats *stats, FILE *fp, int per_frame)
+{
+	struct wcap_stats_frame *frame;
+	uint32_t *intervals, max = 0, period = refresh_usecs(stats);
+	double screen = (double) stats->width * stats->height;
+	double duration, lo, hi;
+	int i, j, n = 0;
+
+	if (per_frame) {
+		fprintf(fp, "%7s %10s %8s %8s %7s\n",
+			"frame", "msecs", "interval", "damage", "missed");
+		for (i = 0; i < stats->nframes; i++) {
+			frame = &stats->frames[i];
+			fprintf(fp, "%7d %10u %8u %7.1f%% %7u%s\n",
+				i, frame->msecs, frame->interval,
+				100.0 * frame->area / screen, frame->missed,
+				frame->keyframe ? " keyframe" : "");
+		}
+		fprintf(fp, "\n");
+	}
+
+	if (stats->nframes == 0) {
+		fprintf(fp, "no frames\n");
+		return;
+	}
+
+	duration = stats->frames[stats->nframes - 1].msecs -
+		stats->frames[0].msecs;
+	fprintf(fp, "frames:        %d in %.3f s", stats->nframes,
+		duration / 1000.0);
+	if (duration > 0)
+		fprintf(fp, ", %.1f fps", (stats->nframes - 1) * 1000.0 / duration);
+	fprintf(fp, "\n");
+	if (stats->nframes > (int) stats->keyframes)
+		fprintf(fp, "damage:        %.1f%% of %dx%d per frame "
+			"on average\n",
+			100.0 * stats->area /
+			(stats->nframes - stats->keyframes) / screen,
+			stats->width, stats->height);
+	fprintf(fp, "keyframes:     %u, not counted in the damage\n",
+		stats->keyframes);
+	fprintf(fp, "refresh:       %.3f Hz\n", stats->refresh_mhz / 1000.0);
+	fprintf(fp, "missed vblanks: %u\n", stats->missed);
+	fprintf(fp, "idle gaps:     %u (longer than %d ms)\n",
+		stats->idle, WCAP_STATS_IDLE_MSECS);
+
+	intervals = malloc(stats->nframes * sizeof *intervals);
+	if (intervals == NULL)
+		return;
+	for (i = 1; i < stats->nframes; i++)
+		if (stats->frames[i].interval <= WCAP_STATS_IDLE_MSECS)
+			intervals[n++] = stats->frames[i].interval;
+	qsort(intervals, n, sizeof *intervals, compare_uint32);
+
+	if (n > 0)
+		fprintf(fp, "interval (ms): p50 %u, p95 %u, p99 %u, max %u\n",
+			intervals[n / 2], intervals[n * 95 / 100],
+			intervals[n * 99 / 100], intervals[n - 1]);
+	free(intervals);
+
+	for (i = 0; i < WCAP_STATS_BUCKETS; i++)
+		if (stats->histogram[i] > max)
+			max = stats->histogram[i];
+	if (max == 0)
+		return;
+
+	fprintf(fp, "\nframe intervals:\n");
+	for (i = 0; i < WCAP_STATS_BUCKETS; i++) {
+		lo = i == 0 ? 0 : (i + 0.5) * period / 1000.0;
+		hi = (i + 1.5) * period / 1000.0;
+		if (i < WCAP_STATS_BUCKETS - 1)
+			fprintf(fp, "  %d vblank%s %6.1f - %6.1f ms %7u ",
+				i + 1, i ? "s" : " ", lo, hi,
+				stats->histogram[i]);
+		else
+			fprintf(fp, " %d+ vblanks %6.1f -    ... ms %7u ",
+				i + 1, lo, stats->histogram[i]);
+		for (j = 0; j < (int) (stats->histogram[i] * 40 / max); j++)
+			fputc('#', fp);
+		fputc('\n', fp);
+	}
+}
+
+void
+wcap_stats_get_heatmap(struct wcap_stats *stats, uint32_t *heatmap)
+{
+	int x, y, width = stats->width, stride = width + 1;
+	int32_t *d, *row, *above, max = 0;
+	uint32_t r, g, b, t;
+
+	/* Integrate a copy of the difference array into per pixel
+	 * damage counts. */
+	d = malloc(stride * (stats->height + 1) * sizeof *d);
+	if (d == NULL)
+		return;
+	memcpy(d, stats->damage, stride * (stats->height + 1) * sizeof *d);
+	for (y = 0; y < stats->height; y++) {
+		row = d + y * stride;
+		above = row - stride;
+		for (x = 0; x < width; x++) {
+			if (x > 0)
+				row[x] += row[x - 1];
+			if (y > 0)
+				row[x] += above[x];
+			if (x > 0 && y > 0)
+				row[x] -= above[x - 1];
+			if (row[x] > max)
+				max = row[x];
+		}
+	}
+
+	for (y = 0; y < stats->height; y++) {
+		for (x = 0; x < width; x++) {
+			/* Scale to 0..767 and ramp black, blue, red,
+			 * white in three steps. */
+			t = max ? (uint32_t) d[y * stride + x] * 767 / max : 0;
+			if (t < 256) {
+				r = 0, g = 0, b = t;
+			} else if (t < 512) {
+				r = t - 256, g = 0, b = 511 - t;
+			} else {
+				r = 255, g = t - 512, b = t - 512;
+			}
+			heatmap[y * width + x] =
+				0xff000000 | (r << 16) | (g << 8) | b;
+		}
+	}
+
+	free(d);
+}
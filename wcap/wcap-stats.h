@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WCAP_STATS_
+#define _WCAP_STATS_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "wcap-decode.h"
+
+/* Frame intervals are sorted into buckets of whole refresh periods,
+ * the last bucket collects everything longer. */
+#define WCAP_STATS_BUCKETS	9
+
+/* Gaps longer than this are taken to mean nothing changed on screen,
+ * rather than the compositor missing frames. */
+#define WCAP_STATS_IDLE_MSECS	250
+
+struct wcap_stats_frame {
+	uint32_t msecs;
+	uint32_t interval;
+	/* Damaged pixels, and how many vblanks were missed before
+	 * this frame. */
+	uint32_t area;
+	uint32_t missed;
+	/* Keyframes repaint everything whether it changed or not, and
+	 * so are left out of the damage average and the heatmap. */
+	int keyframe;
+};
+
+struct wcap_stats {
+	int width, height;
+	uint32_t refresh_mhz;
+
+	struct wcap_stats_frame *frames;
+	int nframes, size;
+
+	uint32_t histogram[WCAP_STATS_BUCKETS];
+	uint32_t missed, idle, keyframes;
+	/* Damage of all frames but the keyframes. */
+	uint64_t area;
+
+	/* Cumulative damage, kept as a 2D difference array so adding a
+	 * rectangle only touches its four corners. */
+	int32_t *damage;
+};
+
+struct wcap_stats *
+wcap_stats_create(int width, int height, uint32_t refresh_mhz);
+void
+wcap_stats_destroy(struct wcap_stats *stats);
+/* The first frame of a recording is always counted as a keyframe,
+ * v1 files don't flag it. */
+int
+wcap_stats_add_frame(struct wcap_stats *stats,
+		     const struct wcap_frame_info *info);
+
+/* Print one line per frame and then a summary with a histogram of the
+ * frame intervals. */
+void
+wcap_stats_print(struct wcap_stats *stats, FILE *fp, int per_frame);
+
+/* Fill the width x height ARGB image in heatmap with the number of
+ * times each pixel was damaged, from black for never through blue and
+ * red to white for the most damaged pixels. */
+void
+wcap_stats_get_heatmap(struct wcap_stats *stats, uint32_t *heatmap);
+
+#endif
@@ -0,0 +1,380 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "wcap-decode.h"
+#include "wcap-yuv.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define WCAP_YUV_X86 1
+#include <immintrin.h>
+#endif
+
+/* Converts a pair of rows; width pixels from p1 and p2 become width
+ * luma samples in y1 and y2 and width / 2 chroma samples in u and v. */
+typedef void (*convert_rows_func_t)(int rshift, int bshift,
+				    const uint32_t *p1, const uint32_t *p2,
+				    int width,
+				    unsigned char *y1, unsigned char *y2,
+				    unsigned char *u, unsigned char *v);
+
+struct wcap_yuv_converter {
+	const char *name;
+	int (*supported)(void);
+	convert_rows_func_t convert_rows;
+};
+
+static inline int
+rgb_to_yuv(int rshift, int bshift, uint32_t p, int *u, int *v)
+{
+	int r, g, b, y;
+
+	r = (p >> rshift) & 0xff;
+	g = (p >> 8) & 0xff;
+	b = (p >> bshift) & 0xff;
+
+	y = (19595 * r + 38469 * g + 7472 * b) >> 16;
+	if (y > 255)
+		y = 255;
+
+	*u += 46727 * (r - y);
+	*v += 36962 * (b - y);
+
+	return y;
+}
+
+static inline
+int clamp_uv(int u)
+{
+	int clamp = (u >> 18) + 128;
+
+	if (clamp < 0)
+		return 0;
+	else if (clamp > 255)
+		return 255;
+	else
+		return clamp;
+}
+
+static int
+supported_always(void)
+{
+	return 1;
+}
+
+static void
+convert_rows_c(int rshift, int bshift,
+	       const uint32_t *p1, const uint32_t *p2, int width,
+	       unsigned char *y1, unsigned char *y2,
+	       unsigned char *u, unsigned char *v)
+{
+	const uint32_t *end = p1 + width;
+	int u_accum, v_accum;
+
+	while (p1 < end) {
+		u_accum = 0;
+		v_accum = 0;
+		y1[0] = rgb_to_yuv(rshift, bshift, p1[0], &u_accum, &v_accum);
+		y1[1] = rgb_to_yuv(rshift, bshift, p1[1], &u_accum, &v_accum);
+		y2[0] = rgb_to_yuv(rshift, bshift, p2[0], &u_accum, &v_accum);
+		y2[1] = rgb_to_yuv(rshift, bshift, p2[1], &u_accum, &v_accum);
+		u[0] = clamp_uv(u_accum);
+		v[0] = clamp_uv(v_accum);
+
+		y1 += 2;
+		p1 += 2;
+		y2 += 2;
+		p2 += 2;
+		u++;
+		v++;
+	}
+}
+
+#ifdef WCAP_YUV_X86
+
+static int
+supported_sse41(void)
+{
+	return __builtin_cpu_supports("sse4.1");
+}
+
+static int
+supported_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+/* The vector versions compute exactly what rgb_to_yuv() does, in 32
+ * bit lanes.  Since the chroma of a 2x2 block is a constant times the
+ * sum of (r - y) or (b - y) over the block, the per-pixel differences
+ * are summed first, vertically then horizontally, and multiplied
+ * once. */
+__attribute__((target("sse4.1"))) static inline __m128i
+luma_sse41(__m128i p, __m128i rshift, __m128i bshift,
+	   __m128i *dr, __m128i *db)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	__m128i r, g, b, y;
+
+	r = _mm_and_si128(_mm_srl_epi32(p, rshift), mask);
+	g = _mm_and_si128(_mm_srli_epi32(p, 8), mask);
+	b = _mm_and_si128(_mm_srl_epi32(p, bshift), mask);
+
+	y = _mm_add_epi32(_mm_add_epi32(
+			_mm_mullo_epi32(r, _mm_set1_epi32(19595)),
+			_mm_mullo_epi32(g, _mm_set1_epi32(38469))),
+			_mm_mullo_epi32(b, _mm_set1_epi32(7472)));
+	y = _mm_min_epi32(_mm_srli_epi32(y, 16), _mm_set1_epi32(255));
+
+	*dr = _mm_sub_epi32(r, y);
+	*db = _mm_sub_epi32(b, y);
+
+	return y;
+}
+
+__attribute__((target("sse4.1"))) static inline __m128i
+chroma_sse41(__m128i sum, int factor)
+{
+	sum = _mm_mullo_epi32(sum, _mm_set1_epi32(factor));
+
+	return _mm_add_epi32(_mm_srai_epi32(sum, 18), _mm_set1_epi32(128));
+}
+
+__attribute__((target("sse4.1"))) static void
+convert_rows_sse41(int rshift, int bshift,
+		   const uint32_t *p1, const uint32_t *p2, int width,
+		   unsigned char *y1, unsigned char *y2,
+		   unsigned char *u, unsigned char *v)
+{
+	const __m128i rs = _mm_cvtsi32_si128(rshift);
+	const __m128i bs = _mm_cvtsi32_si128(bshift);
+	__m128i ya, yb, ra, rb, ba, bb, dr, db, c;
+	uint32_t uv;
+	int k;
+
+	for (k = 0; k + 8 <= width; k += 8) {
+		/* Columns 0-3 in a, 4-7 in b, summing both rows. */
+		ya = luma_sse41(_mm_loadu_si128((const __m128i *) (p1 + k)),
+				rs, bs, &ra, &ba);
+		yb = luma_sse41(_mm_loadu_si128((const __m128i *) (p1 + k + 4)),
+				rs, bs, &rb, &bb);
+		_mm_storel_epi64((__m128i *) (y1 + k),
+				 _mm_packus_epi16(_mm_packs_epi32(ya, yb),
+						  _mm_setzero_si128()));
+
+		ya = luma_sse41(_mm_loadu_si128((const __m128i *) (p2 + k)),
+				rs, bs, &dr, &db);
+		ra = _mm_add_epi32(ra, dr);
+		ba = _mm_add_epi32(ba, db);
+		yb = luma_sse41(_mm_loadu_si128((const __m128i *) (p2 + k + 4)),
+				rs, bs, &dr, &db);
+		rb = _mm_add_epi32(rb, dr);
+		bb = _mm_add_epi32(bb, db);
+		_mm_storel_epi64((__m128i *) (y2 + k),
+				 _mm_packus_epi16(_mm_packs_epi32(ya, yb),
+						  _mm_setzero_si128()));
+
+		c = chroma_sse41(_mm_hadd_epi32(ra, rb), 46727);
+		c = _mm_packus_epi16(_mm_packs_epi32(c, c), c);
+		uv = _mm_cvtsi128_si32(c);
+		memcpy(u + k / 2, &uv, 4);
+
+		c = chroma_sse41(_mm_hadd_epi32(ba, bb), 36962);
+		c = _mm_packus_epi16(_mm_packs_epi32(c, c), c);
+		uv = _mm_cvtsi128_si32(c);
+		memcpy(v + k / 2, &uv, 4);
+	}
+
+	convert_rows_c(rshift, bshift, p1 + k, p2 + k, width - k,
+		       y1 + k, y2 + k, u + k / 2, v + k / 2);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+luma_avx2(__m256i p, __m128i rshift, __m128i bshift,
+	  __m256i *dr, __m256i *db)
+{
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	__m256i r, g, b, y;
+
+	r = _mm256_and_si256(_mm256_srl_epi32(p, rshift), mask);
+	g = _mm256_and_si256(_mm256_srli_epi32(p, 8), mask);
+	b = _mm256_and_si256(_mm256_srl_epi32(p, bshift), mask);
+
+	y = _mm256_add_epi32(_mm256_add_epi32(
+			_mm256_mullo_epi32(r, _mm256_set1_epi32(19595)),
+			_mm256_mullo_epi32(g, _mm256_set1_epi32(38469))),
+			_mm256_mullo_epi32(b, _mm256_set1_epi32(7472)));
+	y = _mm256_min_epi32(_mm256_srli_epi32(y, 16),
+			     _mm256_set1_epi32(255));
+
+	*dr = _mm256_sub_epi32(r, y);
+	*db = _mm256_sub_epi32(b, y);
+
+	return y;
+}
+
+/* Narrow 16 32 bit values, columns 0-7 in a and 8-15 in b, to 16
+ * saturated bytes in column order. */
+__attribute__((target("avx2"))) static inline __m128i
+pack_avx2(__m256i a, __m256i b)
+{
+	__m256i p;
+
+	p = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+
+	return _mm_packus_epi16(_mm256_castsi256_si128(p),
+				_mm256_extracti128_si256(p, 1));
+}
+
+/* Sum horizontal pairs of 16 columns, a and b as above, and scale them
+ * into 8 chroma samples. */
+__attribute__((target("avx2"))) static inline __m128i
+chroma_avx2(__m256i a, __m256i b, int factor)
+{
+	__m256i sum;
+	__m128i lo, hi;
+
+	sum = _mm256_permute4x64_epi64(_mm256_hadd_epi32(a, b), 0xd8);
+	sum = _mm256_mullo_epi32(sum, _mm256_set1_epi32(factor));
+	sum = _mm256_add_epi32(_mm256_srai_epi32(sum, 18),
+			       _mm256_set1_epi32(128));
+
+	lo = _mm256_castsi256_si128(sum);
+	hi = _mm256_extracti128_si256(sum, 1);
+
+	return _mm_packus_epi16(_mm_packs_epi32(lo, hi), _mm_setzero_si128());
+}
+
+__attribute__((target("avx2"))) static void
+convert_rows_avx2(int rshift, int bshift,
+		  const uint32_t *p1, const uint32_t *p2, int width,
+		  unsigned char *y1, unsigned char *y2,
+		  unsigned char *u, unsigned char *v)
+{
+	const __m128i rs = _mm_cvtsi32_si128(rshift);
+	const __m128i bs = _mm_cvtsi32_si128(bshift);
+	__m256i ya, yb, ra, rb, ba, bb, dr, db;
+	int k;
+
+	for (k = 0; k + 16 <= width; k += 16) {
+		ya = luma_avx2(_mm256_loadu_si256((const __m256i *) (p1 + k)),
+			       rs, bs, &ra, &ba);
+		yb = luma_avx2(_mm256_loadu_si256((const __m256i *)
+						  (p1 + k + 8)),
+			       rs, bs, &rb, &bb);
+		_mm_storeu_si128((__m128i *) (y1 + k), pack_avx2(ya, yb));
+
+		ya = luma_avx2(_mm256_loadu_si256((const __m256i *) (p2 + k)),
+			       rs, bs, &dr, &db);
+		ra = _mm256_add_epi32(ra, dr);
+		ba = _mm256_add_epi32(ba, db);
+		yb = luma_avx2(_mm256_loadu_si256((const __m256i *)
+						  (p2 + k + 8)),
+			       rs, bs, &dr, &db);
+		rb = _mm256_add_epi32(rb, dr);
+		bb = _mm256_add_epi32(bb, db);
+		_mm_storeu_si128((__m128i *) (y2 + k), pack_avx2(ya, yb));
+
+		_mm_storel_epi64((__m128i *) (u + k / 2),
+				 chroma_avx2(ra, rb, 46727));
+		_mm_storel_epi64((__m128i *) (v + k / 2),
+				 chroma_avx2(ba, bb, 36962));
+	}
+
+	convert_rows_c(rshift, bshift, p1 + k, p2 + k, width - k,
+		       y1 + k, y2 + k, u + k / 2, v + k / 2);
+}
+
+#endif
+
+/* Fastest first. */
+static const struct wcap_yuv_converter converters[] = {
+#ifdef WCAP_YUV_X86
+	{ "avx2", supported_avx2, convert_rows_avx2 },
+	{ "sse4.1", supported_sse41, convert_rows_sse41 },
+#endif
+	{ "c", supported_always, convert_rows_c },
+};
+
+const struct wcap_yuv_converter *
+wcap_yuv_converter_get(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof converters / sizeof converters[0]; i++) {
+		if (name && strcmp(name, converters[i].name) != 0)
+			continue;
+		if (converters[i].supported())
+			return &converters[i];
+		if (name)
+			return NULL;
+	}
+
+	return NULL;
+}
+
+const char *
+wcap_yuv_converter_get_name(const struct wcap_yuv_converter *converter)
+{
+	return converter->name;
+}
+
+void
+wcap_yuv_converter_convert(const struct wcap_yuv_converter *converter,
+			   uint32_t format, const uint32_t *frame,
+			   int width, int height, unsigned char *out)
+{
+	unsigned char *y1, *u, *v;
+	const uint32_t *p1;
+	int i, rshift, bshift, stride0, stride1;
+
+	switch (format) {
+	case WCAP_FORMAT_XRGB8888:
+		rshift = 16;
+		bshift = 0;
+		break;
+	case WCAP_FORMAT_XBGR8888:
+		rshift = 0;
+		bshift = 16;
+		break;
+	default:
+		assert(0);
+		return;
+	}
+
+	stride0 = width;
+	stride1 = width / 2;
+	for (i = 0; i < height; i += 2) {
+		y1 = out + stride0 * i;
+		v = out + stride0 * height + stride1 * i / 2;
+		u = v + stride1 * height / 2;
+		p1 = frame + width * i;
+
+		converter->convert_rows(rshift, bshift, p1, p1 + width, width,
+					y1, y1 + stride0, u, v);
+	}
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WCAP_YUV_
+#define _WCAP_YUV_
+
+#include <stdint.h>
+
+struct wcap_yuv_converter;
+
+/* Look up a converter implementation by name ("c", "sse4.1" or
+ * "avx2").  With a NULL name the fastest one the CPU supports is
+ * returned.  Returns NULL if the implementation is unknown or not
+ * supported on this machine. */
+const struct wcap_yuv_converter *wcap_yuv_converter_get(const char *name);
+const char *
+wcap_yuv_converter_get_name(const struct wcap_yuv_converter *converter);
+
+/* Convert a width x height frame in one of the XRGB8888 or XBGR8888
+ * wcap formats to planar YV12 in out, which must hold
+ * width * height * 3 / 2 bytes.  width and height must be even.  All
+ * implementations produce the same output. */
+void
+wcap_yuv_converter_convert(const struct wcap_yuv_converter *converter,
+			   uint32_t format, const uint32_t *frame,
+			   int width, int height, unsigned char *out);
+
+#endif